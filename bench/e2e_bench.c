@@ -0,0 +1,801 @@
+/*----------------------------------------------------------------------*
+ * File:    e2e_bench.c                                                 *
+ * Purpose: End to end benchmark of kontaminant on simulated data       *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Builds a reproducible dataset in a work directory (-w) and times
+   kontaminant (-x) on it:
+
+     1. Random genomes, one host and -c contaminants, written as
+        lib/contaminant<n>.fasta and indexed with kontaminant -i.
+     2. -p simulated read pairs, reads_1.fq and reads_2.fq. Each pair is
+        the ends of a fragment (-I bases) from a random strand of the
+        host or a contaminant, chosen with the fractions given by -f,
+        with substitution errors at rate -e. The read name records the
+        source, eg. @12_contaminant2/1.
+     3. Screening at 1, 2, 4 ... -N threads, with the threaded engine
+        (-N) and the pipelined engine (-P auto), and filtering with the
+        pipelined engine.
+
+   For each run it prints one tab separated line:
+
+     mode       - index, screen or filter
+     engine     - serial, threads or pipeline
+     threads    - -N
+     wall_s     - elapsed time
+     cpu_s      - user + system time
+     peak_rss_mb- maximum resident set size
+     pairs_per_s- read pairs / wall_s
+     speedup    - wall_s of the 1 thread run of the same mode and engine
+                  / wall_s
+     check      - ok if the pairs meeting threshold for each contaminant
+                  (and, filtering, the pairs removed) are within -T
+                  percentage points of the simulated fraction, else FAIL
+     phases     - phase=seconds for each phase in the run's
+                  <prefix>timing.json
+
+   Each run's output is kept in the work directory as <run>.log. The
+   exit status is 1 if any check fails.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+
+#define E2E_MAX_CONTAMINANTS 28
+#define E2E_MAX_ARGS 32
+#define E2E_MAX_PATH 1024
+#define E2E_MAX_PHASES 512
+#define E2E_MAX_THREAD_COUNTS 16
+#define E2E_BUCKET_SIZE 100
+
+typedef struct {
+    char* kontaminant;
+    char* work_dir;
+    int n_contaminants;
+    double fractions[E2E_MAX_CONTAMINANTS];
+    long genome_length;
+    long n_pairs;
+    int read_length;
+    int insert_size;
+    double error_rate;
+    int max_threads;
+    int kmer_size;
+    double tolerance;
+    uint64_t seed;
+} E2EOptions;
+
+typedef struct {
+    double wall;
+    double cpu;
+    double peak_rss_mb;
+    int status;
+} RunResult;
+
+static uint64_t random_state;
+
+/*----------------------------------------------------------------------*
+ * Function:   next_random
+ * Purpose:    xorshift64* generator
+ * Parameters: None
+ * Returns:    Random 64 bits
+ *----------------------------------------------------------------------*/
+static uint64_t next_random(void)
+{
+    random_state ^= random_state >> 12;
+    random_state ^= random_state << 25;
+    random_state ^= random_state >> 27;
+
+    return random_state * 0x2545F4914F6CDD1DULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   random_fraction
+ * Purpose:    Uniform random number
+ * Parameters: None
+ * Returns:    0 <= r < 1
+ *----------------------------------------------------------------------*/
+static double random_fraction(void)
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   now_seconds
+ * Purpose:    Monotonic clock
+ * Parameters: None
+ * Returns:    Seconds
+ *----------------------------------------------------------------------*/
+static double now_seconds(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return t.tv_sec + (t.tv_nsec / 1e9);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   open_or_exit
+ * Purpose:    fopen, exiting on failure
+ * Parameters: filename -> file
+ *             mode -> fopen mode
+ * Returns:    File pointer
+ *----------------------------------------------------------------------*/
+static FILE* open_or_exit(char* filename, char* mode)
+{
+    FILE* fp = fopen(filename, mode);
+
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    }
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   random_genome
+ * Purpose:    Random sequence of ACGT
+ * Parameters: length = number of bases
+ * Returns:    Pointer to null terminated sequence
+ *----------------------------------------------------------------------*/
+static char* random_genome(long length)
+{
+    char* genome = malloc(length + 1);
+    long i;
+
+    if (!genome) {
+        printf("Error: can't allocate memory for %ld bases\n", length);
+        exit(1);
+    }
+
+    for (i=0; i<length; i++) {
+        genome[i] = "ACGT"[next_random() & 3];
+    }
+    genome[length] = 0;
+
+    return genome;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_fasta
+ * Purpose:    Write a genome as FASTA, 80 bases per line
+ * Parameters: filename -> output file
+ *             name -> sequence name
+ *             genome -> sequence
+ *             length = number of bases
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void write_fasta(char* filename, char* name, char* genome, long length)
+{
+    FILE* fp = open_or_exit(filename, "w");
+    long i;
+
+    fprintf(fp, ">%s\n", name);
+    for (i=0; i<length; i+=80) {
+        fprintf(fp, "%.*s\n", (int)(length - i < 80 ? length - i : 80), genome + i);
+    }
+    fclose(fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   complement
+ * Purpose:    Complement a base
+ * Parameters: base = ACGT
+ * Returns:    Complement
+ *----------------------------------------------------------------------*/
+static char complement(char base)
+{
+    switch (base) {
+        case 'A': return 'T';
+        case 'C': return 'G';
+        case 'G': return 'C';
+        default: return 'A';
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_read
+ * Purpose:    Write one FASTQ read with substitution errors
+ * Parameters: fp -> output file
+ *             number = pair number
+ *             source -> name of source genome
+ *             end = 1 or 2
+ *             bases -> read, modified by errors
+ *             length = read length
+ *             error_rate = substitution rate
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void write_read(FILE* fp, long number, char* source, int end, char* bases, int length, double error_rate)
+{
+    int i;
+
+    for (i=0; i<length; i++) {
+        if (random_fraction() < error_rate) {
+            bases[i] = "ACGT"[(strchr("ACGT", bases[i]) - "ACGT" + 1 + (next_random() % 3)) & 3];
+        }
+    }
+
+    fprintf(fp, "@%ld_%s/%d\n%.*s\n+\n", number, source, end, length, bases);
+    for (i=0; i<length; i++) {
+        fputc('I', fp);
+    }
+    fputc('\n', fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   simulate_reads
+ * Purpose:    Write read pairs from the host and contaminant genomes
+ * Parameters: options -> options
+ *             genomes -> host, then contaminants
+ *             truth -> filled with pairs simulated from each
+ *                      contaminant
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void simulate_reads(E2EOptions* options, char** genomes, long* truth)
+{
+    char filename[E2E_MAX_PATH];
+    char* read_one = malloc(options->read_length + 1);
+    char* read_two = malloc(options->read_length + 1);
+    FILE* fp_one;
+    FILE* fp_two;
+    long n;
+    int i;
+
+    sprintf(filename, "%s/reads_1.fq", options->work_dir);
+    fp_one = open_or_exit(filename, "w");
+    sprintf(filename, "%s/reads_2.fq", options->work_dir);
+    fp_two = open_or_exit(filename, "w");
+
+    for (i=0; i<options->n_contaminants; i++) {
+        truth[i] = 0;
+    }
+
+    for (n=0; n<options->n_pairs; n++) {
+        double r = random_fraction();
+        int source = 0;
+        char source_name[32];
+        char* fragment;
+        long start;
+
+        for (i=0; i<options->n_contaminants; i++) {
+            if (r < options->fractions[i]) {
+                source = i + 1;
+                truth[i]++;
+                break;
+            }
+            r -= options->fractions[i];
+        }
+
+        if (source == 0) {
+            strcpy(source_name, "host");
+        } else {
+            sprintf(source_name, "contaminant%d", source);
+        }
+
+        start = next_random() % (options->genome_length - options->insert_size + 1);
+        fragment = genomes[source] + start;
+
+        // Read 1 from the start of the fragment, read 2 from the other
+        // strand at the end, on a random strand of the genome
+        for (i=0; i<options->read_length; i++) {
+            read_one[i] = fragment[i];
+            read_two[i] = complement(fragment[options->insert_size - 1 - i]);
+        }
+        if (next_random() & 1) {
+            char* swap = read_one;
+            read_one = read_two;
+            read_two = swap;
+        }
+
+        write_read(fp_one, n, source_name, 1, read_one, options->read_length, options->error_rate);
+        write_read(fp_two, n, source_name, 2, read_two, options->read_length, options->error_rate);
+    }
+
+    fclose(fp_one);
+    fclose(fp_two);
+    free(read_one);
+    free(read_two);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   run_command
+ * Purpose:    Run a command with output to a log, measuring time and
+ *             memory
+ * Parameters: argv -> command, NULL terminated
+ *             log_filename -> file for stdout and stderr
+ *             result -> filled in
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void run_command(char** argv, char* log_filename, RunResult* result)
+{
+    double start = now_seconds();
+    struct rusage usage;
+    pid_t pid;
+    int status;
+
+    fflush(stdout);
+    pid = fork();
+    if (pid == -1) {
+        printf("Error: can't fork\n");
+        exit(1);
+    }
+
+    if (pid == 0) {
+        int fd = open(log_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+        if (fd == -1) {
+            printf("Error: can't open %s\n", log_filename);
+            _exit(127);
+        }
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+        execv(argv[0], argv);
+        printf("Error: can't run %s\n", argv[0]);
+        _exit(127);
+    }
+
+    if (wait4(pid, &status, 0, &usage) == -1) {
+        printf("Error: wait for %s failed\n", argv[0]);
+        exit(1);
+    }
+
+    result->wall = now_seconds() - start;
+    result->cpu = usage.ru_utime.tv_sec + (usage.ru_utime.tv_usec / 1e6) + usage.ru_stime.tv_sec + (usage.ru_stime.tv_usec / 1e6);
+    result->peak_rss_mb = usage.ru_maxrss / 1024.0;
+    result->status = WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parse_timing
+ * Purpose:    Read phase wall times from a run's timing JSON, which
+ *             has one phase object per line
+ * Parameters: timing_filename -> <prefix>timing.json
+ *             phases -> filled with phase=seconds list, empty if the
+ *                       file can't be read
+ *             phases_size = size of phases
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void parse_timing(char* timing_filename, char* phases, int phases_size)
+{
+    FILE* fp = fopen(timing_filename, "r");
+    char* line = NULL;
+    size_t line_size = 0;
+
+    phases[0] = 0;
+    if (!fp) {
+        return;
+    }
+
+    while (getline(&line, &line_size, fp) != -1) {
+        char* name = strstr(line, "{\"name\": \"");
+        char* wall = strstr(line, "\"wall_seconds\": ");
+        char* name_end;
+        double seconds;
+
+        // The total isn't a phase
+        if ((!name) || (!wall) || (strstr(line, "\"total\"") != NULL)) {
+            continue;
+        }
+        name += 10;
+        name_end = strchr(name, '"');
+        if ((name_end) && (sscanf(wall + 16, "%lf", &seconds) == 1) &&
+            (strlen(phases) + (name_end - name) + 16 < (size_t)phases_size)) {
+            char* end = phases + strlen(phases);
+
+            if (end != phases) {
+                *end++ = ',';
+            }
+            for (; name < name_end; name++) {
+                *end++ = *name == ' ' ? '_' : *name;
+            }
+            sprintf(end, "=%.2f", seconds);
+        }
+    }
+
+    free(line);
+    fclose(fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parse_log
+ * Purpose:    Read the pairs meeting threshold for each contaminant from
+ *             a screening or filtering log
+ * Parameters: log_filename -> log
+ *             n_contaminants = number of contaminants
+ *             pairs -> filled with pairs meeting threshold, -1 if not
+ *                      found
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void parse_log(char* log_filename, int n_contaminants, long* pairs)
+{
+    FILE* fp = open_or_exit(log_filename, "r");
+    char* line = NULL;
+    size_t line_size = 0;
+    int in_pair_stats = 0;
+    int in_table = 0;
+    int i;
+
+    for (i=0; i<n_contaminants; i++) {
+        pairs[i] = -1;
+    }
+
+    while (getline(&line, &line_size, fp) != -1) {
+        if (strstr(line, "Statistics for both reads")) {
+            in_pair_stats = 1;
+        } else if (in_pair_stats && (strncmp(line, "Contaminant ", 12) == 0)) {
+            in_table = 1;
+        } else if (in_table) {
+            char name[256];
+            long n_kmers, k_found, reads_threshold;
+            double pc_found;
+            int number;
+
+            if (sscanf(line, "%255s %ld %ld %lf %ld", name, &n_kmers, &k_found, &pc_found, &reads_threshold) != 5) {
+                in_table = 0;
+                in_pair_stats = 0;
+            } else if ((sscanf(name, "contaminant%d", &number) == 1) && (number >= 1) && (number <= n_contaminants)) {
+                pairs[number - 1] = reads_threshold;
+            }
+        }
+    }
+
+    free(line);
+    fclose(fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   count_fastq_records
+ * Purpose:    Count records of a FASTQ file written by kontaminant, by
+ *             their "+" lines (the header lines written are not always
+ *             one line, and simulated qualities never start with +)
+ * Parameters: filename -> file
+ * Returns:    Number of records, -1 if the file can't be read
+ *----------------------------------------------------------------------*/
+static long count_fastq_records(char* filename)
+{
+    FILE* fp = fopen(filename, "r");
+    char* line = NULL;
+    size_t line_size = 0;
+    long records = 0;
+
+    if (!fp) {
+        return -1;
+    }
+    while (getline(&line, &line_size, fp) != -1) {
+        if ((line[0] == '+') && ((line[1] == '\n') || (line[1] == 0))) {
+            records++;
+        }
+    }
+    free(line);
+    fclose(fp);
+
+    return records;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   within_tolerance
+ * Purpose:    Compare a count of pairs with the simulated count
+ * Parameters: options -> options
+ *             found = pairs reported
+ *             truth = pairs simulated
+ * Returns:    1 if within -T percentage points
+ *----------------------------------------------------------------------*/
+static int within_tolerance(E2EOptions* options, long found, long truth)
+{
+    double difference = 100.0 * (found - truth) / (double)options->n_pairs;
+
+    return (found >= 0) && (difference <= options->tolerance) && (difference >= -options->tolerance);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   run_kontaminant
+ * Purpose:    Screen or filter the simulated reads, report and check
+ * Parameters: options -> options
+ *             mode -> "screen" or "filter"
+ *             engine -> "threads" or "pipeline"
+ *             threads = -N
+ *             truth -> pairs simulated from each contaminant
+ *             baseline -> wall time at 1 thread, set if threads is 1
+ *             table_bits -> -n for the contaminant table
+ * Returns:    1 if the check passed
+ *----------------------------------------------------------------------*/
+static int run_kontaminant(E2EOptions* options, char* mode, char* engine, int threads, long* truth, double* baseline, char* table_bits)
+{
+    char* argv[E2E_MAX_ARGS];
+    char run_name[64], log_filename[E2E_MAX_PATH], output_prefix[E2E_MAX_PATH], removed_prefix[E2E_MAX_PATH];
+    char reads_one[E2E_MAX_PATH], reads_two[E2E_MAX_PATH], lib_dir[E2E_MAX_PATH], filename[E2E_MAX_PATH * 2];
+    char contaminants[E2E_MAX_CONTAMINANTS * 16], kmer_size[16], thread_count[16];
+    char phases[E2E_MAX_PHASES];
+    long pairs[E2E_MAX_CONTAMINANTS];
+    long truth_total = 0;
+    RunResult result;
+    int ok = 1;
+    int n = 0;
+    int i;
+
+    sprintf(run_name, "%s_%s_%d", mode, engine, threads);
+    sprintf(log_filename, "%s/%s.log", options->work_dir, run_name);
+    sprintf(output_prefix, "%s/%s_", options->work_dir, run_name);
+    sprintf(removed_prefix, "%s/%s_removed_", options->work_dir, run_name);
+    sprintf(reads_one, "%s/reads_1.fq", options->work_dir);
+    sprintf(reads_two, "%s/reads_2.fq", options->work_dir);
+    sprintf(lib_dir, "%s/lib", options->work_dir);
+    sprintf(kmer_size, "%d", options->kmer_size);
+    sprintf(thread_count, "%d", threads);
+    contaminants[0] = 0;
+    for (i=0; i<options->n_contaminants; i++) {
+        sprintf(contaminants + strlen(contaminants), "%scontaminant%d", i > 0 ? "," : "", i + 1);
+        truth_total += truth[i];
+    }
+
+    argv[n++] = options->kontaminant;
+    argv[n++] = strcmp(mode, "filter") == 0 ? "-f" : "-s";
+    argv[n++] = "-1"; argv[n++] = reads_one;
+    argv[n++] = "-2"; argv[n++] = reads_two;
+    argv[n++] = "-d"; argv[n++] = lib_dir;
+    argv[n++] = "-c"; argv[n++] = contaminants;
+    argv[n++] = "-k"; argv[n++] = kmer_size;
+    argv[n++] = "-n"; argv[n++] = table_bits;
+    argv[n++] = "-o"; argv[n++] = output_prefix;
+    argv[n++] = "-N"; argv[n++] = thread_count;
+    if (strcmp(engine, "pipeline") == 0) {
+        argv[n++] = "-P"; argv[n++] = "auto";
+    }
+    if (strcmp(mode, "filter") == 0) {
+        argv[n++] = "-r"; argv[n++] = removed_prefix;
+    }
+    argv[n] = NULL;
+
+    run_command(argv, log_filename, &result);
+    parse_log(log_filename, options->n_contaminants, pairs);
+    sprintf(filename, "%stiming.json", output_prefix);
+    parse_timing(filename, phases, sizeof(phases));
+
+    if (result.status != 0) {
+        ok = 0;
+    }
+    for (i=0; i<options->n_contaminants; i++) {
+        if (!within_tolerance(options, pairs[i], truth[i])) {
+            ok = 0;
+        }
+    }
+    if (strcmp(mode, "filter") == 0) {
+        sprintf(filename, "%sreads_1.fq", removed_prefix);
+        if (!within_tolerance(options, count_fastq_records(filename), truth_total)) {
+            ok = 0;
+        }
+    }
+
+    if (threads == 1) {
+        *baseline = result.wall;
+    }
+
+    printf("%s\t%s\t%d\t%.3f\t%.3f\t%.1f\t%.0f\t%.2f\t%s\t%s\n", mode, engine, threads, result.wall, result.cpu, result.peak_rss_mb,
+           options->n_pairs / result.wall, *baseline > 0 ? *baseline / result.wall : 0.0, ok ? "ok" : "FAIL", phases);
+    if (!ok) {
+        printf("# %s: exit status %d, pairs meeting threshold", run_name, result.status);
+        for (i=0; i<options->n_contaminants; i++) {
+            printf(" %ld (simulated %ld)", pairs[i], truth[i]);
+        }
+        printf(", see %s\n", log_filename);
+    }
+    fflush(stdout);
+
+    return ok;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parse_fractions
+ * Purpose:    Parse -f, a comma separated list of fractions
+ * Parameters: string -> list
+ *             options -> fractions and n_contaminants set
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void parse_fractions(char* string, E2EOptions* options)
+{
+    char* copy = strdup(string);
+    char* token = strtok(copy, ",");
+    double total = 0;
+
+    options->n_contaminants = 0;
+    while (token) {
+        if (options->n_contaminants == E2E_MAX_CONTAMINANTS) {
+            printf("Error: at most %d contaminants\n", E2E_MAX_CONTAMINANTS);
+            exit(1);
+        }
+        options->fractions[options->n_contaminants] = atof(token);
+        total += options->fractions[options->n_contaminants++];
+        token = strtok(NULL, ",");
+    }
+    free(copy);
+
+    if ((options->n_contaminants == 0) || (total > 1)) {
+        printf("Error: -f needs fractions adding up to at most 1\n");
+        exit(1);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   usage
+ *----------------------------------------------------------------------*/
+static void usage(void)
+{
+    printf("Syntax: e2e_bench [options]\n" \
+           "    [-x path] kontaminant binary (default bin/kontaminant)\n" \
+           "    [-w dir] Work directory (default /tmp/kontaminant_e2e)\n" \
+           "    [-f fractions] Fraction of pairs from each contaminant (default 0.05,0.02,0.01)\n" \
+           "    [-g length] Length of each genome (default 1000000)\n" \
+           "    [-p pairs] Read pairs (default 200000)\n" \
+           "    [-l length] Read length (default 150)\n" \
+           "    [-I size] Fragment size (default 400)\n" \
+           "    [-e rate] Substitution error rate (default 0.002)\n" \
+           "    [-k size] Kmer size (default 21)\n" \
+           "    [-N threads] Most threads to run with (default 4)\n" \
+           "    [-T points] Tolerance of contamination checks in percentage points (default 0.5)\n" \
+           "    [-s seed] Random seed (default 1)\n");
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   main
+ *----------------------------------------------------------------------*/
+int main(int argc, char* argv[])
+{
+    E2EOptions options;
+    char* genomes[E2E_MAX_CONTAMINANTS + 1];
+    long truth[E2E_MAX_CONTAMINANTS];
+    int thread_counts[E2E_MAX_THREAD_COUNTS];
+    int n_thread_counts = 0;
+    char filename[E2E_MAX_PATH], name[32], table_bits[16];
+    char* index_argv[E2E_MAX_ARGS];
+    double baseline;
+    RunResult result;
+    int all_ok = 1;
+    int bits = 10;
+    int opt, i, t;
+
+    memset(&options, 0, sizeof(E2EOptions));
+    options.kontaminant = "bin/kontaminant";
+    options.work_dir = "/tmp/kontaminant_e2e";
+    parse_fractions("0.05,0.02,0.01", &options);
+    options.genome_length = 1000000;
+    options.n_pairs = 200000;
+    options.read_length = 150;
+    options.insert_size = 400;
+    options.error_rate = 0.002;
+    options.kmer_size = 21;
+    options.max_threads = 4;
+    options.tolerance = 0.5;
+    options.seed = 1;
+
+    while ((opt = getopt(argc, argv, "x:w:f:g:p:l:I:e:k:N:T:s:h")) != -1) {
+        switch (opt) {
+            case 'x': options.kontaminant = optarg; break;
+            case 'w': options.work_dir = optarg; break;
+            case 'f': parse_fractions(optarg, &options); break;
+            case 'g': options.genome_length = atol(optarg); break;
+            case 'p': options.n_pairs = atol(optarg); break;
+            case 'l': options.read_length = atoi(optarg); break;
+            case 'I': options.insert_size = atoi(optarg); break;
+            case 'e': options.error_rate = atof(optarg); break;
+            case 'k': options.kmer_size = atoi(optarg); break;
+            case 'N': options.max_threads = atoi(optarg); break;
+            case 'T': options.tolerance = atof(optarg); break;
+            case 's': options.seed = strtoull(optarg, NULL, 10); break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    if ((options.read_length < options.kmer_size) || (options.insert_size < options.read_length) ||
+        (options.genome_length < options.insert_size) || (options.n_pairs < 1) || (options.max_threads < 1) ||
+        (options.error_rate < 0) || (options.error_rate >= 1)) {
+        printf("Error: need k <= read length <= fragment size <= genome length, -p >= 1, -N >= 1 and 0 <= -e < 1\n");
+        return 1;
+    }
+
+    if (access(options.kontaminant, X_OK) != 0) {
+        printf("Error: can't run %s\n", options.kontaminant);
+        return 1;
+    }
+
+    random_state = (options.seed * 0x9E3779B97F4A7C15ULL) | 1;
+
+    sprintf(filename, "%s/lib", options.work_dir);
+    mkdir(options.work_dir, 0755);
+    mkdir(filename, 0755);
+
+    // Table big enough for every contaminant kmer, about half full
+    while ((1LL << bits) * E2E_BUCKET_SIZE < 2LL * options.n_contaminants * options.genome_length) {
+        bits++;
+    }
+    sprintf(table_bits, "%d", bits);
+
+    printf("# e2e_bench\n");
+    printf("# kontaminant\t%s\n", options.kontaminant);
+    printf("# work_dir\t%s\n", options.work_dir);
+    printf("# genome_length\t%ld\n", options.genome_length);
+    printf("# pairs\t%ld\n", options.n_pairs);
+    printf("# read_length\t%d\n", options.read_length);
+    printf("# error_rate\t%g\n", options.error_rate);
+    printf("# kmer_size\t%d\n", options.kmer_size);
+
+    for (i=0; i<=options.n_contaminants; i++) {
+        genomes[i] = random_genome(options.genome_length);
+    }
+    simulate_reads(&options, genomes, truth);
+    for (i=0; i<options.n_contaminants; i++) {
+        printf("# contaminant%d\t%.4f\t%ld pairs\n", i + 1, options.fractions[i], truth[i]);
+    }
+
+    printf("mode\tengine\tthreads\twall_s\tcpu_s\tpeak_rss_mb\tpairs_per_s\tspeedup\tcheck\tphases\n");
+
+    for (i=0; i<options.n_contaminants; i++) {
+        char kmer_size[16];
+        char log_filename[E2E_MAX_PATH];
+        int n = 0;
+
+        sprintf(name, "contaminant%d", i + 1);
+        sprintf(filename, "%s/lib/%s.fasta", options.work_dir, name);
+        sprintf(log_filename, "%s/index_%s.log", options.work_dir, name);
+        sprintf(kmer_size, "%d", options.kmer_size);
+        write_fasta(filename, name, genomes[i + 1], options.genome_length);
+
+        index_argv[n++] = options.kontaminant;
+        index_argv[n++] = "-i";
+        index_argv[n++] = "-1"; index_argv[n++] = filename;
+        index_argv[n++] = "-g"; index_argv[n++] = "FASTA";
+        index_argv[n++] = "-k"; index_argv[n++] = kmer_size;
+        index_argv[n++] = "-n"; index_argv[n++] = table_bits;
+        index_argv[n] = NULL;
+        run_command(index_argv, log_filename, &result);
+
+        printf("index\t%s\t1\t%.3f\t%.3f\t%.1f\t\t\t%s\t\n", name, result.wall, result.cpu, result.peak_rss_mb, result.status == 0 ? "ok" : "FAIL");
+        if (result.status != 0) {
+            printf("# indexing failed, see %s\n", log_filename);
+            return 1;
+        }
+    }
+
+    for (t=1; (t < options.max_threads) && (n_thread_counts < E2E_MAX_THREAD_COUNTS - 1); t *= 2) {
+        thread_counts[n_thread_counts++] = t;
+    }
+    thread_counts[n_thread_counts++] = options.max_threads;
+
+    baseline = 0;
+    for (i=0; i<n_thread_counts; i++) {
+        all_ok &= run_kontaminant(&options, "screen", thread_counts[i] == 1 ? "serial" : "threads", thread_counts[i], truth, &baseline, table_bits);
+    }
+    baseline = 0;
+    for (i=0; i<n_thread_counts; i++) {
+        all_ok &= run_kontaminant(&options, "screen", "pipeline", thread_counts[i], truth, &baseline, table_bits);
+    }
+    baseline = 0;
+    for (i=0; i<n_thread_counts; i++) {
+        all_ok &= run_kontaminant(&options, "filter", "pipeline", thread_counts[i], truth, &baseline, table_bits);
+    }
+
+    for (i=0; i<=options.n_contaminants; i++) {
+        free(genomes[i]);
+    }
+
+    return all_ok ? 0 : 1;
+}
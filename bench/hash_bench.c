@@ -0,0 +1,374 @@
+/*----------------------------------------------------------------------*
+ * File:    hash_bench.c                                                *
+ * Purpose: Compare table hash schemes by collisions, rehashes and speed*
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Fills a simulated table (-n bits, -b bucket size) to a load factor
+   with three key sets and reports, for each bucket hashing scheme:
+
+     chi2/df    - chi squared of first-choice bucket counts against a
+                  uniform spread, divided by degrees of freedom (about 1
+                  for a good hash)
+     max        - most keys hashed to one bucket on the first choice
+     rehashed   - keys that needed a second or later bucket
+     tries      - keys needing each number of rehashes (0..)
+     failed     - keys not placed within the table's 25 rehashes
+     ns/key     - time to place a key
+
+   Schemes:
+     lookup3+add  - previous scheme: hashlittle of the key with the
+                    attempt number added to the last word, rehashed
+                    from scratch on each attempt
+     mxs+double   - hash_value_64 once, then hash_value_bucket
+
+   Key sets: random kmers, consecutive integers (low entropy, the case
+   weak hashes fail on) and, if a FASTA file is given, the distinct
+   canonical kmers of the file.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <getopt.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_value.h"
+
+#define MAX_REHASH 25
+#define MAX_TRIES_REPORTED 6
+
+typedef struct {
+    char* name;
+    long long n_keys;
+    BinaryKmer* keys;
+} KeySet;
+
+typedef struct {
+    double chi2_per_df;
+    int max_first_bucket;
+    long long rehashed;
+    long long tries[MAX_TRIES_REPORTED];
+    long long failed;
+    double ns_per_key;
+} BenchResult;
+
+/*----------------------------------------------------------------------*
+ * Function:   old_bucket
+ * Purpose:    Bucket from the previous scheme
+ * Parameters: key -> key
+ *             rehash = attempt number
+ *             number_buckets = number of buckets
+ * Returns:    Bucket
+ *----------------------------------------------------------------------*/
+static long long old_bucket(BinaryKmer* key, int rehash, long long number_buckets)
+{
+    BinaryKmer k;
+
+    binary_kmer_assignment_operator(k, *key);
+    k[NUMBER_OF_BITFIELDS_IN_BINARY_KMER-1] += (bitfield_of_64bits)rehash;
+
+    return hash_value(&k, (int)number_buckets);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   run_scheme
+ * Purpose:    Place every key of a set, counting collisions
+ * Parameters: set -> keys
+ *             bits = log2 of number of buckets
+ *             bucket_size = slots per bucket
+ *             new_scheme = true for hash_value_64/hash_value_bucket
+ *             result -> filled in
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void run_scheme(KeySet* set, int bits, int bucket_size, boolean new_scheme, BenchResult* result)
+{
+    long long number_buckets = 1LL << bits;
+    int* fill = calloc(number_buckets, sizeof(int));
+    int* first = calloc(number_buckets, sizeof(int));
+    double expected = (double)set->n_keys / (double)number_buckets;
+    struct timespec start, end;
+    long long i, b;
+    int rehash;
+
+    if ((!fill) || (!first)) {
+        printf("Error: can't allocate memory for %lld buckets\n", number_buckets);
+        exit(1);
+    }
+
+    memset(result, 0, sizeof(BenchResult));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i=0; i<set->n_keys; i++) {
+        uint64_t hash = new_scheme ? hash_value_64(&(set->keys[i])) : 0;
+
+        for (rehash=0; rehash<=MAX_REHASH; rehash++) {
+            long long bucket = new_scheme ? hash_value_bucket(hash, rehash, number_buckets) : old_bucket(&(set->keys[i]), rehash, number_buckets);
+            if (rehash == 0) {
+                first[bucket]++;
+            }
+            if (fill[bucket] < bucket_size) {
+                fill[bucket]++;
+                break;
+            }
+        }
+
+        if (rehash > MAX_REHASH) {
+            result->failed++;
+        } else {
+            if (rehash > 0) {
+                result->rehashed++;
+            }
+            result->tries[rehash < MAX_TRIES_REPORTED ? rehash : MAX_TRIES_REPORTED - 1]++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    result->ns_per_key = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / (double)set->n_keys;
+
+    for (b=0; b<number_buckets; b++) {
+        double d = first[b] - expected;
+        result->chi2_per_df += (d * d) / expected;
+        if (first[b] > result->max_first_bucket) {
+            result->max_first_bucket = first[b];
+        }
+    }
+    result->chi2_per_df /= (double)(number_buckets - 1);
+
+    free(fill);
+    free(first);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   new_key_set
+ * Purpose:    Allocate a key set
+ * Parameters: name -> description
+ *             n_keys = number of keys
+ * Returns:    Pointer to set
+ *----------------------------------------------------------------------*/
+static KeySet* new_key_set(char* name, long long n_keys)
+{
+    KeySet* set = calloc(1, sizeof(KeySet));
+
+    if (set) {
+        set->keys = calloc(n_keys > 0 ? n_keys : 1, sizeof(BinaryKmer));
+    }
+    if ((!set) || (!set->keys)) {
+        printf("Error: can't allocate memory for %lld keys\n", n_keys);
+        exit(1);
+    }
+    set->name = name;
+    set->n_keys = n_keys;
+
+    return set;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   random_key_set
+ * Purpose:    Random kmers (xorshift64*, fixed seed)
+ * Parameters: n_keys = number of keys
+ *             kmer_size = kmer size
+ * Returns:    Pointer to set
+ *----------------------------------------------------------------------*/
+static KeySet* random_key_set(long long n_keys, short kmer_size)
+{
+    KeySet* set = new_key_set("random", n_keys);
+    int top_bits = (2 * kmer_size) - (64 * (NUMBER_OF_BITFIELDS_IN_BINARY_KMER - 1));
+    uint64_t x = 0x2545F4914F6CDD1DULL;
+    long long i;
+    int j;
+
+    // Bases fill the last word first, so only the first word is partial
+    for (i=0; i<n_keys; i++) {
+        for (j=0; j<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; j++) {
+            x ^= x >> 12;
+            x ^= x << 25;
+            x ^= x >> 27;
+            set->keys[i][j] = x * 0x2545F4914F6CDD1DULL;
+        }
+        if (top_bits <= 0) {
+            set->keys[i][0] = 0;
+        } else if (top_bits < 64) {
+            set->keys[i][0] &= (1ULL << top_bits) - 1;
+        }
+    }
+
+    return set;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   sequential_key_set
+ * Purpose:    Consecutive integers in the last word
+ * Parameters: n_keys = number of keys
+ * Returns:    Pointer to set
+ *----------------------------------------------------------------------*/
+static KeySet* sequential_key_set(long long n_keys)
+{
+    KeySet* set = new_key_set("sequential", n_keys);
+    long long i;
+
+    for (i=0; i<n_keys; i++) {
+        set->keys[i][NUMBER_OF_BITFIELDS_IN_BINARY_KMER-1] = (bitfield_of_64bits)i;
+    }
+
+    return set;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   compare_keys
+ * Purpose:    qsort comparison of keys
+ *----------------------------------------------------------------------*/
+static int compare_keys(const void* a, const void* b)
+{
+    const bitfield_of_64bits* x = a;
+    const bitfield_of_64bits* y = b;
+    int i;
+
+    for (i=0; i<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; i++) {
+        if (x[i] != y[i]) {
+            return x[i] < y[i] ? -1 : 1;
+        }
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   fasta_key_set
+ * Purpose:    Distinct canonical kmers of a FASTA file
+ * Parameters: filename -> FASTA file
+ *             kmer_size = kmer size
+ *             max_keys = stop after this many kmers
+ * Returns:    Pointer to set
+ *----------------------------------------------------------------------*/
+static KeySet* fasta_key_set(char* filename, short kmer_size, long long max_keys)
+{
+    KeySet* set = new_key_set(filename, max_keys);
+    FILE* fp = fopen(filename, "r");
+    char line[65536];
+    char kmer_string[NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32 + 1];
+    int run = 0;
+    long long n = 0, i, unique;
+    BinaryKmer kmer, key;
+
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    }
+
+    while ((n < max_keys) && fgets(line, sizeof(line), fp)) {
+        char* c;
+        if (line[0] == '>') {
+            run = 0;
+            continue;
+        }
+        for (c=line; (*c != 0) && (n < max_keys); c++) {
+            char base = *c & 0xDF;
+            if ((base == 'A') || (base == 'C') || (base == 'G') || (base == 'T')) {
+                if (run == kmer_size) {
+                    memmove(kmer_string, kmer_string + 1, kmer_size - 1);
+                    run--;
+                }
+                kmer_string[run++] = base;
+                if (run == kmer_size) {
+                    kmer_string[run] = 0;
+                    seq_to_binary_kmer(kmer_string, kmer_size, &kmer);
+                    element_get_key(&kmer, kmer_size, &key);
+                    binary_kmer_assignment_operator(set->keys[n++], key);
+                }
+            } else if ((*c != '\n') && (*c != '\r')) {
+                run = 0;
+            }
+        }
+    }
+    fclose(fp);
+
+    qsort(set->keys, n, sizeof(BinaryKmer), compare_keys);
+    for (i=0, unique=0; i<n; i++) {
+        if ((unique == 0) || compare_keys(set->keys[unique-1], set->keys[i]) != 0) {
+            binary_kmer_assignment_operator(set->keys[unique++], set->keys[i]);
+        }
+    }
+    set->n_keys = unique;
+
+    return set;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   report
+ * Purpose:    Print one line of results
+ *----------------------------------------------------------------------*/
+static void report(KeySet* set, char* scheme, BenchResult* r)
+{
+    int i;
+
+    printf("%-12.12s %-12s %8.3f %5d %10lld %10lld ", set->name, scheme, r->chi2_per_df, r->max_first_bucket, r->rehashed, r->failed);
+    for (i=0; i<MAX_TRIES_REPORTED; i++) {
+        printf(" %9lld", r->tries[i]);
+    }
+    printf(" %7.1f\n", r->ns_per_key);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   main
+ *----------------------------------------------------------------------*/
+int main(int argc, char* argv[])
+{
+    int bits = 20;
+    int bucket_size = 8;
+    short kmer_size = 21;
+    double load = 0.8;
+    KeySet* sets[3];
+    int n_sets = 0;
+    long long n_keys;
+    BenchResult result;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "n:b:k:l:h")) != -1) {
+        switch (opt) {
+            case 'n': bits = atoi(optarg); break;
+            case 'b': bucket_size = atoi(optarg); break;
+            case 'k': kmer_size = atoi(optarg); break;
+            case 'l': load = atof(optarg); break;
+            default:
+                printf("Syntax: hash_bench [-n bits] [-b bucket_size] [-k kmer_size] [-l load] [fasta]\n");
+                return 1;
+        }
+    }
+
+    if ((bits < 4) || (bits > 30) || (bucket_size < 1) || (kmer_size < 1) ||
+        (kmer_size >= NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32) || (load <= 0) || (load > 1)) {
+        printf("Error: need 4 <= n <= 30, b >= 1, k < %d and 0 < load <= 1\n", NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32);
+        return 1;
+    }
+
+    n_keys = (long long)(load * (double)(1LL << bits) * bucket_size);
+    sets[n_sets++] = random_key_set(n_keys, kmer_size);
+    sets[n_sets++] = sequential_key_set(n_keys);
+    if (optind < argc) {
+        sets[n_sets++] = fasta_key_set(argv[optind], kmer_size, n_keys);
+    }
+
+    printf("Buckets 2^%d, bucket size %d, k %d, load %.2f\n\n", bits, bucket_size, kmer_size, load);
+    printf("%-12s %-12s %8s %5s %10s %10s ", "keys", "scheme", "chi2/df", "max", "rehashed", "failed");
+    for (i=0; i<MAX_TRIES_REPORTED; i++) {
+        printf(" %8s%d", i == MAX_TRIES_REPORTED - 1 ? "tries>=" : "tries ", i);
+    }
+    printf(" %7s\n", "ns/key");
+
+    for (i=0; i<n_sets; i++) {
+        run_scheme(sets[i], bits, bucket_size, false, &result);
+        report(sets[i], "lookup3+add", &result);
+        run_scheme(sets[i], bits, bucket_size, true, &result);
+        report(sets[i], "mxs+double", &result);
+    }
+
+    return 0;
+}
@@ -0,0 +1,459 @@
+/*----------------------------------------------------------------------*
+ * File:    kernel_bench.c                                              *
+ * Purpose: Microbenchmarks of the core kmer kernels                    *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Times the functions screening spends its time in, over synthetic
+   inputs, and prints one tab separated line per benchmark:
+
+     benchmark  - function measured
+     variant    - input or table variant
+     bytes      - working set (table size for lookups)
+     ops        - operations timed (kmers, keys, lookups or reads)
+     ns_per_op  - nanoseconds per operation
+     ops_per_s  - operations per second (lookups/s for hash_table_find)
+
+   Lines starting # describe the run. Run with 'make bench', or directly:
+
+     kernel_bench [-k kmer_size] [-b bucket_size] [-m max_table_mb]
+                  [-l lookups] [-t tmp_dir]
+
+   hash_table_find is measured on tables from 256 KB (L2 resident) up
+   to -m MB, each 4 times the last, plus -m itself (32768 for 32 GB).
+   Each table is filled to 75% with random keys, then probed with
+   random keys that are present (hit) and absent (miss), through the
+   packed table and through a split key index (-Y). Random probes of a
+   table bigger than the caches miss on nearly every lookup, so the
+   larger sizes show the memory bound cost.
+
+   The kernels chosen by kmer_kernels_initialise are used, so
+   KONTAMINANT_KERNELS=scalar etc. compares instruction sets.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_value.h"
+#include "hash_table.h"
+#include "key_index.h"
+#include "seq.h"
+#include "kmer_kernels.h"
+
+#define BENCH_READ_LENGTH 150
+#define BENCH_MAX_READ_LENGTH 1000
+#define BENCH_N_READS 200000
+#define BENCH_SEQUENCE_LENGTH (1 << 20)
+#define BENCH_N_KMERS (1 << 20)
+#define BENCH_SMALLEST_TABLE (256 * 1024LL)
+#define BENCH_REHASH_TRIES 25
+#define BENCH_LOAD 0.75
+
+// Stops the compiler removing the timed loops
+static volatile uint64_t sink;
+
+/*----------------------------------------------------------------------*
+ * Function:   now_ns
+ * Purpose:    Monotonic clock
+ * Parameters: None
+ * Returns:    Nanoseconds
+ *----------------------------------------------------------------------*/
+static double now_ns(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+
+    return (t.tv_sec * 1e9) + t.tv_nsec;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   report
+ * Purpose:    Print one result line
+ * Parameters: benchmark, variant -> names
+ *             bytes = working set
+ *             ops = operations timed
+ *             ns = time taken
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void report(char* benchmark, char* variant, long long bytes, long long ops, double ns)
+{
+    printf("%s\t%s\t%lld\t%lld\t%.3f\t%.0f\n", benchmark, variant, bytes, ops, ns / ops, ops / (ns / 1e9));
+    fflush(stdout);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   splitmix64
+ * Purpose:    Random number i of a fixed sequence, so keys can be
+ *             regenerated rather than stored
+ * Parameters: i = index
+ * Returns:    Random 64 bits
+ *----------------------------------------------------------------------*/
+static uint64_t splitmix64(uint64_t i)
+{
+    uint64_t z = (i + 1) * 0x9E3779B97F4A7C15ULL;
+
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+
+    return z ^ (z >> 31);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   key_number
+ * Purpose:    Key i of the fixed random sequence of kmers
+ * Parameters: i = index
+ *             kmer_size = kmer size
+ *             key -> filled in
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void key_number(uint64_t i, short kmer_size, BinaryKmer* key)
+{
+    int top_bits = (2 * kmer_size) - (64 * (NUMBER_OF_BITFIELDS_IN_BINARY_KMER - 1));
+    int j;
+
+    // Bases fill the last word first, so only the first word is partial
+    for (j=0; j<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; j++) {
+        (*key)[j] = splitmix64((i * NUMBER_OF_BITFIELDS_IN_BINARY_KMER) + j);
+    }
+    if (top_bits <= 0) {
+        (*key)[0] = 0;
+    } else if (top_bits < 64) {
+        (*key)[0] &= (1ULL << top_bits) - 1;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   random_bases
+ * Purpose:    Random sequence, with an N at about 1 in n_every bases
+ * Parameters: length = number of bases
+ *             n_every = N rate, 0 for none
+ * Returns:    Pointer to null terminated sequence
+ *----------------------------------------------------------------------*/
+static char* random_bases(int length, int n_every)
+{
+    char* seq = malloc(length + 1);
+    int i;
+
+    if (!seq) {
+        printf("Error: can't allocate memory for %d bases\n", length);
+        exit(1);
+    }
+
+    for (i=0; i<length; i++) {
+        uint64_t r = splitmix64(0x5EED0000ULL + i);
+        seq[i] = ((n_every > 0) && ((r >> 32) % n_every == 0)) ? 'N' : "ACGT"[r & 3];
+    }
+    seq[length] = 0;
+
+    return seq;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bench_kmer_kernels
+ * Purpose:    Time hash_value, seq_to_binary_kmer, element_get_key and
+ *             get_sliding_windows_from_sequence
+ * Parameters: kmer_size = kmer size
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void bench_kmer_kernels(short kmer_size)
+{
+    BinaryKmer* kmers = malloc(BENCH_N_KMERS * sizeof(BinaryKmer));
+    uint64_t* hashes = malloc(BENCH_N_KMERS * sizeof(uint64_t));
+    char* seq = random_bases(BENCH_SEQUENCE_LENGTH + kmer_size, 0);
+    char* reads = random_bases(BENCH_SEQUENCE_LENGTH, 200);
+    char qual[BENCH_READ_LENGTH + 1];
+    char kmer_string[NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32];
+    KmerSlidingWindowSet* windows = binary_kmer_sliding_window_set_new_from_read_length(kmer_size, BENCH_READ_LENGTH);
+    uint64_t total = 0;
+    long long n_kmers;
+    BinaryKmer key;
+    double start;
+    int i;
+
+    if ((!kmers) || (!hashes)) {
+        printf("Error: can't allocate memory for kmers\n");
+        exit(1);
+    }
+
+    for (i=0; i<BENCH_N_KMERS; i++) {
+        key_number(i, kmer_size, &(kmers[i]));
+    }
+
+    start = now_ns();
+    for (i=0; i<BENCH_N_KMERS; i++) {
+        total += hash_value_64(&(kmers[i]));
+    }
+    report("hash_value_64", "single", BENCH_N_KMERS * sizeof(BinaryKmer), BENCH_N_KMERS, now_ns() - start);
+
+    start = now_ns();
+    kmer_kernels.hash_keys(kmers, BENCH_N_KMERS, hashes);
+    report("hash_value_64", "batch", BENCH_N_KMERS * sizeof(BinaryKmer), BENCH_N_KMERS, now_ns() - start);
+    total += hashes[BENCH_N_KMERS - 1];
+
+    start = now_ns();
+    for (i=0; i<BENCH_N_KMERS; i++) {
+        total += hash_value(&(kmers[i]), 1 << 20);
+    }
+    report("hash_value", "lookup3", BENCH_N_KMERS * sizeof(BinaryKmer), BENCH_N_KMERS, now_ns() - start);
+
+    start = now_ns();
+    for (i=0; i<BENCH_N_KMERS; i++) {
+        element_get_key(&(kmers[i]), kmer_size, &key);
+        total += key[NUMBER_OF_BITFIELDS_IN_BINARY_KMER - 1];
+    }
+    report("element_get_key", "random", BENCH_N_KMERS * sizeof(BinaryKmer), BENCH_N_KMERS, now_ns() - start);
+
+    // seq_to_binary_kmer wants a null terminated kmer, copied as callers do
+    kmer_string[kmer_size] = 0;
+    start = now_ns();
+    for (i=0; i<BENCH_N_KMERS; i++) {
+        memcpy(kmer_string, seq + i, kmer_size);
+        seq_to_binary_kmer(kmer_string, kmer_size, &key);
+        total += key[NUMBER_OF_BITFIELDS_IN_BINARY_KMER - 1];
+    }
+    report("seq_to_binary_kmer", "random", BENCH_SEQUENCE_LENGTH, BENCH_N_KMERS, now_ns() - start);
+
+    // Reads of BENCH_READ_LENGTH with an N every 200 bases or so
+    memset(qual, 'I', BENCH_READ_LENGTH);
+    qual[BENCH_READ_LENGTH] = 0;
+    n_kmers = 0;
+    start = now_ns();
+    for (i=0; i+BENCH_READ_LENGTH<=BENCH_SEQUENCE_LENGTH; i+=BENCH_READ_LENGTH) {
+        n_kmers += get_sliding_windows_from_sequence(reads + i, qual, BENCH_READ_LENGTH, 0, kmer_size, windows, windows->max_nwindows, windows->max_kmers, false, 0);
+    }
+    report("get_sliding_windows_from_sequence", "150bp", BENCH_SEQUENCE_LENGTH, n_kmers, now_ns() - start);
+
+    sink = total;
+
+    binary_kmer_free_kmers_set(&windows);
+    free(reads);
+    free(seq);
+    free(hashes);
+    free(kmers);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   time_lookups
+ * Purpose:    Time hash_table_find over a set of keys
+ * Parameters: keys -> keys to find
+ *             n_keys = number of keys
+ *             hash -> table
+ *             found -> number found
+ * Returns:    Time in ns
+ *----------------------------------------------------------------------*/
+static double time_lookups(BinaryKmer* keys, long long n_keys, HashTable* hash, long long* found)
+{
+    double start = now_ns();
+    long long i;
+
+    *found = 0;
+    for (i=0; i<n_keys; i++) {
+        if (hash_table_find(&(keys[i]), hash) != NULL) {
+            (*found)++;
+        }
+    }
+
+    return now_ns() - start;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bench_table
+ * Purpose:    Fill a table and time lookups of present and absent keys,
+ *             through the table and a split key index
+ * Parameters: table_bytes = approximate table size
+ *             bucket_size = bucket size
+ *             kmer_size = kmer size
+ *             n_lookups = lookups to time for each variant
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void bench_table(long long table_bytes, int bucket_size, short kmer_size, long long n_lookups)
+{
+    int bits = 0;
+    HashTable* hash;
+    BinaryKmer* hit_keys = malloc(n_lookups * sizeof(BinaryKmer));
+    BinaryKmer* miss_keys = malloc(n_lookups * sizeof(BinaryKmer));
+    long long n_keys, bytes, i, found;
+    char variant[64];
+    double start, ns;
+
+    if ((!hit_keys) || (!miss_keys)) {
+        printf("Error: can't allocate memory for %lld lookup keys\n", n_lookups);
+        exit(1);
+    }
+
+    while ((2LL << bits) * bucket_size * (long long)sizeof(Element) <= table_bytes) {
+        bits++;
+    }
+    bytes = (1LL << bits) * bucket_size * (long long)sizeof(Element);
+    n_keys = (long long)(BENCH_LOAD * (double)(1LL << bits) * bucket_size);
+
+    hash = hash_table_new(bits, bucket_size, BENCH_REHASH_TRIES, kmer_size);
+
+    start = now_ns();
+    for (i=0; i<n_keys; i++) {
+        BinaryKmer kmer, key;
+        boolean present;
+
+        key_number(i, kmer_size, &kmer);
+        element_get_key(&kmer, kmer_size, &key);
+        hash_table_find_or_insert(&key, &present, hash);
+    }
+    sprintf(variant, "2^%d*%d", bits, bucket_size);
+    report("hash_table_find_or_insert", variant, bytes, n_keys, now_ns() - start);
+
+    // Present keys picked at random, absent keys from past the inserted
+    // ones, both canonical as the table stores them
+    for (i=0; i<n_lookups; i++) {
+        BinaryKmer kmer;
+
+        key_number(splitmix64(0xB00C0000ULL + i) % n_keys, kmer_size, &kmer);
+        element_get_key(&kmer, kmer_size, &(hit_keys[i]));
+        key_number(n_keys + i, kmer_size, &kmer);
+        element_get_key(&kmer, kmer_size, &(miss_keys[i]));
+    }
+
+    ns = time_lookups(hit_keys, n_lookups, hash, &found);
+    sprintf(variant, "hit,2^%d*%d", bits, bucket_size);
+    report("hash_table_find", variant, bytes, n_lookups, ns);
+    if (found != n_lookups) {
+        printf("# warning: found %lld of %lld present keys\n", found, n_lookups);
+    }
+
+    ns = time_lookups(miss_keys, n_lookups, hash, &found);
+    sprintf(variant, "miss,2^%d*%d", bits, bucket_size);
+    report("hash_table_find", variant, bytes, n_lookups, ns);
+
+    hash->key_index = key_index_new_from_hash_table(hash, false);
+
+    ns = time_lookups(hit_keys, n_lookups, hash, &found);
+    sprintf(variant, "split_hit,2^%d*%d", bits, bucket_size);
+    report("hash_table_find", variant, bytes, n_lookups, ns);
+
+    ns = time_lookups(miss_keys, n_lookups, hash, &found);
+    sprintf(variant, "split_miss,2^%d*%d", bits, bucket_size);
+    report("hash_table_find", variant, bytes, n_lookups, ns);
+
+    hash_table_free(&hash);
+    free(miss_keys);
+    free(hit_keys);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bench_fastq
+ * Purpose:    Time read_sequence_from_fastq and skip_sequence_from_fastq
+ *             over a synthetic file (read from the page cache)
+ * Parameters: tmp_dir -> directory for the file
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void bench_fastq(char* tmp_dir)
+{
+    char filename[1024];
+    char* bases = random_bases(BENCH_READ_LENGTH * 64, 200);
+    Sequence* seq = sequence_new(BENCH_MAX_READ_LENGTH, 256, 33);
+    char qual[BENCH_READ_LENGTH + 1];
+    long long n, bytes;
+    double start;
+    FILE* fp;
+    int fd, i;
+
+    sprintf(filename, "%s/kernel_bench_XXXXXX", tmp_dir);
+    fd = mkstemp(filename);
+    if ((fd == -1) || ((fp = fdopen(fd, "w")) == NULL)) {
+        printf("Error: can't create temporary file in %s\n", tmp_dir);
+        exit(1);
+    }
+    memset(qual, 'I', BENCH_READ_LENGTH);
+    qual[BENCH_READ_LENGTH] = 0;
+    for (i=0; i<BENCH_N_READS; i++) {
+        fprintf(fp, "@read%d/1\n%.*s\n+\n%s\n", i, BENCH_READ_LENGTH, bases + ((i % 63) * BENCH_READ_LENGTH), qual);
+    }
+    bytes = ftell(fp);
+    fclose(fp);
+
+    fp = fopen(filename, "r");
+    n = 0;
+    start = now_ns();
+    while (read_sequence_from_fastq(fp, seq, BENCH_MAX_READ_LENGTH) > 0) {
+        n++;
+    }
+    report("read_sequence_from_fastq", "150bp", bytes, n, now_ns() - start);
+    fclose(fp);
+
+    fp = fopen(filename, "r");
+    n = 0;
+    start = now_ns();
+    while (skip_sequence_from_fastq(fp, seq, BENCH_MAX_READ_LENGTH) > 0) {
+        n++;
+    }
+    report("skip_sequence_from_fastq", "150bp", bytes, n, now_ns() - start);
+    fclose(fp);
+
+    unlink(filename);
+    free_sequence(&seq);
+    free(bases);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   main
+ *----------------------------------------------------------------------*/
+int main(int argc, char* argv[])
+{
+    short kmer_size = 21;
+    int bucket_size = 8;
+    long long max_table_mb = 1024;
+    long long n_lookups = 1 << 22;
+    char* tmp_dir = "/tmp";
+    long long table_bytes;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:b:m:l:t:h")) != -1) {
+        switch (opt) {
+            case 'k': kmer_size = atoi(optarg); break;
+            case 'b': bucket_size = atoi(optarg); break;
+            case 'm': max_table_mb = atoll(optarg); break;
+            case 'l': n_lookups = atoll(optarg); break;
+            case 't': tmp_dir = optarg; break;
+            default:
+                printf("Syntax: kernel_bench [-k kmer_size] [-b bucket_size] [-m max_table_mb] [-l lookups] [-t tmp_dir]\n");
+                return 1;
+        }
+    }
+
+    if ((kmer_size < 1) || (kmer_size >= NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32) || (kmer_size > BENCH_READ_LENGTH) ||
+        (bucket_size < 1) || (max_table_mb < 1) || (n_lookups < 1)) {
+        printf("Error: need 0 < k < %d, b >= 1, m >= 1 and l >= 1\n", NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32);
+        return 1;
+    }
+
+    kmer_kernels_initialise();
+
+    printf("# kernel_bench\n");
+    printf("# kernels\t%s\n", kmer_kernels.name);
+    printf("# kmer_size\t%d\n", kmer_size);
+    printf("# bitfields\t%d\n", NUMBER_OF_BITFIELDS_IN_BINARY_KMER);
+    printf("# element_bytes\t%ld\n", sizeof(Element));
+    printf("# bucket_size\t%d\n", bucket_size);
+    printf("benchmark\tvariant\tbytes\tops\tns_per_op\tops_per_s\n");
+
+    bench_kmer_kernels(kmer_size);
+    bench_fastq(tmp_dir);
+
+    for (table_bytes = BENCH_SMALLEST_TABLE; table_bytes < max_table_mb * 1024 * 1024; table_bytes *= 4) {
+        bench_table(table_bytes, bucket_size, kmer_size, n_lookups);
+    }
+    bench_table(max_table_mb * 1024 * 1024, bucket_size, kmer_size, n_lookups);
+
+    return 0;
+}
@@ -93,6 +93,8 @@ typedef struct {
 	int j;
 	BinaryKmer  current;
 	KmerSlidingWindow * window;
+	uint8_t * codes; //Nucleotide of each base of the current sequence, see kmer_kernels
+	int codes_capacity;
 } KmerSlidingWindowSet;
 
 // basic BinaryKmer operations
@@ -0,0 +1,35 @@
+/*----------------------------------------------------------------------*
+ * File:    bloom_filter.h                                              *
+ * Purpose: Blocked Bloom filter prefilter for the contaminant table   *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef BLOOM_FILTER_H_
+#define BLOOM_FILTER_H_
+
+// One block is one 64 byte cache line, split into 8 words. Each kmer
+// sets one bit in every word of a single block.
+#define BLOOM_WORDS_PER_BLOCK 8
+
+typedef struct {
+    uint64_t words[BLOOM_WORDS_PER_BLOCK];
+} BloomBlock;
+
+typedef struct BloomFilter {
+    BloomBlock* blocks;
+    uint64_t number_blocks;
+    uint64_t block_mask;
+    uint64_t number_kmers;
+} BloomFilter;
+
+BloomFilter* bloom_filter_new(uint64_t expected_kmers, int bits_per_kmer);
+void bloom_filter_free(BloomFilter** filter);
+void bloom_filter_add(BloomFilter* filter, Key key);
+boolean bloom_filter_may_contain(BloomFilter* filter, Key key);
+BloomFilter* bloom_filter_new_from_hash_table(HashTable* hash_table, int bits_per_kmer);
+double bloom_filter_false_positive_rate(BloomFilter* filter);
+
+#endif /* BLOOM_FILTER_H_ */
@@ -2,6 +2,9 @@
 #define DO_SCREEN 1
 #define DO_FILTER 2
 #define DO_INDEX 3
+#define DO_SERVE 4
+#define DO_MERGE 5
+#define DO_COMBINE 6
 
 typedef enum
 {
@@ -44,7 +47,31 @@ typedef struct {
     char* read_summary_file;
     int numthreads;
     double ratio;
+    boolean early_exit;
+    int bloom_bits;
+    boolean pipeline;
+    int pipeline_parse_threads;
+    int pipeline_lookup_threads;
+    int window_size;
+    boolean long_reads;
+    int dedup_cache_mb;
+    char* server_socket;
+    char* client_socket;
+    int max_jobs;
+    char* snapshot_file;
+    int n_merge_files;
+    char** merge_files;
+    int n_shards;
+    int shard;
+    int table_memory_mode;
+    boolean table_prefault;
+    boolean table_lock;
+    int numa_policy;
+    boolean numa_pin;
+    boolean split_keys;
+    boolean lookup_stats;
 } CmdLine;
 
 void initialise_cmdline(CmdLine* c);
 void parse_command_line(int argc, char* argv[], CmdLine* c);
+int find_command_line_option(int argc, char* argv[], char* options, char** value);
@@ -0,0 +1,68 @@
+/*----------------------------------------------------------------------*
+ * File:    cmd_line_options.h                                          *
+ * Purpose: Command line option table                                   *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef CMD_LINE_OPTIONS_H_
+#define CMD_LINE_OPTIONS_H_
+
+// Shared by parse_command_line and the multi-build dispatcher
+// (kontaminant_multi.c), which must see options the same way
+
+#define CMD_LINE_SHORT_OPTIONS "1:2:A:b:B:c:C:d:D:e:Efg:hH:iI:j:J:K:k:l:Lm:Mn:N:o:p:P:Qr:R:sS:t:TuU:w:W:xy:Yz:"
+
+static struct option cmd_line_long_options[] = {
+    {"input_one", required_argument, NULL, '1'},
+    {"input_two", required_argument, NULL, '2'},
+    {"alloc", required_argument, NULL, 'A'},
+    {"mem_width", required_argument, NULL, 'b'},
+    {"bloom_bits", required_argument, NULL, 'B'},
+    {"contaminants", required_argument, NULL, 'c'},
+    {"client", required_argument, NULL, 'C'},
+    {"contaminant_dir", required_argument, NULL, 'd'},
+    {"dedup_cache", required_argument, NULL, 'D'},
+    {"contaminants_file", required_argument, NULL, 'e'},
+    {"filter", no_argument, NULL, 'f'},
+    {"early_exit", no_argument, NULL, 'E'},
+    {"file_format", required_argument, NULL, 'g'},
+    {"help", no_argument, NULL, 'h'},
+    {"shards", required_argument, NULL, 'H'},
+    {"index", no_argument, NULL, 'i'},
+    {"shard", required_argument, NULL, 'I'},
+    {"read_summary", required_argument, NULL, 'j'},
+    {"max_jobs", required_argument, NULL, 'J'},
+    {"snapshot", required_argument, NULL, 'K'},
+    {"kmer_size", required_argument, NULL, 'k'},
+    {"readthreshold", required_argument, NULL, 'l'},
+    {"long_reads", no_argument, NULL, 'L'},
+    {"max_read_length", required_argument, NULL, 'm'},
+    {"merge", no_argument, NULL, 'M'},
+    {"mem_height", required_argument, NULL, 'n'},
+    {"mem_height", required_argument, NULL, 'n'},
+    {"numthreads", required_argument, NULL, 'N'},
+    {"output_prefix", required_argument, NULL, 'o'},
+    {"progress", required_argument, NULL, 'p'},
+    {"pipeline", required_argument, NULL, 'P'},
+    {"removed_prefix", required_argument, NULL, 'r'},
+    {"combine", no_argument, NULL, 'Q'},
+    {"ratio", required_argument, NULL, 'R'},
+    {"screen", no_argument, NULL, 's'},
+    {"server", required_argument, NULL, 'S'},
+    {"threshold", required_argument, NULL, 't'},
+    {"lookup_stats", no_argument, NULL, 'T'},
+    {"numa", required_argument, NULL, 'U'},
+    {"split_keys", no_argument, NULL, 'Y'},
+    {"unique", no_argument, NULL, 'u'},
+    {"progress_interval", required_argument, NULL, 'w'},
+    {"window_size", required_argument, NULL, 'W'},
+    {"keep_contaminated_reads", no_argument, NULL, 'x'},
+    {"subsample", required_argument, NULL, 'y'},
+    {"file_of_files", required_argument, NULL, 'z'},
+    {0, 0, 0, 0}
+};
+
+#endif /* CMD_LINE_OPTIONS_H_ */
@@ -0,0 +1,32 @@
+/*----------------------------------------------------------------------*
+ * File:    contaminant_set.h                                           *
+ * Purpose: Histogram of kmers by the set of contaminants holding them  *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef CONTAMINANT_SET_H_
+#define CONTAMINANT_SET_H_
+
+typedef struct {
+    uint32_t words[CONTAMINANT_SET_WORDS];
+    uint64_t count;
+} ContaminantSetEntry;
+
+typedef struct {
+    ContaminantSetEntry* entries;
+    long long capacity;
+    long long number_sets;
+} ContaminantSetHistogram;
+
+ContaminantSetHistogram* contaminant_set_histogram_new(void);
+void contaminant_set_histogram_free(ContaminantSetHistogram** histogram);
+void contaminant_set_of_element(Element* e, uint32_t* words);
+int contaminant_set_members(uint32_t* words, int* ids);
+void contaminant_set_histogram_add(ContaminantSetHistogram* histogram, uint32_t* words, uint64_t count);
+void contaminant_set_histogram_add_element(ContaminantSetHistogram* histogram, Element* e);
+void contaminant_set_histogram_merge(ContaminantSetHistogram* into, ContaminantSetHistogram* from);
+
+#endif /* CONTAMINANT_SET_H_ */
@@ -42,6 +42,10 @@
 //#define CONTAMINANT_FIELDS 0
 #define MAX_CONTAMINANTS ((CONTAMINANT_FIELDS*32)+(32 - FLAG_BITS_USED))
 
+// Words holding an element's contaminant bits: the contaminant_flags words,
+// then the contaminant bits of flags shifted down past FLAG_BITS_USED
+#define CONTAMINANT_SET_WORDS (CONTAMINANT_FIELDS + 1)
+
 typedef char Edges;
 
 // To pack it, use
@@ -41,10 +41,12 @@
 #define HASH_H_
 
 #define MAGIC_TEXT "BINARY_HASH"
-#define HASH_VERSION 1
+#define HASH_VERSION 2
 #ifdef ENABLE_READ_PAIR
 struct read_pair_descriptor_array;
 #endif
+struct BloomFilter;
+struct KeyIndex;
 typedef struct {
     long long number_buckets;
     long long unique_kmers;
@@ -60,8 +62,28 @@ typedef struct {
     short max_coverage_for_branches;
     boolean calculated;
     int number_of_reads;
+    struct BloomFilter * prefilter; //optional, checked by hash_table_find before the table
+    struct KeyIndex * key_index; //optional, probed by hash_table_find instead of the table
+    int table_memory_mode; //how table was allocated, see table_memory.h
+    size_t table_memory_bytes;
+    Element * primary_table; //set in a NUMA replica, coverage flags are kept in the primary
 } HashTable;
 
+#define HASH_TABLE_LOOKUP_DEPTHS 32
+#define HASH_TABLE_PROBE_BINS 16
+#define HASH_TABLE_FILL_ROWS 16
+
+//counts of lookups through hash_table_find and hash_table_find_with_hash,
+//see hash_table_count_lookups
+typedef struct {
+    long long lookups;
+    long long hits;
+    long long slots_probed;
+    long long max_slots_probed;
+    long long buckets_searched[HASH_TABLE_LOOKUP_DEPTHS]; //[0] rejected by the prefilter, [n] searched n buckets (n-1 rehashes), last is that many or more
+    long long slots_probed_bins[HASH_TABLE_PROBE_BINS]; //[0] none, [n] 2^(n-1) to 2^n - 1 slots, last is that many or more
+} HashTableLookupStats;
+
 HashTable * hash_table_new(int number_bits, int bucket_size,
 		int max_rehash_tries, short kmer_size);
 
@@ -85,6 +107,22 @@ Element * hash_table_insert(Key key, HashTable * hash_table);
 
 void hash_table_print_stats(HashTable * db_hash);
 
+//clears lookup counts and starts (or stops) counting lookups on every thread.
+//Off by default; when off a lookup pays one branch.
+void hash_table_count_lookups(boolean enable);
+boolean hash_table_counting_lookups(void);
+
+//sums every thread's lookup counts
+void hash_table_get_lookup_stats(HashTableLookupStats * total);
+
+//histogram[n] = number of buckets holding n elements, for n = 0 to bucket_size
+void hash_table_bucket_fill(long long * histogram, HashTable * hash_table);
+
+//prints lookup counts and bucket fill
+void hash_table_print_lookup_stats(HashTable * hash_table);
+
+//writes lookup counts as name/value lines, for progress files
+
 float hash_table_percentage_occupied(HashTable * hash_table);
 
 long long hash_table_get_unique_kmers(HashTable *);
@@ -94,6 +132,9 @@ void hash_table_dump_memory(char * filename, HashTable * db_graph);
 //return entry for kmer
 Element * hash_table_find(Key key, HashTable * hash_table);
 
+//as hash_table_find, given hash_value_64 of key
+Element * hash_table_find_with_hash(Key key, uint64_t hash, HashTable * hash_table);
+
 //returns the index of the element in the hash.
 long long hash_table_array_index_of_element(Element *, HashTable *);
 
@@ -102,15 +143,37 @@ long long hash_table_array_index_of_element(Element *, HashTable *);
 void hash_table_set_number_of_threads(int threads, HashTable * hash_table);
 
 
-#ifdef THREADS
 //Iterator that splits the hash table on the number of threads given to the
-//table. Default is 1. 
-void hash_table_threaded_traverse_with_vars( void (*f)(Element *, void * args), void ** args, HashTable * hash_table);
+//table, run on the shared thread pool. Default is 1. Block i gets args[i].
+void hash_table_threaded_traverse_with_args( void (*f)(Element *, void * args), void ** args, HashTable * hash_table);
 
 //Iterator that splits the hash table on the number of threads given to the
-//table. Default is 1. 
+//table, run on the shared thread pool. Default is 1. 
 void hash_table_threaded_traverse( void (*f)(Element *), HashTable * hash_table);
-#endif
+
+//applies f to every element, in parallel on the shared thread pool. Each block
+//gets the accumulator returned by new_accumulator (called on its thread), or
+//data if new_accumulator is NULL. reduce, if not NULL, is then called on the
+//calling thread with each accumulator in block order.
+void hash_table_parallel_traverse(void (*f)(Element *, void * accumulator), void * (*new_accumulator)(int block, void * data),
+                                  void (*reduce)(void * accumulator, void * data), void * data, HashTable * hash_table);
+
+//as hash_table_parallel_traverse, without the progress bar on stdout
+void hash_table_parallel_traverse_quiet(void (*f)(Element *, void * accumulator), void * (*new_accumulator)(int block, void * data),
+                                        void (*reduce)(void * accumulator, void * data), void * data, HashTable * hash_table);
+
+//number of blocks hash_table_parallel_traverse splits the table into
+int hash_table_parallel_blocks(void);
+
+//counts elements for which select returns true, in parallel
+long long hash_table_parallel_count(boolean (*select)(Element *, void *), void * data, HashTable * hash_table);
+
+//writes each element for which select returns true, as a record of record_bytes,
+//to an existing file from offset on. Records are in table order, as for a serial
+//traverse, with each block writing its part of the file through its own handle.
+//Returns the number of records.
+long long hash_table_parallel_write(char * filename, long offset, size_t record_bytes, boolean (*select)(Element *, void *),
+                                    void (*write)(Element *, FILE *, void *), void * data, HashTable * hash_table);
 
 void hash_table_traverse_with_data(void (*f)(Element *, void *),void* data,HashTable * hash_table);
 
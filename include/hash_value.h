@@ -42,5 +42,32 @@
 
 int hash_value(Key key, int number_buckets);
 
+//64 bit multiply-xorshift hash of a key, specialised for the number of bitfields
+uint64_t hash_value_64(Key key);
+
+static inline uint64_t hash_value_64_inline(Key key){
+
+#if NUMBER_OF_BITFIELDS_IN_BINARY_KMER == 1
+  uint64_t h = (*key)[0];
+#else
+  uint64_t h = (*key)[0];
+  int i;
+  for (i = 1; i < NUMBER_OF_BITFIELDS_IN_BINARY_KMER; i++) {
+    h = ((h ^ (h >> 32)) * 0x9E3779B97F4A7C15ULL) + (*key)[i];
+  }
+#endif
+
+  h ^= h >> 33;
+  h *= 0xFF51AFD7ED558CCDULL;
+  h ^= h >> 33;
+  h *= 0xC4CEB9FE1A85EC53ULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+//bucket to try after rehash rehashes, derived from one hash_value_64 (number_buckets a power of 2)
+long long hash_value_bucket(uint64_t hash, int rehash, long long number_buckets);
+
 
 #endif /* HASH_VAL_H_ */
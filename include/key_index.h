@@ -0,0 +1,32 @@
+/*----------------------------------------------------------------------*
+ * File:    key_index.h                                                 *
+ * Purpose: Cache line aligned array of keys, probed instead of the     *
+ *          packed elements of a frozen table                           *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef KEY_INDEX_H_
+#define KEY_INDEX_H_
+
+#define KEY_INDEX_ALIGNMENT 64
+
+typedef struct KeyIndex {
+    BinaryKmer* keys;
+    void* memory;
+    long long stride;
+    long long number_buckets;
+    int bucket_size;
+    int memory_mode;
+    size_t memory_bytes;
+} KeyIndex;
+
+KeyIndex* key_index_new_from_hash_table(HashTable* hash_table, boolean progress);
+KeyIndex* key_index_copy_on_node(KeyIndex* index, int node);
+void key_index_free(KeyIndex** index);
+Element* key_index_find(KeyIndex* index, Key key, uint64_t hash, HashTable* hash_table);
+Element* key_index_find_probed(KeyIndex* index, Key key, uint64_t hash, HashTable* hash_table, int* buckets, long long* slots);
+
+#endif /* KEY_INDEX_H_ */
@@ -0,0 +1,53 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_kernels.h                                              *
+ * Purpose: Hot kmer loops, built for several instruction sets and      *
+ *          chosen at startup                                           *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef KMER_KERNELS_H_
+#define KMER_KERNELS_H_
+
+#define KMER_KERNELS_SCALAR 0
+#define KMER_KERNELS_SSE42 1
+#define KMER_KERNELS_AVX2 2
+#define KMER_KERNELS_AVX512 3
+#define KMER_KERNELS_LEVELS 4
+
+// Environment variable naming a lower level to use, eg. scalar
+#define KMER_KERNELS_ENVIRONMENT "KONTAMINANT_KERNELS"
+
+typedef struct {
+    char* name;
+
+    // codes[i] = Nucleotide of seq[i], Undefined for anything but ACGT
+    void (*encode_bases)(char* seq, int length, uint8_t* codes);
+
+    // kmers[i] = kmers[i-1] shifted left one base with codes[i-1] added,
+    // for i = 1 to n; kmers[0] is the kmer to start from
+    void (*roll_kmers)(BinaryKmer* kmers, uint8_t* codes, int n, short kmer_size);
+
+    // keys[i] = lesser of kmers[i] and its reverse complement, as
+    // element_get_key
+    void (*canonical_keys)(BinaryKmer* kmers, int n, short kmer_size, BinaryKmer* keys);
+
+    // hashes[i] = hash_value_64 of keys[i]
+    void (*hash_keys)(BinaryKmer* keys, int n, uint64_t* hashes);
+
+    // First slot of a key index bucket holding key or empty, or
+    // bucket_size if neither. Slots up to the bucket's cache line
+    // aligned stride may be read.
+    int (*probe_bucket)(BinaryKmer* keys, int bucket_size, BinaryKmer* key);
+
+    // As contaminant_set_members
+    int (*contaminant_set_members)(uint32_t* words, int* ids);
+} KmerKernels;
+
+extern KmerKernels kmer_kernels;
+
+void kmer_kernels_initialise(void);
+
+#endif /* KMER_KERNELS_H_ */
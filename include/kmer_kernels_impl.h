@@ -0,0 +1,268 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_kernels_impl.h                                         *
+ * Purpose: Kernel bodies, included by kmer_kernels.c once for each     *
+ *          instruction set                                             *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   No include guard: kmer_kernels.c sets KERNEL_SUFFIX, and the target
+   pragma, then includes this file, and the compiler schedules and
+   vectorises the same C for that instruction set. KERNEL_SSE42,
+   KERNEL_AVX2 and KERNEL_AVX512 switch in the hand written bucket
+   probes. Every version must give exactly the results of the scalar
+   one.
+ */
+
+#define KERNEL_NAME(name, suffix) name##_##suffix
+#define KERNEL_EXPAND(name, suffix) KERNEL_NAME(name, suffix)
+#define KERNEL(name) KERNEL_EXPAND(name, KERNEL_SUFFIX)
+
+/*----------------------------------------------------------------------*
+ * Function:   encode_bases
+ * Purpose:    Convert bases to Nucleotide codes, without branches so
+ *             the loop vectorises.
+ * Parameters: seq -> bases
+ *             length = number of bases
+ *             codes -> length codes to fill
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void KERNEL(encode_bases)(char* seq, int length, uint8_t* codes)
+{
+    int i;
+
+#ifndef SOLID
+    // Upper case, then A,C,T,G = 0x41,0x43,0x54,0x47 give bits 2:1 of
+    // 0,1,2,3 and x ^ (x >> 1) swaps T and G
+    for (i=0; i<length; i++) {
+        uint8_t c = ((uint8_t)seq[i]) & 0xDF;
+        uint8_t x = (c >> 1) & 3;
+        uint8_t valid = (c == 'A') | (c == 'C') | (c == 'G') | (c == 'T');
+
+        codes[i] = valid ? (x ^ (x >> 1)) : Undefined;
+    }
+#else
+    for (i=0; i<length; i++) {
+        codes[i] = char_to_binary_nucleotide(seq[i]);
+    }
+#endif
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   roll_kmers
+ * Purpose:    Extend a kmer base by base, as
+ *             binary_kmer_left_shift_one_base_and_insert_new_base_at_right_end
+ * Parameters: kmers -> n+1 kmers, kmers[0] set
+ *             codes -> n bases to add
+ *             n = number of bases
+ *             kmer_size = kmer size
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void KERNEL(roll_kmers)(BinaryKmer* kmers, uint8_t* codes, int n, short kmer_size)
+{
+    int fully_used = kmer_size / 32;
+    int top = fully_used < NUMBER_OF_BITFIELDS_IN_BINARY_KMER ? NUMBER_OF_BITFIELDS_IN_BINARY_KMER - fully_used - 1 : 0;
+    bitfield_of_64bits top_mask = fully_used < NUMBER_OF_BITFIELDS_IN_BINARY_KMER ? (((bitfield_of_64bits)1) << (2 * (kmer_size % 32))) - 1 : ~((bitfield_of_64bits)0);
+    int i, w;
+
+    for (i=1; i<=n; i++) {
+        bitfield_of_64bits carry = codes[i-1];
+
+        for (w=NUMBER_OF_BITFIELDS_IN_BINARY_KMER-1; w>=top; w--) {
+            bitfield_of_64bits word = kmers[i-1][w];
+            kmers[i][w] = (word << 2) | carry;
+            carry = word >> 62;
+        }
+        for (w=0; w<top; w++) {
+            kmers[i][w] = kmers[i-1][w];
+        }
+        kmers[i][top] &= top_mask;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   canonical_keys
+ * Purpose:    Canonical key of each kmer. The reverse complement is
+ *             made a word at a time: complement, reverse the 2 bit
+ *             bases of each word and the order of the words, then
+ *             shift the kmer back down to the low bits.
+ * Parameters: kmers -> kmers
+ *             n = number of kmers
+ *             kmer_size = kmer size
+ *             keys -> n keys to fill, may be kmers
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void KERNEL(canonical_keys)(BinaryKmer* kmers, int n, short kmer_size, BinaryKmer* keys)
+{
+    int shift = (64 * NUMBER_OF_BITFIELDS_IN_BINARY_KMER) - (2 * kmer_size);
+    int word_shift = shift / 64;
+    int bit_shift = shift % 64;
+    int top = (kmer_size / 32) < NUMBER_OF_BITFIELDS_IN_BINARY_KMER ? NUMBER_OF_BITFIELDS_IN_BINARY_KMER - (kmer_size / 32) - 1 : 0;
+    int i, w;
+
+    for (i=0; i<n; i++) {
+        BinaryKmer reversed;
+        BinaryKmer rc;
+        boolean use_rc = true;
+
+        for (w=0; w<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; w++) {
+#ifndef SOLID
+            bitfield_of_64bits x = ~kmers[i][NUMBER_OF_BITFIELDS_IN_BINARY_KMER - 1 - w];
+#else
+            bitfield_of_64bits x = kmers[i][NUMBER_OF_BITFIELDS_IN_BINARY_KMER - 1 - w];
+#endif
+            x = __builtin_bswap64(x);
+            x = ((x >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((x & 0x0F0F0F0F0F0F0F0FULL) << 4);
+            x = ((x >> 2) & 0x3333333333333333ULL) | ((x & 0x3333333333333333ULL) << 2);
+            reversed[w] = x;
+        }
+
+        for (w=0; w<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; w++) {
+            int from = w - word_shift;
+            bitfield_of_64bits x = 0;
+
+            if (from >= 0) {
+                x = reversed[from] >> bit_shift;
+                if ((bit_shift > 0) && (from > 0)) {
+                    x |= reversed[from - 1] << (64 - bit_shift);
+                }
+            }
+            rc[w] = x;
+        }
+
+        // binary_kmer_less_than, which is really <=
+        for (w=top; w<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; w++) {
+            if (rc[w] != kmers[i][w]) {
+                use_rc = rc[w] < kmers[i][w];
+                break;
+            }
+        }
+
+        for (w=0; w<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; w++) {
+            keys[i][w] = use_rc ? rc[w] : kmers[i][w];
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   hash_keys
+ * Purpose:    Table hash of each key
+ * Parameters: keys -> keys
+ *             n = number of keys
+ *             hashes -> n hashes to fill
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void KERNEL(hash_keys)(BinaryKmer* keys, int n, uint64_t* hashes)
+{
+    int i;
+
+    for (i=0; i<n; i++) {
+        hashes[i] = hash_value_64_inline(&(keys[i]));
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   probe_bucket
+ * Purpose:    Find a key or the first empty slot in a key index bucket.
+ *             Keys of one bitfield are compared several at once.
+ * Parameters: keys -> first key of bucket
+ *             bucket_size = slots in use per bucket
+ *             key -> key
+ * Returns:    Slot, or bucket_size if the key isn't there and the
+ *             bucket is full
+ *----------------------------------------------------------------------*/
+static int KERNEL(probe_bucket)(BinaryKmer* keys, int bucket_size, BinaryKmer* key)
+{
+    int slot;
+
+#if (NUMBER_OF_BITFIELDS_IN_BINARY_KMER == 1) && defined(KERNEL_AVX512)
+    __m512i k = _mm512_set1_epi64((long long)(*key)[0]);
+    __m512i empty = _mm512_set1_epi64(-1);
+
+    // The stride is a multiple of 8 keys and padding slots are empty
+    for (slot=0; slot<bucket_size; slot+=8) {
+        __m512i v = _mm512_loadu_si512((void*)&(keys[slot]));
+        __mmask8 mask = _mm512_cmpeq_epi64_mask(v, k) | _mm512_cmpeq_epi64_mask(v, empty);
+
+        if (mask) {
+            slot += __builtin_ctz(mask);
+            return slot < bucket_size ? slot : bucket_size;
+        }
+    }
+#elif (NUMBER_OF_BITFIELDS_IN_BINARY_KMER == 1) && defined(KERNEL_AVX2)
+    __m256i k = _mm256_set1_epi64x((long long)(*key)[0]);
+    __m256i empty = _mm256_set1_epi64x(-1);
+
+    for (slot=0; slot<bucket_size; slot+=4) {
+        __m256i v = _mm256_loadu_si256((__m256i*)&(keys[slot]));
+        __m256i hit = _mm256_or_si256(_mm256_cmpeq_epi64(v, k), _mm256_cmpeq_epi64(v, empty));
+        int mask = _mm256_movemask_pd(_mm256_castsi256_pd(hit));
+
+        if (mask) {
+            slot += __builtin_ctz(mask);
+            return slot < bucket_size ? slot : bucket_size;
+        }
+    }
+#elif (NUMBER_OF_BITFIELDS_IN_BINARY_KMER == 1) && defined(KERNEL_SSE42)
+    __m128i k = _mm_set1_epi64x((long long)(*key)[0]);
+    __m128i empty = _mm_set1_epi64x(-1);
+
+    for (slot=0; slot<bucket_size; slot+=2) {
+        __m128i v = _mm_loadu_si128((__m128i*)&(keys[slot]));
+        __m128i hit = _mm_or_si128(_mm_cmpeq_epi64(v, k), _mm_cmpeq_epi64(v, empty));
+        int mask = _mm_movemask_pd(_mm_castsi128_pd(hit));
+
+        if (mask) {
+            slot += __builtin_ctz(mask);
+            return slot < bucket_size ? slot : bucket_size;
+        }
+    }
+#else
+    for (slot=0; slot<bucket_size; slot++) {
+        boolean same = true;
+        boolean empty = true;
+        int w;
+
+        for (w=0; w<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; w++) {
+            same = same && (keys[slot][w] == (*key)[w]);
+            empty = empty && (keys[slot][w] == ~((bitfield_of_64bits)0));
+        }
+        if (same || empty) {
+            return slot;
+        }
+    }
+#endif
+
+    return bucket_size;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_members
+ * Purpose:    List the contaminants in a set, visiting only set bits
+ * Parameters: words -> set
+ *             ids -> filled with contaminant numbers in increasing order
+ * Returns:    Number of contaminants in the set
+ *----------------------------------------------------------------------*/
+static int KERNEL(contaminant_set_members)(uint32_t* words, int* ids)
+{
+    int n = 0;
+    int i;
+
+    for (i=0; i<CONTAMINANT_SET_WORDS; i++) {
+        uint32_t word = words[i];
+
+        while (word) {
+            ids[n++] = (i * 32) + __builtin_ctz(word);
+            word &= word - 1;
+        }
+    }
+
+    return n;
+}
+
+#undef KERNEL
+#undef KERNEL_EXPAND
+#undef KERNEL_NAME
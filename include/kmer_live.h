@@ -0,0 +1,82 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_live.h                                                 *
+ * Purpose: Live stats published in a memory mapped file for monitors   *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef KMER_LIVE_H_
+#define KMER_LIVE_H_
+
+#define KMER_LIVE_MAGIC "KONTLIVE"
+#define KMER_LIVE_VERSION 1
+#define KMER_LIVE_FILENAME "live_stats.bin"
+#define KMER_LIVE_NAME_LENGTH 64
+#define KMER_LIVE_INTERVAL_MS 100
+
+// Segment state
+#define KMER_LIVE_RUNNING 1
+#define KMER_LIVE_FINISHED 2
+
+/*
+   Segment layout, native byte order: a KmerLiveHeader, n_contaminants
+   KmerLiveContaminants, then a copy of the sequence number. Every field
+   is 8 byte aligned. New fields are only ever added to the end of a
+   struct (with header_size/contaminant_size growing), anything else
+   changes the version.
+
+   The sequence number is odd while an update is being written. A reader
+   of the mapping loads it, copies what it wants, and loads it again; the
+   copy is good if both loads are the same even number. A reader of the
+   whole file (eg. the progress page) checks the leading number is even
+   and matches the trailing copy.
+ */
+typedef struct {
+    uint64_t number_of_reads;
+    uint64_t k1_contaminated_reads;
+    uint64_t kn_contaminated_reads;
+    uint64_t reads_unclassified;
+    uint64_t kmers_looked_up;
+} KmerLiveReadCounts;
+
+typedef struct {
+    char name[KMER_LIVE_NAME_LENGTH];
+    uint64_t library_kmers;
+    uint64_t kn_contaminated_reads[2];
+    uint64_t reads_with_highest_contaminant[2];
+    uint64_t contaminant_kmers_seen[2];
+    uint64_t threshold_passed_pairs;
+} KmerLiveContaminant;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t contaminant_size;
+    uint32_t n_contaminants;
+    uint64_t sequence;
+    uint32_t state;
+    uint32_t pid;
+    uint32_t number_of_files;
+    uint32_t kmer_threshold_read;
+    uint64_t updates;
+    double start_time;               // Seconds since the epoch
+    double update_time;
+    double elapsed;                  // Seconds since screening started
+    double reads_per_second;         // Since screening started
+    double recent_reads_per_second;  // Since the last update
+    double kmer_lookups_per_second;  // Since screening started
+    uint64_t pairs;
+    uint64_t threshold_passed_pairs;
+    uint64_t hash_lookups;           // Only counted with -T
+    uint64_t hash_hits;
+    uint64_t hash_slots_probed;
+    KmerLiveReadCounts read[2];
+} KmerLiveHeader;
+
+void kmer_live_start(char* filename, KmerStats* stats, CmdLine* cmd_line);
+void kmer_live_stop(void);
+
+#endif /* KMER_LIVE_H_ */
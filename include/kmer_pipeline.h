@@ -0,0 +1,22 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_pipeline.h                                             *
+ * Purpose: Pipelined screening of FASTQ and FASTA, filtering of FASTQ  *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef KMER_PIPELINE_H_
+#define KMER_PIPELINE_H_
+
+// Read pairs per batch passed between stages
+#define PIPELINE_BATCH_PAIRS 1024
+
+// Approximate bases per batch of FASTA windows
+#define PIPELINE_BATCH_BASES (4 * 1024 * 1024)
+
+long long screen_or_filter_pipeline(CmdLine* cmd_line, KmerFileReaderArgs* fra_1, KmerFileReaderArgs* fra_2, KmerStats* stats);
+long long screen_windows_pipeline(CmdLine* cmd_line, KmerFileReaderArgs* fra, KmerStats* stats);
+
+#endif /* KMER_PIPELINE_H_ */
@@ -18,6 +18,7 @@ typedef struct{
     boolean full_entry;
     FileFormat format;
     short kmer_size;
+    boolean long_reads;
 } KmerFileReaderWrapperArgs;
 
 typedef struct {
@@ -37,7 +38,18 @@ typedef struct {
     HashTable * KmerHash;
 } KmerFileReaderArgs;
 
-uint32_t load_kmer_library(char* filename, int n, int k, HashTable* contaminant_hash);
+void initialise_kmer_counts(int n, KmerCounts* counts);
+void reset_kmer_counts(int n, KmerCounts* counts);
+int kmer_counts_add_hit(KmerCounts* counts, Element* node, int* ids);
+KmerFileReaderWrapperArgs* get_kmer_file_reader_wrapper(short kmer_size, KmerFileReaderArgs* fra);
+int file_reader_wrapper(KmerFileReaderWrapperArgs* wargs);
+boolean subsample_keep_read(long int entry_number, double ratio);
+void initialise_hash_mutexes(void);
+void parallel_mutex_lock(pthread_mutex_t* lock);
+void element_get_and_increment_read_coverages(HashTable* hash_table, Element *node, int r, int* a, int* b);
+void write_read_summary(FILE* fp, char* name, int r, KmerCounts* counts, KmerStats* stats, CmdLine* cmd_line);
+void write_sequence_summary(FILE* fp, char* name, KmerCounts* counts, KmerStats* stats);
+uint32_t load_kmer_library(char* filename, int n, int k, HashTable* contaminant_hash, int shard, int n_shards);
 long long screen_kmers_from_file(KmerFileReaderArgs* fra, CmdLine* cmd_line, KmerStats* stats);
 long long screen_or_filter_paired_end(CmdLine* cmd_line, KmerFileReaderArgs* fra_1, KmerFileReaderArgs* fra_2, KmerStats* stats);
 long long screen_or_filter_parallel(CmdLine* cmd_line, KmerFileReaderArgs* fra_1, KmerFileReaderArgs* fra_2, KmerStats* stats);
@@ -0,0 +1,28 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_server.h                                               *
+ * Purpose: Serve screening/filtering jobs over a Unix domain socket    *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef KMER_SERVER_H_
+#define KMER_SERVER_H_
+
+// Limits on a job request from a client
+#define SERVER_MAX_JOB_ARGS 1024
+#define SERVER_MAX_JOB_STRING (64 * 1024)
+
+// Frame types sent from server to client
+#define SERVER_FRAME_OUTPUT 'O'
+#define SERVER_FRAME_EXIT 'X'
+
+// Called in a process of its own, with stdout going to the client and the
+// working directory set to the client's. Returns the job's exit status.
+typedef int (*KmerServerJob)(int argc, char* argv[], void* data);
+
+void kmer_server_run(char* socket_path, int max_jobs, KmerServerJob job, void* data);
+int kmer_client_run(char* socket_path, int argc, char* argv[]);
+
+#endif /* KMER_SERVER_H_ */
@@ -0,0 +1,30 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_shard.h                                                *
+ * Purpose: Hash partitioned contaminant index, screened shard by shard *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef KMER_SHARD_H_
+#define KMER_SHARD_H_
+
+#define SHARD_COUNTS_MAGIC "KONTSHRD"
+#define SHARD_COUNTS_VERSION 2
+#define MAX_SHARDS 1024
+
+// Per-read record states in a counts file
+#define SHARD_READ_ABSENT 0
+#define SHARD_READ_NO_KMERS 1
+#define SHARD_READ_COUNTED 2
+#define SHARD_END 255
+
+int kmer_shard_of_key(Key key, int n_shards);
+void kmer_shard_library_filename(char* filename, char* dir, char* contaminant, CmdLine* cmd_line);
+FILE* kmer_shard_open_counts(CmdLine* cmd_line, KmerStats* stats, int number_of_files);
+void kmer_shard_write_read(FILE* fp, int state, KmerCounts* counts, int n_contaminants);
+void kmer_shard_close_counts(FILE* fp, KmerStats* stats);
+void kmer_shard_combine_files(int n_files, char** filenames, KmerStats* stats, CmdLine* cmd_line);
+
+#endif /* KMER_SHARD_H_ */
@@ -0,0 +1,19 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_snapshot.h                                             *
+ * Purpose: Binary snapshots of screening stats, and merging them       *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef KMER_SNAPSHOT_H_
+#define KMER_SNAPSHOT_H_
+
+#define SNAPSHOT_MAGIC "KONTSNAP"
+#define SNAPSHOT_VERSION 2
+
+void kmer_snapshot_write(char* filename, HashTable* hash, KmerStats* stats, CmdLine* cmd_line);
+void kmer_snapshot_merge_files(int n_files, char** filenames, HashTable* hash, KmerStats* stats, CmdLine* cmd_line);
+
+#endif /* KMER_SNAPSHOT_H_ */
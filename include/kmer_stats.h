@@ -31,8 +31,13 @@ typedef struct {
     uint32_t species_unclassified;
     double   species_unclassified_pc;
     
-    // Coverage histogram
-    uint32_t contaminated_kmers_per_read[MAX_READ_LENGTH];
+    // Coverage histogram - last element counts reads/contigs with
+    // MAX_READ_LENGTH or more contaminated kmers, so long reads can't
+    // index past the end
+    uint32_t contaminated_kmers_per_read[MAX_READ_LENGTH + 1];
+
+    // Kmers looked up in the contaminant table, for lookup rates
+    uint64_t kmers_looked_up;
 
     // For parallel access
     pthread_mutex_t lock;
@@ -85,6 +90,7 @@ typedef struct {
     uint32_t contaminant_kmers[MAX_CONTAMINANTS];
     uint32_t unique_kmers[MAX_CONTAMINANTS];
     uint32_t kmers_in_common[MAX_CONTAMINANTS][MAX_CONTAMINANTS];
+    boolean contaminants_counted;
     uint32_t number_of_files;
     KmerStatsReadCounts* read[2];
     KmerStatsBothReads* both_reads;
@@ -96,9 +102,14 @@ typedef struct {
 typedef struct {
     uint32_t n_contaminants;
     uint32_t kmers_loaded;
+    uint32_t kmers_looked_up;
     uint32_t contaminants_detected;
     uint32_t kmers_from_contaminant[MAX_CONTAMINANTS];
     uint32_t unique_kmers_from_contaminant[MAX_CONTAMINANTS];
+    // Contaminants with non-zero counts, laid out as an element's
+    // contaminant bits, so a read's counts can be cleared without
+    // touching every contaminant
+    uint32_t detected_set[CONTAMINANT_SET_WORDS];
     uint32_t assigned_contaminant;
     uint32_t unique_assigned_contaminant;
 
@@ -112,6 +123,9 @@ void update_stats(int r, KmerCounts* counts, KmerStats* stats, CmdLine* cmd_line
 void update_stats_parallel(int r, KmerCounts* counts, KmerStats* stats, CmdLine* cmd_line);
 boolean update_stats_for_both(KmerStats* stats, CmdLine* cmd_line, KmerCounts* counts_a, KmerCounts* counts_b);
 boolean update_stats_for_both_parallel(KmerStats* stats, CmdLine* cmd_line, KmerCounts* counts_a, KmerCounts* counts_b);
+boolean kmer_stats_read_is_decided(KmerCounts* counts, KmerCounts* mate, int kmers_remaining, CmdLine* cmd_line);
 void kmer_stats_report_to_screen(KmerStats* stats, CmdLine* cmd_line);
+void kmer_stats_count_contaminant_kmers(HashTable* hash, KmerStats* stats);
 void kmer_stats_compare_contaminant_kmers(HashTable* hash, KmerStats* stats, CmdLine* cmd_line);
+void kmer_stats_write_contaminant_comparison(KmerStats* stats, CmdLine* cmd_line);
 void kmer_stats_write_progress(KmerStats* stats, CmdLine* cmd_line);
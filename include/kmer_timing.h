@@ -0,0 +1,40 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_timing.h                                               *
+ * Purpose: Per-phase timing and resource accounting                    *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef KMER_TIMING_H_
+#define KMER_TIMING_H_
+
+#define KMER_TIMING_NAME_LENGTH 256
+
+// Resource counters at one moment. Bytes are -1 if /proc/self/io
+// can't be read.
+typedef struct {
+    double wall;
+    double cpu;
+    long long peak_rss;
+    long long bytes_read;
+    long long bytes_written;
+} KmerTimingSample;
+
+typedef struct {
+    char name[KMER_TIMING_NAME_LENGTH];
+    KmerTimingSample start;
+    KmerTimingSample end;
+    long long reads;
+    long long lookups;
+} KmerTimingPhase;
+
+void kmer_timing_initialise(void);
+double kmer_timing_elapsed(void);
+void kmer_timing_start(char* name);
+void kmer_timing_end(long long reads, long long lookups);
+void kmer_timing_report_to_screen(void);
+void kmer_timing_write_json(char* filename);
+
+#endif /* KMER_TIMING_H_ */
@@ -0,0 +1,33 @@
+/*----------------------------------------------------------------------*
+ * File:    numa_layout.h                                               *
+ * Purpose: NUMA placement of the contaminant table and worker pinning  *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef NUMA_LAYOUT_H_
+#define NUMA_LAYOUT_H_
+
+#define NUMA_MAX_NODES 64
+#define NUMA_MAX_CPUS 1024
+
+// Table placement policies
+#define NUMA_POLICY_NONE 0
+#define NUMA_POLICY_INTERLEAVE 1
+#define NUMA_POLICY_REPLICATE 2
+
+// Node argument to numa_layout_place_memory meaning all nodes
+#define NUMA_ALL_NODES -1
+
+boolean numa_layout_parse_options(char* string, int* policy, boolean* pin);
+void numa_layout_initialise(int policy, boolean pin);
+void numa_layout_report(void);
+int numa_layout_number_of_nodes(void);
+boolean numa_layout_place_memory(void* address, size_t bytes, int node);
+int numa_layout_pin_worker(int worker);
+void numa_layout_replicate_table(HashTable* hash);
+HashTable* numa_layout_local_table(HashTable* hash);
+
+#endif /* NUMA_LAYOUT_H_ */
@@ -0,0 +1,43 @@
+/*----------------------------------------------------------------------*
+ * File:    read_cache.h                                                *
+ * Purpose: Cache of kmer counts for repeated read sequences            *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef READ_CACHE_H_
+#define READ_CACHE_H_
+
+// Entries per set. A new pair replaces the least recently used entry of
+// its set.
+#define READ_CACHE_WAYS 4
+
+// Key is a 128 bit hash of each read in the pair
+#define READ_CACHE_KEY_WORDS 4
+
+typedef struct {
+    uint64_t key[READ_CACHE_KEY_WORDS];
+    uint32_t last_used;
+    boolean valid;
+    KmerCounts counts[2];
+} ReadCacheEntry;
+
+typedef struct {
+    ReadCacheEntry* entries;
+    uint64_t number_sets;
+    uint64_t set_mask;
+    uint32_t clock;
+    long int hits;
+    long int misses;
+    long int evictions;
+} ReadCache;
+
+void read_cache_hash_sequence(char* seq, int length, uint64_t* hash);
+ReadCache* read_cache_new(int megabytes);
+void read_cache_free(ReadCache** cache);
+KmerCounts* read_cache_find(ReadCache* cache, uint64_t* key);
+void read_cache_add(ReadCache* cache, uint64_t* key, KmerCounts* counts_a, KmerCounts* counts_b);
+
+#endif /* READ_CACHE_H_ */
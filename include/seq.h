@@ -57,6 +57,13 @@ typedef struct
    
 } Sequence;
 
+//growable buffer of raw entries
+typedef struct{
+    char * data;
+    size_t length;
+    size_t capacity;
+} SequenceBuffer;
+
 typedef struct{
     void (* header_parser)(Sequence * seq); 
     char * (* get_index)(Sequence * seq); 
@@ -92,8 +99,19 @@ void  print_stats(FILE * f, SequenceStats * total );
 //that means we can only read full fastq entries
 int read_sequence_from_fastq(FILE * fp, Sequence * seq, int max_read_length);
 
+//reads a whole fastq entry without parsing it, optionally copying it, returns the sequence length, 0 at the end of the file or -1 if it isn't well formed
+int scan_sequence_from_fastq(FILE * fp, SequenceBuffer * copy);
+
+//skips a fastq entry, only scanning it if it is well formed, returns the sequence length or 0 at the end of the file
+int skip_sequence_from_fastq(FILE * fp, Sequence * seq, int max_read_length);
+
+//parses one fastq entry copied by scan_sequence_from_fastq, returns the sequence length or 0 for a bad read
+int read_sequence_from_fastq_buffer(char * data, size_t length, Sequence * seq, int max_read_length);
+void sequence_buffer_reserve(SequenceBuffer * buffer, size_t extra);
+
 //this routine can read long sequences (eg full chromosomes) , this is implemented by reading the sequence in chunks
 int read_sequence_from_fasta(FILE * fp, Sequence * seq, int max_chunk_length, boolean new_entry, boolean * full_entry, int offset);
+int read_sequence_from_fastq_chunk(FILE * fp, Sequence * seq, int max_chunk_length, boolean new_entry, boolean * full_entry, int offset);
 
 //Reads a sequnece file and a qualities file
 int read_sequence_from_fasta_and_qual(FILE * fp, FILE * fq, Sequence * seq, int max_read_length);
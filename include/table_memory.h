@@ -0,0 +1,42 @@
+/*----------------------------------------------------------------------*
+ * File:    table_memory.h                                              *
+ * Purpose: Huge page backed, pre-faulted memory for large tables       *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef TABLE_MEMORY_H_
+#define TABLE_MEMORY_H_
+
+// How the memory behind a table was obtained
+#define TABLE_MEMORY_MALLOC 0
+#define TABLE_MEMORY_THP 1
+#define TABLE_MEMORY_HUGETLB 2
+#define TABLE_MEMORY_MMAP 3
+
+// Node argument to table_memory_alloc_on_node meaning no NUMA policy
+#define TABLE_MEMORY_ANY_NODE -2
+
+#define TABLE_MEMORY_PAGE_SIZE 4096
+#define TABLE_MEMORY_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+
+typedef struct {
+    int mode;
+    boolean prefault;
+    boolean lock;
+    boolean interleave;
+    int threads;
+} TableMemoryOptions;
+
+void table_memory_set_options(TableMemoryOptions* options);
+TableMemoryOptions* table_memory_get_options(void);
+boolean table_memory_parse_options(char* string, TableMemoryOptions* options);
+void* table_memory_alloc(size_t bytes, int* mode, size_t* mapped_bytes);
+void* table_memory_alloc_on_node(size_t bytes, int node, int* mode, size_t* mapped_bytes);
+void table_memory_free(void* address, size_t mapped_bytes, int mode);
+char* table_memory_mode_name(int mode);
+size_t table_memory_hugetlb_available(void);
+
+#endif /* TABLE_MEMORY_H_ */
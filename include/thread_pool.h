@@ -0,0 +1,46 @@
+/*----------------------------------------------------------------------*
+ * File:    thread_pool.h                                               *
+ * Purpose: Persistent pool of threads for whole table scans            *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+#ifndef THREAD_POOL_H_
+#define THREAD_POOL_H_
+
+#define THREAD_POOL_MAX_THREADS 64
+
+// Called once on each thread of the pool, thread 0 being the caller
+typedef void (*ThreadPoolTask)(int thread, int number_of_threads, void* data);
+
+// Passed to each worker as it starts
+typedef struct {
+    struct ThreadPool* pool;
+    int thread;
+} ThreadPoolWorker;
+
+typedef struct ThreadPool {
+    int number_of_threads;
+    pthread_t* workers;
+    ThreadPoolWorker* worker_args;
+    pthread_mutex_t lock;
+    pthread_mutex_t run_lock;
+    pthread_cond_t work_ready;
+    pthread_cond_t work_done;
+    ThreadPoolTask task;
+    void* data;
+    long long generation;
+    int busy;
+    boolean stop;
+} ThreadPool;
+
+ThreadPool* thread_pool_new(int number_of_threads);
+void thread_pool_run(ThreadPool* pool, ThreadPoolTask task, void* data);
+void thread_pool_free(ThreadPool** pool);
+void thread_pool_initialise_shared(int number_of_threads);
+ThreadPool* thread_pool_shared(void);
+void thread_pool_reset_after_fork(void);
+
+#endif /* THREAD_POOL_H_ */
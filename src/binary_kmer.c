@@ -37,6 +37,7 @@
 #include <binary_kmer.h>
 #include <global.h>
 #include <string.h>
+#include <kmer_kernels.h>
 
 void binary_kmer_initialise_to_zero(BinaryKmer * bkmer)
 {
@@ -547,6 +548,18 @@ int get_sliding_windows_from_sequence(char * seq,  char * qualities, int length,
         return 0;
     }
     
+    //bases to Nucleotides for the whole sequence at once
+    if (windows->codes_capacity < length){
+        windows->codes = realloc(windows->codes, length);
+        if (windows->codes == NULL){
+            fputs("Out of memory trying to allocate sliding window base codes\n",stderr);
+            exit(1);
+        }
+        windows->codes_capacity = length;
+    }
+    uint8_t * codes = windows->codes;
+    kmer_kernels.encode_bases(seq, length, codes);
+    
     int index_windows = 0;
     
     //loop over the bases in the sequence
@@ -567,7 +580,7 @@ int get_sliding_windows_from_sequence(char * seq,  char * qualities, int length,
                 hom_ct=1;
             }
             
-            if ((char_to_binary_nucleotide(seq[i]) == Undefined) || 
+            if ((codes[i] == Undefined) || 
                 (quality_cut_off>0 && qualities[i]<= quality_cut_off)){
                 j=0; //restart the first kmer 
             }else if ( (break_homopolymers==true) && (hom_ct>=homopolymer_cutoff) ){
@@ -603,42 +616,52 @@ int get_sliding_windows_from_sequence(char * seq,  char * qualities, int length,
             seq_to_binary_kmer(first_kmer,kmer_size, &tmp_bin_kmer);
             binary_kmer_assignment_operator(current_window->kmer[index_kmers] , tmp_bin_kmer);
             
-            //do the rest --
+            //do the rest -- find the run of good bases, then add its kmers in one go
             index_kmers++;
             
-            while(i<length){
-                if (index_kmers>=max_kmers){
-                    fputs("number of kmers is bigger than max_kmers in get_sliding_windows_from_sequence - second check\n",stderr);
-                    assert(false);
-                    exit(1);
-                }
-                Nucleotide current_base = char_to_binary_nucleotide(seq[i]);
+            int run = 0;
+            boolean bad_base = false;
+            boolean homopolymer = false;
+            while (i + run < length){
+                int p = i + run;
                 
-                if ( (i>0) && (seq[i] == seq[i-1]) ){
+                if ( (p>0) && (seq[p] == seq[p-1]) ){
                     hom_ct++;
                 }else{
                     hom_ct=1;
                 }
                 
-                if ((current_base == Undefined) ||
-                    (quality_cut_off!=0 && qualities[i]<= quality_cut_off)){
-                    i++; 
+                if ((codes[p] == Undefined) ||
+                    (quality_cut_off!=0 && qualities[p]<= quality_cut_off)){
+                    bad_base = true;
                     break;
                 }else if ( (break_homopolymers==true) && (hom_ct>=homopolymer_cutoff) ){
-                    //now we may be in the middle of a very long homopolymer run.So we want to increment i sufficiently to go beyond         
-                    int first_base_after_homopolymer=i;
-                    while ( (first_base_after_homopolymer<length) && (seq[first_base_after_homopolymer]==seq[i]) ){
-                        first_base_after_homopolymer++;
-                    }
-                    i=first_base_after_homopolymer; 
+                    homopolymer = true;
                     break;
                 }
-                //set the kmer to previous
-                binary_kmer_assignment_operator(current_window->kmer[index_kmers], current_window->kmer[index_kmers-1]);
-                binary_kmer_left_shift_one_base_and_insert_new_base_at_right_end(&(current_window->kmer[index_kmers]), current_base, kmer_size);
-                index_kmers++;
-                count_kmers++;
+                run++;
+            }
+            
+            if (index_kmers + run > max_kmers){
+                fputs("number of kmers is bigger than max_kmers in get_sliding_windows_from_sequence - second check\n",stderr);
+                assert(false);
+                exit(1);
+            }
+            
+            kmer_kernels.roll_kmers(&(current_window->kmer[index_kmers-1]), &(codes[i]), run, kmer_size);
+            index_kmers += run;
+            count_kmers += run;
+            i += run;
+            
+            if (bad_base){
                 i++;
+            }else if (homopolymer){
+                //now we may be in the middle of a very long homopolymer run.So we want to increment i sufficiently to go beyond         
+                int first_base_after_homopolymer=i;
+                while ( (first_base_after_homopolymer<length) && (seq[first_base_after_homopolymer]==seq[i]) ){
+                    first_base_after_homopolymer++;
+                }
+                i=first_base_after_homopolymer; 
             }
             current_window->nkmers = index_kmers; 
             index_windows++;
@@ -1069,6 +1092,8 @@ void binary_kmer_alloc_kmers_set(KmerSlidingWindowSet * windows,
 		exit(1);
 	}
 	windows->nwindows = 0;
+	windows->codes = NULL;
+	windows->codes_capacity = 0;
 	
 	//allocate memory for every every sliding window
 	int w;
@@ -1106,6 +1131,7 @@ void binary_kmer_free_kmers_set(KmerSlidingWindowSet * *kmers_set)
 	}
 	
 	free((*kmers_set)->window);
+	free((*kmers_set)->codes);
 	free(*kmers_set);
 	*kmers_set = NULL;
 }
@@ -0,0 +1,261 @@
+/*----------------------------------------------------------------------*
+ * File:    bloom_filter.c                                              *
+ * Purpose: Blocked Bloom filter prefilter for the contaminant table   *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Most read kmers miss the contaminant table, and every miss walks a
+   whole bucket. The filter below answers "definitely not present" from
+   a single cache line: a kmer hashes to one 64 byte block and sets one
+   bit in each of the block's 8 words (a split block Bloom filter).
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "bloom_filter.h"
+
+// Odd multipliers used to pick a bit within each word of a block
+static const uint32_t bloom_salt[BLOOM_WORDS_PER_BLOCK] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_hash
+ * Purpose:    64 bit hash of a kmer key, independent of the hashes used
+ *             to choose table buckets and shards.
+ * Parameters: key -> kmer key
+ * Returns:    hash value
+ *----------------------------------------------------------------------*/
+static inline uint64_t bloom_filter_hash(Key key)
+{
+    // Not the shard seed, or a shard's kmers would all share a few blocks
+    uint64_t h = 0xD6E8FEB86659FD93ULL;
+    int i;
+
+    for (i=0; i<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; i++) {
+        h ^= (*key)[i];
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+    }
+
+    return h;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_new
+ * Purpose:    Allocate an empty filter
+ * Parameters: expected_kmers = number of kmers that will be added
+ *             bits_per_kmer = filter bits to allow per kmer
+ * Returns:    Pointer to filter
+ *----------------------------------------------------------------------*/
+BloomFilter* bloom_filter_new(uint64_t expected_kmers, int bits_per_kmer)
+{
+    BloomFilter* filter = calloc(1, sizeof(BloomFilter));
+    uint64_t blocks_needed = ((expected_kmers * bits_per_kmer) + 511) / 512;
+    void* memory = NULL;
+
+    if (!filter) {
+        printf("Error: can't allocate memory for Bloom filter\n");
+        exit(1);
+    }
+
+    // Round up to a power of two so a block can be picked with a mask
+    filter->number_blocks = 1;
+    while (filter->number_blocks < blocks_needed) {
+        filter->number_blocks <<= 1;
+    }
+    filter->block_mask = filter->number_blocks - 1;
+
+    if (posix_memalign(&memory, sizeof(BloomBlock), filter->number_blocks * sizeof(BloomBlock)) != 0) {
+        printf("Error: can't allocate %llu bytes for Bloom filter\n", (unsigned long long)(filter->number_blocks * sizeof(BloomBlock)));
+        exit(1);
+    }
+    memset(memory, 0, filter->number_blocks * sizeof(BloomBlock));
+    filter->blocks = memory;
+
+    return filter;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_free
+ * Purpose:    Free a filter
+ * Parameters: filter -> pointer to filter pointer, set to NULL
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void bloom_filter_free(BloomFilter** filter)
+{
+    if (*filter) {
+        free((*filter)->blocks);
+        free(*filter);
+        *filter = NULL;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_add
+ * Purpose:    Add a kmer to the filter
+ * Parameters: filter -> filter
+ *             key -> kmer key
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void bloom_filter_add(BloomFilter* filter, Key key)
+{
+    uint64_t h = bloom_filter_hash(key);
+    BloomBlock* block = &(filter->blocks[(h >> 32) & filter->block_mask]);
+    uint32_t lo = (uint32_t)h;
+    int i;
+
+    for (i=0; i<BLOOM_WORDS_PER_BLOCK; i++) {
+        block->words[i] |= 1ULL << ((lo * bloom_salt[i]) >> 26);
+    }
+
+    filter->number_kmers++;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_may_contain
+ * Purpose:    Check if a kmer could be in the filter
+ * Parameters: filter -> filter
+ *             key -> kmer key
+ * Returns:    false if the kmer is definitely absent, true otherwise
+ *----------------------------------------------------------------------*/
+boolean bloom_filter_may_contain(BloomFilter* filter, Key key)
+{
+    uint64_t h = bloom_filter_hash(key);
+    BloomBlock* block = &(filter->blocks[(h >> 32) & filter->block_mask]);
+    uint32_t lo = (uint32_t)h;
+    uint64_t missing = 0;
+    int i;
+
+    for (i=0; i<BLOOM_WORDS_PER_BLOCK; i++) {
+        missing |= ~block->words[i] & (1ULL << ((lo * bloom_salt[i]) >> 26));
+    }
+
+    return missing == 0 ? true : false;
+}
+
+// Per thread state while a filter is built from a table
+typedef struct {
+    BloomFilter* filter;
+    uint64_t number_kmers;
+} BloomFilterBuilder;
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_new_builder
+ * Purpose:    Traverse callback to create one thread's builder
+ * Parameters: block = block of table being added
+ *             data -> filter
+ * Returns:    Pointer to builder
+ *----------------------------------------------------------------------*/
+static void* bloom_filter_new_builder(int block, void* data)
+{
+    BloomFilterBuilder* builder = malloc(sizeof(BloomFilterBuilder));
+
+    if (!builder) {
+        printf("Error: can't allocate memory for Bloom filter\n");
+        exit(1);
+    }
+
+    builder->filter = (BloomFilter*)data;
+    builder->number_kmers = 0;
+
+    return builder;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_add_element
+ * Purpose:    Traverse callback to add a table element to the filter.
+ *             As bloom_filter_add, but other threads are setting bits in
+ *             the same words, so each word is updated atomically.
+ * Parameters: e -> element
+ *             data -> this thread's builder
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void bloom_filter_add_element(Element* e, void* data)
+{
+    BloomFilterBuilder* builder = (BloomFilterBuilder*)data;
+    uint64_t h = bloom_filter_hash(element_get_kmer(e));
+    BloomBlock* block = &(builder->filter->blocks[(h >> 32) & builder->filter->block_mask]);
+    uint32_t lo = (uint32_t)h;
+    int i;
+
+    for (i=0; i<BLOOM_WORDS_PER_BLOCK; i++) {
+        __atomic_fetch_or(&(block->words[i]), 1ULL << ((lo * bloom_salt[i]) >> 26), __ATOMIC_RELAXED);
+    }
+
+    builder->number_kmers++;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_reduce_builder
+ * Purpose:    Traverse callback to add one thread's kmer count
+ * Parameters: accumulator -> builder, freed
+ *             data -> filter
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void bloom_filter_reduce_builder(void* accumulator, void* data)
+{
+    BloomFilterBuilder* builder = (BloomFilterBuilder*)accumulator;
+
+    ((BloomFilter*)data)->number_kmers += builder->number_kmers;
+    free(builder);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_new_from_hash_table
+ * Purpose:    Build a filter holding every kmer currently in the table
+ * Parameters: hash_table -> table
+ *             bits_per_kmer = filter bits to allow per kmer
+ * Returns:    Pointer to filter
+ *----------------------------------------------------------------------*/
+BloomFilter* bloom_filter_new_from_hash_table(HashTable* hash_table, int bits_per_kmer)
+{
+    BloomFilter* filter = bloom_filter_new(hash_table_get_unique_kmers(hash_table), bits_per_kmer);
+
+    hash_table_parallel_traverse(bloom_filter_add_element, bloom_filter_new_builder, bloom_filter_reduce_builder, filter, hash_table);
+
+    return filter;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   bloom_filter_false_positive_rate
+ * Purpose:    Estimate false positive rate from the fraction of bits set
+ * Parameters: filter -> filter
+ * Returns:    Estimated probability that an absent kmer passes
+ *----------------------------------------------------------------------*/
+double bloom_filter_false_positive_rate(BloomFilter* filter)
+{
+    uint64_t i;
+    uint64_t bits_set = 0;
+    double fill;
+    double rate = 1.0;
+    int j;
+
+    for (i=0; i<filter->number_blocks; i++) {
+        for (j=0; j<BLOOM_WORDS_PER_BLOCK; j++) {
+            bits_set += __builtin_popcountll(filter->blocks[i].words[j]);
+        }
+    }
+
+    fill = (double)bits_set / (double)(filter->number_blocks * BLOOM_WORDS_PER_BLOCK * 64);
+    for (j=0; j<BLOOM_WORDS_PER_BLOCK; j++) {
+        rate *= fill;
+    }
+
+    return rate;
+}
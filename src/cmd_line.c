@@ -22,8 +22,12 @@
 #include "element.h"
 #include "hash_table.h"
 #include "cmd_line.h"
+#include "cmd_line_options.h"
 #include "kmer_stats.h"
 #include "kmer_reader.h"
+#include "kmer_shard.h"
+#include "table_memory.h"
+#include "numa_layout.h"
 
 /*----------------------------------------------------------------------*
  * Function:
@@ -63,6 +67,29 @@ void initialise_cmdline(CmdLine* c)
     c->filter_unique = false;
     c->numthreads = 1;
     c->ratio = 1.0;
+    c->early_exit = false;
+    c->bloom_bits = 0;
+    c->pipeline = false;
+    c->pipeline_parse_threads = 0;
+    c->pipeline_lookup_threads = 0;
+    c->window_size = 10000;
+    c->long_reads = false;
+    c->dedup_cache_mb = 0;
+    c->server_socket = 0;
+    c->client_socket = 0;
+    c->max_jobs = 4;
+    c->snapshot_file = 0;
+    c->n_merge_files = 0;
+    c->merge_files = 0;
+    c->n_shards = 1;
+    c->shard = 0;
+    c->table_memory_mode = TABLE_MEMORY_MALLOC;
+    c->table_prefault = false;
+    c->table_lock = false;
+    c->numa_policy = NUMA_POLICY_NONE;
+    c->numa_pin = false;
+    c->split_keys = false;
+    c->lookup_stats = false;
 }
 
 /*----------------------------------------------------------------------*
@@ -74,39 +101,104 @@ void initialise_cmdline(CmdLine* c)
 void usage(void)
 {
     printf("k-mer based screening and filtering of reads\n" \
-           "\nSyntax: kontaminant <-s|-f|-i> [options]\n" \
+           "\nSyntax: kontaminant <-s|-f|-i|-S> [options]\n" \
+           "        kontaminant -M [options] <snapshot> [<snapshot> ...]\n" \
+           "        kontaminant -Q [options] <shard counts> [<shard counts> ...]\n" \
            "\nWhere:\n" \
            "    [-s | --screen] invokes screening.\n" \
            "    [-f | --filter] invokes filtering.\n" \
            "    [-i | --index] indexes a reference.\n" \
+           "    [-S | --server] <socket> loads contaminants once and serves screening/filtering jobs on a Unix socket.\n" \
+           "    [-M | --merge] merges stats snapshots written with -K and reports, with the kmer similarity files (use -n/-b to size table for seen kmers).\n" \
+           "    [-Q | --combine] combines the counts files from screening each shard of an index with -I, and reports, with the kmer similarity files.\n" \
            "Kmer options:\n" \
            "    [-k | --kmer_size] Kmer size (default 21).\n" \
            "    [-t | --threshold] Kmer threshold for both reads (default 10).\n" \
            "    [-l | --readthreshold] Kmer threshold for individual reads (default 1).\n" \
            "    [-y | --subsample] Ratio of reads to sample >0 <=1 (default 1).\n" \
            "    [-u | --unique] Count only unique kmers (default off).\n" \
+           "    [-E | --early_exit] Stop looking up a read's kmers once its classification is fixed (default off).\n" \
+           "Threading options:\n" \
+           "    [-N | --numthreads] Number of threads (default 1).\n" \
+           "    [-P | --pipeline] Use pipelined engine, 'auto' to balance parse/lookup threads within -N, or parse:lookup counts.\n" \
+           "    [-D | --dedup_cache] MB per lookup thread to cache counts of repeated read pairs (default 0 = off, implies -P auto).\n" \
+           "Server options:\n" \
+           "    [-C | --client] <socket> Run this screening/filtering job on a server (contaminants, -k and the table, so -A -b -B -H -I -n -U -Y, come from the server).\n" \
+           "    [-J | --max_jobs] Maximum jobs the server runs at once (default 4).\n" \
            "Input options:\n" \
            "    [-1 | --input_one] Input R1 file (or reference FASTA for indexing).\n" \
            "    [-2 | --input_two] Input R2 file.\n" \
            "    [-g | --file_format] Input file format FASTA or FASTQ (default FASTQ).\n" \
            "    [-z | --file_of_files] Input file of files (for batch processing - instead of -1 and -2).\n" \
+           "    [-m | --max_read_length] Maximum read length (default 200000, not needed with -L).\n" \
+           "    [-L | --long_reads] Stream FASTQ long reads in windows, classifying each window (default off).\n" \
+           "    [-W | --window_size] Window size in bases for FASTA with -N or -P, and for -L (default 10000).\n" \
            "Output options:\n" \
            "    [-j | --read_summary] Read summary file.\n" \
+           "    [-K | --snapshot] Write binary snapshot of stats, for merging with -M.\n" \
            "    [-o | --output_prefix] Output prefix (default: 'kout_').\n" \
-           "    [-p | --progress] Name of directory for streaming progress page.\n"
+           "    [-p | --progress] Directory for live stats (live_stats.bin), progress text files and the streaming progress page.\n"
            "    [-r | --removed_prefix] Removed reads prefix (filtering only).\n" \
+           "    [-T | --lookup_stats] Count hash table lookups, slots probed and buckets searched, and report them with bucket fill (default off).\n" \
            "    [-x | --keep_contaminated_reads] Save contaminated reads into separate file.\n" \
            "Contaminant options:\n" \
            "    [-d | --contaminant_dir] Contaminant library directory.\n" \
            "    [-c | --contaminants] List of contaminants to screen/filter, OR\n" \
            "    [-e | --contaminants_file] Filename of file containing list of contaminants to screen/filer.\n" \
+           "    [-H | --shards] Number of shards to split index into by kmer hash, for indexing, or for screening with -I (default 1).\n" \
+           "    [-I | --shard] Screen against only this shard (1 to -H) and write per-read counts to <prefix>shard<I>of<H>.counts.\n" \
            "Memory options:\n" \
+           "    [-A | --alloc] Hash table memory: malloc, thp or hugetlb, optionally with ,prefault (using -N threads) and ,lock (default malloc).\n" \
            "    [-b | --mem_width] Size of hash table buckets (default 100).\n" \
            "    [-n | --mem_height] Number of buckets in hash table in bits (default 20, this is a power of 2, ie 2^mem_height).\n" \
+           "    [-U | --numa] Place hash table 'interleave'd across NUMA nodes or 'replicate' it on each node, and/or 'pin' workers, eg. replicate,pin.\n" \
+           "    [-Y | --split_keys] Search a separate cache line aligned array of keys, not the packed table (default off, try with -b 8).\n" \
+           "    [-B | --bloom_bits] Bits per kmer for a Bloom filter checked before the hash table (default 0 = off, try 16).\n" \
            "\nComments/suggestions to richard.leggett@tgac.ac.uk\n" \
            "\n");
 }
 
+/*----------------------------------------------------------------------*
+ * Function:   find_command_line_option
+ * Purpose:    Look for any of some options the way parse_command_line
+ *             would see them (so -Cvalue and --client=value count too),
+ *             without reporting errors or changing argv.
+ * Parameters: argc = number of arguments
+ *             argv -> array of arguments
+ *             options -> short option characters to look for
+ *             value -> set to the option's argument, if not NULL
+ * Returns:    First option found, or 0 if none
+ *----------------------------------------------------------------------*/
+int find_command_line_option(int argc, char* argv[], char* options, char** value)
+{
+    char** args = malloc((argc + 1) * sizeof(char*));
+    int found = 0;
+    int opt;
+
+    if (!args) {
+        printf("Error: can't allocate memory for arguments\n");
+        exit(1);
+    }
+
+    // getopt_long reorders its argv, so scan a copy
+    memcpy(args, argv, (argc + 1) * sizeof(char*));
+    opterr = 0;
+    optind = 0;
+    while ((found == 0) && ((opt = getopt_long(argc, args, CMD_LINE_SHORT_OPTIONS, cmd_line_long_options, NULL)) > 0)) {
+        if (strchr(options, opt) != NULL) {
+            found = opt;
+            if (value != NULL) {
+                *value = optarg;
+            }
+        }
+    }
+    free(args);
+    opterr = 1;
+    optind = 0;
+
+    return found;
+}
+
 /*----------------------------------------------------------------------*
  * Function:   parse_command_line
  * Purpose:    Parse command line options
@@ -116,45 +208,16 @@ void usage(void)
  *----------------------------------------------------------------------*/
 void parse_command_line(int argc, char* argv[], CmdLine* c)
 {
-    static struct option long_options[] = {
-        {"input_one", required_argument, NULL, '1'},
-        {"input_two", required_argument, NULL, '2'},
-        {"mem_width", required_argument, NULL, 'b'},
-        {"contaminants", required_argument, NULL, 'c'},
-        {"contaminant_dir", required_argument, NULL, 'd'},
-        {"contaminants_file", required_argument, NULL, 'e'},
-        {"filter", no_argument, NULL, 'f'},
-        {"file_format", required_argument, NULL, 'g'},
-        {"help", no_argument, NULL, 'h'},
-        {"index", no_argument, NULL, 'i'},
-        {"read_summary", required_argument, NULL, 'j'},
-        {"kmer_size", required_argument, NULL, 'k'},
-        {"readthreshold", required_argument, NULL, 'l'},
-        {"mem_height", required_argument, NULL, 'n'},
-        {"mem_height", required_argument, NULL, 'n'},
-        {"numthreads", required_argument, NULL, 'N'},
-        {"output_prefix", required_argument, NULL, 'o'},
-        {"progress", required_argument, NULL, 'p'},
-        {"removed_prefix", required_argument, NULL, 'r'},
-        {"ratio", required_argument, NULL, 'R'},
-        {"screen", no_argument, NULL, 's'},
-        {"threshold", required_argument, NULL, 't'},
-        {"unique", no_argument, NULL, 'u'},
-        {"progress_interval", required_argument, NULL, 'w'},
-        {"keep_contaminated_reads", no_argument, NULL, 'x'},
-        {"subsample", required_argument, NULL, 'y'},
-        {"file_of_files", required_argument, NULL, 'z'},
-        {0, 0, 0, 0}
-    };
     int opt;
     int longopt_index;
+    TableMemoryOptions table_options;
     
     if (argc == 1) {
         usage();
         exit(0);
     }
     
-    while ((opt = getopt_long(argc, argv, "1:2:b:c:d:e:fg:hij:k:l:n:N:o:p:r:R:st:uw:xy:z:", long_options, &longopt_index)) > 0)
+    while ((opt = getopt_long(argc, argv, CMD_LINE_SHORT_OPTIONS, cmd_line_long_options, &longopt_index)) > 0)
     {
         switch(opt) {
             case '1':
@@ -183,6 +246,15 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                     exit(1);
                 }
                 break;
+            case 'A':
+                if ((optarg == NULL) || (!table_memory_parse_options(optarg, &table_options))) {
+                    printf("Error: [-A | --alloc] option requires malloc, thp or hugetlb, optionally followed by ,prefault and/or ,lock.\n");
+                    exit(1);
+                }
+                c->table_memory_mode = table_options.mode;
+                c->table_prefault = table_options.prefault;
+                c->table_lock = table_options.lock;
+                break;
             case 'b':
                 if (optarg == NULL) {
                     printf("[-b | --mem_width] option requires int argument [hash table bucket size]");
@@ -194,6 +266,17 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                     exit(1);
                 }
                 break;
+            case 'B':
+                if (optarg == NULL) {
+                    printf("[-B | --bloom_bits] option requires int argument [bits per kmer]");
+                    exit(1);
+                }
+                c->bloom_bits = atoi(optarg);
+                if (c->bloom_bits < 0 || c->bloom_bits > 64) {
+                    printf("[-B | --bloom_bits] option requires an argument between 0 and 64");
+                    exit(1);
+                }
+                break;
             case 'c':
                 if (optarg==NULL) {
                     printf("Error: [-c | --contaminants] option requires an argument.\n");
@@ -207,6 +290,19 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                     exit(1);
                 }
                 break;
+            case 'C':
+                if (optarg==NULL) {
+                    printf("Error: [-C | --client] option requires an argument.\n");
+                    exit(1);
+                }
+                c->client_socket = malloc(strlen(optarg) + 1);
+                if (c->client_socket) {
+                    strcpy(c->client_socket, optarg);
+                } else {
+                    printf("Error: can't allocate memory for string.\n");
+                    exit(1);
+                }
+                break;
             case 'd':
                 if (optarg==NULL) {
                     printf("Error: [-d | --contaminant_dir] option requires an argument.\n");
@@ -220,6 +316,20 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                     exit(1);
                 }
                 break;
+            case 'D':
+                if (optarg==NULL) {
+                    printf("Error: [-D | --dedup_cache] option requires an argument.\n");
+                    exit(1);
+                }
+                c->dedup_cache_mb = atoi(optarg);
+                if ((c->dedup_cache_mb < 0) || (c->dedup_cache_mb > 65536)) {
+                    printf("Error: [-D | --dedup_cache] must be between 0 and 65536.\n");
+                    exit(1);
+                }
+                if (c->dedup_cache_mb > 0) {
+                    c->pipeline = true;
+                }
+                break;
             case 'e':
                 if (optarg==NULL) {
                     printf("Error: [-e | --contaminants_file] option requires an argument.\n");
@@ -233,6 +343,9 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                     exit(1);
                 }
                 break;
+            case 'E':
+                c->early_exit = true;
+                break;
             case 'f':
                 if (c->run_type == 0) {
                     c->run_type = DO_FILTER;
@@ -259,6 +372,17 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                 usage();
                 exit(0);
                 break;
+            case 'H':
+                if (optarg==NULL) {
+                    printf("Error: [-H | --shards] option requires an argument.\n");
+                    exit(1);
+                }
+                c->n_shards = atoi(optarg);
+                if ((c->n_shards < 1) || (c->n_shards > MAX_SHARDS)) {
+                    printf("Error: [-H | --shards] must be between 1 and %d.\n", MAX_SHARDS);
+                    exit(1);
+                }
+                break;
             case 'i':
                 if (c->run_type == 0) {
                     c->run_type = DO_INDEX;
@@ -267,6 +391,18 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                     exit(1);
                 }
                 break;
+            case 'I':
+                if (optarg==NULL) {
+                    printf("Error: [-I | --shard] option requires an argument.\n");
+                    exit(1);
+                }
+                c->shard = atoi(optarg);
+                // 0 means no shard, so it can't be asked for
+                if (c->shard < 1) {
+                    printf("Error: [-I | --shard] must be between 1 and the number of shards given with -H.\n");
+                    exit(1);
+                }
+                break;
             case 'j':
                 if (optarg==NULL) {
                     printf("Error: [-j | --read_summary] option requires an argument.\n");
@@ -280,6 +416,30 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                     exit(1);
                 }
                 break;
+            case 'J':
+                if (optarg==NULL) {
+                    printf("Error: [-J | --max_jobs] option requires an argument.\n");
+                    exit(1);
+                }
+                c->max_jobs = atoi(optarg);
+                if (c->max_jobs < 1) {
+                    printf("Error: [-J | --max_jobs] must be at least 1.\n");
+                    exit(1);
+                }
+                break;
+            case 'K':
+                if (optarg==NULL) {
+                    printf("Error: [-K | --snapshot] option requires an argument.\n");
+                    exit(1);
+                }
+                c->snapshot_file = malloc(strlen(optarg) + 1);
+                if (c->snapshot_file) {
+                    strcpy(c->snapshot_file, optarg);
+                } else {
+                    printf("Error: can't allocate memory for string.\n");
+                    exit(1);
+                }
+                break;
             case 'k':
                 if (optarg==NULL) {
                     printf("Error: [-k | --kmer_size] option requires an argument.\n");
@@ -294,6 +454,28 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                 }
                 c->kmer_threshold_read = atoi(optarg);
                 break;
+            case 'L':
+                c->long_reads = true;
+                break;
+            case 'm':
+                if (optarg==NULL) {
+                    printf("Error: [-m | --max_read_length] option requires an argument.\n");
+                    exit(1);
+                }
+                c->max_read_length = atoi(optarg);
+                if (c->max_read_length < 1) {
+                    printf("Error: [-m | --max_read_length] must be at least 1.\n");
+                    exit(1);
+                }
+                break;
+            case 'M':
+                if (c->run_type == 0) {
+                    c->run_type = DO_MERGE;
+                } else {
+                    printf("Error: You must specify either screening, filtering or indexing.\n");
+                    exit(1);
+                }
+                break;
             case 'n':
                 if (optarg == NULL) {
                     printf("[-n | --mem_height] option requires int argument [hash table number of buckets in bits]");
@@ -338,6 +520,29 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                 }
                 c->write_progress_file = true;
                 break;
+            case 'P':
+                if (optarg==NULL) {
+                    printf("Error: [-P | --pipeline] option requires an argument.\n");
+                    exit(1);
+                }
+                c->pipeline = true;
+                if (strcmp(optarg, "auto") != 0) {
+                    if ((sscanf(optarg, "%d:%d", &c->pipeline_parse_threads, &c->pipeline_lookup_threads) != 2) ||
+                        (c->pipeline_parse_threads < 1) || (c->pipeline_lookup_threads < 1) ||
+                        ((c->pipeline_parse_threads + c->pipeline_lookup_threads) > 32)) {
+                        printf("Error: [-P | --pipeline] option requires 'auto' or parse:lookup thread counts.\n");
+                        exit(1);
+                    }
+                }
+                break;
+            case 'Q':
+                if (c->run_type == 0) {
+                    c->run_type = DO_COMBINE;
+                } else {
+                    printf("Error: You must specify either screening, filtering or indexing.\n");
+                    exit(1);
+                }
+                break;
             case 'r':
                 if (optarg==NULL) {
                     printf("Error: [-r | --removed_prefix] option requires an argument.\n");
@@ -366,6 +571,25 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                     exit(1);
                 }
                 break;
+            case 'S':
+                if (optarg==NULL) {
+                    printf("Error: [-S | --server] option requires an argument.\n");
+                    exit(1);
+                }
+                if (c->run_type == 0) {
+                    c->run_type = DO_SERVE;
+                } else {
+                    printf("Error: You must specify either screening, filtering or indexing.\n");
+                    exit(1);
+                }
+                c->server_socket = malloc(strlen(optarg) + 1);
+                if (c->server_socket) {
+                    strcpy(c->server_socket, optarg);
+                } else {
+                    printf("Error: can't allocate memory for string.\n");
+                    exit(1);
+                }
+                break;
             case 't':
                 if (optarg==NULL) {
                     printf("Error: [-t | --threshold] option requires an argument.\n");
@@ -376,6 +600,12 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
             case 'u':
                 c->filter_unique = true;
                 break;
+            case 'U':
+                if ((optarg == NULL) || (!numa_layout_parse_options(optarg, &c->numa_policy, &c->numa_pin))) {
+                    printf("Error: [-U | --numa] option requires interleave or replicate, and/or pin.\n");
+                    exit(1);
+                }
+                break;
             case 'w':
                 if (optarg == NULL) {
                     printf("[-u | --progress_interval] option requires int argument [delay in seconds]");
@@ -383,6 +613,13 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                 }
                 c->progress_delay = atoi(optarg);
                 break;
+            case 'W':
+                if (optarg==NULL) {
+                    printf("Error: [-W | --window_size] option requires an argument.\n");
+                    exit(1);
+                }
+                c->window_size = atoi(optarg);
+                break;
             case 'x':
                 c->keep_contaminated_reads = true;
                 break;
@@ -393,6 +630,12 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
                 }
                 c->subsample_ratio = atof(optarg);
                 break;
+            case 'T':
+                c->lookup_stats = true;
+                break;
+            case 'Y':
+                c->split_keys = true;
+                break;
             case 'z':
                 if (optarg==NULL) {
                     printf("Error: [-z | --file_of_files] option requires an argument.\n");
@@ -413,7 +656,17 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
         }
     }
     
-    if (c->file_of_files == 0) {
+    if ((c->run_type == DO_MERGE) || (c->run_type == DO_COMBINE)) {
+        // Snapshots or counts files are the arguments left over after options
+        c->n_merge_files = argc - optind;
+        c->merge_files = &(argv[optind]);
+        if (c->n_merge_files < 1) {
+            printf("Error: [-M | --merge] and [-Q | --combine] require at least one file.\n");
+            exit(1);
+        }
+    } else if (c->run_type == DO_SERVE) {
+        // Input files come with each job
+    } else if (c->file_of_files == 0) {
         if (c->input_filename_one == 0) {
             printf("Error: you must specify an input filename.\n");
             exit(1);
@@ -429,7 +682,7 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
         exit(1);
     }
     
-    if ((c->run_type == DO_SCREEN) || (c->run_type == DO_FILTER)) {
+    if ((c->run_type == DO_SCREEN) || (c->run_type == DO_FILTER) || (c->run_type == DO_SERVE)) {
         if ((c->contaminants == 0) && (c->contaminants_file == 0)) {
             printf("Error: you must specify a contaminant list\n");
             exit(1);
@@ -441,6 +694,42 @@ void parse_command_line(int argc, char* argv[], CmdLine* c)
         exit(1);
     }
     
+    // Windows after the first carry k bases over, and each must still
+    // leave k new bases
+    if (c->window_size < (2 * c->kmer_size)) {
+        printf("Error: [-W | --window_size] must be at least twice the kmer size.\n");
+        exit(1);
+    }
+
+    if ((c->long_reads) && ((c->input_filename_two != 0) || (c->run_type == DO_FILTER))) {
+        printf("Error: [-L | --long_reads] supports screening of a single input file only.\n");
+        exit(1);
+    }
+
+    // FASTA input is only ever screened, so filtering would silently
+    // write nothing
+    if ((c->run_type == DO_FILTER) && (c->format != FASTQ)) {
+        printf("Error: filtering supports FASTQ input only.\n");
+        exit(1);
+    }
+
+    if (c->shard != 0) {
+        if ((c->shard < 1) || (c->shard > c->n_shards)) {
+            printf("Error: [-I | --shard] must be between 1 and the number of shards given with -H.\n");
+            exit(1);
+        }
+        if (c->run_type != DO_SCREEN) {
+            printf("Error: [-I | --shard] is for screening only.\n");
+            exit(1);
+        }
+        // Read summaries and early exit need a read's counts from every shard
+        if ((c->format != FASTQ) || (c->long_reads) || (c->early_exit) || (c->read_summary_file != 0)) {
+            printf("Error: [-I | --shard] supports FASTQ screening without -L, -E or -j.\n");
+            exit(1);
+        }
+        c->pipeline = true;
+    }
+
     if ((c->kmer_threshold_read * 2) > c->kmer_threshold_overall) {
         printf("NOTE: by specifying a read threshold of %d, you require at least %d kmers over both reads, which has the effect of increasing your overall threshold past the specified value (%d). This isn't a problem, as long as you are aware.\n\n", c->kmer_threshold_read, c->kmer_threshold_read*2, c->kmer_threshold_overall);
     }
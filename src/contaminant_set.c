@@ -0,0 +1,213 @@
+/*----------------------------------------------------------------------*
+ * File:    contaminant_set.c                                           *
+ * Purpose: Histogram of kmers by the set of contaminants holding them  *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   The shared and unique kmer matrices depend only on which contaminants
+   hold each kmer, and far fewer distinct sets of contaminants occur than
+   there are kmers. So the table is scanned once, counting kmers per
+   distinct set (the contaminant bits of an element, copied out as
+   words), and the matrices are worked out from the sets afterwards.
+
+   The histogram is an open addressed table, linear probing, doubled
+   when half full. A count of zero marks an empty entry.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "contaminant_set.h"
+#include "kmer_kernels.h"
+
+#define CONTAMINANT_SET_INITIAL_CAPACITY 256
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_hash
+ * Purpose:    Hash a set
+ * Parameters: words -> set
+ * Returns:    hash value
+ *----------------------------------------------------------------------*/
+static inline uint64_t contaminant_set_hash(uint32_t* words)
+{
+    uint64_t h = 0;
+    int i;
+
+    for (i=0; i<CONTAMINANT_SET_WORDS; i++) {
+        h = (h ^ words[i]) * 0x9E3779B97F4A7C15ULL;
+        h ^= h >> 29;
+    }
+
+    return h;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_allocate
+ * Purpose:    Allocate empty entries
+ * Parameters: histogram -> histogram
+ *             capacity = number of entries, a power of 2
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void contaminant_set_allocate(ContaminantSetHistogram* histogram, long long capacity)
+{
+    histogram->entries = calloc(capacity, sizeof(ContaminantSetEntry));
+    if (!histogram->entries) {
+        printf("Error: can't allocate memory for contaminant set histogram\n");
+        exit(1);
+    }
+    histogram->capacity = capacity;
+    histogram->number_sets = 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_histogram_new
+ * Purpose:    Create an empty histogram
+ * Parameters: None
+ * Returns:    Pointer to histogram
+ *----------------------------------------------------------------------*/
+ContaminantSetHistogram* contaminant_set_histogram_new(void)
+{
+    ContaminantSetHistogram* histogram = malloc(sizeof(ContaminantSetHistogram));
+
+    if (!histogram) {
+        printf("Error: can't allocate memory for contaminant set histogram\n");
+        exit(1);
+    }
+
+    contaminant_set_allocate(histogram, CONTAMINANT_SET_INITIAL_CAPACITY);
+
+    return histogram;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_histogram_free
+ * Purpose:    Free a histogram
+ * Parameters: histogram -> pointer to histogram pointer, set to NULL
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void contaminant_set_histogram_free(ContaminantSetHistogram** histogram)
+{
+    if (*histogram) {
+        free((*histogram)->entries);
+        free(*histogram);
+        *histogram = NULL;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_of_element
+ * Purpose:    Copy out the contaminant bits of an element
+ * Parameters: e -> element
+ *             words -> CONTAMINANT_SET_WORDS words to fill
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void contaminant_set_of_element(Element* e, uint32_t* words)
+{
+    int i;
+
+    for (i=0; i<CONTAMINANT_FIELDS; i++) {
+        words[i] = e->contaminant_flags[i];
+    }
+    words[CONTAMINANT_FIELDS] = e->flags >> FLAG_BITS_USED;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_members
+ * Purpose:    List the contaminants in a set, visiting only set bits
+ *             (see kmer_kernels_impl.h)
+ * Parameters: words -> set
+ *             ids -> array of at least MAX_CONTAMINANTS, filled with
+ *                    contaminant numbers in increasing order
+ * Returns:    Number of contaminants in the set
+ *----------------------------------------------------------------------*/
+int contaminant_set_members(uint32_t* words, int* ids)
+{
+    return kmer_kernels.contaminant_set_members(words, ids);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_histogram_add
+ * Purpose:    Add kmers to the count for a set
+ * Parameters: histogram -> histogram
+ *             words -> set
+ *             count = number of kmers
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void contaminant_set_histogram_add(ContaminantSetHistogram* histogram, uint32_t* words, uint64_t count)
+{
+    long long mask = histogram->capacity - 1;
+    long long i = contaminant_set_hash(words) & mask;
+    ContaminantSetEntry* entry;
+
+    if (count == 0) {
+        return;
+    }
+
+    while (histogram->entries[i].count != 0) {
+        if (memcmp(histogram->entries[i].words, words, sizeof(histogram->entries[i].words)) == 0) {
+            histogram->entries[i].count += count;
+            return;
+        }
+        i = (i + 1) & mask;
+    }
+
+    entry = &(histogram->entries[i]);
+    memcpy(entry->words, words, sizeof(entry->words));
+    entry->count = count;
+    histogram->number_sets++;
+
+    // Keep at most half full so probes stay short
+    if ((histogram->number_sets * 2) > histogram->capacity) {
+        ContaminantSetEntry* old_entries = histogram->entries;
+        long long old_capacity = histogram->capacity;
+
+        contaminant_set_allocate(histogram, old_capacity * 2);
+        for (i=0; i<old_capacity; i++) {
+            if (old_entries[i].count != 0) {
+                contaminant_set_histogram_add(histogram, old_entries[i].words, old_entries[i].count);
+            }
+        }
+        free(old_entries);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_histogram_add_element
+ * Purpose:    Count an element's kmer against its set
+ * Parameters: histogram -> histogram
+ *             e -> element
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void contaminant_set_histogram_add_element(ContaminantSetHistogram* histogram, Element* e)
+{
+    uint32_t words[CONTAMINANT_SET_WORDS];
+
+    contaminant_set_of_element(e, words);
+    contaminant_set_histogram_add(histogram, words, 1);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   contaminant_set_histogram_merge
+ * Purpose:    Add the counts of one histogram to another
+ * Parameters: into -> histogram added to
+ *             from -> histogram to add
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void contaminant_set_histogram_merge(ContaminantSetHistogram* into, ContaminantSetHistogram* from)
+{
+    long long i;
+
+    for (i=0; i<from->capacity; i++) {
+        if (from->entries[i].count != 0) {
+            contaminant_set_histogram_add(into, from->entries[i].words, from->entries[i].count);
+        }
+    }
+}
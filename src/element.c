@@ -46,6 +46,7 @@
 #include <nucleotide.h>
 #include <binary_kmer.h>
 #include <element.h>
+#include <kmer_kernels.h>
 
 long long int visited_count = 0;
 
@@ -85,20 +86,8 @@ BinaryKmer *element_get_kmer(Element * e)
 
 Key element_get_key(BinaryKmer * kmer, short kmer_size, Key preallocated_key)
 {
-
-	BinaryKmer local_rev_kmer;
-	binary_kmer_initialise_to_zero(&local_rev_kmer);
-    
-	binary_kmer_reverse_complement(kmer, kmer_size, &local_rev_kmer);
-
-	if (binary_kmer_less_than(local_rev_kmer, *kmer, kmer_size)) {
-		binary_kmer_assignment_operator(*((BinaryKmer *)
-						  preallocated_key),
-						local_rev_kmer);
-	} else {
-		binary_kmer_assignment_operator(*((BinaryKmer *)
-						  preallocated_key), *kmer);
-	}
+	// Word at a time reverse complement, see canonical_keys in kmer_kernels_impl.h
+	kmer_kernels.canonical_keys(kmer, 1, kmer_size, preallocated_key);
 
 	return preallocated_key;
 
@@ -38,9 +38,7 @@
 #include <stdint.h>
 #include <assert.h>
 #include <locale.h>
-#ifdef THREADS
 #include <pthread.h>
-#endif
 #include <global.h>
 #include <flags.h>
 #include <string.h>
@@ -48,7 +46,11 @@
 #include <element.h>
 #include <hash_table.h>
 #include <hash_value.h>
+#include <bloom_filter.h>
+#include <key_index.h>
+#include <table_memory.h>
 #include <logger.h>
+#include <thread_pool.h>
 
 
 HashTable * hash_table_new(int number_bits, int bucket_size, int max_rehash_tries, short kmer_size){ 
@@ -75,8 +77,9 @@ HashTable * hash_table_new(int number_bits, int bucket_size, int max_rehash_trie
 	hash_table->number_buckets = (long long) 1 << number_bits;
 	hash_table->bucket_size   = bucket_size;
 
-	//calloc is vital - we want to make sure initialised to zero
-	hash_table->table = calloc(hash_table->number_buckets * hash_table->bucket_size, sizeof(Element));
+	//zeroed memory is vital - table_memory_alloc gives calloc or fresh anonymous pages
+	hash_table->table = table_memory_alloc(hash_table->number_buckets * hash_table->bucket_size * sizeof(Element),
+                                           &hash_table->table_memory_mode, &hash_table->table_memory_bytes);
 	
 	if (hash_table->table == NULL) {
 		fprintf(stderr,"ERROR: could not allocate hash table of size %qd\n",hash_table->number_buckets * hash_table->bucket_size);
@@ -100,9 +103,11 @@ HashTable * hash_table_new(int number_bits, int bucket_size, int max_rehash_trie
 
 void hash_table_free(HashTable ** hash_table)
 { 
-	free((*hash_table)->table);
+	table_memory_free((*hash_table)->table, (*hash_table)->table_memory_bytes, (*hash_table)->table_memory_mode);
 	free((*hash_table)->next_element);
 	free((*hash_table)->collisions);
+	bloom_filter_free(&(*hash_table)->prefilter);
+	key_index_free(&(*hash_table)->key_index);
 	free(*hash_table);
 	*hash_table = NULL;
 }
@@ -112,16 +117,11 @@ void hash_table_free(HashTable ** hash_table)
 // If key is in bucket, returns true and the position of the key/element in current_pos.
 // If key is not in bucket, and bucket is not full, returns the next available position in current_pos (and overflow is returned as false)
 // If key is not in bucket, and bucket is full, returns overflow=true
-boolean hash_table_find_in_bucket(Key key, long long * current_pos, boolean * overflow, HashTable * hash_table, int rehash){
-	
+// hash is hash_value_64 of key, computed once by the caller for all rehashes
+boolean hash_table_find_in_bucket(Key key, uint64_t hash, long long * current_pos, boolean * overflow, HashTable * hash_table, int rehash){
 	
-	//add the rehash to the final bitfield in the BinaryKmer
-	BinaryKmer bkmer_with_rehash_added;
-	binary_kmer_initialise_to_zero(&bkmer_with_rehash_added);
-	binary_kmer_assignment_operator(bkmer_with_rehash_added, *key);
-	bkmer_with_rehash_added[NUMBER_OF_BITFIELDS_IN_BINARY_KMER-1] =   bkmer_with_rehash_added[NUMBER_OF_BITFIELDS_IN_BINARY_KMER-1]+ (bitfield_of_64bits) rehash;
 	
-	int hashval = (int)hash_value(&bkmer_with_rehash_added, (int)hash_table->number_buckets);
+	long long hashval = hash_value_bucket(hash, rehash, hash_table->number_buckets);
 	
 	
 	boolean found = false;
@@ -192,9 +192,10 @@ boolean hash_table_apply_or_insert(Key key, void (*f)(Element *), HashTable * ha
 	boolean overflow;
 	int rehash=0;
 	boolean found;
+	uint64_t hash = hash_value_64(key);
 	do
     {
-		found = hash_table_find_in_bucket(key,&current_pos,&overflow, hash_table,rehash);
+		found = hash_table_find_in_bucket(key,hash,&current_pos,&overflow, hash_table,rehash);
 		
 		if (!found)
 		{
@@ -497,7 +498,7 @@ HashTable *  hash_table_read_dumped_memory(char * filename ){
 	//printf("Hash size %lld \n", hash_size);
 	
 	//Allocating the table according to the description of the file
-	hash->table = calloc(hash_size, sizeof(Element));
+	hash->table = table_memory_alloc(hash_size * sizeof(Element), &hash->table_memory_mode, &hash->table_memory_bytes);
 	hash->next_element = calloc(number_buckets, sizeof(int));
 	hash->collisions = calloc(number_buckets, sizeof(long long));
 	
@@ -602,83 +603,259 @@ void hash_table_n_buckets_traverse_with_args(int block, int number_of_blocks, vo
 	printf("\n");
 	
 }
-#ifdef THREADS
-void hash_table_threaded_traverse_with_args( void (*f)(Element *, void *), void ** args, HashTable * hash_table){
+/*
+   Parallel scans run on the shared thread pool (thread_pool.c). Thread t
+   of n takes the t'th of n contiguous runs of slots, so a scan split
+   over threads visits elements in the same order as a serial one, block
+   after block. Each thread can have its own accumulator, created on that
+   thread, and the accumulators are reduced on the calling thread in
+   block order once every thread has finished.
+ */
+typedef struct {
+	void (*f)(Element *, void *);
+	void * (*new_accumulator)(int block, void * data);
+	void * data;
+	void * accumulators[THREAD_POOL_MAX_THREADS];
+	boolean progress;
+	HashTable * hash_table;
+} ParallelTraverse;
+
+static void parallel_traverse_block(int thread, int number_of_threads, void * ptr){
+	ParallelTraverse * pt = (ParallelTraverse *) ptr;
+	HashTable * hash_table = pt->hash_table;
+	long long entries = hash_table->number_buckets * hash_table->bucket_size;
+	long long first = (entries * thread) / number_of_threads;
+	long long last = (entries * (thread + 1)) / number_of_threads;
+	long long one_percent = (last - first) / 100;
+	void * accumulator = pt->new_accumulator ? pt->new_accumulator(thread, pt->data) : pt->data;
+	long long i;
+	
+	for(i=first; i<last; i++){
+		if (!element_check_for_flag_ALL_OFF(&hash_table->table[i])){
+			pt->f(&hash_table->table[i], accumulator);
+		}
+		
+		// The first block stands in for the rest
+		if(pt->progress && (thread == 0) && (one_percent > 0) && ((i - first) % one_percent == 0)){
+			log_progress_bar(((double)(i - first) / (double)(last - first)) * 100);
+		}
+	}
+	
+	pt->accumulators[thread] = accumulator;
+}
+
+static void parallel_traverse(void (*f)(Element *, void *), void * (*new_accumulator)(int, void *), void (*reduce)(void *, void *), void * data, boolean progress, HashTable * hash_table){
+	ParallelTraverse pt;
+	ThreadPool * pool = thread_pool_shared();
 	int i;
-	int no_of_threads = hash_table->number_of_threads;
-	printf("\n");
 	
+	pt.f = f;
+	pt.new_accumulator = new_accumulator;
+	pt.data = data;
+	pt.progress = progress;
+	pt.hash_table = hash_table;
 	
-	pthread_t * threads = calloc(no_of_threads, sizeof(pthread_t));
+	if (progress) {
+		printf("\n");
+		log_progress_bar(0);
+	}
 	
-	void *exec_thread( void *ptr ){
-		int * b_ptr = (int *) ptr;
-		int block;
-		block =  *b_ptr;
-        
-		//    printf("Executing thread %d\n", block);
-		hash_table_n_buckets_traverse_with_args(block,  no_of_threads, f, &args[block],hash_table);
-		return b_ptr;
+	thread_pool_run(pool, parallel_traverse_block, &pt);
+	
+	if (reduce) {
+		for(i=0; i<pool->number_of_threads; i++){
+			reduce(pt.accumulators[i], data);
+		}
 	}
-	int * starts = calloc(no_of_threads, sizeof(int));
-	int ret;
 	
-	for(i = 0; i < no_of_threads; i ++){
-		starts[i] = i;
-		ret = pthread_create( &threads[i], NULL, exec_thread, (void*) &starts[i]);
-		assert(ret==0);
+	if (progress) {
+		log_progress_bar(100);
+		printf("\n");
 	}
+}
+
+void hash_table_parallel_traverse(void (*f)(Element *, void *), void * (*new_accumulator)(int, void *), void (*reduce)(void *, void *), void * data, HashTable * hash_table){
+	parallel_traverse(f, new_accumulator, reduce, data, true, hash_table);
+}
+
+void hash_table_parallel_traverse_quiet(void (*f)(Element *, void *), void * (*new_accumulator)(int, void *), void (*reduce)(void *, void *), void * data, HashTable * hash_table){
+	parallel_traverse(f, new_accumulator, reduce, data, false, hash_table);
+}
+
+int hash_table_parallel_blocks(void){
+	return thread_pool_shared()->number_of_threads;
+}
+
+// Per block state for hash_table_parallel_count and hash_table_parallel_write
+typedef struct {
+	boolean (*select)(Element *, void *);
+	void (*write)(Element *, FILE *, void *);
+	void * data;
+	char * filename;
+	long offset;
+	size_t record_bytes;
+	long long counts[THREAD_POOL_MAX_THREADS];
+} ParallelSelect;
+
+typedef struct {
+	ParallelSelect * ps;
+	int block;
+	long long count;
+	FILE * fp;
+} ParallelSelectBlock;
+
+static void * parallel_select_new_block(int block, void * data){
+	ParallelSelectBlock * psb = calloc(1, sizeof(ParallelSelectBlock));
 	
+	if (!psb) {
+		printf("Error: can't allocate memory for table scan\n");
+		exit(1);
+	}
 	
-	printf("\n");
+	psb->ps = (ParallelSelect *) data;
+	psb->block = block;
 	
+	return psb;
+}
+
+static void parallel_select_count(Element * e, void * accumulator){
+	ParallelSelectBlock * psb = (ParallelSelectBlock *) accumulator;
 	
-	for(i = 0; i < no_of_threads; i ++){
-		pthread_join(threads[i], NULL);
+	if (psb->ps->select(e, psb->ps->data)) {
+		psb->count++;
 	}
+}
+
+static void parallel_select_reduce_count(void * accumulator, void * data){
+	ParallelSelectBlock * psb = (ParallelSelectBlock *) accumulator;
 	
-	free(starts);
-	free(threads);	
+	psb->ps->counts[psb->block] = psb->count;
+	free(psb);
 }
 
-void hash_table_threaded_traverse( void (*f)(Element *),HashTable * hash_table){
+long long hash_table_parallel_count(boolean (*select)(Element *, void *), void * data, HashTable * hash_table){
+	ParallelSelect ps;
+	long long total = 0;
 	int i;
-	int no_of_threads = hash_table->number_of_threads;
-	printf("\n");
 	
+	ps.select = select;
+	ps.data = data;
+	parallel_traverse(parallel_select_count, parallel_select_new_block, parallel_select_reduce_count, &ps, false, hash_table);
+	
+	for(i=0; i<hash_table_parallel_blocks(); i++){
+		total += ps.counts[i];
+	}
 	
-	pthread_t * threads = calloc(no_of_threads, sizeof(pthread_t));
+	return total;
+}
+
+static void * parallel_select_open_block(int block, void * data){
+	ParallelSelectBlock * psb = (ParallelSelectBlock *) parallel_select_new_block(block, data);
+	ParallelSelect * ps = psb->ps;
+	long long first = 0;
+	int i;
 	
-	void *exec_thread( void *ptr ){
-		int * b_ptr = (int *) ptr;
-		int block;
-		block =  *b_ptr;
-		//    printf("Executing thread %d\n", block);
-		hash_table_n_buckets_traverse(block,  no_of_threads, f, hash_table);
-		return b_ptr;
+	for(i=0; i<block; i++){
+		first += ps->counts[i];
 	}
-	int * starts = calloc(no_of_threads, sizeof(int));
-	int ret;
 	
-	for(i = 0; i < no_of_threads; i ++){
-		starts[i] = i;
-		ret = pthread_create( &threads[i], NULL, exec_thread, (void*) &starts[i]);
-		assert(ret==0);
+	psb->fp = fopen(ps->filename, "r+b");
+	if (!psb->fp) {
+		printf("Error: can't open %s\n", ps->filename);
+		exit(1);
 	}
 	
+	if (fseeko(psb->fp, (off_t)ps->offset + ((off_t)first * ps->record_bytes), SEEK_SET) != 0) {
+		printf("Error: can't seek in %s\n", ps->filename);
+		exit(1);
+	}
 	
-	printf("\n");
+	return psb;
+}
+
+static void parallel_select_write(Element * e, void * accumulator){
+	ParallelSelectBlock * psb = (ParallelSelectBlock *) accumulator;
 	
+	if (psb->ps->select(e, psb->ps->data)) {
+		psb->ps->write(e, psb->fp, psb->ps->data);
+	}
+}
+
+static void parallel_select_reduce_close(void * accumulator, void * data){
+	ParallelSelectBlock * psb = (ParallelSelectBlock *) accumulator;
 	
-	for(i = 0; i < no_of_threads; i ++){
-		pthread_join(threads[i], NULL);
+	if (fclose(psb->fp) != 0) {
+		printf("Error: can't write to %s\n", psb->ps->filename);
+		exit(1);
 	}
+	free(psb);
+}
+
+long long hash_table_parallel_write(char * filename, long offset, size_t record_bytes, boolean (*select)(Element *, void *), void (*write)(Element *, FILE *, void *), void * data, HashTable * hash_table){
+	ParallelSelect ps;
+	long long total = 0;
+	int i;
+	
+	ps.select = select;
+	ps.write = write;
+	ps.data = data;
+	ps.filename = filename;
+	ps.offset = offset;
+	ps.record_bytes = record_bytes;
+	
+	// Count first so each block knows where its records start
+	parallel_traverse(parallel_select_count, parallel_select_new_block, parallel_select_reduce_count, &ps, false, hash_table);
+	parallel_traverse(parallel_select_write, parallel_select_open_block, parallel_select_reduce_close, &ps, true, hash_table);
 	
-	free(starts);
-	free(threads);	
+	for(i=0; i<hash_table_parallel_blocks(); i++){
+		total += ps.counts[i];
+	}
+	
+	return total;
+}
+
+// The older block iterators, now run on the shared pool. Thread t takes
+// blocks t, t + threads, ... of hash_table->number_of_threads.
+typedef struct {
+	void (*f)(Element *);
+	void (*f_with_args)(Element *, void *);
+	void ** args;
+	HashTable * hash_table;
+} ThreadedTraverse;
+
+static void threaded_traverse_blocks(int thread, int number_of_threads, void * ptr){
+	ThreadedTraverse * tt = (ThreadedTraverse *) ptr;
+	int no_of_blocks = tt->hash_table->number_of_threads;
+	int block;
+	
+	for(block = thread; block < no_of_blocks; block += number_of_threads){
+		if (tt->f_with_args) {
+			hash_table_n_buckets_traverse_with_args(block, no_of_blocks, tt->f_with_args, tt->args[block], tt->hash_table);
+		} else {
+			hash_table_n_buckets_traverse(block, no_of_blocks, tt->f, tt->hash_table);
+		}
+	}
+}
+
+void hash_table_threaded_traverse_with_args( void (*f)(Element *, void *), void ** args, HashTable * hash_table){
+	ThreadedTraverse tt;
+	
+	tt.f = NULL;
+	tt.f_with_args = f;
+	tt.args = args;
+	tt.hash_table = hash_table;
+	thread_pool_run(thread_pool_shared(), threaded_traverse_blocks, &tt);
+}
+
+void hash_table_threaded_traverse( void (*f)(Element *),HashTable * hash_table){
+	ThreadedTraverse tt;
+	
+	tt.f = f;
+	tt.f_with_args = NULL;
+	tt.args = NULL;
+	tt.hash_table = hash_table;
+	thread_pool_run(thread_pool_shared(), threaded_traverse_blocks, &tt);
 }
- 
-#endif
 
 long long hash_table_array_index_of_element(Element * element, HashTable * hash_table){
 	//void * ptr_element = (void *) element;
@@ -692,23 +869,87 @@ long long hash_table_array_index_of_element(Element * element, HashTable * hash_
 
 
 
-Element * hash_table_find(Key key, HashTable * hash_table)
-{
-	if (hash_table == NULL) 
-    {
-		puts("hash_table_find has been called with a NULL table! Exiting");
-		exit(1);
-    }
+/*
+   Lookup counting (hash_table_count_lookups) is off unless asked for, and
+   then costs one branch per lookup when off. Each thread that looks keys
+   up gets its own block of counts, allocated on its first counted lookup
+   and linked into a list, so threads never share a counter's cache line;
+   hash_table_get_lookup_stats sums the blocks. Blocks outlive their
+   threads, so counts from a finished run of threads are kept. A sum
+   taken while threads are still looking keys up (for progress) may be a
+   few lookups behind.
+ */
+typedef struct LookupStatsBlock {
+	HashTableLookupStats counts;
+	struct LookupStatsBlock * next;
+} LookupStatsBlock;
+
+static boolean lookup_stats_enabled = false;
+static LookupStatsBlock * lookup_stats_blocks = NULL;
+static pthread_mutex_t lookup_stats_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread LookupStatsBlock * lookup_stats_thread = NULL;
+
+static HashTableLookupStats * lookup_stats_for_thread(void){
+	if (lookup_stats_thread == NULL) {
+		lookup_stats_thread = calloc(1, sizeof(LookupStatsBlock));
+		if (lookup_stats_thread == NULL) {
+			printf("Error: can't allocate memory for lookup counts\n");
+			exit(1);
+		}
+		pthread_mutex_lock(&lookup_stats_lock);
+		lookup_stats_thread->next = lookup_stats_blocks;
+		lookup_stats_blocks = lookup_stats_thread;
+		pthread_mutex_unlock(&lookup_stats_lock);
+	}
+	
+	return &(lookup_stats_thread->counts);
+}
+
+static void count_lookup(Element * found, int buckets, long long slots){
+	HashTableLookupStats * counts = lookup_stats_for_thread();
+	int bin = slots == 0 ? 0 : 64 - __builtin_clzll((unsigned long long)slots);
 	
+	counts->lookups++;
+	if (found != NULL) {
+		counts->hits++;
+	}
+	counts->slots_probed += slots;
+	if (slots > counts->max_slots_probed) {
+		counts->max_slots_probed = slots;
+	}
+	counts->slots_probed_bins[bin < HASH_TABLE_PROBE_BINS ? bin : HASH_TABLE_PROBE_BINS - 1]++;
+	counts->buckets_searched[buckets < HASH_TABLE_LOOKUP_DEPTHS ? buckets : HASH_TABLE_LOOKUP_DEPTHS - 1]++;
+}
+
+// Search for a key whose hash_value_64 is already known. Always inlined
+// with a constant counting, so the copy that doesn't count has none of
+// the counting code.
+static inline __attribute__((always_inline)) Element * hash_table_probe_loop(Key key, uint64_t hash, HashTable * hash_table, const boolean counting)
+{
 	Element * ret = NULL;
 	long long current_pos;
+	long long slots = 0;
 	boolean overflow;
 	int rehash = 0;
 	boolean found; 
 	
+	//frozen tables can be probed through the separate array of keys
+	if (hash_table->key_index != NULL)
+    {
+		if (counting)
+        {
+			int buckets;
+			
+			ret = key_index_find_probed(hash_table->key_index, key, hash, hash_table, &buckets, &slots);
+			count_lookup(ret, buckets, slots);
+			return ret;
+        }
+		return key_index_find(hash_table->key_index, key, hash, hash_table);
+    }
+	
 	do
     {
-		found = hash_table_find_in_bucket(key, &current_pos, &overflow, hash_table, rehash);
+		found = hash_table_find_in_bucket(key, hash, &current_pos, &overflow, hash_table, rehash);
 		
 		if (found) //then we know overflow is false - this is checked in find_in_bucket
 		{
@@ -723,11 +964,74 @@ Element * hash_table_find(Key key, HashTable * hash_table)
 				exit(1);
 			}
 		}
+		
+		if (counting)
+        {
+			//a whole bucket, or up to the key or empty slot it stopped at
+			slots += overflow ? hash_table->bucket_size : (current_pos % hash_table->bucket_size) + 1;
+        }
     } while(overflow);
 	
+	if (counting)
+    {
+		count_lookup(ret, rehash + 1, slots);
+    }
+	
 	return ret;
 }
 
+static Element * hash_table_probe(Key key, uint64_t hash, HashTable * hash_table)
+{
+	if (lookup_stats_enabled)
+    {
+		return hash_table_probe_loop(key, hash, hash_table, true);
+    }
+	
+	return hash_table_probe_loop(key, hash, hash_table, false);
+}
+
+Element * hash_table_find(Key key, HashTable * hash_table)
+{
+	if (hash_table == NULL) 
+    {
+		puts("hash_table_find has been called with a NULL table! Exiting");
+		exit(1);
+    }
+	
+	//most kmers are absent, the prefilter rejects them from one cache line
+	if (hash_table->prefilter != NULL && !bloom_filter_may_contain(hash_table->prefilter, key))
+    {
+		if (lookup_stats_enabled)
+        {
+			count_lookup(NULL, 0, 0);
+        }
+		return NULL;
+    }
+	
+	return hash_table_probe(key, hash_value_64(key), hash_table);
+}
+
+// As hash_table_find, for callers that hash keys in batches (kmer_kernels.hash_keys)
+Element * hash_table_find_with_hash(Key key, uint64_t hash, HashTable * hash_table)
+{
+	if (hash_table == NULL) 
+    {
+		puts("hash_table_find_with_hash has been called with a NULL table! Exiting");
+		exit(1);
+    }
+	
+	if (hash_table->prefilter != NULL && !bloom_filter_may_contain(hash_table->prefilter, key))
+    {
+		if (lookup_stats_enabled)
+        {
+			count_lookup(NULL, 0, 0);
+        }
+		return NULL;
+    }
+	
+	return hash_table_probe(key, hash, hash_table);
+}
+
 
 Element * hash_table_find_or_insert(Key key, boolean * found,  HashTable * hash_table){
 	
@@ -740,12 +1044,13 @@ Element * hash_table_find_or_insert(Key key, boolean * found,  HashTable * hash_
 	Element * ret = NULL;
 	int rehash = 0;
 	boolean overflow; 
+	uint64_t hash = hash_value_64(key);
 	
 	long long current_pos;
 	
 	do{
 		
-		*found = hash_table_find_in_bucket(key,&current_pos,&overflow,hash_table,rehash);
+		*found = hash_table_find_in_bucket(key,hash,&current_pos,&overflow,hash_table,rehash);
 		
 		if (! *found)
 		{
@@ -809,14 +1114,9 @@ Element * hash_table_insert(Key key, HashTable * hash_table){
 	Element * ret = NULL;
 	int rehash = 0;
 	boolean inserted = false;
+	uint64_t hash = hash_value_64(key);
 	do{
-		//add the rehash to the final bitfield in the BinaryKmer
-		BinaryKmer bkmer_with_rehash_added;
-		binary_kmer_initialise_to_zero(&bkmer_with_rehash_added);
-		binary_kmer_assignment_operator(bkmer_with_rehash_added, *key);
-		bkmer_with_rehash_added[NUMBER_OF_BITFIELDS_IN_BINARY_KMER-1] =   bkmer_with_rehash_added[NUMBER_OF_BITFIELDS_IN_BINARY_KMER-1]+ (bitfield_of_64bits) rehash;
-		
-		int hashval = hash_value(&bkmer_with_rehash_added,(int)hash_table->number_buckets);//RHRG: Not quite sure if we want to cast here...
+		long long hashval = hash_value_bucket(hash, rehash, hash_table->number_buckets);
 		
 		if (hash_table->next_element[hashval] < hash_table->bucket_size)
 		{ //can insert element
@@ -877,6 +1177,172 @@ void hash_table_print_stats(HashTable * hash_table)
 
 
 
+void hash_table_count_lookups(boolean enable){
+	LookupStatsBlock * block;
+	
+	pthread_mutex_lock(&lookup_stats_lock);
+	for (block = lookup_stats_blocks; block != NULL; block = block->next) {
+		memset(&(block->counts), 0, sizeof(HashTableLookupStats));
+	}
+	pthread_mutex_unlock(&lookup_stats_lock);
+	
+	lookup_stats_enabled = enable;
+}
+
+boolean hash_table_counting_lookups(void){
+	return lookup_stats_enabled;
+}
+
+void hash_table_get_lookup_stats(HashTableLookupStats * total){
+	LookupStatsBlock * block;
+	int i;
+	
+	memset(total, 0, sizeof(HashTableLookupStats));
+	
+	pthread_mutex_lock(&lookup_stats_lock);
+	for (block = lookup_stats_blocks; block != NULL; block = block->next) {
+		HashTableLookupStats * counts = &(block->counts);
+		
+		total->lookups += counts->lookups;
+		total->hits += counts->hits;
+		total->slots_probed += counts->slots_probed;
+		if (counts->max_slots_probed > total->max_slots_probed) {
+			total->max_slots_probed = counts->max_slots_probed;
+		}
+		for (i=0; i<HASH_TABLE_LOOKUP_DEPTHS; i++) {
+			total->buckets_searched[i] += counts->buckets_searched[i];
+		}
+		for (i=0; i<HASH_TABLE_PROBE_BINS; i++) {
+			total->slots_probed_bins[i] += counts->slots_probed_bins[i];
+		}
+	}
+	pthread_mutex_unlock(&lookup_stats_lock);
+}
+
+typedef struct {
+	HashTable * hash_table;
+	long long * histograms;
+} BucketFill;
+
+static void bucket_fill_block(int thread, int number_of_threads, void * ptr){
+	BucketFill * bf = (BucketFill *) ptr;
+	HashTable * hash_table = bf->hash_table;
+	long long * histogram = &(bf->histograms[thread * (hash_table->bucket_size + 1)]);
+	long long first = (hash_table->number_buckets * thread) / number_of_threads;
+	long long last = (hash_table->number_buckets * (thread + 1)) / number_of_threads;
+	long long bucket;
+	int i;
+	
+	for (bucket=first; bucket<last; bucket++) {
+		Element * e = &(hash_table->table[bucket * hash_table->bucket_size]);
+		int used = 0;
+		
+		for (i=0; i<hash_table->bucket_size; i++) {
+			if (e[i].flags != ALL_OFF) {
+				used++;
+			}
+		}
+		histogram[used]++;
+	}
+}
+
+void hash_table_bucket_fill(long long * histogram, HashTable * hash_table){
+	ThreadPool * pool = thread_pool_shared();
+	BucketFill bf;
+	int t, i;
+	
+	bf.hash_table = hash_table;
+	bf.histograms = calloc(pool->number_of_threads * (hash_table->bucket_size + 1), sizeof(long long));
+	if (bf.histograms == NULL) {
+		printf("Error: can't allocate memory for bucket fill\n");
+		exit(1);
+	}
+	
+	thread_pool_run(pool, bucket_fill_block, &bf);
+	
+	for (i=0; i<=hash_table->bucket_size; i++) {
+		histogram[i] = 0;
+		for (t=0; t<pool->number_of_threads; t++) {
+			histogram[i] += bf.histograms[(t * (hash_table->bucket_size + 1)) + i];
+		}
+	}
+	
+	free(bf.histograms);
+}
+
+static double percentage_of(long long n, long long total){
+	return total > 0 ? (100.0 * (double)n) / (double)total : 0;
+}
+
+void hash_table_print_lookup_stats(HashTable * hash_table)
+{
+	HashTableLookupStats counts;
+	long long * fill = calloc(hash_table->bucket_size + 1, sizeof(long long));
+	int most = 0;
+	int width;
+	int i, j;
+	
+	if (fill == NULL) {
+		printf("Error: can't allocate memory for bucket fill\n");
+		exit(1);
+	}
+	
+	hash_table_get_lookup_stats(&counts);
+	hash_table_bucket_fill(fill, hash_table);
+	
+	//group fills up to the fullest bucket into at most HASH_TABLE_FILL_ROWS rows
+	for (i=0; i<=hash_table->bucket_size; i++) {
+		if (fill[i] != 0) {
+			most = i;
+		}
+	}
+	width = (most + HASH_TABLE_FILL_ROWS) / HASH_TABLE_FILL_ROWS;
+	
+	log_and_screen_printf("Hash lookups:\n");
+	log_and_screen_printf(" Lookups: %'lld\n", counts.lookups);
+	log_and_screen_printf(" Hits: %'lld (%3.2f%%)\n", counts.hits, percentage_of(counts.hits, counts.lookups));
+	log_and_screen_printf(" Slots probed per lookup: %.2f (max %'lld)\n", counts.lookups > 0 ? (double)counts.slots_probed / (double)counts.lookups : 0.0, counts.max_slots_probed);
+	log_and_screen_printf(" Slots probed:\n");
+	for (i=0; i<HASH_TABLE_PROBE_BINS; i++) {
+		if (counts.slots_probed_bins[i] != 0) {
+			long long low = i == 0 ? 0 : 1LL << (i - 1);
+			long long high = i == 0 ? 0 : (1LL << i) - 1;
+			
+			if (i == HASH_TABLE_PROBE_BINS - 1) {
+				log_and_screen_printf("\t %'lld+: %'lld (%3.2f%%)\n", low, counts.slots_probed_bins[i], percentage_of(counts.slots_probed_bins[i], counts.lookups));
+			} else if (low == high) {
+				log_and_screen_printf("\t %'lld: %'lld (%3.2f%%)\n", low, counts.slots_probed_bins[i], percentage_of(counts.slots_probed_bins[i], counts.lookups));
+			} else {
+				log_and_screen_printf("\t %'lld-%'lld: %'lld (%3.2f%%)\n", low, high, counts.slots_probed_bins[i], percentage_of(counts.slots_probed_bins[i], counts.lookups));
+			}
+		}
+	}
+	log_and_screen_printf(" Buckets searched (0 = rejected by Bloom filter):\n");
+	for (i=0; i<HASH_TABLE_LOOKUP_DEPTHS; i++) {
+		if (counts.buckets_searched[i] != 0) {
+			log_and_screen_printf("\t %d%s: %'lld (%3.2f%%)\n", i, i == HASH_TABLE_LOOKUP_DEPTHS - 1 ? "+" : "", counts.buckets_searched[i], percentage_of(counts.buckets_searched[i], counts.lookups));
+		}
+	}
+	log_and_screen_printf(" Bucket fill (elements: buckets):\n");
+	for (i=0; i<=most; i+=width) {
+		int last = i + width - 1 < most ? i + width - 1 : most;
+		long long buckets = 0;
+		
+		for (j=i; j<=last; j++) {
+			buckets += fill[j];
+		}
+		if (buckets != 0) {
+			if (last == i) {
+				log_and_screen_printf("\t %d: %'lld (%3.2f%%)\n", i, buckets, percentage_of(buckets, hash_table->number_buckets));
+			} else {
+				log_and_screen_printf("\t %d-%d: %'lld (%3.2f%%)\n", i, last, buckets, percentage_of(buckets, hash_table->number_buckets));
+			}
+		}
+	}
+	
+	free(fill);
+}
+
 long long hash_table_get_unique_kmers(HashTable * hash_table)
 {
 	return hash_table->unique_kmers;
@@ -771,6 +771,34 @@ uint32_t hashbig( const void *key, size_t length, uint32_t initval)
 }
 
 
+/*
+ The table hashes below replace hashlittle for bucket selection. A key is
+ one to four 64 bit words, so rather than hashing it as a byte string the
+ words are folded with a multiply and finished with the murmur3 64 bit
+ mixer (two multiply-xorshift rounds), which avalanches every input bit.
+
+ Rehashing used to add the attempt number to the key and hash it again
+ from scratch. Now the low bits of the one hash pick the first bucket and
+ the high bits give an odd step, so attempt r is first + r*step: double
+ hashing, and with a power of 2 number of buckets an odd step visits
+ every bucket before repeating.
+
+ The hash itself is hash_value_64_inline in hash_value.h, so the batch
+ kernels (kmer_kernels.c) inline exactly the same function.
+ */
+uint64_t hash_value_64(Key key){
+
+  return hash_value_64_inline(key);
+
+}
+
+long long hash_value_bucket(uint64_t hash, int rehash, long long number_buckets){
+
+  uint64_t step = (hash >> 32) | 1;
+  return (long long)((hash + (uint64_t)rehash * step) & (uint64_t)(number_buckets - 1));
+
+}
+
 int hash_value(Key key, int number_buckets){
 
   int hashval = hashlittle( key,    NUMBER_OF_BITFIELDS_IN_BINARY_KMER*sizeof(bitfield_of_64bits),10);
@@ -0,0 +1,274 @@
+/*----------------------------------------------------------------------*
+ * File:    key_index.c                                                 *
+ * Purpose: Cache line aligned array of keys, probed instead of the     *
+ *          packed elements of a frozen table                           *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Element is packed, so with k <= 31 a slot is 12 bytes: keys straddle
+   cache lines, 64 bit loads are unaligned, and a bucket search drags
+   the flags and contaminant bits of every slot it passes through the
+   cache.
+
+   Once the contaminants are loaded the keys don't change, so the keys
+   are copied into a structure of arrays: each bucket's keys are
+   contiguous and the bucket starts on a cache line. Searching a bucket
+   reads only keys; the Element array is still the payload (flags,
+   contaminant bits, coverage) and is touched once, for a hit. Slot i
+   of a bucket here is slot i of the same bucket in the table, so a hit
+   maps straight back to its Element. With b <= 8 (k <= 31) a bucket's
+   keys fit in one cache line.
+
+   Empty slots hold all ones, which no kmer can be because k is less
+   than 32 per bitfield, so the search stops at the first empty slot
+   exactly as hash_table_find_in_bucket stops at an unassigned element.
+   A bucket is searched by kmer_kernels.probe_bucket, which with one
+   bitfield compares 2, 4 or 8 keys at a time with SSE4.2, AVX2 or
+   AVX-512.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "hash_value.h"
+#include "key_index.h"
+#include "kmer_kernels.h"
+#include "table_memory.h"
+
+/*----------------------------------------------------------------------*
+ * Function:   keys_equal
+ * Purpose:    Compare two keys, inline for the bucket search
+ * Parameters: a -> key
+ *             b -> key
+ * Returns:    true if the same
+ *----------------------------------------------------------------------*/
+static inline boolean keys_equal(BinaryKmer* a, BinaryKmer* b)
+{
+    int i;
+
+    for (i=0; i<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; i++) {
+        if ((*a)[i] != (*b)[i]) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   key_index_allocate
+ * Purpose:    Allocate the key array, aligned to a cache line
+ * Parameters: index -> index, with number_buckets and stride set
+ *             node = NUMA node, or TABLE_MEMORY_ANY_NODE for the
+ *                    table's usual placement
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void key_index_allocate(KeyIndex* index, int node)
+{
+    size_t bytes = index->number_buckets * index->stride * sizeof(BinaryKmer);
+
+    if (node == TABLE_MEMORY_ANY_NODE) {
+        index->memory = table_memory_alloc(bytes + KEY_INDEX_ALIGNMENT, &index->memory_mode, &index->memory_bytes);
+    } else {
+        index->memory = table_memory_alloc_on_node(bytes + KEY_INDEX_ALIGNMENT, node, &index->memory_mode, &index->memory_bytes);
+    }
+
+    if (!index->memory) {
+        printf("Error: can't allocate %ld bytes for key index\n", (long)bytes);
+        exit(1);
+    }
+
+    index->keys = (BinaryKmer*)(((uintptr_t)index->memory + KEY_INDEX_ALIGNMENT - 1) & ~((uintptr_t)KEY_INDEX_ALIGNMENT - 1));
+}
+
+// Shared by the threads copying keys into a new index
+typedef struct {
+    KeyIndex* index;
+    HashTable* hash_table;
+} KeyIndexBuilder;
+
+/*----------------------------------------------------------------------*
+ * Function:   key_index_add_element
+ * Purpose:    Traverse callback to copy an element's key into the same
+ *             slot of the index. Slots are distinct, so threads don't
+ *             need to coordinate.
+ * Parameters: e -> element
+ *             data -> KeyIndexBuilder
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void key_index_add_element(Element* e, void* data)
+{
+    KeyIndexBuilder* builder = (KeyIndexBuilder*)data;
+    KeyIndex* index = builder->index;
+    long long position = hash_table_array_index_of_element(e, builder->hash_table);
+    long long bucket = position / index->bucket_size;
+    long long slot = position % index->bucket_size;
+    int i;
+
+    for (i=0; i<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; i++) {
+        index->keys[(bucket * index->stride) + slot][i] = e->kmer[i];
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   key_index_new_from_hash_table
+ * Purpose:    Copy the keys of a loaded table into a key index
+ * Parameters: hash_table -> table
+ *             progress = true to draw a progress bar on stdout
+ * Returns:    Pointer to index
+ *----------------------------------------------------------------------*/
+KeyIndex* key_index_new_from_hash_table(HashTable* hash_table, boolean progress)
+{
+    KeyIndex* index = calloc(1, sizeof(KeyIndex));
+    KeyIndexBuilder builder;
+
+    if (!index) {
+        printf("Error: can't allocate memory for key index\n");
+        exit(1);
+    }
+
+    // Pad buckets so each starts on a cache line
+    index->number_buckets = hash_table->number_buckets;
+    index->bucket_size = hash_table->bucket_size;
+    index->stride = hash_table->bucket_size;
+    while ((index->stride * sizeof(BinaryKmer)) % KEY_INDEX_ALIGNMENT != 0) {
+        index->stride++;
+    }
+
+    key_index_allocate(index, TABLE_MEMORY_ANY_NODE);
+    memset(index->keys, 0xFF, index->number_buckets * index->stride * sizeof(BinaryKmer));
+
+    builder.index = index;
+    builder.hash_table = hash_table;
+    if (progress) {
+        hash_table_parallel_traverse(key_index_add_element, NULL, NULL, &builder, hash_table);
+    } else {
+        hash_table_parallel_traverse_quiet(key_index_add_element, NULL, NULL, &builder, hash_table);
+    }
+
+    return index;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   key_index_copy_on_node
+ * Purpose:    Copy an index into memory on a NUMA node
+ * Parameters: index -> index to copy
+ *             node = node index (see numa_layout.c)
+ * Returns:    Pointer to copy
+ *----------------------------------------------------------------------*/
+KeyIndex* key_index_copy_on_node(KeyIndex* index, int node)
+{
+    KeyIndex* copy = malloc(sizeof(KeyIndex));
+    size_t bytes = index->number_buckets * index->stride * sizeof(BinaryKmer);
+
+    if (!copy) {
+        printf("Error: can't allocate memory for key index\n");
+        exit(1);
+    }
+
+    *copy = *index;
+    key_index_allocate(copy, node);
+    memcpy(copy->keys, index->keys, bytes);
+
+    return copy;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   key_index_free
+ * Purpose:    Free an index
+ * Parameters: index -> pointer to index pointer, set to NULL
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void key_index_free(KeyIndex** index)
+{
+    if (*index) {
+        table_memory_free((*index)->memory, (*index)->memory_bytes, (*index)->memory_mode);
+        free(*index);
+        *index = NULL;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   key_index_search
+ * Purpose:    Find a key, following the same buckets and rehashes as
+ *             hash_table_find. Always inlined with a constant counting,
+ *             so key_index_find has none of the counting code.
+ * Parameters: index -> index
+ *             key -> kmer key
+ *             hash = hash_value_64 of key
+ *             hash_table -> table the index was built from (or a copy)
+ *             counting = true to set buckets and slots
+ *             buckets -> set to number of buckets searched
+ *             slots -> set to number of slots compared
+ * Returns:    Element for key, or NULL if not present
+ *----------------------------------------------------------------------*/
+static inline __attribute__((always_inline)) Element* key_index_search(KeyIndex* index, Key key, uint64_t hash, HashTable* hash_table, const boolean counting, int* buckets, long long* slots)
+{
+    int rehash;
+
+    if (counting) {
+        *slots = 0;
+    }
+    for (rehash=0; rehash<=hash_table->max_rehash_tries; rehash++) {
+        long long bucket = hash_value_bucket(hash, rehash, index->number_buckets);
+        BinaryKmer* keys = &(index->keys[bucket * index->stride]);
+        int slot = kmer_kernels.probe_bucket(keys, index->bucket_size, key);
+
+        if (counting) {
+            *buckets = rehash + 1;
+            *slots += slot < index->bucket_size ? slot + 1 : index->bucket_size;
+        }
+        if (slot < index->bucket_size) {
+            if (keys_equal(&(keys[slot]), key)) {
+                return &(hash_table->table[(bucket * index->bucket_size) + slot]);
+            }
+            return NULL;
+        }
+    }
+
+    fprintf(stderr,"too much rehashing!! Rehash=%d\n", rehash);
+    exit(1);
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   key_index_find
+ * Purpose:    Find a key, following the same buckets and rehashes as
+ *             hash_table_find.
+ * Parameters: index -> index
+ *             key -> kmer key
+ *             hash = hash_value_64 of key
+ *             hash_table -> table the index was built from (or a copy)
+ * Returns:    Element for key, or NULL if not present
+ *----------------------------------------------------------------------*/
+Element* key_index_find(KeyIndex* index, Key key, uint64_t hash, HashTable* hash_table)
+{
+    return key_index_search(index, key, hash, hash_table, false, NULL, NULL);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   key_index_find_probed
+ * Purpose:    As key_index_find, also giving how far the search went,
+ *             for counting lookups
+ * Parameters: index -> index
+ *             key -> kmer key
+ *             hash = hash_value_64 of key
+ *             hash_table -> table the index was built from (or a copy)
+ *             buckets -> set to number of buckets searched
+ *             slots -> set to number of slots compared
+ * Returns:    Element for key, or NULL if not present
+ *----------------------------------------------------------------------*/
+Element* key_index_find_probed(KeyIndex* index, Key key, uint64_t hash, HashTable* hash_table, int* buckets, long long* slots)
+{
+    return key_index_search(index, key, hash, hash_table, true, buckets, slots);
+}
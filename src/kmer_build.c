@@ -16,6 +16,7 @@
 #include "cmd_line.h"
 #include "kmer_stats.h"
 #include "kmer_reader.h"
+#include "kmer_shard.h"
 
 /*----------------------------------------------------------------------*
  * Function:
@@ -52,22 +53,34 @@ void load_reads_into_table(CmdLine* cmd_line,  HashTable* kmer_hash)
 }
 
 typedef struct {
-    long long kmers_dumped;
-    FILE* fout;
     int kmer_size;
+    int shard;
+    int n_shards;
 } PrintNodeBinaryStruct;
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters: None
- * Returns:    None
+ * Function:   in_dumped_shard
+ * Purpose:    Select kmers belonging to the shard being dumped
+ * Parameters: node -> element
+ *             data -> PrintNodeBinaryStruct
+ * Returns:    true if the kmer is dumped
  *----------------------------------------------------------------------*/
-void print_node_binary(Element* node, void* data) {
+static boolean in_dumped_shard(Element* node, void* data) {
     PrintNodeBinaryStruct* pnb = (PrintNodeBinaryStruct*)data;
-    db_node_print_binary(pnb->fout, node, pnb->kmer_size);
-    pnb->kmers_dumped++;
-    //printf("k=%d\n", pnb->kmer_size);
+
+    return (pnb->n_shards == 1) || (kmer_shard_of_key(element_get_kmer(node), pnb->n_shards) == pnb->shard);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   print_node_binary
+ * Purpose:    Write a kmer to a library file
+ * Parameters: node -> element
+ *             fout -> file, positioned for this kmer
+ *             data -> PrintNodeBinaryStruct
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void print_node_binary(Element* node, FILE* fout, void* data) {
+    db_node_print_binary(fout, node, ((PrintNodeBinaryStruct*)data)->kmer_size);
 }
 
 /*----------------------------------------------------------------------*
@@ -78,11 +91,12 @@ void print_node_binary(Element* node, void* data) {
  *----------------------------------------------------------------------*/
 void dump_kmer_hash(CmdLine* cmd_line, HashTable * kmer_hash)
 {
-    char* output_filename = malloc(strlen(cmd_line->input_filename_one) + 16);
+    char* output_filename = malloc(strlen(cmd_line->input_filename_one) + 64);
     KmerLibraryHeader* header = calloc(1, sizeof(KmerLibraryHeader));
     PrintNodeBinaryStruct pnb;
-    
-    pnb.kmers_dumped = 0;
+    long long kmers_dumped;
+    FILE* fout;
+    int shard;
     
     if (!header) {
         printf("Error: can't allocate room for header\n");
@@ -96,21 +110,37 @@ void dump_kmer_hash(CmdLine* cmd_line, HashTable * kmer_hash)
     header->num_bitfields = NUMBER_OF_BITFIELDS_IN_BINARY_KMER;
     header->num_kmers = (uint32_t)kmer_hash->unique_kmers;
 
-    sprintf(output_filename, "%s.%d.kmers", cmd_line->input_filename_one, cmd_line->kmer_size);
+    pnb.kmer_size = kmer_hash->kmer_size;
+    pnb.n_shards = cmd_line->n_shards;
+    
+    // With -H, one file per shard, each holding the kmers that hash to it.
+    // The header is written first, then the table's blocks write their
+    // kmers in parallel, each from its own position in the file.
+    for (shard=0; shard<cmd_line->n_shards; shard++) {
+        pnb.shard = shard;
+
+        if (cmd_line->n_shards > 1) {
+            sprintf(output_filename, "%s.%d.shard%dof%d.kmers", cmd_line->input_filename_one, cmd_line->kmer_size, shard + 1, cmd_line->n_shards);
+            header->num_kmers = (uint32_t)hash_table_parallel_count(&in_dumped_shard, (void*)&pnb, kmer_hash);
+        } else {
+            sprintf(output_filename, "%s.%d.kmers", cmd_line->input_filename_one, cmd_line->kmer_size);
+        }
     
-    printf("\nDumping hash table to file: %s\n", output_filename);
+        printf("\nDumping hash table to file: %s\n", output_filename);
 
-    pnb.fout = fopen(output_filename, "wb");
-	if (pnb.fout == NULL) {
-		fprintf(stderr, "Error: cannot open %s", output_filename);
-		exit(1);
-	}
+        fout = fopen(output_filename, "wb");
+        if (fout == NULL) {
+            fprintf(stderr, "Error: cannot open %s", output_filename);
+            exit(1);
+        }
     
-    fwrite(header, sizeof(KmerLibraryHeader), 1, pnb.fout);
+        fwrite(header, sizeof(KmerLibraryHeader), 1, fout);
+        fclose(fout);
     
-    hash_table_traverse_with_data(&print_node_binary, (void*)&pnb, kmer_hash);
+        kmers_dumped = hash_table_parallel_write(output_filename, sizeof(KmerLibraryHeader), NUMBER_OF_BITFIELDS_IN_BINARY_KMER * sizeof(bitfield_of_64bits),
+                                                 &in_dumped_shard, &print_node_binary, (void*)&pnb, kmer_hash);
     
-	fclose(pnb.fout);
-    fflush(stdout);
-	printf("%'lld kmers dumped\n", pnb.kmers_dumped);
+        fflush(stdout);
+        printf("%'lld kmers dumped\n", kmers_dumped);
+    }
 }
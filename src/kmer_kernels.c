@@ -0,0 +1,141 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_kernels.c                                              *
+ * Purpose: Hot kmer loops, built for several instruction sets and      *
+ *          chosen at startup                                           *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   One build has to run on every node, so it is compiled for the oldest
+   instruction set. The loops screening spends its time in - turning
+   bases into kmers, making canonical keys, hashing them, searching key
+   index buckets and listing a kmer's contaminants - are compiled here
+   again for SSE4.2, AVX2 and AVX-512 (the bodies are in
+   kmer_kernels_impl.h), and kmer_kernels_initialise picks the best the
+   CPU supports. Callers go through the kmer_kernels table.
+
+   All versions give identical results, so the choice only affects
+   speed. Setting KONTAMINANT_KERNELS to scalar, sse4.2 or avx2 forces a
+   lower level, for comparing them.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_value.h"
+#include "kmer_kernels.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define KMER_KERNELS_X86
+#include <immintrin.h>
+#endif
+
+#define KERNEL_SUFFIX scalar
+#include "kmer_kernels_impl.h"
+#undef KERNEL_SUFFIX
+
+#ifdef KMER_KERNELS_X86
+#pragma GCC push_options
+#pragma GCC target("sse4.2,popcnt")
+#define KERNEL_SUFFIX sse42
+#define KERNEL_SSE42
+#include "kmer_kernels_impl.h"
+#undef KERNEL_SSE42
+#undef KERNEL_SUFFIX
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx2,bmi,bmi2,popcnt,sse4.2")
+#define KERNEL_SUFFIX avx2
+#define KERNEL_AVX2
+#include "kmer_kernels_impl.h"
+#undef KERNEL_AVX2
+#undef KERNEL_SUFFIX
+#pragma GCC pop_options
+
+#pragma GCC push_options
+#pragma GCC target("avx512f,avx512bw,avx512dq,avx512vl,avx2,bmi,bmi2,popcnt,sse4.2")
+#define KERNEL_SUFFIX avx512
+#define KERNEL_AVX512
+#include "kmer_kernels_impl.h"
+#undef KERNEL_AVX512
+#undef KERNEL_SUFFIX
+#pragma GCC pop_options
+#endif
+
+#define KMER_KERNELS_ENTRY(name, suffix) { name, encode_bases_##suffix, roll_kmers_##suffix, canonical_keys_##suffix, hash_keys_##suffix, probe_bucket_##suffix, contaminant_set_members_##suffix }
+
+static KmerKernels all_kernels[KMER_KERNELS_LEVELS] = {
+    KMER_KERNELS_ENTRY("scalar", scalar),
+#ifdef KMER_KERNELS_X86
+    KMER_KERNELS_ENTRY("sse4.2", sse42),
+    KMER_KERNELS_ENTRY("avx2", avx2),
+    KMER_KERNELS_ENTRY("avx512", avx512)
+#endif
+};
+
+// Usable before kmer_kernels_initialise, eg. by hash_bench
+KmerKernels kmer_kernels = KMER_KERNELS_ENTRY("scalar", scalar);
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_kernels_supported
+ * Purpose:    Find the best level this CPU can run
+ * Parameters: None
+ * Returns:    KMER_KERNELS_ level
+ *----------------------------------------------------------------------*/
+static int kmer_kernels_supported(void)
+{
+#ifdef KMER_KERNELS_X86
+    __builtin_cpu_init();
+
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") &&
+        __builtin_cpu_supports("avx512dq") && __builtin_cpu_supports("avx512vl") &&
+        __builtin_cpu_supports("bmi2")) {
+        return KMER_KERNELS_AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi2") && __builtin_cpu_supports("popcnt")) {
+        return KMER_KERNELS_AVX2;
+    }
+    if (__builtin_cpu_supports("sse4.2") && __builtin_cpu_supports("popcnt")) {
+        return KMER_KERNELS_SSE42;
+    }
+#endif
+
+    return KMER_KERNELS_SCALAR;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_kernels_initialise
+ * Purpose:    Choose the kernels for this CPU, or the level named by
+ *             KONTAMINANT_KERNELS if lower.
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_kernels_initialise(void)
+{
+    char* requested = getenv(KMER_KERNELS_ENVIRONMENT);
+    int level = kmer_kernels_supported();
+    int i;
+
+    if ((requested != NULL) && (*requested != 0)) {
+        for (i=0; i<=level; i++) {
+            if (strcmp(requested, all_kernels[i].name) == 0) {
+                break;
+            }
+        }
+        if (i <= level) {
+            level = i;
+        } else {
+            printf("Warning: %s=%s isn't a level this CPU supports, using %s.\n", KMER_KERNELS_ENVIRONMENT, requested, all_kernels[level].name);
+        }
+    }
+
+    kmer_kernels = all_kernels[level];
+}
@@ -0,0 +1,324 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_live.c                                                 *
+ * Purpose: Live stats published in a memory mapped file for monitors   *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   While screening with -p, <progress dir>/live_stats.bin holds the
+   running counts, updated every KMER_LIVE_INTERVAL_MS by a thread of its
+   own. The screening threads don't know about it: the publisher reads
+   the KmerStats counters as they are being updated, so an update can be
+   a read or two out between fields, but never torn. Monitors map or
+   read the file and use the sequence number (see kmer_live.h) to get a
+   consistent copy, without any lock the writer could wait on. Putting
+   the progress directory in /dev/shm keeps the segment off disk.
+
+   The file is built under a temporary name and renamed into place, so a
+   monitor never sees it without a header.
+
+   The same thread rewrites the text progress files (data_overall_r*.txt,
+   data_per_contaminant_r*.txt and largest_contaminant_r*.txt) every -w
+   seconds, and once more at the end.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "cmd_line.h"
+#include "kmer_stats.h"
+#include "kmer_live.h"
+
+typedef struct {
+    KmerLiveHeader* header;
+    KmerLiveContaminant* contaminants;
+    uint64_t* sequence_end;
+    size_t size;
+    KmerStats* stats;
+    CmdLine* cmd_line;
+    double start;
+    double progress_previous;
+    double previous_time;
+    uint64_t previous_reads;
+    pthread_t publisher;
+    pthread_mutex_t lock;
+    pthread_mutex_t stop_lock;
+    pthread_cond_t stop_signal;
+    boolean stop;
+} KmerLive;
+
+static KmerLive* live = NULL;
+
+/*----------------------------------------------------------------------*
+ * Function:   live_clock
+ * Purpose:    Read a clock
+ * Parameters: clock_id = clock
+ * Returns:    Seconds
+ *----------------------------------------------------------------------*/
+static double live_clock(clockid_t clock_id)
+{
+    struct timespec now;
+
+    clock_gettime(clock_id, &now);
+
+    return (double)now.tv_sec + ((double)now.tv_nsec / 1e9);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   copy_stats
+ * Purpose:    Copy counters from stats into the segment. Only called
+ *             between the odd and even sequence numbers.
+ * Parameters: state = KMER_LIVE_RUNNING or KMER_LIVE_FINISHED
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void copy_stats(uint32_t state)
+{
+    KmerLiveHeader* h = live->header;
+    KmerStats* stats = live->stats;
+    HashTableLookupStats lookups;
+    double now = live_clock(CLOCK_MONOTONIC);
+    uint64_t reads = 0;
+    uint64_t lookups_made = 0;
+    int i, r;
+
+    for (r=0; r<2; r++) {
+        KmerStatsReadCounts* read = stats->read[r];
+
+        h->read[r].number_of_reads = read->number_of_reads;
+        h->read[r].k1_contaminated_reads = read->k1_contaminated_reads;
+        h->read[r].kn_contaminated_reads = read->kn_contaminated_reads;
+        h->read[r].reads_unclassified = read->reads_unclassified;
+        h->read[r].kmers_looked_up = read->kmers_looked_up;
+        reads += read->number_of_reads;
+        lookups_made += read->kmers_looked_up;
+    }
+
+    for (i=0; i<(int)h->n_contaminants; i++) {
+        KmerLiveContaminant* c = &(live->contaminants[i]);
+
+        c->library_kmers = stats->contaminant_kmers[i];
+        for (r=0; r<2; r++) {
+            c->kn_contaminated_reads[r] = stats->read[r]->kn_contaminated_reads_by_contaminant[i];
+            c->reads_with_highest_contaminant[r] = stats->read[r]->reads_with_highest_contaminant[i];
+            c->contaminant_kmers_seen[r] = stats->read[r]->contaminant_kmers_seen[i];
+        }
+        c->threshold_passed_pairs = stats->both_reads->threshold_passed_reads_by_contaminant[i];
+    }
+
+    h->pairs = stats->both_reads->number_of_reads;
+    h->threshold_passed_pairs = stats->both_reads->threshold_passed_reads;
+
+    if (hash_table_counting_lookups()) {
+        hash_table_get_lookup_stats(&lookups);
+        h->hash_lookups = lookups.lookups;
+        h->hash_hits = lookups.hits;
+        h->hash_slots_probed = lookups.slots_probed;
+    }
+
+    h->state = state;
+    h->updates++;
+    h->update_time = live_clock(CLOCK_REALTIME);
+    h->elapsed = now - live->start;
+    h->reads_per_second = h->elapsed > 0 ? (double)reads / h->elapsed : 0;
+    h->kmer_lookups_per_second = h->elapsed > 0 ? (double)lookups_made / h->elapsed : 0;
+    // The final update follows straight on from the last one, so would
+    // give a meaningless recent rate
+    if ((state == KMER_LIVE_RUNNING) && (now > live->previous_time)) {
+        h->recent_reads_per_second = (double)(reads - live->previous_reads) / (now - live->previous_time);
+        live->previous_time = now;
+        live->previous_reads = reads;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   publish
+ * Purpose:    Write an update to the segment
+ * Parameters: state = KMER_LIVE_RUNNING or KMER_LIVE_FINISHED
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void publish(uint32_t state)
+{
+    uint64_t sequence;
+
+    pthread_mutex_lock(&(live->lock));
+
+    sequence = live->header->sequence;
+    __atomic_store_n(&(live->header->sequence), sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    copy_stats(state);
+
+    __atomic_store_n(&(live->header->sequence), sequence + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(live->sequence_end, sequence + 2, __ATOMIC_RELEASE);
+
+    pthread_mutex_unlock(&(live->lock));
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   publisher_thread
+ * Purpose:    Publish an update every KMER_LIVE_INTERVAL_MS, and write
+ *             the progress files every progress_delay seconds, until
+ *             stopped
+ * Parameters: data -> unused
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* publisher_thread(void* data)
+{
+    struct timespec wake;
+    double now;
+
+    pthread_mutex_lock(&(live->stop_lock));
+    while (!live->stop) {
+        clock_gettime(CLOCK_REALTIME, &wake);
+        wake.tv_nsec += KMER_LIVE_INTERVAL_MS * 1000000L;
+        if (wake.tv_nsec >= 1000000000L) {
+            wake.tv_sec += wake.tv_nsec / 1000000000L;
+            wake.tv_nsec = wake.tv_nsec % 1000000000L;
+        }
+        pthread_cond_timedwait(&(live->stop_signal), &(live->stop_lock), &wake);
+        if (!live->stop) {
+            publish(KMER_LIVE_RUNNING);
+            now = live_clock(CLOCK_MONOTONIC);
+            if ((now - live->progress_previous) > live->cmd_line->progress_delay) {
+                kmer_stats_write_progress(live->stats, live->cmd_line);
+                live->progress_previous = now;
+            }
+        }
+    }
+    pthread_mutex_unlock(&(live->stop_lock));
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_live_start
+ * Purpose:    Create the segment and start publishing to it
+ * Parameters: filename -> segment file
+ *             stats -> stats being screened into
+ *             cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_live_start(char* filename, KmerStats* stats, CmdLine* cmd_line)
+{
+    char* temp_filename;
+    void* memory;
+    int fd;
+    int i;
+
+    if (live != NULL) {
+        kmer_live_stop();
+    }
+
+    live = calloc(1, sizeof(KmerLive));
+    temp_filename = malloc(strlen(filename) + 16);
+    if ((!live) || (!temp_filename)) {
+        printf("Error: can't allocate memory for live stats.\n");
+        exit(1);
+    }
+
+    live->size = sizeof(KmerLiveHeader) + (stats->n_contaminants * sizeof(KmerLiveContaminant)) + sizeof(uint64_t);
+
+    sprintf(temp_filename, "%s.%d", filename, (int)getpid());
+    fd = open(temp_filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        printf("Error: can't open %s (%s).\n", temp_filename, strerror(errno));
+        exit(1);
+    }
+    if (ftruncate(fd, live->size) != 0) {
+        printf("Error: can't size %s (%s).\n", temp_filename, strerror(errno));
+        exit(1);
+    }
+    memory = mmap(NULL, live->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        printf("Error: can't map %s (%s).\n", temp_filename, strerror(errno));
+        exit(1);
+    }
+
+    live->header = memory;
+    live->contaminants = (KmerLiveContaminant*)((char*)memory + sizeof(KmerLiveHeader));
+    live->sequence_end = (uint64_t*)((char*)memory + live->size - sizeof(uint64_t));
+    live->stats = stats;
+    live->cmd_line = cmd_line;
+    live->start = live_clock(CLOCK_MONOTONIC);
+    live->previous_time = live->start;
+    live->progress_previous = live->start;
+    pthread_mutex_init(&(live->lock), NULL);
+    pthread_mutex_init(&(live->stop_lock), NULL);
+    pthread_cond_init(&(live->stop_signal), NULL);
+
+    // The mapping starts zeroed, so sequence is 0
+    memcpy(live->header->magic, KMER_LIVE_MAGIC, 8);
+    live->header->version = KMER_LIVE_VERSION;
+    live->header->header_size = sizeof(KmerLiveHeader);
+    live->header->contaminant_size = sizeof(KmerLiveContaminant);
+    live->header->n_contaminants = stats->n_contaminants;
+    live->header->pid = (uint32_t)getpid();
+    live->header->number_of_files = stats->number_of_files;
+    live->header->kmer_threshold_read = cmd_line->kmer_threshold_read;
+    live->header->start_time = live_clock(CLOCK_REALTIME);
+    for (i=0; i<stats->n_contaminants; i++) {
+        strncpy(live->contaminants[i].name, stats->contaminant_ids[i], KMER_LIVE_NAME_LENGTH - 1);
+    }
+    publish(KMER_LIVE_RUNNING);
+
+    if (rename(temp_filename, filename) != 0) {
+        printf("Error: can't rename %s to %s (%s).\n", temp_filename, filename, strerror(errno));
+        exit(1);
+    }
+    free(temp_filename);
+
+    kmer_stats_write_progress(stats, cmd_line);
+
+    if (pthread_create(&(live->publisher), NULL, publisher_thread, NULL) != 0) {
+        printf("Error: can't start live stats thread.\n");
+        exit(1);
+    }
+
+    printf("Publishing live stats to %s\n", filename);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_live_stop
+ * Purpose:    Stop the publisher, leaving the final counts in the
+ *             segment marked finished and in the progress files
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_live_stop(void)
+{
+    if (live == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(live->stop_lock));
+    live->stop = true;
+    pthread_cond_signal(&(live->stop_signal));
+    pthread_mutex_unlock(&(live->stop_lock));
+    pthread_join(live->publisher, NULL);
+
+    publish(KMER_LIVE_FINISHED);
+    kmer_stats_write_progress(live->stats, live->cmd_line);
+
+    munmap(live->header, live->size);
+    pthread_mutex_destroy(&(live->lock));
+    pthread_mutex_destroy(&(live->stop_lock));
+    pthread_cond_destroy(&(live->stop_signal));
+    free(live);
+    live = NULL;
+}
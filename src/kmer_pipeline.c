@@ -0,0 +1,1262 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_pipeline.c                                             *
+ * Purpose: Pipelined screening of FASTQ and FASTA, filtering of FASTQ  *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Batches of read pairs move through five stages:
+     reader - one thread, copies raw FASTQ records from the input files
+     parse  - parses records and turns them into kmer keys
+     lookup - looks the keys up in the contaminant table
+     merge  - one thread, updates statistics in input order
+     writer - one thread, writes kept/removed reads (filtering only)
+   Batches come from a fixed pool, so the queues between stages can never
+   hold more than the pool and a slow stage holds the reader back rather
+   than letting memory grow. Parse and lookup are run by a shared set of
+   workers which take from whichever queue is longer, unless fixed counts
+   are given with -P parse:lookup.
+
+   FASTA files, and FASTQ long reads with -L, go through the same stages,
+   except that a batch holds windows of -W bases streamed from the
+   sequences instead of read pairs, and the merge stage writes the window
+   and contig/read tables in place of the writer.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <pthread.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "cmd_line.h"
+#include "kmer_stats.h"
+#include "kmer_reader.h"
+#include "kmer_pipeline.h"
+#include "read_cache.h"
+#include "kmer_shard.h"
+#include "numa_layout.h"
+#include "kmer_kernels.h"
+
+typedef struct {
+    size_t raw_offset;
+    size_t raw_length;
+    size_t name_offset;
+    size_t output_offset;
+    size_t kmer_offset;
+    int length;
+    int nkmers;
+    KmerCounts counts;
+    uint64_t hash[2];
+
+    // FASTA windows only
+    long long start;
+    long long end;
+    boolean last_window;
+} PipelineRead;
+
+typedef struct PipelineBatch {
+    long int id;
+    int n_pairs;
+    PipelineRead reads[2][PIPELINE_BATCH_PAIRS];
+    SequenceBuffer raw[2];
+    SequenceBuffer text[2];
+    BinaryKmer* kmers[2];
+    uint64_t* hashes[2];
+    size_t kmers_capacity[2];
+    uint32_t kmers_seen[2][MAX_CONTAMINANTS];
+    uint32_t both_kmers_seen[MAX_CONTAMINANTS];
+    boolean filter[PIPELINE_BATCH_PAIRS];
+    struct PipelineBatch* next;
+} PipelineBatch;
+
+typedef struct {
+    PipelineBatch* head;
+    PipelineBatch* tail;
+    int count;
+} PipelineQueue;
+
+typedef enum {
+    WORKER_ANY,
+    WORKER_PARSE,
+    WORKER_LOOKUP
+} PipelineWorkerRole;
+
+typedef struct {
+    CmdLine* cmd_line;
+    KmerStats* stats;
+    HashTable* kmer_hash;
+    KmerFileReaderArgs* fra[2];
+    FILE* fp_in[2];
+    FILE* fp_out[2];
+    FILE* fp_removed[2];
+    FILE* fp_read_summary;
+    FILE* fp_shard_counts;
+    int number_of_files;
+    boolean filtering;
+
+    // Reader's sequence, for skipping unsampled records it can't just scan
+    Sequence* skip_seq;
+
+    // Windowed (FASTA and long read) only - reader's chunked file reader,
+    // and merge stage's tables and running totals for the current contig
+    // or read
+    KmerFileReaderWrapperArgs* frw;
+    FILE* fp_windows;
+    FILE* fp_contigs;
+    KmerCounts contig_counts;
+    uint32_t contig_window_classes[MAX_CONTAMINANTS];
+    long long contig_length;
+    long long contig_kmers;
+    int contig_windows;
+    long int contigs_screened;
+    long int contigs_mixed;
+    long long bases_read;
+
+    // Everything below is protected by lock
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    PipelineQueue free_batches;
+    PipelineQueue parse_queue;
+    PipelineQueue lookup_queue;
+    PipelineQueue merge_queue;
+    PipelineQueue write_queue;
+    boolean reading_done;
+    long int batches_read;
+    long int batches_parsed;
+    long int batches_looked_up;
+    long int batches_written;
+    long int pairs_read;
+} Pipeline;
+
+typedef struct {
+    Pipeline* pipeline;
+    PipelineWorkerRole role;
+    int index;
+    HashTable* kmer_hash;
+    long int parsed;
+    long int looked_up;
+    ReadCache* cache;
+} PipelineWorker;
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_queue_push
+ * Purpose:    Add batch to end of queue. Caller holds pipeline lock.
+ * Parameters: queue -> queue
+ *             batch -> batch
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_queue_push(PipelineQueue* queue, PipelineBatch* batch)
+{
+    batch->next = NULL;
+    if (queue->tail) {
+        queue->tail->next = batch;
+    } else {
+        queue->head = batch;
+    }
+    queue->tail = batch;
+    queue->count++;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_queue_remove
+ * Purpose:    Take batch from queue - the first one, or the one with the
+ *             given id. Caller holds pipeline lock.
+ * Parameters: queue -> queue
+ *             id = batch id wanted, or -1 for first
+ * Returns:    Pointer to batch, or NULL if not there
+ *----------------------------------------------------------------------*/
+static PipelineBatch* pipeline_queue_remove(PipelineQueue* queue, long int id)
+{
+    PipelineBatch* previous = NULL;
+    PipelineBatch* batch = queue->head;
+
+    while ((batch != NULL) && (id != -1) && (batch->id != id)) {
+        previous = batch;
+        batch = batch->next;
+    }
+
+    if (batch != NULL) {
+        if (previous) {
+            previous->next = batch->next;
+        } else {
+            queue->head = batch->next;
+        }
+        if (queue->tail == batch) {
+            queue->tail = previous;
+        }
+        batch->next = NULL;
+        queue->count--;
+    }
+
+    return batch;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_fill_batch
+ * Purpose:    Reader stage - fill batch with the next raw records
+ * Parameters: p -> pipeline
+ *             batch -> empty batch
+ * Returns:    true if there may be more records to read
+ *----------------------------------------------------------------------*/
+static boolean pipeline_fill_batch(Pipeline* p, PipelineBatch* batch)
+{
+    int i;
+
+    batch->n_pairs = 0;
+    for (i=0; i<p->number_of_files; i++) {
+        batch->raw[i].length = 0;
+    }
+
+    while (batch->n_pairs < PIPELINE_BATCH_PAIRS) {
+        size_t length[2] = {0, 0};
+        boolean sample_read = subsample_keep_read(p->pairs_read, p->cmd_line->subsample_ratio);
+
+        for (i=0; i<p->number_of_files; i++) {
+            if (sample_read) {
+                size_t start = batch->raw[i].length;
+
+                // A malformed record is kept for the parse stage to reject
+                if (scan_sequence_from_fastq(p->fp_in[i], &(batch->raw[i])) == 0) {
+                    batch->raw[i].length = start;
+                }
+                length[i] = batch->raw[i].length - start;
+                batch->reads[i][batch->n_pairs].raw_offset = start;
+                batch->reads[i][batch->n_pairs].raw_length = length[i];
+            } else {
+                length[i] = skip_sequence_from_fastq(p->fp_in[i], p->skip_seq, p->fra[i]->max_read_length) > 0 ? 1 : 0;
+            }
+        }
+
+        if ((p->number_of_files == 2) && ((length[0] == 0) != (length[1] == 0))) {
+            printf("Error: differing number of entries in files (%ld).\n", p->pairs_read);
+            return false;
+        }
+
+        if (length[0] == 0) {
+            return false;
+        }
+
+        p->pairs_read++;
+        if (sample_read) {
+            batch->n_pairs++;
+        }
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_fill_batch_fasta
+ * Purpose:    Reader stage for FASTA - fill batch with the next windows of
+ *             the current contig(s). Long sequences are read in chunks of
+ *             window size with the usual k base carry-over, of which the
+ *             first base is dropped so each kmer is in exactly one window.
+ * Parameters: p -> pipeline
+ *             batch -> empty batch
+ * Returns:    true if there may be more sequence to read
+ *----------------------------------------------------------------------*/
+static boolean pipeline_fill_batch_fasta(Pipeline* p, PipelineBatch* batch)
+{
+    KmerFileReaderWrapperArgs* frw = p->frw;
+    SequenceBuffer* raw = &(batch->raw[0]);
+
+    batch->n_pairs = 0;
+    raw->length = 0;
+
+    while ((batch->n_pairs < PIPELINE_BATCH_PAIRS) && (raw->length < PIPELINE_BATCH_BASES)) {
+        PipelineRead* read = &(batch->reads[0][batch->n_pairs]);
+        boolean continuation = frw->new_entry ? false : true;
+        int length;
+        char* start;
+
+        // Continuation chunks carry k bases over, so read k more to keep
+        // window boundaries on multiples of the window size
+        frw->max_read_length = p->cmd_line->window_size + (continuation ? frw->kmer_size : 0);
+        length = file_reader_wrapper(frw);
+        start = frw->seq->seq;
+
+        if (length == 0) {
+            return false;
+        }
+
+        if (continuation) {
+            start++;
+            length--;
+        }
+
+        read->name_offset = raw->length;
+        sequence_buffer_reserve(raw, strlen(frw->seq->name) + length + 2);
+        strcpy(raw->data + raw->length, frw->seq->name);
+        raw->length += strlen(frw->seq->name) + 1;
+
+        read->raw_offset = raw->length;
+        read->raw_length = length;
+        memcpy(raw->data + raw->length, start, length);
+        raw->length += length;
+        raw->data[raw->length++] = 0;
+
+        read->start = frw->seq->start;
+        read->end = frw->seq->end;
+        read->last_window = frw->full_entry;
+        batch->n_pairs++;
+        p->pairs_read++;
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_add_kmer_keys
+ * Purpose:    Add the kmer keys for a sequence to the batch
+ * Parameters: p -> pipeline
+ *             batch -> batch
+ *             r = file number
+ *             read -> read the keys belong to
+ *             seq -> bases
+ *             qual -> qualities
+ *             windows -> worker's sliding windows
+ *             kmers_used -> number of keys in batch so far, updated
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_add_kmer_keys(Pipeline* p, PipelineBatch* batch, int r, PipelineRead* read, char* seq, char* qual, KmerSlidingWindowSet* windows, size_t* kmers_used)
+{
+    short kmer_size = p->kmer_hash->kmer_size;
+    int w;
+
+    read->nkmers = 0;
+    read->kmer_offset = *kmers_used;
+
+    // Too short or all Ns leaves windows from the previous sequence in place
+    if (get_sliding_windows_from_sequence(seq, qual, read->length, p->fra[r]->quality_cut_off, kmer_size, windows, windows->max_nwindows, windows->max_kmers, false, 0) == 0) {
+        return;
+    }
+
+    for (w=0; w<windows->nwindows; w++) {
+        KmerSlidingWindow* window = &(windows->window[w]);
+
+        if ((*kmers_used + window->nkmers) > batch->kmers_capacity[r]) {
+            while ((*kmers_used + window->nkmers) > batch->kmers_capacity[r]) {
+                batch->kmers_capacity[r] = batch->kmers_capacity[r] ? batch->kmers_capacity[r] * 2 : 65536;
+            }
+            batch->kmers[r] = realloc(batch->kmers[r], batch->kmers_capacity[r] * sizeof(BinaryKmer));
+            batch->hashes[r] = realloc(batch->hashes[r], batch->kmers_capacity[r] * sizeof(uint64_t));
+            if ((!batch->kmers[r]) || (!batch->hashes[r])) {
+                printf("Error: can't get memory for pipeline kmers\n");
+                exit(1);
+            }
+        }
+
+        // Keys and their table hashes a window at a time, for the lookup stage
+        kmer_kernels.canonical_keys(window->kmer, window->nkmers, kmer_size, &(batch->kmers[r][*kmers_used]));
+        kmer_kernels.hash_keys(&(batch->kmers[r][*kmers_used]), window->nkmers, &(batch->hashes[r][*kmers_used]));
+        *kmers_used += window->nkmers;
+        read->nkmers += window->nkmers;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_parse_batch
+ * Purpose:    Parse stage - parse raw records and convert them to kmer
+ *             keys, ready for lookup.
+ * Parameters: p -> pipeline
+ *             batch -> batch
+ *             seq -> worker's sequence
+ *             windows -> worker's sliding windows
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_parse_batch(Pipeline* p, PipelineBatch* batch, Sequence* seq, KmerSlidingWindowSet* windows)
+{
+    int i, n;
+
+    // FASTA windows are already bare sequence
+    if (p->frw != NULL) {
+        size_t kmers_used = 0;
+
+        for (n=0; n<batch->n_pairs; n++) {
+            PipelineRead* read = &(batch->reads[0][n]);
+
+            read->length = read->raw_length;
+            pipeline_add_kmer_keys(p, batch, 0, read, batch->raw[0].data + read->raw_offset, seq->qual, windows, &kmers_used);
+        }
+        return;
+    }
+
+    for (i=0; i<p->number_of_files; i++) {
+        size_t kmers_used = 0;
+
+        batch->text[i].length = 0;
+
+        for (n=0; n<batch->n_pairs; n++) {
+            PipelineRead* read = &(batch->reads[i][n]);
+
+            read->length = read_sequence_from_fastq_buffer(batch->raw[i].data + read->raw_offset, read->raw_length, seq, p->fra[i]->max_read_length);
+            read->nkmers = 0;
+
+            if (p->cmd_line->dedup_cache_mb > 0) {
+                read_cache_hash_sequence(seq->seq, read->length, read->hash);
+            }
+
+            if (read->length == 0) {
+                continue;
+            }
+
+            // Keep name for read summary
+            read->name_offset = batch->text[i].length;
+            sequence_buffer_reserve(&(batch->text[i]), strlen(seq->name) + 1);
+            strcpy(batch->text[i].data + batch->text[i].length, seq->name);
+            batch->text[i].length += strlen(seq->name) + 1;
+
+            // And the record as the writer will output it
+            if (p->filtering) {
+                char temp_string[seq->length + 1];
+                size_t needed = strlen(seq->id_string) + (2 * seq->length) + 8;
+
+                read->output_offset = batch->text[i].length;
+                sequence_buffer_reserve(&(batch->text[i]), needed);
+                batch->text[i].length += sprintf(batch->text[i].data + batch->text[i].length, "@%s\n%s\n+\n%s\n", seq->id_string, seq->seq, sequence_get_quality_string(seq, temp_string)) + 1;
+            }
+
+            // Convert to kmer keys
+            pipeline_add_kmer_keys(p, batch, i, read, seq->seq, seq->qual, windows, &kmers_used);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_lookup_batch
+ * Purpose:    Lookup stage - look up each read's kmers and count hits per
+ *             contaminant. Counts of first-seen kmers are kept in the
+ *             batch for the merge stage to add to the stats.
+ *             Pairs found in the worker's dedup cache skip the lookups.
+ * Parameters: p -> pipeline
+ *             batch -> batch
+ *             cache -> worker's dedup cache, or NULL
+ *             kmer_hash -> table to search, the NUMA local copy if any
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_lookup_batch(Pipeline* p, PipelineBatch* batch, ReadCache* cache, HashTable* kmer_hash)
+{
+    CmdLine* cmd_line = p->cmd_line;
+    int n_contaminants = p->stats->n_contaminants;
+    uint64_t key[READ_CACHE_KEY_WORDS];
+    int node_cov[2];
+    int ids[MAX_CONTAMINANTS];
+    int n, r, j, c;
+
+    memset(batch->kmers_seen, 0, sizeof(batch->kmers_seen));
+    memset(batch->both_kmers_seen, 0, sizeof(batch->both_kmers_seen));
+
+    for (n=0; n<batch->n_pairs; n++) {
+        if (cache) {
+            KmerCounts* cached;
+
+            memset(key, 0, sizeof(key));
+            for (r=0; r<p->number_of_files; r++) {
+                key[r * 2] = batch->reads[r][n].hash[0];
+                key[(r * 2) + 1] = batch->reads[r][n].hash[1];
+            }
+
+            cached = read_cache_find(cache, key);
+            if (cached) {
+                for (r=0; r<p->number_of_files; r++) {
+                    batch->reads[r][n].counts = cached[r];
+                    batch->reads[r][n].counts.kmers_looked_up = 0;
+                }
+                continue;
+            }
+        }
+
+        for (r=0; r<p->number_of_files; r++) {
+            PipelineRead* read = &(batch->reads[r][n]);
+            KmerCounts* counts = &(read->counts);
+            boolean early_exit = (p->frw == NULL) && cmd_line->early_exit && ((r == 1) || (p->number_of_files == 1));
+
+            reset_kmer_counts(n_contaminants, counts);
+
+            for (j=0; j<read->nkmers; j++) {
+                Element* node = hash_table_find_with_hash(&(batch->kmers[r][read->kmer_offset + j]), batch->hashes[r][read->kmer_offset + j], kmer_hash);
+
+                counts->kmers_looked_up++;
+
+                if (node != NULL) {
+                    int n_ids;
+
+                    element_get_and_increment_read_coverages(kmer_hash, node, r, &(node_cov[0]), &(node_cov[1]));
+
+                    n_ids = kmer_counts_add_hit(counts, node, ids);
+
+                    // First time this kmer has been seen in this read / either read
+                    if (node_cov[r] == 0) {
+                        for (c=0; c<n_ids; c++) {
+                            batch->kmers_seen[r][ids[c]]++;
+                            if ((node_cov[0] == 0) && (node_cov[1] == 0)) {
+                                batch->both_kmers_seen[ids[c]]++;
+                            }
+                        }
+                    }
+
+                    counts->kmers_loaded++;
+                }
+
+                if (early_exit && kmer_stats_read_is_decided(counts, r == 1 ? &(batch->reads[0][n].counts) : NULL, read->nkmers - j - 1, cmd_line)) {
+                    break;
+                }
+            }
+        }
+
+        if (cache) {
+            read_cache_add(cache, key, &(batch->reads[0][n].counts), p->number_of_files == 2 ? &(batch->reads[1][n].counts) : NULL);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_merge_kmers_seen
+ * Purpose:    Add a batch's counts of first-seen kmers to the stats
+ * Parameters: p -> pipeline
+ *             batch -> batch
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_merge_kmers_seen(Pipeline* p, PipelineBatch* batch)
+{
+    KmerStats* stats = p->stats;
+    int r, c;
+
+    for (r=0; r<p->number_of_files; r++) {
+        for (c=0; c<stats->n_contaminants; c++) {
+            stats->read[r]->contaminant_kmers_seen[c] += batch->kmers_seen[r][c];
+        }
+    }
+    for (c=0; c<stats->n_contaminants; c++) {
+        stats->both_reads->contaminant_kmers_seen[c] += batch->both_kmers_seen[c];
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_merge_batch
+ * Purpose:    Merge stage - update stats for each pair, in input order,
+ *             and decide which pairs are filtered.
+ * Parameters: p -> pipeline
+ *             batch -> batch
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_merge_batch(Pipeline* p, PipelineBatch* batch)
+{
+    KmerStats* stats = p->stats;
+    int n, r;
+
+    pipeline_merge_kmers_seen(p, batch);
+
+    for (n=0; n<batch->n_pairs; n++) {
+        batch->filter[n] = false;
+
+        for (r=0; r<p->number_of_files; r++) {
+            PipelineRead* read = &(batch->reads[r][n]);
+
+            if (read->length == 0) {
+                continue;
+            }
+
+            if (read->nkmers == 0) {
+                p->fra[r]->bad_reads++;
+            } else {
+                if (p->fp_read_summary) {
+                    write_read_summary(p->fp_read_summary, batch->text[r].data + read->name_offset, r, &(read->counts), stats, p->cmd_line);
+                }
+                hash_table_add_number_of_reads(1, p->kmer_hash);
+                update_stats(r, &(read->counts), stats, p->cmd_line);
+            }
+        }
+
+        if (p->fp_shard_counts) {
+            for (r=0; r<p->number_of_files; r++) {
+                PipelineRead* read = &(batch->reads[r][n]);
+                int state = read->length == 0 ? SHARD_READ_ABSENT : (read->nkmers == 0 ? SHARD_READ_NO_KMERS : SHARD_READ_COUNTED);
+
+                kmer_shard_write_read(p->fp_shard_counts, state, &(read->counts), stats->n_contaminants);
+            }
+        }
+
+        if ((p->number_of_files == 2) && (batch->reads[0][n].length > 0) && (batch->reads[1][n].length > 0)) {
+            stats->both_reads->number_of_reads++;
+            batch->filter[n] = update_stats_for_both(stats, p->cmd_line, &(batch->reads[0][n].counts), &(batch->reads[1][n].counts));
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_write_table_counts
+ * Purpose:    Write the count columns shared by the window and contig
+ *             tables, ending with the contaminant with most kmers.
+ * Parameters: fp -> table file
+ *             nkmers = kmers in the sequence
+ *             counts -> counts for the sequence
+ *             stats -> stats, for contaminant IDs
+ * Returns:    Index of contaminant with most kmers, or -1 if none
+ *----------------------------------------------------------------------*/
+static int pipeline_write_table_counts(FILE* fp, long long nkmers, KmerCounts* counts, KmerStats* stats)
+{
+    uint32_t largest_kmers = 0;
+    int assigned = -1;
+    int c;
+
+    fprintf(fp, "\t%lld\t%d", nkmers, counts->kmers_loaded);
+    for (c=0; c<stats->n_contaminants; c++) {
+        fprintf(fp, "\t%d", counts->kmers_from_contaminant[c]);
+        if (counts->kmers_from_contaminant[c] > largest_kmers) {
+            largest_kmers = counts->kmers_from_contaminant[c];
+            assigned = c;
+        }
+    }
+    fprintf(fp, "\t%s", assigned == -1 ? "Unassigned" : stats->contaminant_ids[assigned]);
+
+    return assigned;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_merge_windows
+ * Purpose:    Merge stage for windows - write a table row for each
+ *             window, add it to the running totals for its contig (or long
+ *             read) and, at the last window, update stats and write the
+ *             contig row. Windows over the read threshold are classified
+ *             on their own, and a contig whose windows classify to more
+ *             than one contaminant (a chimera or misassembly, say) is
+ *             counted as mixed.
+ * Parameters: p -> pipeline
+ *             batch -> batch
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_merge_windows(Pipeline* p, PipelineBatch* batch)
+{
+    KmerStats* stats = p->stats;
+    KmerCounts* contig = &(p->contig_counts);
+    int assigned;
+    int n, c;
+
+    pipeline_merge_kmers_seen(p, batch);
+
+    for (n=0; n<batch->n_pairs; n++) {
+        PipelineRead* read = &(batch->reads[0][n]);
+        KmerCounts* counts = &(read->counts);
+        char* name = batch->raw[0].data + read->name_offset;
+
+        p->contig_windows++;
+        p->contig_kmers += read->nkmers;
+        p->contig_length = read->end;
+        contig->kmers_loaded += counts->kmers_loaded;
+        contig->kmers_looked_up += counts->kmers_looked_up;
+        for (c=0; c<stats->n_contaminants; c++) {
+            contig->kmers_from_contaminant[c] += counts->kmers_from_contaminant[c];
+            contig->unique_kmers_from_contaminant[c] += counts->unique_kmers_from_contaminant[c];
+        }
+
+        fprintf(p->fp_windows, "%s\t%d\t%lld\t%lld", name, p->contig_windows, read->start, read->end);
+        assigned = pipeline_write_table_counts(p->fp_windows, read->nkmers, counts, stats);
+        fprintf(p->fp_windows, "\n");
+        if ((assigned != -1) && (counts->kmers_from_contaminant[assigned] >= p->cmd_line->kmer_threshold_read)) {
+            p->contig_window_classes[assigned]++;
+        }
+
+        if (read->last_window) {
+            int classes = 0;
+
+            for (c=0; c<stats->n_contaminants; c++) {
+                if (contig->kmers_from_contaminant[c] > 0) {
+                    contig->contaminants_detected++;
+                }
+                if (p->contig_window_classes[c] > 0) {
+                    classes++;
+                }
+            }
+            if (classes > 1) {
+                p->contigs_mixed++;
+            }
+
+            if (p->contig_kmers == 0) {
+                p->fra[0]->bad_reads++;
+            }
+            hash_table_add_number_of_reads(1, p->kmer_hash);
+            update_stats(0, contig, stats, p->cmd_line);
+
+            fprintf(p->fp_contigs, "%s\t%lld\t%d", name, p->contig_length, p->contig_windows);
+            pipeline_write_table_counts(p->fp_contigs, p->contig_kmers, contig, stats);
+            fprintf(p->fp_contigs, "\t%d\n", classes);
+            if (p->fp_read_summary) {
+                write_sequence_summary(p->fp_read_summary, name, contig, stats);
+            }
+
+            p->contigs_screened++;
+            p->bases_read += p->contig_length;
+            p->contig_windows = 0;
+            p->contig_kmers = 0;
+            p->contig_length = 0;
+            memset(p->contig_window_classes, 0, sizeof(p->contig_window_classes));
+            initialise_kmer_counts(stats->n_contaminants, contig);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_write_batch
+ * Purpose:    Writer stage - write each read to the kept or removed file
+ * Parameters: p -> pipeline
+ *             batch -> batch
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_write_batch(Pipeline* p, PipelineBatch* batch)
+{
+    int n, r;
+
+    for (n=0; n<batch->n_pairs; n++) {
+        for (r=0; r<p->number_of_files; r++) {
+            PipelineRead* read = &(batch->reads[r][n]);
+            FILE* fp_out = batch->filter[n] ? p->fp_removed[r] : p->fp_out[r];
+
+            if ((read->length > 0) && (fp_out)) {
+                fputs(batch->text[r].data + read->output_offset, fp_out);
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_reader_thread
+ * Purpose:    Reader stage thread
+ * Parameters: a -> pipeline
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* pipeline_reader_thread(void* a)
+{
+    Pipeline* p = a;
+    boolean more = true;
+
+    while (more) {
+        PipelineBatch* batch;
+
+        pthread_mutex_lock(&(p->lock));
+        while (p->free_batches.count == 0) {
+            pthread_cond_wait(&(p->changed), &(p->lock));
+        }
+        batch = pipeline_queue_remove(&(p->free_batches), -1);
+        pthread_mutex_unlock(&(p->lock));
+
+        more = p->frw ? pipeline_fill_batch_fasta(p, batch) : pipeline_fill_batch(p, batch);
+
+        pthread_mutex_lock(&(p->lock));
+        if (batch->n_pairs > 0) {
+            batch->id = p->batches_read++;
+            pipeline_queue_push(&(p->parse_queue), batch);
+        } else {
+            pipeline_queue_push(&(p->free_batches), batch);
+        }
+        if (!more) {
+            p->reading_done = true;
+        }
+        pthread_cond_broadcast(&(p->changed));
+        pthread_mutex_unlock(&(p->lock));
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_worker_thread
+ * Purpose:    Parse and/or lookup stage thread. Workers with role
+ *             WORKER_ANY take from whichever of the two queues is longer,
+ *             which moves threads to the stage that is falling behind.
+ * Parameters: a -> PipelineWorker
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* pipeline_worker_thread(void* a)
+{
+    PipelineWorker* worker = a;
+    Pipeline* p = worker->pipeline;
+    Sequence* seq = NULL;
+    KmerSlidingWindowSet* windows = NULL;
+
+    numa_layout_pin_worker(worker->index);
+    worker->kmer_hash = numa_layout_local_table(p->kmer_hash);
+
+    if ((worker->role != WORKER_PARSE) && (p->frw == NULL) && (p->cmd_line->dedup_cache_mb > 0)) {
+        worker->cache = read_cache_new(p->cmd_line->dedup_cache_mb);
+    }
+
+    if (worker->role != WORKER_LOOKUP) {
+        seq = sequence_new(p->fra[0]->max_read_length, p->fra[0]->max_read_length, p->fra[0]->fastq_ascii_offset);
+        windows = binary_kmer_sliding_window_set_new_from_read_length(p->kmer_hash->kmer_size, p->fra[0]->max_read_length);
+        if ((seq == NULL) || (windows == NULL)) {
+            printf("Error: can't get memory for pipeline worker\n");
+            exit(1);
+        }
+    }
+
+    pthread_mutex_lock(&(p->lock));
+    while (1) {
+        boolean can_parse = (worker->role != WORKER_LOOKUP) && (p->parse_queue.count > 0);
+        boolean can_lookup = (worker->role != WORKER_PARSE) && (p->lookup_queue.count > 0);
+        PipelineBatch* batch;
+
+        if (can_lookup && (!can_parse || (p->lookup_queue.count >= p->parse_queue.count))) {
+            batch = pipeline_queue_remove(&(p->lookup_queue), -1);
+            pthread_mutex_unlock(&(p->lock));
+            pipeline_lookup_batch(p, batch, worker->cache, worker->kmer_hash);
+            worker->looked_up++;
+            pthread_mutex_lock(&(p->lock));
+            pipeline_queue_push(&(p->merge_queue), batch);
+            p->batches_looked_up++;
+            pthread_cond_broadcast(&(p->changed));
+        } else if (can_parse) {
+            batch = pipeline_queue_remove(&(p->parse_queue), -1);
+            pthread_mutex_unlock(&(p->lock));
+            pipeline_parse_batch(p, batch, seq, windows);
+            worker->parsed++;
+            pthread_mutex_lock(&(p->lock));
+            pipeline_queue_push(&(p->lookup_queue), batch);
+            p->batches_parsed++;
+            pthread_cond_broadcast(&(p->changed));
+        } else if (p->reading_done &&
+                   (((worker->role == WORKER_PARSE) && (p->batches_parsed == p->batches_read)) ||
+                    ((worker->role != WORKER_PARSE) && (p->batches_looked_up == p->batches_read)))) {
+            break;
+        } else {
+            pthread_cond_wait(&(p->changed), &(p->lock));
+        }
+    }
+    pthread_mutex_unlock(&(p->lock));
+
+    if (seq) {
+        free_sequence(&seq);
+    }
+    if (windows) {
+        binary_kmer_free_kmers_set(&windows);
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_merge_thread
+ * Purpose:    Merge stage thread. Batches are merged strictly in the order
+ *             they were read, so stats, read summary and output match a
+ *             serial run.
+ * Parameters: a -> pipeline
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* pipeline_merge_thread(void* a)
+{
+    Pipeline* p = a;
+    long int next_id = 0;
+
+    pthread_mutex_lock(&(p->lock));
+    while (1) {
+        PipelineBatch* batch = pipeline_queue_remove(&(p->merge_queue), next_id);
+
+        if (batch != NULL) {
+            pthread_mutex_unlock(&(p->lock));
+            if (p->frw) {
+                pipeline_merge_windows(p, batch);
+            } else {
+                pipeline_merge_batch(p, batch);
+            }
+
+            pthread_mutex_lock(&(p->lock));
+            next_id++;
+            if (p->filtering) {
+                pipeline_queue_push(&(p->write_queue), batch);
+            } else {
+                pipeline_queue_push(&(p->free_batches), batch);
+            }
+            pthread_cond_broadcast(&(p->changed));
+        } else if (p->reading_done && (next_id == p->batches_read)) {
+            break;
+        } else {
+            pthread_cond_wait(&(p->changed), &(p->lock));
+        }
+    }
+    pthread_mutex_unlock(&(p->lock));
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_writer_thread
+ * Purpose:    Writer stage thread. The merge stage hands batches over in
+ *             order, so they are written as they arrive.
+ * Parameters: a -> pipeline
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* pipeline_writer_thread(void* a)
+{
+    Pipeline* p = a;
+
+    pthread_mutex_lock(&(p->lock));
+    while (1) {
+        PipelineBatch* batch = pipeline_queue_remove(&(p->write_queue), -1);
+
+        if (batch != NULL) {
+            pthread_mutex_unlock(&(p->lock));
+            pipeline_write_batch(p, batch);
+            pthread_mutex_lock(&(p->lock));
+            p->batches_written++;
+            pipeline_queue_push(&(p->free_batches), batch);
+            pthread_cond_broadcast(&(p->changed));
+        } else if (p->reading_done && (p->batches_written == p->batches_read)) {
+            break;
+        } else {
+            pthread_cond_wait(&(p->changed), &(p->lock));
+        }
+    }
+    pthread_mutex_unlock(&(p->lock));
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_open_output
+ * Purpose:    Open an output file, if one was asked for
+ * Parameters: filename -> filename or NULL
+ *             description -> for messages
+ * Returns:    File pointer or NULL
+ *----------------------------------------------------------------------*/
+static FILE* pipeline_open_output(char* filename, char* description)
+{
+    FILE* fp = NULL;
+
+    if (filename) {
+        fp = fopen(filename, "w");
+        if (!fp) {
+            printf("Error: can't open %s file %s\n", description, filename);
+            exit(3);
+        }
+        printf("Opened %s %s\n", description, filename);
+    }
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_run
+ * Purpose:    Create batches and threads, run the pipeline to the end of
+ *             the input, then free them again.
+ * Parameters: p -> pipeline, with inputs and outputs set up
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_run(Pipeline* p)
+{
+    CmdLine* cmd_line = p->cmd_line;
+    PipelineWorker* workers;
+    PipelineBatch* batch;
+    pthread_t reader_thread, merge_thread, writer_thread;
+    pthread_t* worker_threads;
+    int number_of_workers;
+    int number_of_batches;
+    int fixed_threads;
+    long int parsed = 0;
+    long int looked_up = 0;
+    int i;
+
+    pthread_mutex_init(&(p->lock), NULL);
+    pthread_cond_init(&(p->changed), NULL);
+    initialise_hash_mutexes();
+
+    // Thread counts. Reader, merge and writer get a thread each, the rest
+    // of -N go to parse/lookup workers, unless counts were given.
+    fixed_threads = p->filtering ? 3 : 2;
+    if ((cmd_line->pipeline_parse_threads > 0) && (cmd_line->pipeline_lookup_threads > 0)) {
+        number_of_workers = cmd_line->pipeline_parse_threads + cmd_line->pipeline_lookup_threads;
+    } else {
+        number_of_workers = cmd_line->numthreads - fixed_threads;
+        if (number_of_workers < 1) {
+            number_of_workers = 1;
+        }
+    }
+
+    workers = calloc(number_of_workers, sizeof(PipelineWorker));
+    worker_threads = calloc(number_of_workers, sizeof(pthread_t));
+    if ((!workers) || (!worker_threads)) {
+        printf("Error: can't get memory for pipeline workers\n");
+        exit(1);
+    }
+
+    for (i=0; i<number_of_workers; i++) {
+        workers[i].pipeline = p;
+        workers[i].index = i;
+        if (cmd_line->pipeline_parse_threads > 0) {
+            workers[i].role = i < cmd_line->pipeline_parse_threads ? WORKER_PARSE : WORKER_LOOKUP;
+        } else {
+            workers[i].role = WORKER_ANY;
+        }
+    }
+
+    // Batch pool bounds the amount of work in flight
+    number_of_batches = (2 * number_of_workers) + 4;
+    for (i=0; i<number_of_batches; i++) {
+        batch = calloc(1, sizeof(PipelineBatch));
+        if (!batch) {
+            printf("Error: can't get memory for pipeline batch\n");
+            exit(1);
+        }
+        pipeline_queue_push(&(p->free_batches), batch);
+    }
+
+    if (cmd_line->pipeline_parse_threads > 0) {
+        printf("Pipeline: reader 1, parse %d, lookup %d, merge 1, writer %d\n", cmd_line->pipeline_parse_threads, cmd_line->pipeline_lookup_threads, p->filtering ? 1 : 0);
+    } else {
+        printf("Pipeline: reader 1, parse/lookup %d (balanced), merge 1, writer %d\n", number_of_workers, p->filtering ? 1 : 0);
+    }
+    if (p->frw) {
+        printf("Batches: %d of up to %d windows of %d bases\n", number_of_batches, PIPELINE_BATCH_PAIRS, cmd_line->window_size);
+    } else {
+        printf("Batches: %d of %d pairs\n", number_of_batches, PIPELINE_BATCH_PAIRS);
+        printf("Checking every %f read\n", 1.0 / cmd_line->subsample_ratio);
+    }
+
+    if (pthread_create(&reader_thread, NULL, pipeline_reader_thread, p) ||
+        pthread_create(&merge_thread, NULL, pipeline_merge_thread, p) ||
+        (p->filtering && pthread_create(&writer_thread, NULL, pipeline_writer_thread, p))) {
+        printf("Error: can't create pipeline threads\n");
+        exit(1);
+    }
+    for (i=0; i<number_of_workers; i++) {
+        if (pthread_create(&(worker_threads[i]), NULL, pipeline_worker_thread, &(workers[i]))) {
+            printf("Error: can't create pipeline threads\n");
+            exit(1);
+        }
+    }
+
+    pthread_join(reader_thread, NULL);
+    for (i=0; i<number_of_workers; i++) {
+        pthread_join(worker_threads[i], NULL);
+        parsed += workers[i].parsed;
+        looked_up += workers[i].looked_up;
+    }
+    pthread_join(merge_thread, NULL);
+    if (p->filtering) {
+        pthread_join(writer_thread, NULL);
+    }
+
+    if (p->frw) {
+        printf("Pipeline done: %ld %s, %ld windows read, %ld batches parsed, %ld batches looked up\n", p->contigs_screened, p->frw->format == FASTA ? "contigs" : "reads", p->pairs_read, parsed, looked_up);
+        printf("With windows from 2+ contaminants: %ld\n", p->contigs_mixed);
+    } else {
+        printf("Pipeline done: %ld pairs read, %ld batches parsed, %ld batches looked up\n", p->pairs_read, parsed, looked_up);
+    }
+    for (i=0; i<number_of_workers; i++) {
+        if (workers[i].role == WORKER_ANY) {
+            printf("  Worker %d: parsed %ld, looked up %ld\n", i, workers[i].parsed, workers[i].looked_up);
+        }
+    }
+
+    if ((cmd_line->dedup_cache_mb > 0) && (p->frw == NULL)) {
+        long int hits = 0;
+        long int misses = 0;
+        long int evictions = 0;
+
+        for (i=0; i<number_of_workers; i++) {
+            if (workers[i].cache) {
+                hits += workers[i].cache->hits;
+                misses += workers[i].cache->misses;
+                evictions += workers[i].cache->evictions;
+                read_cache_free(&(workers[i].cache));
+            }
+        }
+        printf("Dedup cache: %ld hits, %ld misses (%.2f%% hit rate), %ld evictions\n", hits, misses, (hits + misses) > 0 ? (100.0 * hits) / (hits + misses) : 0.0, evictions);
+    }
+
+    while ((batch = pipeline_queue_remove(&(p->free_batches), -1)) != NULL) {
+        for (i=0; i<2; i++) {
+            free(batch->raw[i].data);
+            free(batch->text[i].data);
+            free(batch->kmers[i]);
+            free(batch->hashes[i]);
+        }
+        free(batch);
+    }
+    free(workers);
+    free(worker_threads);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_open_read_summary
+ * Purpose:    Open read summary file for appending, if one was asked for
+ * Parameters: p -> pipeline
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void pipeline_open_read_summary(Pipeline* p)
+{
+    if (p->cmd_line->read_summary_file != 0) {
+        p->fp_read_summary = fopen(p->cmd_line->read_summary_file, "a");
+        if (!p->fp_read_summary) {
+            printf("Error: can't open read summary file %s\n", p->cmd_line->read_summary_file);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   screen_or_filter_pipeline
+ * Purpose:    Screen or filter FASTQ reads (single or paired) with the
+ *             pipelined engine.
+ * Parameters: cmd_line -> command line options
+ *             fra_1 -> file reader args for R1
+ *             fra_2 -> file reader args for R2, or NULL
+ *             stats -> stats structure
+ * Returns:    Number of read pairs processed
+ *----------------------------------------------------------------------*/
+long long screen_or_filter_pipeline(CmdLine* cmd_line, KmerFileReaderArgs* fra_1, KmerFileReaderArgs* fra_2, KmerStats* stats)
+{
+    Pipeline p;
+    int i;
+
+    assert(fra_1 != 0);
+
+    memset(&p, 0, sizeof(Pipeline));
+    p.cmd_line = cmd_line;
+    p.stats = stats;
+    p.kmer_hash = fra_1->KmerHash;
+    p.fra[0] = fra_1;
+    p.fra[1] = fra_2;
+    p.number_of_files = fra_2 ? 2 : 1;
+    p.filtering = cmd_line->run_type == DO_FILTER ? true : false;
+    p.skip_seq = sequence_new(fra_1->max_read_length, fra_1->max_read_length, fra_1->fastq_ascii_offset);
+    if (!p.skip_seq) {
+        printf("Error: can't get memory for pipeline reader\n");
+        exit(1);
+    }
+
+    for (i=0; i<p.number_of_files; i++) {
+        p.fp_in[i] = fopen(p.fra[i]->input_filename, "r");
+        if (!p.fp_in[i]) {
+            printf("Error: can't open input file %s\n", p.fra[i]->input_filename);
+            exit(1);
+        }
+        if (p.filtering) {
+            p.fp_out[i] = pipeline_open_output(p.fra[i]->output_filename, "output");
+            p.fp_removed[i] = pipeline_open_output(p.fra[i]->removed_filename, "removed");
+        }
+    }
+    pipeline_open_read_summary(&p);
+    if (cmd_line->shard > 0) {
+        p.fp_shard_counts = kmer_shard_open_counts(cmd_line, stats, p.number_of_files);
+    }
+
+    pipeline_run(&p);
+
+    // Tidy up
+    if (p.fp_shard_counts) {
+        kmer_shard_close_counts(p.fp_shard_counts, stats);
+    }
+    for (i=0; i<p.number_of_files; i++) {
+        fclose(p.fp_in[i]);
+        if (p.fp_out[i]) {
+            fclose(p.fp_out[i]);
+        }
+        if (p.fp_removed[i]) {
+            fclose(p.fp_removed[i]);
+        }
+    }
+    if (p.fp_read_summary) {
+        fclose(p.fp_read_summary);
+    }
+    free_sequence(&(p.skip_seq));
+
+    return p.pairs_read;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   pipeline_open_table
+ * Purpose:    Open a window or contig/read table and write its header
+ * Parameters: fra -> file reader args, for input filename
+ *             cmd_line -> command line options, for output prefix
+ *             stats -> stats, for contaminant IDs
+ *             type -> "windows", "contigs" or "reads"
+ *             columns -> leading column names
+ *             last_columns -> trailing column names
+ * Returns:    File pointer
+ *----------------------------------------------------------------------*/
+static FILE* pipeline_open_table(KmerFileReaderArgs* fra, CmdLine* cmd_line, KmerStats* stats, char* type, char* columns, char* last_columns)
+{
+    char filename[MAX_PATH_LENGTH];
+    char* leafname = strrchr(fra->input_filename, '/');
+    FILE* fp;
+    int c;
+
+    leafname = leafname ? leafname + 1 : fra->input_filename;
+    snprintf(filename, MAX_PATH_LENGTH, "%s%s.%s.txt", cmd_line->output_prefix, leafname, type);
+    fp = pipeline_open_output(filename, type);
+
+    fprintf(fp, "ID\t%s\tKmers\tContaminantKmers", columns);
+    for (c=0; c<stats->n_contaminants; c++) {
+        fprintf(fp, "\t%s", stats->contaminant_ids[c]);
+    }
+    fprintf(fp, "\t%s\n", last_columns);
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   screen_windows_pipeline
+ * Purpose:    Screen a FASTA file (contigs, scaffolds, assemblies) or a
+ *             FASTQ file of long reads with the pipelined engine. Each
+ *             sequence is streamed in windows of -W bases which are spread
+ *             over the workers, so memory does not grow with sequence
+ *             length, and one pass writes tables of per-window and
+ *             per-contig (or per-read) counts.
+ * Parameters: cmd_line -> command line options
+ *             fra -> file reader args
+ *             stats -> stats structure
+ * Returns:    Number of bases screened
+ *----------------------------------------------------------------------*/
+long long screen_windows_pipeline(CmdLine* cmd_line, KmerFileReaderArgs* fra, KmerStats* stats)
+{
+    Pipeline p;
+
+    assert(fra != 0);
+
+    memset(&p, 0, sizeof(Pipeline));
+    p.cmd_line = cmd_line;
+    p.stats = stats;
+    p.kmer_hash = fra->KmerHash;
+    p.fra[0] = fra;
+    p.number_of_files = 1;
+    p.filtering = false;
+    initialise_kmer_counts(stats->n_contaminants, &(p.contig_counts));
+
+    // Sequence and window buffers are sized from fra, so make room for a
+    // window plus the k bases carried over from the one before
+    fra->max_read_length = cmd_line->window_size + p.kmer_hash->kmer_size;
+    p.frw = get_kmer_file_reader_wrapper(p.kmer_hash->kmer_size, fra);
+    if ((!p.frw) || (!p.frw->input_fp)) {
+        printf("Error: can't open input file %s\n", fra->input_filename);
+        exit(1);
+    }
+    p.frw->long_reads = fra->format == FASTQ ? true : false;
+
+    p.fp_windows = pipeline_open_table(fra, cmd_line, stats, "windows", "Window\tStart\tEnd", "Assigned");
+    p.fp_contigs = pipeline_open_table(fra, cmd_line, stats, fra->format == FASTA ? "contigs" : "reads", "Length\tWindows", "Assigned\tWindowClasses");
+    pipeline_open_read_summary(&p);
+
+    pipeline_run(&p);
+
+    // Tidy up
+    if (p.frw->input_fp != stdin) {
+        fclose(p.frw->input_fp);
+    }
+    free_sequence(&(p.frw->seq));
+    free(p.frw);
+    fclose(p.fp_windows);
+    fclose(p.fp_contigs);
+    if (p.fp_read_summary) {
+        fclose(p.fp_read_summary);
+    }
+
+    return p.bases_read;
+}
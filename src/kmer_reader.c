@@ -26,6 +26,9 @@
 #include "cmd_line.h"
 #include "kmer_stats.h"
 #include "kmer_reader.h"
+#include "contaminant_set.h"
+#include "kmer_shard.h"
+#include "numa_layout.h"
 
 #define MAX_THREADS 32
 #define STATE_READY 1
@@ -65,6 +68,160 @@ pthread_mutex_t mutex_hash[256];
 int reads_passed = 0;
 int reads_processed = 0;
 
+/*
+   Utilisation of screen_or_filter_parallel's threads. Each worker adds
+   the time it spends on pairs (less any waiting on locks) to busy, and
+   time blocked on a contended lock to waiting_on_locks - locks are tried
+   first, so an uncontended lock costs nothing extra. Time a worker isn't
+   doing either it spends waiting for a pair. The reader is busy reading
+   pairs and blocked on output while it waits for a free worker to take
+   one. Each time it hands a pair over, it samples how many workers hold
+   one (the queue depth).
+ */
+typedef struct {
+    double busy;
+    double waiting_on_locks;
+    double blocked_on_output;
+    long long locks;
+    long long lock_waits;
+    long long pairs;
+} ThreadUtilisation;
+
+ThreadUtilisation utilisation[MAX_THREADS];
+ThreadUtilisation reader_utilisation;
+long long queue_depth_samples[MAX_THREADS];
+double parallel_start;
+static __thread ThreadUtilisation* thread_utilisation = NULL;
+
+/*----------------------------------------------------------------------*
+ * Function:   seconds_now
+ * Purpose:    Read monotonic clock
+ * Parameters: None
+ * Returns:    Seconds
+ *----------------------------------------------------------------------*/
+static double seconds_now(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (double)now.tv_sec + ((double)now.tv_nsec / 1e9);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   parallel_mutex_lock
+ * Purpose:    Lock a mutex, counting time spent waiting for it against
+ *             the calling thread if it is a screen_or_filter_parallel
+ *             worker
+ * Parameters: lock -> mutex
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void parallel_mutex_lock(pthread_mutex_t* lock)
+{
+    ThreadUtilisation* u = thread_utilisation;
+
+    if (u == NULL) {
+        pthread_mutex_lock(lock);
+        return;
+    }
+
+    u->locks++;
+    if (pthread_mutex_trylock(lock) != 0) {
+        double start = seconds_now();
+
+        pthread_mutex_lock(lock);
+        u->waiting_on_locks += seconds_now() - start;
+        u->lock_waits++;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   print_utilisation_line
+ * Purpose:    Print one thread's line of the utilisation table
+ * Parameters: fp -> file to print to
+ *             name -> thread name
+ *             u -> thread's utilisation
+ *             elapsed = seconds since screening started
+ *             waiting_for_work = seconds spent waiting for a pair
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void print_utilisation_line(FILE* fp, char* name, ThreadUtilisation* u, double elapsed, double waiting_for_work)
+{
+    double pc = elapsed > 0 ? 100.0 / elapsed : 0;
+
+    fprintf(fp, "%-10s %12lld %9.1f%% %9.1f%% %9.1f%% %9.1f%% %12lld %12lld\n", name, u->pairs,
+            u->busy * pc, waiting_for_work * pc, u->waiting_on_locks * pc, u->blocked_on_output * pc, u->locks, u->lock_waits);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   report_utilisation
+ * Purpose:    Print utilisation of screen_or_filter_parallel's threads
+ *             and queue depth so far
+ * Parameters: fp -> file to print to
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void report_utilisation(FILE* fp)
+{
+    double elapsed = seconds_now() - parallel_start;
+    int n_workers = num_threads - 1;
+    long long samples = 0;
+    long long depth_total = 0;
+    char name[32];
+    int i;
+
+    fprintf(fp, "Thread utilisation over %.1f seconds\n", elapsed);
+    fprintf(fp, "%-10s %12s %10s %10s %10s %10s %12s %12s\n", "Thread", "Pairs", "Busy", "Work wait", "Lock wait", "Out wait", "Locks", "Contended");
+    print_utilisation_line(fp, "reader", &reader_utilisation, elapsed, 0);
+    for (i=0; i<n_workers; i++) {
+        double waiting_for_work = elapsed - utilisation[i].busy - utilisation[i].waiting_on_locks - utilisation[i].blocked_on_output;
+
+        sprintf(name, "worker %d", i + 1);
+        print_utilisation_line(fp, name, &(utilisation[i]), elapsed, waiting_for_work > 0 ? waiting_for_work : 0);
+    }
+
+    for (i=0; i<=n_workers; i++) {
+        samples += queue_depth_samples[i];
+        depth_total += queue_depth_samples[i] * i;
+    }
+    fprintf(fp, "Queue depth (workers holding a pair when the reader has one to hand over), %lld samples\n", samples);
+    if (samples > 0) {
+        fprintf(fp, "%10s: %.2f of %d\n", "Mean", (double)depth_total / (double)samples, n_workers);
+        for (i=0; i<=n_workers; i++) {
+            if (queue_depth_samples[i] > 0) {
+                fprintf(fp, "%10d: %lld (%.2f%%)\n", i, queue_depth_samples[i], (100.0 * (double)queue_depth_samples[i]) / (double)samples);
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_utilisation_progress
+ * Purpose:    Write thread utilisation to the progress directory
+ * Parameters: cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_utilisation_progress(CmdLine* cmd_line)
+{
+    char* filename = malloc(strlen(cmd_line->progress_dir) + 64);
+    FILE* fp;
+
+    if (!filename) {
+        printf("Error: no room for filename\n");
+        exit(1);
+    }
+
+    sprintf(filename, "%s/thread_utilisation.txt", cmd_line->progress_dir);
+    fp = fopen(filename, "w");
+    if (fp) {
+        report_utilisation(fp);
+        fclose(fp);
+    } else {
+        printf("Error: can't open %s\n", filename);
+    }
+
+    free(filename);
+}
+
 /*----------------------------------------------------------------------*
  * Function:
  * Purpose:
@@ -78,25 +235,136 @@ void initialise_kmer_counts(int n, KmerCounts* counts)
     pthread_mutex_init(&(counts->lock), NULL);
     counts->n_contaminants = n;
     counts->kmers_loaded = 0;
+    counts->kmers_looked_up = 0;
     counts->contaminants_detected = 0;
     for (i=0; i<MAX_CONTAMINANTS; i++) {
         counts->kmers_from_contaminant[i] = 0;
         counts->unique_kmers_from_contaminant[i] = 0;
     }
+    for (i=0; i<CONTAMINANT_SET_WORDS; i++) {
+        counts->detected_set[i] = 0;
+    }
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters: None
+ * Function:   reset_kmer_counts
+ * Purpose:    Clear counts for the next read. Only the contaminants
+ *             detected in the last read are cleared, so counts must have
+ *             been initialised (or zeroed) once and only changed by
+ *             kmer_counts_add_hit since.
+ * Parameters: n = number of contaminants
+ *             counts -> counts
  * Returns:    None
  *----------------------------------------------------------------------*/
-void kmer_hash_load_sliding_windows(Element **previous_node, HashTable* kmer_hash, boolean prev_full_entry, KmerFileReaderArgs* fra, short kmer_size, KmerSlidingWindowSet *windows, int read, KmerStats* stats, KmerCounts* counts)
+void reset_kmer_counts(int n, KmerCounts* counts)
+{
+    int ids[MAX_CONTAMINANTS];
+    int n_ids = contaminant_set_members(counts->detected_set, ids);
+    int i;
+
+    for (i=0; i<n_ids; i++) {
+        counts->kmers_from_contaminant[ids[i]] = 0;
+        counts->unique_kmers_from_contaminant[ids[i]] = 0;
+    }
+    for (i=0; i<CONTAMINANT_SET_WORDS; i++) {
+        counts->detected_set[i] = 0;
+    }
+
+    counts->n_contaminants = n;
+    counts->kmers_loaded = 0;
+    counts->kmers_looked_up = 0;
+    counts->contaminants_detected = 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_counts_add_hit
+ * Purpose:    Count a kmer found in the contaminant table against each
+ *             contaminant holding it. Only the contaminant bits that are
+ *             set are visited, usually one or two, however many
+ *             contaminants are loaded. Doesn't change kmers_loaded.
+ * Parameters: counts -> counts for this read
+ *             node -> element found
+ *             ids -> array of MAX_CONTAMINANTS, filled with the
+ *                    contaminants holding the kmer
+ * Returns:    Number of contaminants holding the kmer
+ *----------------------------------------------------------------------*/
+int kmer_counts_add_hit(KmerCounts* counts, Element* node, int* ids)
+{
+    uint32_t words[CONTAMINANT_SET_WORDS];
+    int n_ids;
+    int i;
+
+    contaminant_set_of_element(node, words);
+    n_ids = contaminant_set_members(words, ids);
+
+    // Contaminants not seen before in this read
+    for (i=0; i<CONTAMINANT_SET_WORDS; i++) {
+        counts->contaminants_detected += __builtin_popcount(words[i] & ~counts->detected_set[i]);
+        counts->detected_set[i] |= words[i];
+    }
+
+    for (i=0; i<n_ids; i++) {
+        counts->kmers_from_contaminant[ids[i]]++;
+    }
+
+    if (n_ids == 1) {
+        counts->unique_kmers_from_contaminant[ids[0]]++;
+    }
+
+    return n_ids;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   subsample_keep_read
+ * Purpose:    Decide if a read (or pair) is in the subsample. The decision
+ *             is a hash of the entry number, so both files of a pair make
+ *             the same choice and unsampled entries can be skipped without
+ *             reading them.
+ * Parameters: entry_number = number of the read (pair) in the file
+ *             ratio = subsample ratio >0 <=1
+ * Returns:    true if the read should be processed
+ *----------------------------------------------------------------------*/
+boolean subsample_keep_read(long int entry_number, double ratio)
+{
+    uint64_t x = (uint64_t)entry_number;
+
+    if (ratio >= 1.0) {
+        return true;
+    }
+
+    // splitmix64 finaliser
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    x = x ^ (x >> 31);
+
+    // Top 53 bits as a uniform value in [0,1)
+    return ((double)(x >> 11) * (1.0 / 9007199254740992.0)) < ratio;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_hash_load_sliding_windows
+ * Purpose:    Look up (or insert) kmers from a set of sliding windows
+ * Parameters: ...
+ *             mate_counts -> final counts for first read of pair, or NULL
+ *             early_exit = stop once kmer_stats_read_is_decided says the
+ *                          read's classification can't change
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_hash_load_sliding_windows(Element **previous_node, HashTable* kmer_hash, boolean prev_full_entry, KmerFileReaderArgs* fra, short kmer_size, KmerSlidingWindowSet *windows, int read, KmerStats* stats, KmerCounts* counts, KmerCounts* mate_counts, boolean early_exit)
 {
     Element *current_node = NULL;
+    int ids[MAX_CONTAMINANTS];
     BinaryKmer tmp_kmer;
     int i;
     int j;
+    int kmers_remaining = 0;
+    
+    if (early_exit) {
+        for (i = 0; i < windows->nwindows; i++) {
+            kmers_remaining += windows->window[i].nkmers;
+        }
+    }
     
     // For each window...
     for (i = 0; i < windows->nwindows; i++) {
@@ -115,6 +383,7 @@ void kmer_hash_load_sliding_windows(Element **previous_node, HashTable* kmer_has
             } else {
                 current_node = hash_table_find(key, kmer_hash);
             }
+            counts->kmers_looked_up++;
             
             // If we found kmer...
             if (current_node != NULL) {
@@ -122,41 +391,21 @@ void kmer_hash_load_sliding_windows(Element **previous_node, HashTable* kmer_has
                     int c;
                     
                     if (stats != NULL) {
-                        int contaminant_count = 0;
-                        int contaminant_index = 0;
+                        int n_ids = kmer_counts_add_hit(counts, current_node, ids);
                         
-                        /* Go through all contaminants */
-                        for (c=0; c<counts->n_contaminants; c++) {
-                            /* Check if kmer is found in this contaminant */
-                            if (element_get_contaminant_bit(current_node, c) > 0) {
-                                /* Count how many contaminants have this kmer */
-                                contaminant_count++;
-                                contaminant_index = c;
-                                
-                                /* If the count of kmers from this contaminant is 0, then this is the first kmer we've
-                                   seen from this contaminant, so we update the count of number of contaminants seen */
-                                if (counts->kmers_from_contaminant[c] == 0) {
-                                    counts->contaminants_detected++;
-                                }
-                                
-                                /* Update the count of number of kmers from this contaminant */
-                                counts->kmers_from_contaminant[c]++;
-                                
-                                /* Now for the stats for both reads: If there is no coverage for this kmer in either
-                                   read, then this is the first time we've seen this kmer, so update the count of kmers
-                                   seen. */
-                                if (element_get_coverage(current_node, read) == 0) {
-                                    if ((element_get_coverage(current_node, 0) + element_get_coverage(current_node, 1)) == 0) {
-                                        stats->both_reads->contaminant_kmers_seen[c]++;
-                                    }
-                                    stats->read[read]->contaminant_kmers_seen[c]++;
+                        /* Now for the stats for both reads: If there is no coverage for this kmer in either
+                           read, then this is the first time we've seen this kmer, so update the count of kmers
+                           seen. */
+                        if (element_get_coverage(current_node, read) == 0) {
+                            boolean first_in_both = (element_get_coverage(current_node, 0) + element_get_coverage(current_node, 1)) == 0;
+                            
+                            for (c=0; c<n_ids; c++) {
+                                if (first_in_both) {
+                                    stats->both_reads->contaminant_kmers_seen[ids[c]]++;
                                 }
+                                stats->read[read]->contaminant_kmers_seen[ids[c]]++;
                             }
                         }
-                        
-                        if (contaminant_count == 1) {
-                            counts->unique_kmers_from_contaminant[contaminant_index]++;
-                        }
                     }
                     
                     /* Update count of how many times we've seen this kmer in this read */
@@ -168,6 +417,12 @@ void kmer_hash_load_sliding_windows(Element **previous_node, HashTable* kmer_has
             
             *previous_node = current_node;
             
+            if (early_exit) {
+                kmers_remaining--;
+                if (kmer_stats_read_is_decided(counts, mate_counts, kmers_remaining, fra->cmd_line)) {
+                    return;
+                }
+            }
         }
     }
 }
@@ -197,8 +452,18 @@ int file_reader_wrapper(KmerFileReaderWrapperArgs* wargs)
     		length =  read_sequence_from_fasta(wargs->input_fp, wargs->seq, wargs->max_read_length, wargs->new_entry, &wargs->full_entry, offset);
             break;
         case FASTQ:
-    		length = read_sequence_from_fastq(wargs->input_fp, wargs->seq, wargs->max_read_length);
-            wargs->full_entry = true;
+            if (wargs->long_reads) {
+                // Long reads are streamed in chunks, exactly as for FASTA
+                offset = 0;
+                if (wargs->new_entry == false) {
+                    shift_last_kmer_to_start_of_sequence(wargs->seq, wargs->seq->length, wargs->kmer_size);
+                    offset = wargs->kmer_size;
+                }
+                length = read_sequence_from_fastq_chunk(wargs->input_fp, wargs->seq, wargs->max_read_length, wargs->new_entry, &wargs->full_entry, offset);
+            } else {
+                length = read_sequence_from_fastq(wargs->input_fp, wargs->seq, wargs->max_read_length);
+                wargs->full_entry = true;
+            }
             break;
         default:
             fprintf(stderr, "Error: File format not supported yet %d\n", wargs->format);
@@ -282,9 +547,6 @@ long long screen_kmers_from_file(KmerFileReaderArgs* fra, CmdLine* cmd_line, Kme
     KmerCounts counts;
     KmerFileReaderWrapperArgs* frw;
     KmerSlidingWindowSet* windows;
-    time_t time_previous = 0;
-    time_t time_now = 0;
-    int i;
     FILE* fp_read_summary = 0;
 
     assert(fra != NULL);
@@ -320,7 +582,7 @@ long long screen_kmers_from_file(KmerFileReaderArgs* fra, CmdLine* cmd_line, Kme
             fra->bad_reads++;
 		} else {
             // Load kmers
-            kmer_hash_load_sliding_windows(&previous_node, kmer_hash, prev_full_entry, fra, kmer_hash->kmer_size, windows, 0, stats, &counts);
+            kmer_hash_load_sliding_windows(&previous_node, kmer_hash, prev_full_entry, fra, kmer_hash->kmer_size, windows, 0, stats, &counts, NULL, cmd_line->early_exit && frw->full_entry);
         }
         
         if (frw->full_entry == false) {
@@ -331,47 +593,13 @@ long long screen_kmers_from_file(KmerFileReaderArgs* fra, CmdLine* cmd_line, Kme
             update_stats(0, &counts, stats, cmd_line);
 
             if (fp_read_summary) {
-                fprintf(fp_read_summary, "%s", frw->seq->name);
-                fprintf(fp_read_summary, "\t%d", counts.contaminants_detected);
-                fprintf(fp_read_summary, "\t%d", counts.kmers_loaded);
-                for (i=0; i<stats->n_contaminants; i++) {
-                    fprintf(fp_read_summary, "\t%d", counts.kmers_from_contaminant[i]);
-                }
-                if (counts.assigned_contaminant == -1) {
-                    fprintf(fp_read_summary, "\tUnassigned");
-                } else {
-                    fprintf(fp_read_summary, "\t%s", stats->contaminant_ids[counts.assigned_contaminant]);
-                }
-
-                for (i=0; i<stats->n_contaminants; i++) {
-                    fprintf(fp_read_summary, "\t%d", counts.unique_kmers_from_contaminant[i]);
-                }
-                if (counts.unique_assigned_contaminant == -1) {
-                    fprintf(fp_read_summary, "\tUnassigned");
-                } else {
-                    fprintf(fp_read_summary, "\t%s", stats->contaminant_ids[counts.unique_assigned_contaminant]);
-                }
-                
-                fprintf(fp_read_summary, "\n");
-                fflush(fp_read_summary);
+                write_sequence_summary(fp_read_summary, frw->seq->name, &counts, stats);
             }
 
-            initialise_kmer_counts(stats->n_contaminants, &counts);
+            reset_kmer_counts(stats->n_contaminants, &counts);
         }
         
         prev_full_entry = frw->full_entry;
-        
-        if (cmd_line->write_progress_file) {
-            time(&time_now);
-            if (difftime(time_now, time_previous) > cmd_line->progress_delay) {
-                kmer_stats_write_progress(stats, cmd_line);
-                time_previous = time_now;
-            }
-        }
-    }
-
-    if (cmd_line->write_progress_file) {
-        kmer_stats_write_progress(stats, cmd_line);
     }
     
     free_sequence(&frw->seq);
@@ -385,6 +613,60 @@ long long screen_kmers_from_file(KmerFileReaderArgs* fra, CmdLine* cmd_line, Kme
     return seq_length;
 }
 
+/*----------------------------------------------------------------------*
+ * Function:   write_sequence_summary
+ * Purpose:    Write read summary line for a FASTA sequence
+ * Parameters: fp -> read summary file
+ *             name -> sequence name
+ *             counts -> kmer counts for whole sequence, after update_stats
+ *             stats -> stats, for contaminant IDs
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_sequence_summary(FILE* fp, char* name, KmerCounts* counts, KmerStats* stats)
+{
+    int i;
+
+    fprintf(fp, "%s", name);
+    fprintf(fp, "\t%d", counts->contaminants_detected);
+    fprintf(fp, "\t%d", counts->kmers_loaded);
+    for (i=0; i<stats->n_contaminants; i++) {
+        fprintf(fp, "\t%d", counts->kmers_from_contaminant[i]);
+    }
+    if (counts->assigned_contaminant == -1) {
+        fprintf(fp, "\tUnassigned");
+    } else {
+        fprintf(fp, "\t%s", stats->contaminant_ids[counts->assigned_contaminant]);
+    }
+
+    for (i=0; i<stats->n_contaminants; i++) {
+        fprintf(fp, "\t%d", counts->unique_kmers_from_contaminant[i]);
+    }
+    if (counts->unique_assigned_contaminant == -1) {
+        fprintf(fp, "\tUnassigned");
+    } else {
+        fprintf(fp, "\t%s", stats->contaminant_ids[counts->unique_assigned_contaminant]);
+    }
+
+    fprintf(fp, "\n");
+    fflush(fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   initialise_hash_mutexes
+ * Purpose:    Initialise the mutexes used by
+ *             element_get_and_increment_read_coverages
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void initialise_hash_mutexes(void)
+{
+    int i;
+    
+    for (i=0; i<256; i++) {
+        pthread_mutex_init(&(mutex_hash[i]), NULL);
+    }
+}
+
 /*----------------------------------------------------------------------*
  * Function:
  * Purpose:
@@ -394,9 +676,15 @@ long long screen_kmers_from_file(KmerFileReaderArgs* fra, CmdLine* cmd_line, Kme
 void element_get_and_increment_read_coverages(HashTable* hash_table, Element *node, int r, int* a, int* b)
 {
     int flags;
-    int mutex_index = (int)node->kmer & 255;
+    int mutex_index;
+    
+    // Replicas are searched, but kmers are marked as seen in the primary
+    if (hash_table->primary_table) {
+        node = hash_table->primary_table + (node - hash_table->table);
+    }
+    mutex_index = (int)node->kmer & 255;
     
-    pthread_mutex_lock(&(mutex_hash[mutex_index]));
+    parallel_mutex_lock(&(mutex_hash[mutex_index]));
 #ifdef STORE_FULL_COVERAGE
     *a = node->coverage[0];
     *b = node->coverage[1];
@@ -433,17 +721,20 @@ int read_indefinite_length_read(char** seq, FILE* fp) {
         printf("Error: can't allocate memory for read\n");
         exit(1);
     }
+    (*seq)[0] = 0;
     
     while ((got_read == 0) && (fgets((*seq) + read_length, current_size - read_length, fp))) {
-        int l = strlen(*seq);
+        // Only the newly read part needs scanning
+        int l = read_length + strlen((*seq) + read_length);
         
         // Look for new line - got everything
         if ((*seq)[l-1] == '\n') {
             (*seq)[l-1] = 0;
             got_read = 1;
         } else {
+            // Double, so long reads cost a few reallocs rather than one per 1 KB
             read_length = l;
-            current_size += chunk_size;
+            current_size *= 2;
             new_block = realloc(*seq, current_size);
             if (!new_block) {
                 printf("Error: can't allocate memory for read\n");
@@ -454,7 +745,7 @@ int read_indefinite_length_read(char** seq, FILE* fp) {
         }
     }
    
-    return strlen(*seq);
+    return read_length + strlen((*seq) + read_length);
 }
 
 /*----------------------------------------------------------------------*
@@ -477,14 +768,15 @@ int get_fastq_read(FILE* fp, char** id, char** seq)
         if (fgets(qhead, 1024, fp)) {
             if (read_indefinite_length_read(&quals, fp) == 0) {
                 l = 0;
-                free(quals);
             }
+            free(quals);
         } else {
             l = 0;
         }
     } else {
         l = 0;
     }
+    free(qhead);
     
     return l;
 }
@@ -530,12 +822,14 @@ void* read_process_thread(void* a)
     int read_offset;
     int c;
     int node_cov[2];
+    int ids[MAX_CONTAMINANTS];
     struct timespec req, rem;
     BinaryKmer kmer;
     BinaryKmer tmp_kmer;
     Element *current_node = NULL;
     char kmer_str[1024];
     ReadThreadData* rtd;
+    HashTable* kmer_hash = NULL;
     boolean filter_read = false;
     boolean increment_both_kmers_seen = false;
     boolean increment_read_kmers_seen = false;
@@ -543,81 +837,74 @@ void* read_process_thread(void* a)
     req.tv_sec = 0;
     req.tv_nsec = 10;
     
+    numa_layout_pin_worker(n);
+    thread_utilisation = &(utilisation[n]);
+    
     while (thread_state[n] != STATE_END) {
         if (thread_state[n] == STATE_DATA) {
+            double pair_start = seconds_now();
+            double locks_before = thread_utilisation->waiting_on_locks;
+            
             // Get data
             rtd = thread_data[n];
             assert(rtd != 0);
+            if (kmer_hash == NULL) {
+                kmer_hash = numa_layout_local_table(rtd->kmer_hash);
+            }
         
             // Process reads
             filter_read = false;
             for (r=0; r<rtd->number_of_files; r++) {
-                initialise_kmer_counts(rtd->n_contaminants, &(rtd->counts[r]));
+                int read_kmers = strlen(rtd->seq[r]) - rtd->kmer_size + 1;
+                boolean early_exit = rtd->cmd_line->early_exit && ((r == 1) || (rtd->number_of_files == 1));
+                
+                reset_kmer_counts(rtd->n_contaminants, &(rtd->counts[r]));
                 read_offset = 0;
-                while (read_offset < strlen(rtd->seq[r])-rtd->kmer_size+1) {
+                while (read_offset < read_kmers) {
                     // Get next kmer
                     if (get_next_kmer_from_string(rtd->seq[r], kmer_str, &read_offset, rtd->kmer_size) == rtd->kmer_size) {
                         // Convert to binary kmer and lookup
                         seq_to_binary_kmer(kmer_str, rtd->kmer_size, &kmer);
                         Key key = element_get_key(&kmer, rtd->kmer_size, &tmp_kmer);
-                        current_node = hash_table_find(key, rtd->kmer_hash);
+                        current_node = hash_table_find(key, kmer_hash);
+                        rtd->counts[r].kmers_looked_up++;
                         if (current_node != NULL) {
-                            int contaminant_count = 0;
-                            int contaminant_index = 0;
+                            int n_ids;
                             
-                            element_get_and_increment_read_coverages(rtd->kmer_hash, current_node, r, &(node_cov[0]), &(node_cov[1]));
+                            element_get_and_increment_read_coverages(kmer_hash, current_node, r, &(node_cov[0]), &(node_cov[1]));
                             
-                            /* Go through all contaminants */
-                            for (c=0; c<rtd->counts[r].n_contaminants; c++) {
-                                /* Check if kmer is found in this contaminant */
-                                if (element_get_contaminant_bit(current_node, c) > 0) {
-                                    /* Count how many contaminants have this kmer */
-                                    contaminant_count++;
-                                    contaminant_index = c;
-                                    
-                                    /* If the count of kmers from this contaminant is 0, then this is the first kmer we've
-                                     seen from this contaminant, so we update the count of number of contaminants seen */
-                                    if (rtd->counts[r].kmers_from_contaminant[c] == 0) {
-                                        rtd->counts[r].contaminants_detected++;
-                                    }
-                                    
-                                    /* Update the count of number of kmers from this contaminant in this read */
-                                    rtd->counts[r].kmers_from_contaminant[c]++;
-                                    
-                                    /* Now for the stats for both reads: If there is no coverage for this kmer in either
-                                       read, then this is the first time we've seen this kmer, so update the count of kmers
-                                       seen. */
-                                    increment_both_kmers_seen = false;
-                                    increment_read_kmers_seen = false;
-                                    
-                                    if (node_cov[r] == 0) {
-                                        increment_read_kmers_seen = 1;
-                                        if ((node_cov[0] == 0) && (node_cov[1] == 0)) {
-                                            increment_both_kmers_seen = 1;
-                                        }
-                                    }
-                                    
-                                    if (increment_read_kmers_seen) {
-                                        pthread_mutex_lock(&(rtd->stats->read[r]->lock));
-                                        rtd->stats->read[r]->contaminant_kmers_seen[c]++;
-                                        pthread_mutex_unlock(&(rtd->stats->read[r]->lock));
-                                    }
-                                    
-                                    if (increment_both_kmers_seen) {
-                                        pthread_mutex_lock(&(rtd->stats->both_reads->lock));
-                                        rtd->stats->both_reads->contaminant_kmers_seen[c]++;
-                                        pthread_mutex_unlock(&(rtd->stats->both_reads->lock));
+                            /* Only the contaminants holding this kmer are visited */
+                            n_ids = kmer_counts_add_hit(&(rtd->counts[r]), current_node, ids);
+                            
+                            /* Now for the stats for both reads: If there is no coverage for this kmer in either
+                               read, then this is the first time we've seen this kmer, so update the count of kmers
+                               seen. */
+                            increment_read_kmers_seen = (node_cov[r] == 0);
+                            increment_both_kmers_seen = (node_cov[0] == 0) && (node_cov[1] == 0);
+                            
+                            if (increment_read_kmers_seen) {
+                                parallel_mutex_lock(&(rtd->stats->read[r]->lock));
+                                for (c=0; c<n_ids; c++) {
+                                    rtd->stats->read[r]->contaminant_kmers_seen[ids[c]]++;
+                                }
+                                pthread_mutex_unlock(&(rtd->stats->read[r]->lock));
+                                
+                                if (increment_both_kmers_seen) {
+                                    parallel_mutex_lock(&(rtd->stats->both_reads->lock));
+                                    for (c=0; c<n_ids; c++) {
+                                        rtd->stats->both_reads->contaminant_kmers_seen[ids[c]]++;
                                     }
+                                    pthread_mutex_unlock(&(rtd->stats->both_reads->lock));
                                 }
                             }
                             
-                            if (contaminant_count == 1) {
-                                rtd->counts[r].unique_kmers_from_contaminant[contaminant_index]++;
-                            }
-                            
                             /* Update count of how many times we've seen this kmer in this read */
                             rtd->counts[r].kmers_loaded++;
                         } // End if (current_node != NULL)
+                        
+                        if (early_exit && kmer_stats_read_is_decided(&(rtd->counts[r]), r == 1 ? &(rtd->counts[0]) : NULL, read_kmers - read_offset, rtd->cmd_line)) {
+                            break;
+                        }
                     } else {
                         printf("Error in kmer\n");
                     }
@@ -646,7 +933,7 @@ void* read_process_thread(void* a)
             } // End r loop
 
             // Update global stats
-            pthread_mutex_lock(&mutex_nr);
+            parallel_mutex_lock(&mutex_nr);
             rtd->stats->both_reads->number_of_reads++;
             pthread_mutex_unlock(&mutex_nr);
             filter_read = update_stats_for_both_parallel(rtd->stats, rtd->cmd_line, &(rtd->counts[0]), &(rtd->counts[1]));
@@ -669,9 +956,11 @@ void* read_process_thread(void* a)
             free(thread_data[n]);
             
             // Set state ready to receive another pair
-            pthread_mutex_lock(&mutex_counts);
+            parallel_mutex_lock(&mutex_counts);
             reads_processed++;
             pthread_mutex_unlock(&mutex_counts);
+            thread_utilisation->pairs++;
+            thread_utilisation->busy += (seconds_now() - pair_start) - (thread_utilisation->waiting_on_locks - locks_before);
             thread_state[n] = STATE_READY;
         } else {
             // Sleep before checking again
@@ -692,6 +981,8 @@ void pass_to_a_thread(ReadThreadData * rtd)
 {
     int i;
     int n = -1;
+    int depth = 0;
+    double wait_start;
     struct timespec req, rem;
     
     assert(rtd != 0);
@@ -699,7 +990,15 @@ void pass_to_a_thread(ReadThreadData * rtd)
     req.tv_sec = 0;
     req.tv_nsec = 10;
 
+    for (i=0; i<num_threads-1; i++) {
+        if (thread_state[i] == STATE_DATA) {
+            depth++;
+        }
+    }
+    queue_depth_samples[depth]++;
+
     // Find a thread in the READY state
+    wait_start = seconds_now();
     while (n == -1) {
         for (i=0; i<num_threads-1; i++) {
             if (thread_state[i] == STATE_READY) {
@@ -709,6 +1008,7 @@ void pass_to_a_thread(ReadThreadData * rtd)
         }
         nanosleep(&req, &rem);
     }
+    reader_utilisation.blocked_on_output += seconds_now() - wait_start;
 
     // Pass thread the data
     thread_data[n] = rtd;
@@ -728,12 +1028,12 @@ long long screen_or_filter_parallel(CmdLine* cmd_line, KmerFileReaderArgs* fra_1
     HashTable* kmer_hash;
     KmerFileReaderArgs* fra[2];
     FILE* fp_in[2];
-    //time_t time_previous = 0;
-    //time_t time_now = 0;
+    Sequence* skip_seq[2];
+    double progress_previous;
+    double wait_start;
     int number_of_files = 1;
     long int number_of_pairs = 0;
     long int pairs_processed = 0;
-    double read_write_counter = 1.0;
     long int i;
     int rc;
     struct timespec req, rem;
@@ -750,10 +1050,13 @@ long long screen_or_filter_parallel(CmdLine* cmd_line, KmerFileReaderArgs* fra_1
     pthread_mutex_init(&mutex_summary_file, NULL);
     pthread_mutex_init(&mutex_counts, NULL);
     pthread_mutex_init(&mutex_nr, NULL);
+    initialise_hash_mutexes();
     
-    for (i=0; i<256; i++) {
-        pthread_mutex_init(&(mutex_hash[i]), NULL);
-    }
+    memset(utilisation, 0, sizeof(utilisation));
+    memset(&reader_utilisation, 0, sizeof(reader_utilisation));
+    memset(queue_depth_samples, 0, sizeof(queue_depth_samples));
+    parallel_start = seconds_now();
+    progress_previous = parallel_start;
     
     // Create threads to process read pairs
     for (i=0; i<num_threads-1; i++) {
@@ -787,13 +1090,24 @@ long long screen_or_filter_parallel(CmdLine* cmd_line, KmerFileReaderArgs* fra_1
             printf("Error: can't open input file %s\n", fra[i]->input_filename);
             exit(1);
         }
+        skip_seq[i] = sequence_new(fra[i]->max_read_length, fra[i]->max_read_length, fra[i]->fastq_ascii_offset);
     }
     
     // Get reads
     while (!feof(fp_in[0])) {
-        ReadThreadData* rtd = calloc(1, sizeof(ReadThreadData));
+        ReadThreadData* rtd;
         int reads = 0;
         
+        // Unsampled pairs are skipped without being parsed or allocated
+        if (!subsample_keep_read(number_of_pairs, cmd_line->subsample_ratio)) {
+            for (i=0; i<number_of_files; i++) {
+                skip_sequence_from_fastq(fp_in[i], skip_seq[i], fra[i]->max_read_length);
+            }
+            number_of_pairs++;
+            continue;
+        }
+        
+        rtd = calloc(1, sizeof(ReadThreadData));
         if (!rtd) {
             printf("Error: can't get memory for read thread data!\n");
             exit(1);
@@ -817,47 +1131,110 @@ long long screen_or_filter_parallel(CmdLine* cmd_line, KmerFileReaderArgs* fra_1
         
         // Pass reads to a thread
         if (reads == 2) {
-            //if ((number_of_pairs % read_interval) == 0) {
-            if (read_write_counter >= read_interval) {
-                read_write_counter -= read_interval;
-                pass_to_a_thread(rtd);
-                pairs_processed++;
-            }
+            pass_to_a_thread(rtd);
+            pairs_processed++;
             number_of_pairs++;
-            read_write_counter++;
+            reader_utilisation.pairs++;
         }
         
-        // Write progress report?
-        //if (cmd_line->write_progress_file) {
-        //    time(&time_now);
-        //    if (difftime(time_now, time_previous) > cmd_line->progress_delay) {
-        //        kmer_stats_write_progress(stats, cmd_line);
-        //        time_previous = time_now;
-        //    }
-        //}
+        // Thread utilisation goes to the progress directory
+        if (cmd_line->write_progress_file && ((seconds_now() - progress_previous) > cmd_line->progress_delay)) {
+            reader_utilisation.busy = (seconds_now() - parallel_start) - reader_utilisation.blocked_on_output;
+            write_utilisation_progress(cmd_line);
+            progress_previous = seconds_now();
+        }
     }
     
     // Close files
     for (i=0; i<number_of_files; i++) {
         fclose(fp_in[i]);
+        free_sequence(&(skip_seq[i]));
     }
     
     // Wait for threads to finish...
     req.tv_sec = 0;
     req.tv_nsec = 10;
+    reader_utilisation.busy = (seconds_now() - parallel_start) - reader_utilisation.blocked_on_output;
+    wait_start = seconds_now();
     for (i=0; i<num_threads-1; i++) {
         while (thread_state[i] != STATE_READY) {
             nanosleep(&req, &rem);
         }
         thread_state[i] = STATE_END;
     }
+    reader_utilisation.blocked_on_output += seconds_now() - wait_start;
     printf("Done reading %ld reads\n\n", pairs_processed);
     
+    report_utilisation(stdout);
+    printf("\n");
+    if (cmd_line->write_progress_file) {
+        write_utilisation_progress(cmd_line);
+    }
+    
     return 0;
 }
 
 
 
+/*----------------------------------------------------------------------*
+ * Function:   write_read_summary
+ * Purpose:    Write a read's line to the read summary file and update the
+ *             species classification counts
+ * Parameters: fp -> read summary file
+ *             name -> read name
+ *             r = read number (0 or 1)
+ *             counts -> kmer counts for the read
+ *             stats -> stats structure
+ *             cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_read_summary(FILE* fp, char* name, int r, KmerCounts* counts, KmerStats* stats, CmdLine* cmd_line)
+{
+    uint32_t index_first = 0;
+    uint32_t count_first = 0;
+    uint32_t count_second = 0;
+    uint32_t classified = 0;
+    double ratio = 0.0;
+    int j;
+
+    fprintf(fp, "%s", name);
+    fprintf(fp, "\t%d", counts->contaminants_detected);
+    fprintf(fp, "\t%d", counts->kmers_loaded);
+    for (j=0; j<stats->n_contaminants; j++) {
+        fprintf(fp, "\t%d", counts->kmers_from_contaminant[j]);
+        
+        if (counts->kmers_from_contaminant[j] > count_first) {
+            count_second = count_first;
+            count_first = counts->kmers_from_contaminant[j];
+            index_first = j;
+        }
+        else if (counts->kmers_from_contaminant[j] > count_second) {
+            count_second = counts->kmers_from_contaminant[j];
+        }
+    }
+    
+    if (count_second > 0) {
+        ratio = (double)count_second/(double)count_first;
+    }
+    
+    if (count_first >= cmd_line->kmer_threshold_read) {
+        if (ratio <= cmd_line->ratio) {
+            classified = index_first + 1;
+            stats->read[r]->species_read_counts[index_first]++;
+        } else {
+            stats->read[r]->species_unclassified++;
+        }
+    } else {
+        stats->read[r]->species_unclassified++;
+    }
+    
+    fprintf(fp, "\t%d", count_first);
+    fprintf(fp, "\t%d", count_second);
+    fprintf(fp, "\t%.2f", ratio);
+    fprintf(fp, "\t%d", classified);
+    fprintf(fp, "\n");
+}
+
 /*----------------------------------------------------------------------*
  * Function:
  * Purpose:
@@ -876,14 +1253,12 @@ long long screen_or_filter_paired_end(CmdLine* cmd_line, KmerFileReaderArgs* fra
     KmerFileReaderWrapperArgs* frw[2];
     KmerSlidingWindowSet* windows[2];
     int number_of_files = 1;
-    int i, j;
-    time_t time_previous = 0;
-    time_t time_now = 0;
+    int i;
     FILE* fp_read_summary = 0;
     int nr = 0;
     long int number_of_pairs = 0;
     double read_interval = (1.0 / cmd_line->subsample_ratio);
-    double read_write_counter = 1.0;
+    boolean sample_read;
     
     printf("Checking every %f read\n", read_interval);
     
@@ -933,6 +1308,7 @@ long long screen_or_filter_paired_end(CmdLine* cmd_line, KmerFileReaderArgs* fra
     for (i=0; i<2; i++) {
         seq_length[i] = 0;
         entry_length[i] = 0;
+        initialise_kmer_counts(stats->n_contaminants, &(counts[i]));
     }
 
     // Open read summary file
@@ -948,13 +1324,19 @@ long long screen_or_filter_paired_end(CmdLine* cmd_line, KmerFileReaderArgs* fra
 	{
         boolean filter_read = false;
         
+        sample_read = subsample_keep_read(number_of_pairs, cmd_line->subsample_ratio);
+        
         for (i=0; i<number_of_files; i++) {
             int nkmers;
             
-            initialise_kmer_counts(stats->n_contaminants, &(counts[i]));
+            reset_kmer_counts(stats->n_contaminants, &(counts[i]));
             
-            // Get next read
-            entry_length[i] = file_reader_wrapper(frw[i]);
+            // Get next read, or just step over it if it isn't in the subsample
+            if (sample_read) {
+                entry_length[i] = file_reader_wrapper(frw[i]);
+            } else {
+                entry_length[i] = skip_sequence_from_fastq(frw[i]->input_fp, frw[i]->seq, fra[i]->max_read_length);
+            }
             if (entry_length[i] == 0) {
                 keep_reading = false;
             }
@@ -962,7 +1344,7 @@ long long screen_or_filter_paired_end(CmdLine* cmd_line, KmerFileReaderArgs* fra
             // Update length read
             seq_length[i] += (long long)entry_length[i];
         
-            if (read_write_counter >= read_interval) {
+            if (sample_read) {
                 // Get sliding windows
                 nkmers = get_sliding_windows_from_sequence(frw[i]->seq->seq, frw[i]->seq->qual, entry_length[i], fra[i]->quality_cut_off, kmer_hash->kmer_size, windows[i], windows[i]->max_nwindows, windows[i]->max_kmers, false, 0);
 
@@ -977,54 +1359,10 @@ long long screen_or_filter_paired_end(CmdLine* cmd_line, KmerFileReaderArgs* fra
                     fra[i]->bad_reads++;
                 } else {
                     // Load kmers
-                    kmer_hash_load_sliding_windows(&previous_node, kmer_hash, true, fra[i], kmer_hash->kmer_size, windows[i], i, stats, &(counts[i]));
+                    kmer_hash_load_sliding_windows(&previous_node, kmer_hash, true, fra[i], kmer_hash->kmer_size, windows[i], i, stats, &(counts[i]), i == 1 ? &(counts[0]) : NULL, cmd_line->early_exit && ((i == 1) || (number_of_files == 1)));
                     
                     if (fp_read_summary) {
-                        uint32_t index_first = 0;
-                        //uint32_t index_second = 0;
-                        uint32_t count_first = 0;
-                        uint32_t count_second = 0;
-                        uint32_t classified = 0;
-                        double ratio = 0.0;
-
-                        fprintf(fp_read_summary, "%s", frw[i]->seq->name);
-                        fprintf(fp_read_summary, "\t%d", counts[i].contaminants_detected);
-                        fprintf(fp_read_summary, "\t%d", counts[i].kmers_loaded);
-                        for (j=0; j<stats->n_contaminants; j++) {
-                            fprintf(fp_read_summary, "\t%d", counts[i].kmers_from_contaminant[j]);
-                            
-                            if (counts[i].kmers_from_contaminant[j] > count_first) {
-                                count_second = count_first;
-                                //index_second = index_first;
-                                count_first = counts[i].kmers_from_contaminant[j];
-                                index_first = j;
-                            }
-                            else if (counts[i].kmers_from_contaminant[j] > count_second) {
-                                count_second = counts[i].kmers_from_contaminant[j];
-                                //index_second = j;
-                            }
-                        }
-                        
-                        if (count_second > 0) {
-                            ratio = (double)count_second/(double)count_first;
-                        }
-                        
-                        if (count_first >= cmd_line->kmer_threshold_read) {
-                            if (ratio <= cmd_line->ratio) {
-                                classified = index_first + 1;
-                                stats->read[i]->species_read_counts[index_first]++;
-                            } else {
-                                stats->read[i]->species_unclassified++;
-                            }
-                        } else {
-                            stats->read[i]->species_unclassified++;
-                        }
-                        
-                        fprintf(fp_read_summary, "\t%d", count_first);
-                        fprintf(fp_read_summary, "\t%d", count_second);
-                        fprintf(fp_read_summary, "\t%.2f", ratio);
-                        fprintf(fp_read_summary, "\t%d", classified);
-                        fprintf(fp_read_summary, "\n");
+                        write_read_summary(fp_read_summary, frw[i]->seq->name, i, &(counts[i]), stats, cmd_line);
                     }
                     
                     hash_table_add_number_of_reads(1, kmer_hash);
@@ -1034,9 +1372,7 @@ long long screen_or_filter_paired_end(CmdLine* cmd_line, KmerFileReaderArgs* fra
             }
         } // End number_of_files loop
         
-        if (read_write_counter >= read_interval) {
-            read_write_counter -= read_interval;
-
+        if (sample_read) {
             if (number_of_files == 2) {
                 // Check for not getting both reads
                 if (((entry_length[0] == 0) && (entry_length[1] > 0)) ||
@@ -1072,21 +1408,8 @@ long long screen_or_filter_paired_end(CmdLine* cmd_line, KmerFileReaderArgs* fra
                     }
                 }
             }
-
-            if (cmd_line->write_progress_file) {
-                time(&time_now);
-                if (difftime(time_now, time_previous) > cmd_line->progress_delay) {
-                    kmer_stats_write_progress(stats, cmd_line);
-                    time_previous = time_now;
-                }
-            }
         }
         number_of_pairs++;
-        read_write_counter++;
-    }
-    
-    if (cmd_line->write_progress_file) {
-        kmer_stats_write_progress(stats, cmd_line);
     }
     
     for (i=0; i<number_of_files; i++) {
@@ -1191,7 +1514,7 @@ long long load_seq_into_kmers_hash(KmerFileReaderArgs* fra, KmerFileReaderWrappe
 		if (nkmers == 0) {
 			(*bad_reads)++;
 		} else {
-            kmer_hash_load_sliding_windows(&previous_node, kmer_hash, prev_full_entry, fra, kmer_size, windows, 0, 0, &counts);
+            kmer_hash_load_sliding_windows(&previous_node, kmer_hash, prev_full_entry, fra, kmer_size, windows, 0, 0, &counts, NULL, false);
         }
         
         if (fria->full_entry == false) {
@@ -1490,12 +1813,17 @@ boolean read_kmer_from_file(FILE* fp, short kmer_size, Element* node)
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters: None
- * Returns:    None
+ * Function:   load_kmer_library
+ * Purpose:    Load a contaminant's kmers into the table
+ * Parameters: filename -> library filename
+ *             n = contaminant number
+ *             k = kmer size
+ *             contaminant_hash -> table to load into
+ *             shard = shard to load (from 1), or 0 to load all kmers
+ *             n_shards = number of shards
+ * Returns:    Number of kmers loaded
  *----------------------------------------------------------------------*/
-uint32_t load_kmer_library(char* filename, int n, int k, HashTable* contaminant_hash)
+uint32_t load_kmer_library(char* filename, int n, int k, HashTable* contaminant_hash, int shard, int n_shards)
 {
 	FILE* fp_bin;
     uint32_t num_colours_in_binary;
@@ -1520,9 +1848,14 @@ uint32_t load_kmer_library(char* filename, int n, int k, HashTable* contaminant_
     
 	//Go through all the entries in the binary file
 	while (read_kmer_from_file(fp_bin, k, &node_from_file)) {
+		Element *current_node = NULL;
+
+		if ((shard > 0) && (kmer_shard_of_key(element_get_key(element_get_kmer(&node_from_file), k, &tmp_kmer), n_shards) != (shard - 1))) {
+			continue;
+		}
+
 		count++;
         
-		Element *current_node = NULL;
 		if (!all_entries_are_unique) {
 			current_node =  hash_table_find_or_insert(element_get_key(element_get_kmer(&node_from_file), k, &tmp_kmer), &found, contaminant_hash);
 		} else {
@@ -0,0 +1,522 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_server.c                                               *
+ * Purpose: Serve screening/filtering jobs over a Unix domain socket    *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Loading a large contaminant index can take far longer than screening a
+   small run against it. In server mode the index is loaded once and jobs
+   arrive over a Unix domain socket. A client sends its working directory
+   and command line; the server forks a process for the job, so the job
+   shares the loaded table copy-on-write and the only pages it copies are
+   those holding the coverage flags it sets. Several jobs can therefore run
+   at once without seeing each other's state. The job's stdout is passed
+   back to the client, followed by its exit status.
+
+   Request:  int32 count, then count x (int32 length, bytes). The first
+             string is the working directory, the rest are argv.
+   Response: frames of char type, uint32 length, data. SERVER_FRAME_OUTPUT
+             carries job output, SERVER_FRAME_EXIT carries an int32 status
+             and ends the job.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <signal.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include "kmer_server.h"
+
+static char* server_socket_path = 0;
+
+/*----------------------------------------------------------------------*
+ * Function:   write_all
+ * Purpose:    Write a buffer to a file descriptor, coping with short
+ *             writes.
+ * Parameters: fd = file descriptor
+ *             buffer -> data
+ *             length = bytes to write
+ * Returns:    1 for success, 0 for failure
+ *----------------------------------------------------------------------*/
+static int write_all(int fd, void* buffer, size_t length)
+{
+    char* ptr = buffer;
+    ssize_t n;
+
+    while (length > 0) {
+        n = send(fd, ptr, length, MSG_NOSIGNAL);
+        if ((n < 0) && (errno == ENOTSOCK)) {
+            n = write(fd, ptr, length);
+        }
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+        ptr += n;
+        length -= n;
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_all
+ * Purpose:    Read an exact number of bytes from a file descriptor.
+ * Parameters: fd = file descriptor
+ *             buffer -> buffer to fill
+ *             length = bytes to read
+ * Returns:    1 for success, 0 for failure or end of file
+ *----------------------------------------------------------------------*/
+static int read_all(int fd, void* buffer, size_t length)
+{
+    char* ptr = buffer;
+    ssize_t n;
+
+    while (length > 0) {
+        n = read(fd, ptr, length);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        } else if (n == 0) {
+            return 0;
+        }
+        ptr += n;
+        length -= n;
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_frame
+ * Purpose:    Send a response frame to the client.
+ * Parameters: fd = client socket
+ *             type = SERVER_FRAME_OUTPUT or SERVER_FRAME_EXIT
+ *             data -> frame data
+ *             length = bytes of data
+ * Returns:    1 for success, 0 for failure
+ *----------------------------------------------------------------------*/
+static int write_frame(int fd, char type, void* data, uint32_t length)
+{
+    char header[5];
+
+    header[0] = type;
+    memcpy(header + 1, &length, sizeof(uint32_t));
+
+    if (!write_all(fd, header, sizeof(header))) {
+        return 0;
+    }
+
+    return write_all(fd, data, length);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_string
+ * Purpose:    Send a length prefixed string.
+ * Parameters: fd = socket
+ *             string -> string to send
+ * Returns:    1 for success, 0 for failure
+ *----------------------------------------------------------------------*/
+static int write_string(int fd, char* string)
+{
+    int32_t length = (int32_t)strlen(string);
+
+    if (!write_all(fd, &length, sizeof(int32_t))) {
+        return 0;
+    }
+
+    return write_all(fd, string, length);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_string
+ * Purpose:    Receive a length prefixed string.
+ * Parameters: fd = socket
+ * Returns:    Pointer to allocated string, or NULL on failure
+ *----------------------------------------------------------------------*/
+static char* read_string(int fd)
+{
+    int32_t length;
+    char* string;
+
+    if (!read_all(fd, &length, sizeof(int32_t))) {
+        return NULL;
+    }
+
+    if ((length < 0) || (length > SERVER_MAX_JOB_STRING)) {
+        return NULL;
+    }
+
+    string = malloc(length + 1);
+    if (!string) {
+        return NULL;
+    }
+
+    if (!read_all(fd, string, length)) {
+        free(string);
+        return NULL;
+    }
+    string[length] = 0;
+
+    return string;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_request
+ * Purpose:    Receive a job request from a client.
+ * Parameters: fd = client socket
+ *             cwd -> to receive working directory
+ *             argc -> to receive number of arguments
+ *             argv -> to receive arguments
+ * Returns:    1 for success, 0 for failure
+ *----------------------------------------------------------------------*/
+static int read_request(int fd, char** cwd, int* argc, char*** argv)
+{
+    int32_t count;
+    int i;
+
+    if (!read_all(fd, &count, sizeof(int32_t))) {
+        return 0;
+    }
+
+    if ((count < 2) || (count > SERVER_MAX_JOB_ARGS)) {
+        return 0;
+    }
+
+    *cwd = read_string(fd);
+    if (!*cwd) {
+        return 0;
+    }
+
+    *argc = count - 1;
+    *argv = calloc(count, sizeof(char*));
+    if (!*argv) {
+        return 0;
+    }
+
+    for (i=0; i<*argc; i++) {
+        (*argv)[i] = read_string(fd);
+        if (!(*argv)[i]) {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   run_job
+ * Purpose:    Run one job for a connected client. Called in a process of
+ *             its own, which forks again so that a job ending with exit()
+ *             still gets its status back to the client.
+ * Parameters: fd = client socket
+ *             job -> job function
+ *             data -> data for job function
+ * Returns:    Exit status for process
+ *----------------------------------------------------------------------*/
+static int run_job(int fd, KmerServerJob job, void* data)
+{
+    char* cwd;
+    char** argv;
+    int argc;
+    int fds[2];
+    pid_t pid;
+    char buffer[64 * 1024];
+    ssize_t n;
+    int status;
+    int32_t exit_status;
+
+    if (!read_request(fd, &cwd, &argc, &argv)) {
+        return 1;
+    }
+
+    if (pipe(fds) != 0) {
+        return 1;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        return 1;
+    } else if (pid == 0) {
+        close(fds[0]);
+        close(fd);
+        dup2(fds[1], STDOUT_FILENO);
+        dup2(fds[1], STDERR_FILENO);
+        close(fds[1]);
+        setvbuf(stdout, NULL, _IOLBF, 0);
+
+        if (chdir(cwd) != 0) {
+            printf("Error: can't change to directory %s\n", cwd);
+            exit(1);
+        }
+
+        exit(job(argc, argv, data));
+    }
+
+    close(fds[1]);
+
+    // Keep reading until the job ends even if the client goes away, so
+    // that it isn't left blocked on a full pipe
+    while ((n = read(fds[0], buffer, sizeof(buffer))) != 0) {
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        write_frame(fd, SERVER_FRAME_OUTPUT, buffer, (uint32_t)n);
+    }
+    close(fds[0]);
+
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return 1;
+        }
+    }
+
+    if (WIFEXITED(status)) {
+        exit_status = WEXITSTATUS(status);
+    } else {
+        exit_status = 128 + WTERMSIG(status);
+    }
+
+    write_frame(fd, SERVER_FRAME_EXIT, &exit_status, sizeof(int32_t));
+
+    return exit_status;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   server_signal_handler
+ * Purpose:    Remove socket when server is stopped.
+ * Parameters: signal = signal number
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void server_signal_handler(int signal)
+{
+    if (server_socket_path) {
+        unlink(server_socket_path);
+    }
+    _exit(0);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   reap_jobs
+ * Purpose:    Collect finished jobs.
+ * Parameters: running -> number of running jobs, decremented for each
+ *             job collected
+ *             block = true to wait for at least one job to finish
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void reap_jobs(int* running, int block)
+{
+    pid_t pid;
+    int status;
+
+    while (*running > 0) {
+        pid = waitpid(-1, &status, block ? 0 : WNOHANG);
+        if (pid > 0) {
+            (*running)--;
+            printf("Job process %d finished with status %d\n", (int)pid, WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status));
+            fflush(stdout);
+            block = 0;
+        } else if ((pid < 0) && (errno == EINTR)) {
+            continue;
+        } else {
+            break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_server_run
+ * Purpose:    Accept jobs on a Unix domain socket until killed.
+ * Parameters: socket_path -> path of socket to create
+ *             max_jobs = maximum jobs to run at once
+ *             job -> function to run each job
+ *             data -> data for job function
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_server_run(char* socket_path, int max_jobs, KmerServerJob job, void* data)
+{
+    struct sockaddr_un address;
+    int listen_fd;
+    int client_fd;
+    int running = 0;
+    long int jobs = 0;
+    pid_t pid;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        printf("Error: socket path %s is too long\n", socket_path);
+        exit(1);
+    }
+
+    listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0) {
+        printf("Error: can't create socket\n");
+        exit(1);
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+    unlink(socket_path);
+
+    if (bind(listen_fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        printf("Error: can't bind socket %s\n", socket_path);
+        exit(1);
+    }
+
+    if (listen(listen_fd, 64) != 0) {
+        printf("Error: can't listen on socket %s\n", socket_path);
+        exit(1);
+    }
+
+    server_socket_path = socket_path;
+    signal(SIGINT, server_signal_handler);
+    signal(SIGTERM, server_signal_handler);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("\nServing jobs on %s (up to %d at once)\n", socket_path, max_jobs);
+    fflush(stdout);
+
+    while (1) {
+        client_fd = accept(listen_fd, NULL, NULL);
+        if (client_fd < 0) {
+            if (errno != EINTR) {
+                printf("Error: accept failed on %s\n", socket_path);
+            }
+            continue;
+        }
+
+        reap_jobs(&running, 0);
+        if (running >= max_jobs) {
+            reap_jobs(&running, 1);
+        }
+
+        // Anything still buffered would be written again by the child
+        fflush(stdout);
+
+        pid = fork();
+        if (pid < 0) {
+            printf("Error: can't fork job process\n");
+            close(client_fd);
+        } else if (pid == 0) {
+            close(listen_fd);
+            signal(SIGINT, SIG_DFL);
+            signal(SIGTERM, SIG_DFL);
+            signal(SIGPIPE, SIG_DFL);
+            server_socket_path = 0;
+            exit(run_job(client_fd, job, data));
+        } else {
+            close(client_fd);
+            running++;
+            jobs++;
+            printf("Job %ld started in process %d (%d running)\n", jobs, (int)pid, running);
+            fflush(stdout);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_client_run
+ * Purpose:    Send a job to a server and print its output.
+ * Parameters: socket_path -> path of server socket
+ *             argc = number of arguments
+ *             argv -> arguments
+ * Returns:    Exit status of job
+ *----------------------------------------------------------------------*/
+int kmer_client_run(char* socket_path, int argc, char* argv[])
+{
+    struct sockaddr_un address;
+    char cwd[4096];
+    char header[5];
+    char* buffer;
+    uint32_t length;
+    int32_t count = argc + 1;
+    int32_t exit_status;
+    int fd;
+    int i;
+
+    if (strlen(socket_path) >= sizeof(address.sun_path)) {
+        printf("Error: socket path %s is too long\n", socket_path);
+        return 1;
+    }
+
+    if (!getcwd(cwd, sizeof(cwd))) {
+        printf("Error: can't get working directory\n");
+        return 1;
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        printf("Error: can't create socket\n");
+        return 1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, socket_path);
+
+    if (connect(fd, (struct sockaddr*)&address, sizeof(address)) != 0) {
+        printf("Error: can't connect to server on %s\n", socket_path);
+        return 1;
+    }
+
+    if (!write_all(fd, &count, sizeof(int32_t)) || !write_string(fd, cwd)) {
+        printf("Error: can't send job to server\n");
+        return 1;
+    }
+    for (i=0; i<argc; i++) {
+        if (!write_string(fd, argv[i])) {
+            printf("Error: can't send job to server\n");
+            return 1;
+        }
+    }
+
+    buffer = malloc(64 * 1024);
+    if (!buffer) {
+        printf("Error: can't allocate memory for buffer\n");
+        return 1;
+    }
+
+    while (read_all(fd, header, sizeof(header))) {
+        memcpy(&length, header + 1, sizeof(uint32_t));
+        if (length > (64 * 1024)) {
+            break;
+        }
+        if (!read_all(fd, buffer, length)) {
+            break;
+        }
+
+        if ((header[0] == SERVER_FRAME_EXIT) && (length == sizeof(int32_t))) {
+            memcpy(&exit_status, buffer, sizeof(int32_t));
+            fflush(stdout);
+            free(buffer);
+            close(fd);
+            return exit_status;
+        } else if (header[0] == SERVER_FRAME_OUTPUT) {
+            fwrite(buffer, 1, length, stdout);
+        }
+    }
+
+    fflush(stdout);
+    printf("Error: lost connection to server\n");
+    free(buffer);
+    close(fd);
+
+    return 1;
+}
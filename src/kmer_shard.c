@@ -0,0 +1,507 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_shard.c                                                *
+ * Purpose: Hash partitioned contaminant index, screened shard by shard *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   A contaminant panel whose table won't fit in one node's memory can be
+   split into N shards by a hash of each kmer. Indexing with -H N writes
+   one library file per shard. Screening with -I i -H N loads only shard
+   i (from its shard file, or by skipping other kmers in the full
+   library) and writes each read's partial KmerCounts to a counts file.
+
+   Every kmer lives in exactly one shard, with all of its contaminant
+   bits, so a read's counts are the sums of its partial counts over all
+   shards, and so are the kmers-seen totals. The combiner (-Q) reads the
+   N counts files in step, sums each read's counts and classifies it just
+   as a single process would. The shards can run on different nodes, or
+   one after another on one box.
+
+   Counts file: SHARD_COUNTS_MAGIC, uint32 SHARD_COUNTS_VERSION, uint32
+   header words (see kmer_shard_header), per contaminant uint32 id
+   length, id, uint32 kmers in shard, uint32 kmers unique to it in the
+   shard and a row of uint32 kmers in common with each contaminant (so
+   -Q can write the similarity files for the whole index). Then for each pair, for each
+   input file, a uint8 state and, if SHARD_READ_COUNTED, uint32
+   kmers_loaded, kmers_from_contaminant and unique_kmers_from_contaminant.
+   Ends with uint8 SHARD_END and the uint32 kmers-seen arrays for read 1,
+   read 2 and both reads.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "cmd_line.h"
+#include "kmer_stats.h"
+#include "kmer_reader.h"
+#include "kmer_shard.h"
+
+#define SHARD_HEADER_WORDS 8
+#define SHARD_SETTINGS_WORDS 6
+
+static char* header_names[SHARD_SETTINGS_WORDS] = {
+    "kmer size", "read threshold", "overall threshold", "unique filtering",
+    "number of contaminants", "number of input files"
+};
+
+typedef struct {
+    char* filename;
+    FILE* fp;
+    uint32_t header[SHARD_HEADER_WORDS];
+} ShardCountsFile;
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_shard_of_key
+ * Purpose:    Find which shard a kmer belongs to. Independent of table
+ *             size, so indexing and screening agree whatever -n and -b.
+ * Parameters: key -> canonical kmer
+ *             n_shards = number of shards
+ * Returns:    Shard, from 0 to n_shards - 1
+ *----------------------------------------------------------------------*/
+int kmer_shard_of_key(Key key, int n_shards)
+{
+    // Shard libraries and counts files depend on this seed, so it must
+    // not change. The Bloom filter and table hashes are seeded differently
+    // so that within one shard they still use all their blocks and buckets.
+    uint64_t h = 0x9E3779B97F4A7C15ULL;
+    int i;
+
+    for (i=0; i<NUMBER_OF_BITFIELDS_IN_BINARY_KMER; i++) {
+        h ^= (*key)[i];
+        h ^= h >> 33;
+        h *= 0xFF51AFD7ED558CCDULL;
+        h ^= h >> 33;
+        h *= 0xC4CEB9FE1A85EC53ULL;
+        h ^= h >> 33;
+    }
+
+    return (int)(h % (uint64_t)n_shards);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_shard_library_filename
+ * Purpose:    Make filename of library to load for a contaminant - the
+ *             shard's own file if screening a shard and there is one,
+ *             otherwise the full library.
+ * Parameters: filename -> MAX_PATH_LENGTH buffer to fill
+ *             dir -> contaminant directory
+ *             contaminant -> contaminant name
+ *             cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_shard_library_filename(char* filename, char* dir, char* contaminant, CmdLine* cmd_line)
+{
+    if (cmd_line->shard > 0) {
+        sprintf(filename, "%s/%s.fasta.%d.shard%dof%d.kmers", dir, contaminant, cmd_line->kmer_size, cmd_line->shard, cmd_line->n_shards);
+        if (access(filename, R_OK) == 0) {
+            return;
+        }
+    }
+
+    sprintf(filename, "%s/%s.fasta.%d.kmers", dir, contaminant, cmd_line->kmer_size);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_shard_header
+ * Purpose:    Fill counts file header words. The settings words must
+ *             match between files being combined.
+ * Parameters: header -> SHARD_HEADER_WORDS words to fill
+ *             cmd_line -> command line options
+ *             stats -> KmerStats structure
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void kmer_shard_header(uint32_t* header, CmdLine* cmd_line, KmerStats* stats)
+{
+    header[0] = cmd_line->kmer_size;
+    header[1] = cmd_line->kmer_threshold_read;
+    header[2] = cmd_line->kmer_threshold_overall;
+    header[3] = cmd_line->filter_unique ? 1:0;
+    header[4] = stats->n_contaminants;
+    header[5] = stats->number_of_files;
+    header[6] = cmd_line->shard;
+    header[7] = cmd_line->n_shards;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   shard_write
+ * Purpose:    Write to counts file, exiting on failure
+ * Parameters: ptr -> data
+ *             size = bytes to write
+ *             fp -> file
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void shard_write(void* ptr, size_t size, FILE* fp)
+{
+    if (fwrite(ptr, size, 1, fp) != 1) {
+        printf("Error: can't write shard counts file\n");
+        exit(1);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   shard_read
+ * Purpose:    Read from counts file, exiting on failure
+ * Parameters: ptr -> buffer
+ *             size = bytes to read
+ *             file -> counts file
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void shard_read(void* ptr, size_t size, ShardCountsFile* file)
+{
+    if (fread(ptr, size, 1, file->fp) != 1) {
+        printf("Error: %s is truncated\n", file->filename);
+        exit(1);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_shard_open_counts
+ * Purpose:    Open counts file for a shard screening run and write its
+ *             header.
+ * Parameters: cmd_line -> command line options
+ *             stats -> KmerStats structure
+ *             number_of_files = 1 for single ended, 2 for pairs
+ * Returns:    Pointer to open file
+ *----------------------------------------------------------------------*/
+FILE* kmer_shard_open_counts(CmdLine* cmd_line, KmerStats* stats, int number_of_files)
+{
+    char* filename = malloc(strlen(cmd_line->output_prefix) + 64);
+    uint32_t header[SHARD_HEADER_WORDS];
+    uint32_t version = SHARD_COUNTS_VERSION;
+    uint32_t length;
+    FILE* fp;
+    int c;
+
+    if (!filename) {
+        printf("Error: No room to store filename!\n");
+        exit(1);
+    }
+    sprintf(filename, "%sshard%dof%d.counts", cmd_line->output_prefix, cmd_line->shard, cmd_line->n_shards);
+
+    fp = fopen(filename, "wb");
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    } else {
+        printf("Opened %s\n", filename);
+    }
+
+    shard_write(SHARD_COUNTS_MAGIC, strlen(SHARD_COUNTS_MAGIC), fp);
+    shard_write(&version, sizeof(uint32_t), fp);
+    kmer_shard_header(header, cmd_line, stats);
+    header[5] = number_of_files;
+    shard_write(header, sizeof(header), fp);
+
+    for (c=0; c<stats->n_contaminants; c++) {
+        length = strlen(stats->contaminant_ids[c]);
+        shard_write(&length, sizeof(uint32_t), fp);
+        shard_write(stats->contaminant_ids[c], length, fp);
+        shard_write(&(stats->contaminant_kmers[c]), sizeof(uint32_t), fp);
+        shard_write(&(stats->unique_kmers[c]), sizeof(uint32_t), fp);
+        shard_write(stats->kmers_in_common[c], stats->n_contaminants * sizeof(uint32_t), fp);
+    }
+
+    free(filename);
+
+    return fp;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_shard_write_read
+ * Purpose:    Write one read's partial counts.
+ * Parameters: fp -> counts file
+ *             state = SHARD_READ_ABSENT, SHARD_READ_NO_KMERS or
+ *             SHARD_READ_COUNTED
+ *             counts -> counts for read
+ *             n_contaminants = number of contaminants
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_shard_write_read(FILE* fp, int state, KmerCounts* counts, int n_contaminants)
+{
+    uint8_t s = state;
+
+    shard_write(&s, sizeof(uint8_t), fp);
+    if (state == SHARD_READ_COUNTED) {
+        shard_write(&(counts->kmers_loaded), sizeof(uint32_t), fp);
+        shard_write(counts->kmers_from_contaminant, n_contaminants * sizeof(uint32_t), fp);
+        shard_write(counts->unique_kmers_from_contaminant, n_contaminants * sizeof(uint32_t), fp);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_shard_close_counts
+ * Purpose:    Finish counts file with the shard's kmers-seen totals.
+ * Parameters: fp -> counts file
+ *             stats -> KmerStats structure
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_shard_close_counts(FILE* fp, KmerStats* stats)
+{
+    uint8_t s = SHARD_END;
+    size_t size = stats->n_contaminants * sizeof(uint32_t);
+
+    shard_write(&s, sizeof(uint8_t), fp);
+    shard_write(stats->read[0]->contaminant_kmers_seen, size, fp);
+    shard_write(stats->read[1]->contaminant_kmers_seen, size, fp);
+    shard_write(stats->both_reads->contaminant_kmers_seen, size, fp);
+    fclose(fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_shard_open_file
+ * Purpose:    Open a counts file for combining and read its header. The
+ *             first file sets contaminants and settings for the rest.
+ * Parameters: file -> file to open, with filename set
+ *             first = true for first file
+ *             stats -> KmerStats structure
+ *             cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void kmer_shard_open_file(ShardCountsFile* file, boolean first, KmerStats* stats, CmdLine* cmd_line)
+{
+    uint32_t expected[SHARD_HEADER_WORDS];
+    uint32_t version;
+    uint32_t length;
+    uint32_t kmers;
+    uint32_t unique;
+    uint32_t in_common[MAX_CONTAMINANTS];
+    char magic[16];
+    char id[1024];
+    int i, j;
+
+    file->fp = fopen(file->filename, "rb");
+    if (!file->fp) {
+        printf("Error: can't open %s\n", file->filename);
+        exit(1);
+    }
+
+    shard_read(magic, strlen(SHARD_COUNTS_MAGIC), file);
+    if (memcmp(magic, SHARD_COUNTS_MAGIC, strlen(SHARD_COUNTS_MAGIC)) != 0) {
+        printf("Error: %s is not a kontaminant shard counts file\n", file->filename);
+        exit(1);
+    }
+
+    shard_read(&version, sizeof(uint32_t), file);
+    if (version != SHARD_COUNTS_VERSION) {
+        printf("Error: %s is version %u, this build reads version %d\n", file->filename, version, SHARD_COUNTS_VERSION);
+        exit(1);
+    }
+
+    shard_read(file->header, sizeof(file->header), file);
+
+    if (first) {
+        cmd_line->kmer_size = file->header[0];
+        cmd_line->kmer_threshold_read = file->header[1];
+        cmd_line->kmer_threshold_overall = file->header[2];
+        cmd_line->filter_unique = file->header[3] ? true:false;
+        stats->n_contaminants = file->header[4];
+        stats->number_of_files = file->header[5];
+        cmd_line->n_shards = file->header[7];
+        if (stats->n_contaminants > MAX_CONTAMINANTS) {
+            printf("Error: %s has %u contaminants, this build holds up to %d\n", file->filename, stats->n_contaminants, MAX_CONTAMINANTS);
+            exit(1);
+        }
+        if (cmd_line->kmer_size > (NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32) - 1) {
+            printf("Error: %s has kmer size %d, this build holds up to %d\n", file->filename, cmd_line->kmer_size, (NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32) - 1);
+            exit(1);
+        }
+        if ((stats->number_of_files < 1) || (stats->number_of_files > 2) ||
+            (cmd_line->n_shards < 1) || (cmd_line->n_shards > MAX_SHARDS)) {
+            printf("Error: %s is corrupt\n", file->filename);
+            exit(1);
+        }
+    }
+
+    kmer_shard_header(expected, cmd_line, stats);
+    for (i=0; i<SHARD_SETTINGS_WORDS; i++) {
+        if (file->header[i] != expected[i]) {
+            printf("Error: %s has %s %u, earlier files have %u\n", file->filename, header_names[i], file->header[i], expected[i]);
+            exit(1);
+        }
+    }
+    if (file->header[7] != cmd_line->n_shards) {
+        printf("Error: %s is from a %u shard index, earlier files are from a %d shard index\n", file->filename, file->header[7], cmd_line->n_shards);
+        exit(1);
+    }
+    if ((file->header[6] < 1) || (file->header[6] > cmd_line->n_shards)) {
+        printf("Error: %s is corrupt\n", file->filename);
+        exit(1);
+    }
+
+    for (i=0; i<stats->n_contaminants; i++) {
+        shard_read(&length, sizeof(uint32_t), file);
+        if ((length < 1) || (length >= sizeof(id))) {
+            printf("Error: %s is corrupt\n", file->filename);
+            exit(1);
+        }
+        shard_read(id, length, file);
+        id[length] = 0;
+        shard_read(&kmers, sizeof(uint32_t), file);
+        shard_read(&unique, sizeof(uint32_t), file);
+        shard_read(in_common, stats->n_contaminants * sizeof(uint32_t), file);
+
+        if (first) {
+            stats->contaminant_ids[i] = malloc(length + 1);
+            if (!stats->contaminant_ids[i]) {
+                printf("Error: can't allocate memory for string!");
+                exit(1);
+            }
+            strcpy(stats->contaminant_ids[i], id);
+        } else if (strcmp(id, stats->contaminant_ids[i]) != 0) {
+            printf("Error: contaminant %d of %s is %s, earlier files have %s\n", i+1, file->filename, id, stats->contaminant_ids[i]);
+            exit(1);
+        }
+
+        // Each shard holds its own part of the contaminant's kmers
+        stats->contaminant_kmers[i] += kmers;
+        stats->unique_kmers[i] += unique;
+        for (j=0; j<stats->n_contaminants; j++) {
+            stats->kmers_in_common[i][j] += in_common[j];
+        }
+    }
+
+    stats->contaminants_counted = true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_shard_combine_files
+ * Purpose:    Sum per-read partial counts from every shard of an index
+ *             and classify each read, giving the same stats as screening
+ *             against the whole index.
+ * Parameters: n_files = number of counts files
+ *             filenames -> counts filenames, one per shard, any order
+ *             stats -> initialised KmerStats structure
+ *             cmd_line -> command line options, thresholds are set
+ *             from the files
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_shard_combine_files(int n_files, char** filenames, KmerStats* stats, CmdLine* cmd_line)
+{
+    ShardCountsFile* files = calloc(n_files, sizeof(ShardCountsFile));
+    boolean shard_seen[MAX_SHARDS];
+    KmerCounts counts[2];
+    uint32_t values[1 + (2 * MAX_CONTAMINANTS)];
+    uint32_t seen[3][MAX_CONTAMINANTS];
+    uint32_t* totals[3];
+    long int pairs = 0;
+    uint8_t state[2];
+    uint8_t s;
+    int n_contaminants;
+    int f, r, c, i;
+
+    if (!files) {
+        printf("Error: can't allocate memory for shard files\n");
+        exit(1);
+    }
+
+    printf("\nCombining %d shard counts files...\n", n_files);
+
+    for (f=0; f<n_files; f++) {
+        files[f].filename = filenames[f];
+        kmer_shard_open_file(&(files[f]), f == 0 ? true:false, stats, cmd_line);
+        printf("Opened %s (shard %u of %u)\n", files[f].filename, files[f].header[6], files[f].header[7]);
+    }
+
+    if (n_files != cmd_line->n_shards) {
+        printf("Error: index has %d shards, but %d counts files given\n", cmd_line->n_shards, n_files);
+        exit(1);
+    }
+
+    memset(shard_seen, 0, sizeof(shard_seen));
+    for (f=0; f<n_files; f++) {
+        if (shard_seen[files[f].header[6] - 1]) {
+            printf("Error: more than one counts file for shard %u\n", files[f].header[6]);
+            exit(1);
+        }
+        shard_seen[files[f].header[6] - 1] = true;
+    }
+
+    n_contaminants = stats->n_contaminants;
+
+    while (1) {
+        for (r=0; r<stats->number_of_files; r++) {
+            initialise_kmer_counts(n_contaminants, &(counts[r]));
+
+            for (f=0; f<n_files; f++) {
+                shard_read(&s, sizeof(uint8_t), &(files[f]));
+                if (f == 0) {
+                    state[r] = s;
+                } else if (s != state[r]) {
+                    printf("Error: %s and %s are from different input files\n", files[0].filename, files[f].filename);
+                    exit(1);
+                }
+
+                if (s == SHARD_READ_COUNTED) {
+                    shard_read(values, (1 + (2 * n_contaminants)) * sizeof(uint32_t), &(files[f]));
+                    counts[r].kmers_loaded += values[0];
+                    for (c=0; c<n_contaminants; c++) {
+                        counts[r].kmers_from_contaminant[c] += values[1 + c];
+                        counts[r].unique_kmers_from_contaminant[c] += values[1 + n_contaminants + c];
+                    }
+                } else if ((s != SHARD_READ_ABSENT) && (s != SHARD_READ_NO_KMERS) && (s != SHARD_END)) {
+                    printf("Error: %s is corrupt\n", files[f].filename);
+                    exit(1);
+                }
+            }
+
+            if (state[r] == SHARD_END) {
+                break;
+            }
+        }
+
+        if (state[0] == SHARD_END) {
+            break;
+        } else if ((stats->number_of_files == 2) && (state[1] == SHARD_END)) {
+            printf("Error: counts files end part way through a pair\n");
+            exit(1);
+        }
+
+        // Same as the merge stage of the pipeline, with summed counts
+        for (r=0; r<stats->number_of_files; r++) {
+            if (state[r] == SHARD_READ_COUNTED) {
+                for (c=0; c<n_contaminants; c++) {
+                    if (counts[r].kmers_from_contaminant[c] > 0) {
+                        counts[r].contaminants_detected++;
+                    }
+                }
+                update_stats(r, &(counts[r]), stats, cmd_line);
+            }
+        }
+
+        if ((stats->number_of_files == 2) && (state[0] != SHARD_READ_ABSENT) && (state[1] != SHARD_READ_ABSENT)) {
+            stats->both_reads->number_of_reads++;
+            update_stats_for_both(stats, cmd_line, &(counts[0]), &(counts[1]));
+        }
+
+        pairs++;
+    }
+
+    // Shards hold disjoint kmers, so kmers seen add up exactly
+    totals[0] = stats->read[0]->contaminant_kmers_seen;
+    totals[1] = stats->read[1]->contaminant_kmers_seen;
+    totals[2] = stats->both_reads->contaminant_kmers_seen;
+    for (f=0; f<n_files; f++) {
+        for (i=0; i<3; i++) {
+            shard_read(seen[i], n_contaminants * sizeof(uint32_t), &(files[f]));
+            for (c=0; c<n_contaminants; c++) {
+                totals[i][c] += seen[i][c];
+            }
+        }
+        fclose(files[f].fp);
+    }
+
+    free(files);
+
+    printf("Combined %ld %s\n", pairs, stats->number_of_files == 2 ? "pairs":"reads");
+}
@@ -0,0 +1,522 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_snapshot.c                                             *
+ * Purpose: Binary snapshots of screening stats, and merging them       *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   A large run can be split across nodes, each writing a snapshot of its
+   raw KmerStats counters (before kmer_stats_calculate). Merging sums the
+   counters and reports as if one process had screened everything.
+
+   Most counters are per read, so summing them is exact. kFound is not: a
+   contaminant kmer found on two nodes must only be counted once. So the
+   snapshot also holds every contaminant kmer seen, with its contaminant
+   and coverage flags. Merging ORs these into a table and kFound is
+   counted from that.
+
+   The contaminants' kmer comparison (kmers unique to each, and in common
+   between each pair) can't be made from the seen kmers, so it is copied
+   too. Snapshots being merged share their contaminants, so it must match
+   between them.
+
+   File: SNAPSHOT_MAGIC, uint32 SNAPSHOT_VERSION, uint32 header words
+         (build then settings, see kmer_snapshot_header), then per
+         contaminant uint32 id length, id, uint32 kmers, uint32 unique
+         kmers and a row of uint32 kmers in common with each contaminant.
+         Then counters in
+         kmer_snapshot_fields order, uint64 number of seen kmers and the
+         seen kmers as Elements.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "cmd_line.h"
+#include "kmer_stats.h"
+#include "kmer_snapshot.h"
+
+#define SNAPSHOT_BUILD_WORDS 4
+#define SNAPSHOT_HEADER_WORDS 11
+#define SNAPSHOT_MAX_FIELDS 64
+
+typedef struct {
+    uint32_t* values;
+    int n;
+} SnapshotField;
+
+static char* header_names[SNAPSHOT_HEADER_WORDS] = {
+    "element size", "kmer bitfields", "maximum contaminants", "maximum read length",
+    "kmer size", "read threshold", "overall threshold", "unique filtering", "early exit",
+    "number of contaminants", "number of input files"
+};
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_snapshot_header
+ * Purpose:    Fill header words. Build words must match for the file to
+ *             be read at all, settings words must match between files
+ *             being merged.
+ * Parameters: header -> SNAPSHOT_HEADER_WORDS words to fill
+ *             stats -> KmerStats structure
+ *             cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void kmer_snapshot_header(uint32_t* header, KmerStats* stats, CmdLine* cmd_line)
+{
+    header[0] = sizeof(Element);
+    header[1] = NUMBER_OF_BITFIELDS_IN_BINARY_KMER;
+    header[2] = MAX_CONTAMINANTS;
+    header[3] = MAX_READ_LENGTH;
+    header[4] = cmd_line->kmer_size;
+    header[5] = cmd_line->kmer_threshold_read;
+    header[6] = cmd_line->kmer_threshold_overall;
+    header[7] = cmd_line->filter_unique ? 1:0;
+    header[8] = cmd_line->early_exit ? 1:0;
+    header[9] = stats->n_contaminants;
+    header[10] = stats->number_of_files;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_snapshot_fields
+ * Purpose:    List the counters held in a snapshot. Percentages are
+ *             left out, as kmer_stats_calculate makes them, and so is
+ *             kFound, which is counted from the seen kmers.
+ * Parameters: stats -> KmerStats structure
+ *             fields -> array of SNAPSHOT_MAX_FIELDS to fill
+ * Returns:    Number of fields
+ *----------------------------------------------------------------------*/
+static int kmer_snapshot_fields(KmerStats* stats, SnapshotField* fields)
+{
+    KmerStatsBothReads* b = stats->both_reads;
+    int n = 0;
+    int r;
+
+#define SNAPSHOT_FIELD(v, count) { fields[n].values = (v); fields[n].n = (count); n++; }
+
+    for (r=0; r<2; r++) {
+        KmerStatsReadCounts* read = stats->read[r];
+
+        SNAPSHOT_FIELD(&(read->number_of_reads), 1);
+        SNAPSHOT_FIELD(&(read->k1_contaminated_reads), 1);
+        SNAPSHOT_FIELD(read->k1_contaminated_reads_by_contaminant, MAX_CONTAMINANTS);
+        SNAPSHOT_FIELD(read->k1_unique_contaminated_reads_by_contaminant, MAX_CONTAMINANTS);
+        SNAPSHOT_FIELD(&(read->kn_contaminated_reads), 1);
+        SNAPSHOT_FIELD(read->kn_contaminated_reads_by_contaminant, MAX_CONTAMINANTS);
+        SNAPSHOT_FIELD(read->kn_unique_contaminated_reads_by_contaminant, MAX_CONTAMINANTS);
+        SNAPSHOT_FIELD(read->reads_with_highest_contaminant, MAX_CONTAMINANTS);
+        SNAPSHOT_FIELD(&(read->reads_unclassified), 1);
+        SNAPSHOT_FIELD(read->species_read_counts, MAX_CONTAMINANTS);
+        SNAPSHOT_FIELD(&(read->species_unclassified), 1);
+        SNAPSHOT_FIELD(read->contaminated_kmers_per_read, MAX_READ_LENGTH + 1);
+    }
+
+    SNAPSHOT_FIELD(&(b->number_of_reads), 1);
+    SNAPSHOT_FIELD(&(b->threshold_passed_reads), 1);
+    SNAPSHOT_FIELD(&(b->k1_both_reads_not_threshold), 1);
+    SNAPSHOT_FIELD(&(b->k1_either_read_not_threshold), 1);
+    SNAPSHOT_FIELD(&(b->threshold_passed_reads_unique), 1);
+    SNAPSHOT_FIELD(&(b->k1_both_reads_not_threshold_unique), 1);
+    SNAPSHOT_FIELD(&(b->k1_either_read_not_threshold_unique), 1);
+    SNAPSHOT_FIELD(b->threshold_passed_reads_by_contaminant, MAX_CONTAMINANTS);
+    SNAPSHOT_FIELD(b->k1_both_reads_not_threshold_by_contaminant, MAX_CONTAMINANTS);
+    SNAPSHOT_FIELD(b->k1_either_read_not_threshold_by_contaminant, MAX_CONTAMINANTS);
+    SNAPSHOT_FIELD(b->threshold_passed_reads_unique_by_contaminant, MAX_CONTAMINANTS);
+    SNAPSHOT_FIELD(b->k1_both_reads_not_threshold_unique_by_contaminant, MAX_CONTAMINANTS);
+    SNAPSHOT_FIELD(b->k1_either_read_not_threshold_unique_by_contaminant, MAX_CONTAMINANTS);
+
+#undef SNAPSHOT_FIELD
+
+    return n;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   snapshot_write
+ * Purpose:    Write to snapshot file, exiting on failure
+ * Parameters: ptr -> data
+ *             size = bytes to write
+ *             fp -> file
+ *             filename -> filename for error message
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void snapshot_write(void* ptr, size_t size, FILE* fp, char* filename)
+{
+    if (fwrite(ptr, size, 1, fp) != 1) {
+        printf("Error: can't write to %s\n", filename);
+        exit(1);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   snapshot_read
+ * Purpose:    Read from snapshot file, exiting on failure
+ * Parameters: ptr -> buffer
+ *             size = bytes to read
+ *             fp -> file
+ *             filename -> filename for error message
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void snapshot_read(void* ptr, size_t size, FILE* fp, char* filename)
+{
+    if (fread(ptr, size, 1, fp) != 1) {
+        printf("Error: %s is truncated\n", filename);
+        exit(1);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   snapshot_element_seen
+ * Purpose:    Select contaminant kmers seen in the reads
+ * Parameters: e -> element
+ *             data -> unused
+ * Returns:    true if seen
+ *----------------------------------------------------------------------*/
+static boolean snapshot_element_seen(Element* e, void* data)
+{
+    return (e->flags & (COVERAGE_L | COVERAGE_R)) ? true : false;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   snapshot_write_element
+ * Purpose:    Write a seen kmer to a snapshot file
+ * Parameters: e -> element
+ *             fp -> file, positioned for this element
+ *             data -> filename for error message
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void snapshot_write_element(Element* e, FILE* fp, void* data)
+{
+    snapshot_write(e, sizeof(Element), fp, (char*)data);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_snapshot_write
+ * Purpose:    Write raw counters and seen contaminant kmers to a
+ *             snapshot file. Must be called before kmer_stats_calculate.
+ * Parameters: filename -> snapshot filename
+ *             hash -> contaminant hash table, after screening
+ *             stats -> KmerStats structure
+ *             cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_snapshot_write(char* filename, HashTable* hash, KmerStats* stats, CmdLine* cmd_line)
+{
+    SnapshotField fields[SNAPSHOT_MAX_FIELDS];
+    uint32_t header[SNAPSHOT_HEADER_WORDS];
+    uint32_t version = SNAPSHOT_VERSION;
+    uint32_t length;
+    uint64_t seen = 0;
+    long offset;
+    int n_fields;
+    int f;
+    FILE* fp;
+
+    fp = fopen(filename, "wb");
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    }
+
+    snapshot_write(SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC), fp, filename);
+    snapshot_write(&version, sizeof(uint32_t), fp, filename);
+    kmer_snapshot_header(header, stats, cmd_line);
+    snapshot_write(header, sizeof(header), fp, filename);
+
+    for (f=0; f<stats->n_contaminants; f++) {
+        length = strlen(stats->contaminant_ids[f]);
+        snapshot_write(&length, sizeof(uint32_t), fp, filename);
+        snapshot_write(stats->contaminant_ids[f], length, fp, filename);
+        snapshot_write(&(stats->contaminant_kmers[f]), sizeof(uint32_t), fp, filename);
+        snapshot_write(&(stats->unique_kmers[f]), sizeof(uint32_t), fp, filename);
+        snapshot_write(stats->kmers_in_common[f], stats->n_contaminants * sizeof(uint32_t), fp, filename);
+    }
+
+    n_fields = kmer_snapshot_fields(stats, fields);
+    for (f=0; f<n_fields; f++) {
+        snapshot_write(fields[f].values, fields[f].n * sizeof(uint32_t), fp, filename);
+    }
+
+    // Seen kmers are written by the table's blocks in parallel, after
+    // the rest of the file
+    seen = hash_table_parallel_count(&snapshot_element_seen, NULL, hash);
+    snapshot_write(&seen, sizeof(uint64_t), fp, filename);
+    offset = ftell(fp);
+    if (fclose(fp) != 0) {
+        printf("Error: can't write to %s\n", filename);
+        exit(1);
+    }
+
+    hash_table_parallel_write(filename, offset, sizeof(Element), &snapshot_element_seen, &snapshot_write_element, filename, hash);
+
+    printf("\nWrote snapshot %s (%llu contaminant kmers seen)\n", filename, (unsigned long long)seen);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_snapshot_merge
+ * Purpose:    Add one snapshot to stats and to table of seen kmers.
+ * Parameters: filename -> snapshot filename
+ *             first = true if first snapshot, which sets contaminants
+ *             and settings for the rest to match
+ *             hash -> table of seen kmers
+ *             stats -> KmerStats structure
+ *             cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void kmer_snapshot_merge(char* filename, boolean first, HashTable* hash, KmerStats* stats, CmdLine* cmd_line)
+{
+    SnapshotField fields[SNAPSHOT_MAX_FIELDS];
+    uint32_t header[SNAPSHOT_HEADER_WORDS];
+    uint32_t expected[SNAPSHOT_HEADER_WORDS];
+    uint32_t* values;
+    char magic[16];
+    char id[1024];
+    uint32_t version;
+    uint32_t length;
+    uint32_t kmers;
+    uint32_t unique;
+    uint32_t in_common[MAX_CONTAMINANTS];
+    uint64_t seen;
+    uint64_t s;
+    Element e;
+    Element* node;
+    BinaryKmer tmp_kmer;
+    boolean found;
+    int n_fields;
+    int f;
+    int i;
+    FILE* fp;
+
+    fp = fopen(filename, "rb");
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    }
+
+    snapshot_read(magic, strlen(SNAPSHOT_MAGIC), fp, filename);
+    if (memcmp(magic, SNAPSHOT_MAGIC, strlen(SNAPSHOT_MAGIC)) != 0) {
+        printf("Error: %s is not a kontaminant snapshot\n", filename);
+        exit(1);
+    }
+
+    snapshot_read(&version, sizeof(uint32_t), fp, filename);
+    if (version != SNAPSHOT_VERSION) {
+        printf("Error: %s is snapshot version %u, this build reads version %d\n", filename, version, SNAPSHOT_VERSION);
+        exit(1);
+    }
+
+    snapshot_read(header, sizeof(header), fp, filename);
+
+    // Build words first, so a snapshot from a wider build isn't reported
+    // as corrupt below
+    kmer_snapshot_header(expected, stats, cmd_line);
+    for (i=0; i<SNAPSHOT_BUILD_WORDS; i++) {
+        if (header[i] != expected[i]) {
+            printf("Error: %s was written by a build with %s %u, this build has %u\n", filename, header_names[i], header[i], expected[i]);
+            exit(1);
+        }
+    }
+
+    if (first) {
+        cmd_line->kmer_size = header[4];
+        cmd_line->kmer_threshold_read = header[5];
+        cmd_line->kmer_threshold_overall = header[6];
+        cmd_line->filter_unique = header[7] ? true:false;
+        cmd_line->early_exit = header[8] ? true:false;
+        stats->n_contaminants = header[9];
+        stats->number_of_files = header[10];
+        hash->kmer_size = cmd_line->kmer_size;
+        if ((stats->n_contaminants > MAX_CONTAMINANTS) || (stats->number_of_files > 2) || (cmd_line->kmer_size > (NUMBER_OF_BITFIELDS_IN_BINARY_KMER * 32) - 1)) {
+            printf("Error: %s is corrupt\n", filename);
+            exit(1);
+        }
+    }
+
+    kmer_snapshot_header(expected, stats, cmd_line);
+    for (i=0; i<SNAPSHOT_HEADER_WORDS; i++) {
+        if (header[i] != expected[i]) {
+            if (i < SNAPSHOT_BUILD_WORDS) {
+                printf("Error: %s was written by a build with %s %u, this build has %u\n", filename, header_names[i], header[i], expected[i]);
+            } else {
+                printf("Error: %s has %s %u, earlier snapshots have %u\n", filename, header_names[i], header[i], expected[i]);
+            }
+            exit(1);
+        }
+    }
+
+    for (i=0; i<stats->n_contaminants; i++) {
+        snapshot_read(&length, sizeof(uint32_t), fp, filename);
+        if (length >= sizeof(id)) {
+            printf("Error: %s is corrupt\n", filename);
+            exit(1);
+        }
+        snapshot_read(id, length, fp, filename);
+        id[length] = 0;
+        snapshot_read(&kmers, sizeof(uint32_t), fp, filename);
+        snapshot_read(&unique, sizeof(uint32_t), fp, filename);
+        snapshot_read(in_common, stats->n_contaminants * sizeof(uint32_t), fp, filename);
+
+        if (first) {
+            stats->contaminant_ids[i] = malloc(length + 1);
+            if (!stats->contaminant_ids[i]) {
+                printf("Error: can't allocate memory for string!");
+                exit(1);
+            }
+            strcpy(stats->contaminant_ids[i], id);
+            stats->contaminant_kmers[i] = kmers;
+            stats->unique_kmers[i] = unique;
+            memcpy(stats->kmers_in_common[i], in_common, stats->n_contaminants * sizeof(uint32_t));
+        } else if ((strcmp(id, stats->contaminant_ids[i]) != 0) || (kmers != stats->contaminant_kmers[i])) {
+            printf("Error: contaminant %d of %s is %s (%u kmers), earlier snapshots have %s (%u kmers)\n", i+1, filename, id, kmers, stats->contaminant_ids[i], stats->contaminant_kmers[i]);
+            exit(1);
+        } else if ((unique != stats->unique_kmers[i]) || (memcmp(in_common, stats->kmers_in_common[i], stats->n_contaminants * sizeof(uint32_t)) != 0)) {
+            printf("Error: contaminant %s of %s shares different kmers with the other contaminants to earlier snapshots\n", id, filename);
+            exit(1);
+        }
+    }
+
+    stats->contaminants_counted = true;
+
+    values = malloc((MAX_READ_LENGTH + 1) * sizeof(uint32_t));
+    if (!values) {
+        printf("Error: can't allocate memory for snapshot counters\n");
+        exit(1);
+    }
+
+    n_fields = kmer_snapshot_fields(stats, fields);
+    for (f=0; f<n_fields; f++) {
+        snapshot_read(values, fields[f].n * sizeof(uint32_t), fp, filename);
+        for (i=0; i<fields[f].n; i++) {
+            if (((uint64_t)fields[f].values[i] + values[i]) > UINT32_MAX) {
+                printf("Error: counts from %s overflow 32 bit counters\n", filename);
+                exit(1);
+            }
+            fields[f].values[i] += values[i];
+        }
+    }
+
+    free(values);
+
+    snapshot_read(&seen, sizeof(uint64_t), fp, filename);
+    for (s=0; s<seen; s++) {
+        snapshot_read(&e, sizeof(Element), fp, filename);
+        node = hash_table_find_or_insert(element_get_key(element_get_kmer(&e), cmd_line->kmer_size, &tmp_kmer), &found, hash);
+        node->flags |= e.flags;
+        for (i=0; i<CONTAMINANT_FIELDS; i++) {
+            node->contaminant_flags[i] |= e.contaminant_flags[i];
+        }
+    }
+
+    fclose(fp);
+
+    printf("Merged %s (%llu contaminant kmers seen)\n", filename, (unsigned long long)seen);
+}
+
+// Per thread kFound counts while merging
+typedef struct {
+    uint32_t seen[3][MAX_CONTAMINANTS];
+    int n_contaminants;
+} SeenKmerCounts;
+
+/*----------------------------------------------------------------------*
+ * Function:   new_seen_kmer_counts
+ * Purpose:    Traverse callback to create one thread's counts
+ * Parameters: block = block of table being counted
+ *             data -> KmerStats structure
+ * Returns:    Pointer to zeroed counts
+ *----------------------------------------------------------------------*/
+static void* new_seen_kmer_counts(int block, void* data)
+{
+    SeenKmerCounts* counts = calloc(1, sizeof(SeenKmerCounts));
+
+    if (!counts) {
+        printf("Error: can't allocate memory for kmer counts\n");
+        exit(1);
+    }
+
+    counts->n_contaminants = ((KmerStats*)data)->n_contaminants;
+
+    return counts;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   count_seen_kmers
+ * Purpose:    Traverse callback to count a merged kmer towards kFound of
+ *             each read and of both reads.
+ * Parameters: node -> element
+ *             data -> this thread's SeenKmerCounts
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void count_seen_kmers(Element* node, void* data)
+{
+    SeenKmerCounts* counts = (SeenKmerCounts*)data;
+    int c;
+
+    if (node->flags & (COVERAGE_L | COVERAGE_R)) {
+        for (c=0; c<counts->n_contaminants; c++) {
+            if (element_get_contaminant_bit(node, c) > 0) {
+                if (node->flags & COVERAGE_L) {
+                    counts->seen[0][c]++;
+                }
+                if (node->flags & COVERAGE_R) {
+                    counts->seen[1][c]++;
+                }
+                counts->seen[2][c]++;
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   reduce_seen_kmer_counts
+ * Purpose:    Traverse callback to add one thread's counts to the stats
+ * Parameters: accumulator -> SeenKmerCounts, freed
+ *             data -> KmerStats structure
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void reduce_seen_kmer_counts(void* accumulator, void* data)
+{
+    SeenKmerCounts* counts = (SeenKmerCounts*)accumulator;
+    KmerStats* stats = (KmerStats*)data;
+    int c;
+
+    for (c=0; c<counts->n_contaminants; c++) {
+        stats->read[0]->contaminant_kmers_seen[c] += counts->seen[0][c];
+        stats->read[1]->contaminant_kmers_seen[c] += counts->seen[1][c];
+        stats->both_reads->contaminant_kmers_seen[c] += counts->seen[2][c];
+    }
+
+    free(counts);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_snapshot_merge_files
+ * Purpose:    Sum snapshots into stats, ready for kmer_stats_calculate.
+ * Parameters: n_files = number of snapshots
+ *             filenames -> snapshot filenames
+ *             hash -> empty table, to hold seen kmers
+ *             stats -> initialised KmerStats structure
+ *             cmd_line -> command line options, thresholds are set
+ *             from the snapshots
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_snapshot_merge_files(int n_files, char** filenames, HashTable* hash, KmerStats* stats, CmdLine* cmd_line)
+{
+    long long i;
+
+    printf("\nMerging %d snapshots...\n", n_files);
+
+    for (i=0; i<n_files; i++) {
+        kmer_snapshot_merge(filenames[i], i == 0 ? true:false, hash, stats, cmd_line);
+    }
+
+    // kFound counts each contaminant kmer once, whichever snapshots saw it
+    hash_table_parallel_traverse(&count_seen_kmers, &new_seen_kmer_counts, &reduce_seen_kmer_counts, (void*)stats, hash);
+}
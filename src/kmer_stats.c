@@ -23,6 +23,7 @@
 #include "hash_table.h"
 #include "cmd_line.h"
 #include "kmer_stats.h"
+#include "contaminant_set.h"
 #include "kmer_reader.h"
 
 /*----------------------------------------------------------------------*
@@ -37,6 +38,7 @@ void kmer_stats_read_counts_initialise(KmerStatsReadCounts *r)
     
     pthread_mutex_init(&(r->lock), NULL);
     r->number_of_reads = 0;
+    r->kmers_looked_up = 0;
     r->k1_contaminated_reads = 0;
     r->kn_contaminated_reads = 0;
     
@@ -47,7 +49,7 @@ void kmer_stats_read_counts_initialise(KmerStatsReadCounts *r)
         r->species_read_counts[i] = 0;
     }
     
-    for (i=0; i<MAX_READ_LENGTH; i++) {
+    for (i=0; i<=MAX_READ_LENGTH; i++) {
         r->contaminated_kmers_per_read[i] = 0;
     }
     
@@ -103,6 +105,7 @@ void kmer_stats_initialise(KmerStats* stats, CmdLine* cmd_line)
                        
     stats->n_contaminants = 0;
     stats->number_of_files = 0;
+    stats->contaminants_counted = false;
     
     for (i=0; i<MAX_CONTAMINANTS; i++) {
         stats->contaminant_kmers[i] = 0;
@@ -147,9 +150,10 @@ void update_stats_parallel(int r, KmerCounts* counts, KmerStats* stats, CmdLine*
     int unique_largest_contaminant = 0;
     int unique_largest_kmers = 0;
     
-    pthread_mutex_lock(&(stats->read[r]->lock));
+    parallel_mutex_lock(&(stats->read[r]->lock));
     // Update number of reads
     stats->read[r]->number_of_reads++;
+    stats->read[r]->kmers_looked_up += counts->kmers_looked_up;
     // We allow up to the maximum read length. The last element is the cumulative of the reads/contigs that have more than the space we have allocated
     stats->read[r]->contaminated_kmers_per_read[counts->kmers_loaded < MAX_READ_LENGTH? counts->kmers_loaded:MAX_READ_LENGTH]++;
     pthread_mutex_unlock(&(stats->read[r]->lock));
@@ -172,13 +176,13 @@ void update_stats_parallel(int r, KmerCounts* counts, KmerStats* stats, CmdLine*
                 }
                 
                 // Update the count of contaminanted reads
-                pthread_mutex_lock(&(stats->read[r]->lock));
+                parallel_mutex_lock(&(stats->read[r]->lock));
                 stats->read[r]->k1_contaminated_reads_by_contaminant[i]++;
                 pthread_mutex_unlock(&(stats->read[r]->lock));
                 
                 // If only one contaminant detected, then we can safely update the number of k1 unique reads
                 if (counts->contaminants_detected == 1) {
-                    pthread_mutex_lock(&(stats->read[r]->lock));
+                    parallel_mutex_lock(&(stats->read[r]->lock));
                     stats->read[r]->k1_unique_contaminated_reads_by_contaminant[i]++;
                     pthread_mutex_unlock(&(stats->read[r]->lock));
                 }
@@ -186,20 +190,20 @@ void update_stats_parallel(int r, KmerCounts* counts, KmerStats* stats, CmdLine*
         }
         
         // Update number of k1 (not necessarily unique) reads
-        pthread_mutex_lock(&(stats->read[r]->lock));
+        parallel_mutex_lock(&(stats->read[r]->lock));
         stats->read[r]->k1_contaminated_reads++;
         pthread_mutex_unlock(&(stats->read[r]->lock));
     }
     
     // If we didn't find any kmers, then this is unclassified
     if (largest_kmers == 0) {
-        pthread_mutex_lock(&(stats->read[r]->lock));
+        parallel_mutex_lock(&(stats->read[r]->lock));
         stats->read[r]->reads_unclassified++;
         pthread_mutex_unlock(&(stats->read[r]->lock));
         counts->assigned_contaminant = -1;
     } else {
         // But if we did, store the higest contaminant (the "assigned" contaminant)
-        pthread_mutex_lock(&(stats->read[r]->lock));
+        parallel_mutex_lock(&(stats->read[r]->lock));
         stats->read[r]->reads_with_highest_contaminant[largest_contaminant]++;
         pthread_mutex_unlock(&(stats->read[r]->lock));
         counts->assigned_contaminant = largest_contaminant;
@@ -217,18 +221,18 @@ void update_stats_parallel(int r, KmerCounts* counts, KmerStats* stats, CmdLine*
     if (counts->kmers_loaded >= cmd_line->kmer_threshold_read) {
         for (i=0; i<stats->n_contaminants; i++) {
             if (counts->kmers_from_contaminant[i] > cmd_line->kmer_threshold_read) {
-                pthread_mutex_lock(&(stats->read[r]->lock));
+                parallel_mutex_lock(&(stats->read[r]->lock));
                 stats->read[r]->kn_contaminated_reads_by_contaminant[i]++;
                 pthread_mutex_unlock(&(stats->read[r]->lock));
                 if (counts->contaminants_detected == 1) {
-                    pthread_mutex_lock(&(stats->read[r]->lock));
+                    parallel_mutex_lock(&(stats->read[r]->lock));
                     stats->read[r]->kn_unique_contaminated_reads_by_contaminant[i]++;
                     pthread_mutex_unlock(&(stats->read[r]->lock));
                 }
             }
         }
         
-        pthread_mutex_lock(&(stats->read[r]->lock));
+        parallel_mutex_lock(&(stats->read[r]->lock));
         stats->read[r]->kn_contaminated_reads++;
         pthread_mutex_unlock(&(stats->read[r]->lock));
     }
@@ -250,6 +254,7 @@ void update_stats(int r, KmerCounts* counts, KmerStats* stats, CmdLine* cmd_line
     int unique_largest_kmers = 0;
     
     stats->read[r]->number_of_reads++;
+    stats->read[r]->kmers_looked_up += counts->kmers_looked_up;
     
     // We allow up to the maximum read length. The last element is the cumulative of the reads/contigs that have more than the space we have allocated
     stats->read[r]->contaminated_kmers_per_read[counts->kmers_loaded < MAX_READ_LENGTH? counts->kmers_loaded:MAX_READ_LENGTH]++;
@@ -320,6 +325,127 @@ void update_stats(int r, KmerCounts* counts, KmerStats* stats, CmdLine* cmd_line
 
 
 
+/*----------------------------------------------------------------------*
+ * Function:   kmer_counts_top_two
+ * Purpose:    Find the largest and second largest values in a count array
+ * Parameters: values -> counts per contaminant
+ *             n = number of contaminants
+ *             first -> largest value
+ *             second -> second largest value
+ * Returns:    Index of largest value
+ *----------------------------------------------------------------------*/
+static int kmer_counts_top_two(uint32_t* values, int n, uint32_t* first, uint32_t* second)
+{
+    int i;
+    int index = 0;
+    
+    *first = 0;
+    *second = 0;
+    for (i=0; i<n; i++) {
+        if (values[i] > *first) {
+            *second = *first;
+            *first = values[i];
+            index = i;
+        } else if (values[i] > *second) {
+            *second = values[i];
+        }
+    }
+    
+    return index;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_counts_pair_decided
+ * Purpose:    Check if the pair threshold and best contaminant can no
+ *             longer change as more kmers from read b are added.
+ * Parameters: a -> final counts for read a
+ *             b -> counts so far for read b
+ *             n = number of contaminants
+ *             remaining = most kmers still to come from read b
+ *             cmd_line -> command line options
+ * Returns:    true if decided
+ *----------------------------------------------------------------------*/
+static boolean kmer_counts_pair_decided(uint32_t* a, uint32_t* b, int n, uint32_t remaining, CmdLine* cmd_line)
+{
+    int i;
+    int largest_contaminant = -1;
+    uint32_t largest_kmers = 0;
+    
+    // Threshold must already be met, as counts only go up it then stays met
+    for (i=0; i<n; i++) {
+        if ((a[i] >= cmd_line->kmer_threshold_read) &&
+            (b[i] >= cmd_line->kmer_threshold_read) &&
+            ((a[i] + b[i]) >= cmd_line->kmer_threshold_overall) &&
+            ((a[i] + b[i]) > largest_kmers)) {
+            largest_kmers = a[i] + b[i];
+            largest_contaminant = i;
+        }
+    }
+    
+    if (largest_contaminant == -1) {
+        return false;
+    }
+    
+    // And no other contaminant can catch up with the best one
+    for (i=0; i<n; i++) {
+        if ((i != largest_contaminant) && ((a[i] + b[i] + remaining) >= largest_kmers)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_stats_read_is_decided
+ * Purpose:    Used by early exit mode. Check if the classification of a
+ *             read can't change, whatever the remaining kmers turn out to
+ *             be. That is, the read threshold is met, the assigned and
+ *             unique assigned contaminants can't be overtaken, the ratio
+ *             test passes and, for the second read of a pair, the pair
+ *             threshold and best contaminant are fixed.
+ * Parameters: counts -> counts so far for this read
+ *             mate -> final counts for first read of pair, or NULL
+ *             kmers_remaining = most kmers still to be looked up
+ *             cmd_line -> command line options
+ * Returns:    true if no more lookups are needed
+ *----------------------------------------------------------------------*/
+boolean kmer_stats_read_is_decided(KmerCounts* counts, KmerCounts* mate, int kmers_remaining, CmdLine* cmd_line)
+{
+    uint32_t remaining = kmers_remaining > 0 ? kmers_remaining : 0;
+    uint32_t first, second;
+    
+    // Reads that never reach the threshold are always looked up in full
+    if (counts->kmers_loaded < cmd_line->kmer_threshold_read) {
+        return false;
+    }
+    
+    // Assigned contaminant and ratio
+    kmer_counts_top_two(counts->kmers_from_contaminant, counts->n_contaminants, &first, &second);
+    if ((first < cmd_line->kmer_threshold_read) ||
+        ((first - second) <= remaining) ||
+        ((double)(second + remaining) > (cmd_line->ratio * (double)first))) {
+        return false;
+    }
+    
+    // Unique assigned contaminant
+    kmer_counts_top_two(counts->unique_kmers_from_contaminant, counts->n_contaminants, &first, &second);
+    if ((first - second) <= remaining) {
+        return false;
+    }
+    
+    if (mate != NULL) {
+        if (!kmer_counts_pair_decided(mate->kmers_from_contaminant, counts->kmers_from_contaminant, counts->n_contaminants, remaining, cmd_line)) {
+            return false;
+        }
+        if (!kmer_counts_pair_decided(mate->unique_kmers_from_contaminant, counts->unique_kmers_from_contaminant, counts->n_contaminants, remaining, cmd_line)) {
+            return false;
+        }
+    }
+    
+    return true;
+}
+
 /*----------------------------------------------------------------------*
  * Function:
  * Purpose:
@@ -416,7 +542,7 @@ boolean update_stats_for_both_parallel(KmerStats* stats, CmdLine* cmd_line, Kmer
     
     // Update read counts
     if (threshold_met) {
-        pthread_mutex_lock(&(stats->both_reads->lock));
+        parallel_mutex_lock(&(stats->both_reads->lock));
         stats->both_reads->threshold_passed_reads++;
         stats->both_reads->threshold_passed_reads_by_contaminant[largest_contaminant]++;
         pthread_mutex_unlock(&(stats->both_reads->lock));
@@ -424,30 +550,30 @@ boolean update_stats_for_both_parallel(KmerStats* stats, CmdLine* cmd_line, Kmer
             filter_read = true;
         }
     } else if (one_in_both > 0) {
-        pthread_mutex_lock(&(stats->both_reads->lock));
+        parallel_mutex_lock(&(stats->both_reads->lock));
         stats->both_reads->k1_both_reads_not_threshold++;
         stats->both_reads->k1_both_reads_not_threshold_by_contaminant[largest_contaminant]++;
         pthread_mutex_unlock(&(stats->both_reads->lock));
     } else if (one_in_either > 0) {
-        pthread_mutex_lock(&(stats->both_reads->lock));
+        parallel_mutex_lock(&(stats->both_reads->lock));
         stats->both_reads->k1_either_read_not_threshold++;
         stats->both_reads->k1_either_read_not_threshold_by_contaminant[largest_contaminant]++;
         pthread_mutex_unlock(&(stats->both_reads->lock));
     }
     
     if (unique_threshold_met) {
-        pthread_mutex_lock(&(stats->both_reads->lock));
+        parallel_mutex_lock(&(stats->both_reads->lock));
         stats->both_reads->threshold_passed_reads_unique++;
         stats->both_reads->threshold_passed_reads_unique_by_contaminant[unique_largest_contaminant]++;
         pthread_mutex_unlock(&(stats->both_reads->lock));
         filter_read = true;
     } else if (unique_one_in_both > 0) {
-        pthread_mutex_lock(&(stats->both_reads->lock));
+        parallel_mutex_lock(&(stats->both_reads->lock));
         stats->both_reads->k1_both_reads_not_threshold_unique++;
         stats->both_reads->k1_both_reads_not_threshold_unique_by_contaminant[unique_largest_contaminant]++;
         pthread_mutex_unlock(&(stats->both_reads->lock));
     } else if (unique_one_in_either > 0) {
-        pthread_mutex_lock(&(stats->both_reads->lock));
+        parallel_mutex_lock(&(stats->both_reads->lock));
         stats->both_reads->k1_either_read_not_threshold_unique++;
         stats->both_reads->k1_either_read_not_threshold_unique_by_contaminant[unique_largest_contaminant]++;
         pthread_mutex_unlock(&(stats->both_reads->lock));
@@ -767,6 +893,12 @@ void kmer_stats_report_to_screen(KmerStats* stats, CmdLine* cmd_line)
     
     printf("\nThreshold: at least %d kmers in each read and at least %d in pair\n", cmd_line->kmer_threshold_read, cmd_line->kmer_threshold_overall);
     
+    if (cmd_line->early_exit) {
+        printf("\nEarly exit: kmer lookups for a read stop once its classification is fixed. Threshold, Assigned, ReadsThr\n" \
+               "and filtering decisions are exact, but kFound, %%kFound, ReadsW1k, ReadsWnk and their percentages are lower\n" \
+               "bounds, UniqW1k and UniqWnk are upper bounds, and per-read kmer counts in the read summary are lower bounds.\n");
+    }
+    
     for (r=0; r<stats->number_of_files; r++) {
         printf("\n========== Statistics for Read %d ===========\n\n", r+1);
         kmer_stats_report_read_stats(stats, r, cmd_line);
@@ -804,51 +936,128 @@ void kmer_stats_report_to_screen(KmerStats* stats, CmdLine* cmd_line)
     printf("%%EithW1k  - Percentage of reads not passing threshold, but containing 1 or more kmer in either read\n");
 }
 
-void check_kmers_in_common(Element* node, void* data) {
-    KmerStats* stats = data;
+/*----------------------------------------------------------------------*
+ * Function:   new_contaminant_set_histogram
+ * Purpose:    Traverse callback to create one thread's histogram
+ * Parameters: block = block of table being counted
+ *             data -> merged histogram
+ * Returns:    Pointer to empty histogram
+ *----------------------------------------------------------------------*/
+static void* new_contaminant_set_histogram(int block, void* data)
+{
+    return contaminant_set_histogram_new();
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   count_contaminant_set
+ * Purpose:    Traverse callback to count a kmer against the set of
+ *             contaminants holding it
+ * Parameters: node -> element
+ *             data -> this thread's histogram
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void count_contaminant_set(Element* node, void* data) {
+    contaminant_set_histogram_add_element((ContaminantSetHistogram*)data, node);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   reduce_contaminant_set_histogram
+ * Purpose:    Traverse callback to merge one thread's histogram
+ * Parameters: accumulator -> histogram, freed
+ *             data -> merged histogram
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void reduce_contaminant_set_histogram(void* accumulator, void* data)
+{
+    ContaminantSetHistogram* histogram = (ContaminantSetHistogram*)accumulator;
+
+    contaminant_set_histogram_merge((ContaminantSetHistogram*)data, histogram);
+    contaminant_set_histogram_free(&histogram);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_stats_count_contaminant_kmers
+ * Purpose:    Count kmers shared between each pair of contaminants and
+ *             kmers unique to each contaminant. Only counts once, so a
+ *             server can count before its jobs report.
+ * Parameters: hash -> contaminant hash table
+ *             stats -> KmerStats structure
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_stats_count_contaminant_kmers(HashTable* hash, KmerStats* stats)
+{
+    ContaminantSetHistogram* histogram;
+    int members[MAX_CONTAMINANTS];
+    int n_members;
+    long long s;
     int i, j;
-    for (i=0; i<(stats->n_contaminants); i++) {
-        if (element_get_contaminant_bit(node, i) > 0) {
-            for (j=i; j<stats->n_contaminants; j++) {
-                if (element_get_contaminant_bit(node, j) > 0) {
-                    stats->kmers_in_common[i][j]++;
-                    if (i != j) {
-                        stats->kmers_in_common[j][i]++;
-                    }
-                }
-            }
-        }
+
+    if ((stats->n_contaminants < 2) || (stats->contaminants_counted)) {
+        return;
     }
-}
 
-void check_unique_kmers(Element* node, void* data) {
-    KmerStats* stats = data;
-    int i;
-    int count = 0;
-    int index = 0;
-    
-    for (i=0; i<(stats->n_contaminants); i++) {
-        if (element_get_contaminant_bit(node, i) > 0) {
-            index = i;
-            count++;
-            if (count > 1) {
-                break;
+    histogram = contaminant_set_histogram_new();
+
+    // One pass counts kmers per distinct set of contaminants, then each
+    // set adds its kmers to every pair of contaminants in it
+    hash_table_parallel_traverse(&count_contaminant_set, &new_contaminant_set_histogram,
+                                 &reduce_contaminant_set_histogram, (void*)histogram, hash);
+
+    for (s=0; s<histogram->capacity; s++) {
+        ContaminantSetEntry* entry = &(histogram->entries[s]);
+
+        if (entry->count == 0) {
+            continue;
+        }
+
+        n_members = contaminant_set_members(entry->words, members);
+
+        if (n_members == 1) {
+            stats->unique_kmers[members[0]] += entry->count;
+        }
+
+        for (i=0; i<n_members; i++) {
+            for (j=0; j<n_members; j++) {
+                stats->kmers_in_common[members[i]][members[j]] += entry->count;
             }
         }
     }
-    
-    if (count == 1) {
-        stats->unique_kmers[index]++;
-    }
+
+    contaminant_set_histogram_free(&histogram);
+
+    stats->contaminants_counted = true;
 }
 
 /*----------------------------------------------------------------------*
- * Function:
- * Purpose:
- * Parameters: None
+ * Function:   kmer_stats_compare_contaminant_kmers
+ * Purpose:    Count kmers shared between contaminants and write the
+ *             similarity and unique kmer files
+ * Parameters: hash -> contaminant hash table
+ *             stats -> KmerStats structure
+ *             cmd_line -> command line options
  * Returns:    None
  *----------------------------------------------------------------------*/
 void kmer_stats_compare_contaminant_kmers(HashTable* hash, KmerStats* stats, CmdLine* cmd_line)
+{
+    if (stats->n_contaminants < 2) {
+        return;
+    }
+
+    printf("\nComparing contaminant kmers...\n");
+
+    kmer_stats_count_contaminant_kmers(hash, stats);
+    kmer_stats_write_contaminant_comparison(stats, cmd_line);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_stats_write_contaminant_comparison
+ * Purpose:    Write the similarity and unique kmer files from counts
+ *             already made
+ * Parameters: stats -> KmerStats structure
+ *             cmd_line -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_stats_write_contaminant_comparison(KmerStats* stats, CmdLine* cmd_line)
 {
     int i, j;
     FILE* fp_abs;
@@ -864,8 +1073,6 @@ void kmer_stats_compare_contaminant_kmers(HashTable* hash, KmerStats* stats, Cmd
         return;
     }
     
-    printf("\nComparing contaminant kmers...\n");
-    
     filename_abs = malloc(strlen(cmd_line->output_prefix)+32);
     if (!filename_abs) {
         printf("Error: No room to store filename!\n");
@@ -926,10 +1133,6 @@ void kmer_stats_compare_contaminant_kmers(HashTable* hash, KmerStats* stats, Cmd
         printf("Opened %s\n", filename_pc_unique);
     }
     
-    hash_table_traverse_with_data(&check_kmers_in_common, (void*)stats, hash);
-
-    hash_table_traverse_with_data(&check_unique_kmers, (void*)stats, hash);
-    
     printf("\n%15s ", "");
     fprintf(fp_abs, "Contaminant");
     fprintf(fp_pc, "Contaminant");
@@ -1045,4 +1248,6 @@ void kmer_stats_write_progress(KmerStats* stats, CmdLine* cmd_line)
         }
     
     }
+
+    free(filename);
 }
@@ -0,0 +1,387 @@
+/*----------------------------------------------------------------------*
+ * File:    kmer_timing.c                                               *
+ * Purpose: Per-phase timing and resource accounting                    *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   A run is split into phases - allocating the table, loading each
+   library, comparing contaminants, screening, calculating stats - and
+   kmer_timing_start/kmer_timing_end bracket each one on the main
+   thread. For every phase we keep wall time (monotonic clock), CPU time
+   of all threads (getrusage), the process's peak RSS when it ended, and
+   bytes passed to read/write calls (rchar/wchar in /proc/self/io, which
+   counts every thread and includes page cache hits). Phases that go
+   through reads also record how many reads and kmer lookups they did,
+   for rates.
+
+   The report goes to screen at the end and to <output_prefix>timing.json,
+   one phase per line so it is easy to pull apart with line tools.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "global.h"
+#include "kmer_timing.h"
+
+#define KMER_TIMING_VERSION 1
+
+static KmerTimingSample program_start;
+static KmerTimingPhase* phases = NULL;
+static int number_of_phases = 0;
+static int phases_allocated = 0;
+static int current_phase = -1;
+
+/*----------------------------------------------------------------------*
+ * Function:   read_proc_io
+ * Purpose:    Get bytes read and written by this process so far
+ * Parameters: bytes_read -> set to rchar, or -1 if unavailable
+ *             bytes_written -> set to wchar, or -1 if unavailable
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void read_proc_io(long long* bytes_read, long long* bytes_written)
+{
+    FILE* fp = fopen("/proc/self/io", "r");
+    char line[256];
+
+    *bytes_read = -1;
+    *bytes_written = -1;
+
+    if (!fp) {
+        return;
+    }
+
+    while (fgets(line, 256, fp)) {
+        if (strncmp(line, "rchar:", 6) == 0) {
+            *bytes_read = atoll(line + 6);
+        } else if (strncmp(line, "wchar:", 6) == 0) {
+            *bytes_written = atoll(line + 6);
+        }
+    }
+
+    fclose(fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   take_sample
+ * Purpose:    Read clock and resource counters
+ * Parameters: sample -> sample to fill
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void take_sample(KmerTimingSample* sample)
+{
+    struct timespec now;
+    struct rusage usage;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    sample->wall = (double)now.tv_sec + ((double)now.tv_nsec / 1e9);
+
+    getrusage(RUSAGE_SELF, &usage);
+    sample->cpu = (double)usage.ru_utime.tv_sec + ((double)usage.ru_utime.tv_usec / 1e6) +
+                  (double)usage.ru_stime.tv_sec + ((double)usage.ru_stime.tv_usec / 1e6);
+    // ru_maxrss is in KB on Linux
+    sample->peak_rss = (long long)usage.ru_maxrss * 1024;
+
+    read_proc_io(&(sample->bytes_read), &(sample->bytes_written));
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_timing_initialise
+ * Purpose:    Start timing a run (or server job), forgetting any phases
+ *             recorded so far
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_timing_initialise(void)
+{
+    number_of_phases = 0;
+    current_phase = -1;
+    take_sample(&program_start);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_timing_elapsed
+ * Purpose:    Get wall time since kmer_timing_initialise
+ * Parameters: None
+ * Returns:    Seconds
+ *----------------------------------------------------------------------*/
+double kmer_timing_elapsed(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return ((double)now.tv_sec + ((double)now.tv_nsec / 1e9)) - program_start.wall;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_timing_start
+ * Purpose:    Start a phase, ending any phase still open
+ * Parameters: name -> phase name
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_timing_start(char* name)
+{
+    KmerTimingPhase* phase;
+
+    if (current_phase >= 0) {
+        kmer_timing_end(0, 0);
+    }
+
+    if (number_of_phases == phases_allocated) {
+        phases_allocated = phases_allocated == 0 ? 16 : phases_allocated * 2;
+        phases = realloc(phases, phases_allocated * sizeof(KmerTimingPhase));
+        if (!phases) {
+            printf("Error: can't allocate memory for timing phases.\n");
+            exit(1);
+        }
+    }
+
+    current_phase = number_of_phases++;
+    phase = &(phases[current_phase]);
+    strncpy(phase->name, name, KMER_TIMING_NAME_LENGTH - 1);
+    phase->name[KMER_TIMING_NAME_LENGTH - 1] = 0;
+    phase->reads = 0;
+    phase->lookups = 0;
+    take_sample(&(phase->start));
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_timing_end
+ * Purpose:    End the current phase
+ * Parameters: reads = reads processed in phase
+ *             lookups = kmer lookups made in phase
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_timing_end(long long reads, long long lookups)
+{
+    KmerTimingPhase* phase;
+
+    if (current_phase < 0) {
+        return;
+    }
+
+    phase = &(phases[current_phase]);
+    take_sample(&(phase->end));
+    phase->reads = reads;
+    phase->lookups = lookups;
+    current_phase = -1;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   get_total
+ * Purpose:    Make a phase covering the whole run so far
+ * Parameters: total -> phase to fill
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void get_total(KmerTimingPhase* total)
+{
+    int i;
+
+    strcpy(total->name, "Total");
+    total->start = program_start;
+    take_sample(&(total->end));
+    total->reads = 0;
+    total->lookups = 0;
+    for (i=0; i<number_of_phases; i++) {
+        total->reads += phases[i].reads;
+        total->lookups += phases[i].lookups;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   phase_bytes
+ * Purpose:    Get bytes moved during a phase
+ * Parameters: start = counter at start, -1 if unavailable
+ *             end = counter at end, -1 if unavailable
+ * Returns:    Bytes, or -1 if unavailable
+ *----------------------------------------------------------------------*/
+static long long phase_bytes(long long start, long long end)
+{
+    if ((start < 0) || (end < 0)) {
+        return -1;
+    }
+
+    return end - start;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   phase_rate
+ * Purpose:    Get a per second rate for a phase
+ * Parameters: count = number of things done
+ *             seconds = wall time
+ * Returns:    Rate, 0 if the phase took no measurable time
+ *----------------------------------------------------------------------*/
+static double phase_rate(long long count, double seconds)
+{
+    return seconds > 0 ? (double)count / seconds : 0;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   print_phase
+ * Purpose:    Print one line of the timing table
+ * Parameters: phase -> phase to print
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void print_phase(KmerTimingPhase* phase)
+{
+    double wall = phase->end.wall - phase->start.wall;
+    long long bytes_read = phase_bytes(phase->start.bytes_read, phase->end.bytes_read);
+    long long bytes_written = phase_bytes(phase->start.bytes_written, phase->end.bytes_written);
+
+    printf("%-32.32s %10.3f %10.3f %10.1f", phase->name, wall, phase->end.cpu - phase->start.cpu, (double)phase->end.peak_rss / (1024 * 1024));
+
+    if (bytes_read >= 0) {
+        printf(" %10.1f %10.1f", (double)bytes_read / (1024 * 1024), (double)bytes_written / (1024 * 1024));
+    } else {
+        printf(" %10s %10s", "-", "-");
+    }
+
+    if (phase->reads > 0) {
+        printf(" %12.0f", phase_rate(phase->reads, wall));
+    } else {
+        printf(" %12s", "-");
+    }
+
+    if (phase->lookups > 0) {
+        printf(" %12.0f", phase_rate(phase->lookups, wall));
+    } else {
+        printf(" %12s", "-");
+    }
+
+    printf("\n");
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_timing_report_to_screen
+ * Purpose:    Print table of phases
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_timing_report_to_screen(void)
+{
+    KmerTimingPhase total;
+    int i;
+
+    if (current_phase >= 0) {
+        kmer_timing_end(0, 0);
+    }
+
+    get_total(&total);
+
+    printf("\nTiming\n\n");
+    printf("%-32s %10s %10s %10s %10s %10s %12s %12s\n", "Phase", "Wall s", "CPU s", "Peak MB", "Read MB", "Write MB", "Reads/s", "Lookups/s");
+    for (i=0; i<number_of_phases; i++) {
+        print_phase(&(phases[i]));
+    }
+    print_phase(&total);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_json_string
+ * Purpose:    Write a quoted, escaped JSON string
+ * Parameters: fp -> file to write to
+ *             s -> string
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void write_json_string(FILE* fp, char* s)
+{
+    fputc('"', fp);
+    while (*s) {
+        if ((*s == '"') || (*s == '\\')) {
+            fprintf(fp, "\\%c", *s);
+        } else if ((unsigned char)*s < ' ') {
+            fprintf(fp, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, fp);
+        }
+        s++;
+    }
+    fputc('"', fp);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_json_bytes
+ * Purpose:    Write a byte count, or null if unavailable
+ * Parameters: fp -> file to write to
+ *             bytes = count, -1 if unavailable
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void write_json_bytes(FILE* fp, long long bytes)
+{
+    if (bytes >= 0) {
+        fprintf(fp, "%lld", bytes);
+    } else {
+        fprintf(fp, "null");
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_json_phase
+ * Purpose:    Write one phase as a JSON object on a single line
+ * Parameters: fp -> file to write to
+ *             phase -> phase to write
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void write_json_phase(FILE* fp, KmerTimingPhase* phase)
+{
+    double wall = phase->end.wall - phase->start.wall;
+
+    fprintf(fp, "{\"name\": ");
+    write_json_string(fp, phase->name);
+    fprintf(fp, ", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"peak_rss_bytes\": %lld", wall, phase->end.cpu - phase->start.cpu, phase->end.peak_rss);
+    fprintf(fp, ", \"bytes_read\": ");
+    write_json_bytes(fp, phase_bytes(phase->start.bytes_read, phase->end.bytes_read));
+    fprintf(fp, ", \"bytes_written\": ");
+    write_json_bytes(fp, phase_bytes(phase->start.bytes_written, phase->end.bytes_written));
+    fprintf(fp, ", \"reads\": %lld, \"reads_per_second\": %.1f", phase->reads, phase_rate(phase->reads, wall));
+    fprintf(fp, ", \"kmer_lookups\": %lld, \"kmer_lookups_per_second\": %.1f}", phase->lookups, phase_rate(phase->lookups, wall));
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   kmer_timing_write_json
+ * Purpose:    Write phases to a JSON file
+ * Parameters: filename -> file to write
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void kmer_timing_write_json(char* filename)
+{
+    KmerTimingPhase total;
+    FILE* fp;
+    int i;
+
+    if (current_phase >= 0) {
+        kmer_timing_end(0, 0);
+    }
+
+    fp = fopen(filename, "w");
+    if (!fp) {
+        printf("Error: can't open %s\n", filename);
+        exit(1);
+    }
+
+    get_total(&total);
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"version\": %d,\n", KMER_TIMING_VERSION);
+    fprintf(fp, "  \"phases\": [\n");
+    for (i=0; i<number_of_phases; i++) {
+        fprintf(fp, "    ");
+        write_json_phase(fp, &(phases[i]));
+        fprintf(fp, "%s\n", i < (number_of_phases - 1) ? "," : "");
+    }
+    fprintf(fp, "  ],\n");
+    fprintf(fp, "  \"total\": ");
+    write_json_phase(fp, &total);
+    fprintf(fp, "\n}\n");
+
+    fclose(fp);
+}
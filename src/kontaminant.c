@@ -34,6 +34,18 @@
 #include "kmer_stats.h"
 #include "kmer_reader.h"
 #include "kmer_build.h"
+#include "bloom_filter.h"
+#include "key_index.h"
+#include "table_memory.h"
+#include "numa_layout.h"
+#include "thread_pool.h"
+#include "kmer_pipeline.h"
+#include "kmer_server.h"
+#include "kmer_snapshot.h"
+#include "kmer_shard.h"
+#include "kmer_kernels.h"
+#include "kmer_timing.h"
+#include "kmer_live.h"
 
 /*----------------------------------------------------------------------*
  * Constants
@@ -97,17 +109,43 @@ int strcmp_i(char* a, char* b)
 HashTable* create_hash_table(CmdLine* cmdline, int kmer_size)
 {
     HashTable* hash;
+    TableMemoryOptions memory_options;
     long int entries = pow(2.0, (double)cmdline->bucket_bits)*cmdline->bucket_size;
     long int memory = entries*sizeof(Element);
 
+    // Prefault with as many threads as will later use the table
+    memory_options.mode = cmdline->table_memory_mode;
+    memory_options.prefault = cmdline->table_prefault;
+    memory_options.lock = cmdline->table_lock;
+    memory_options.interleave = cmdline->numa_policy != NUMA_POLICY_NONE;
+    memory_options.threads = cmdline->numthreads;
+    if ((cmdline->pipeline_parse_threads + cmdline->pipeline_lookup_threads) > memory_options.threads) {
+        memory_options.threads = cmdline->pipeline_parse_threads + cmdline->pipeline_lookup_threads;
+    }
+    table_memory_set_options(&memory_options);
+    numa_layout_initialise(cmdline->numa_policy, cmdline->numa_pin);
+    thread_pool_initialise_shared(memory_options.threads);
+
     printf("Creating hash table for kmer storage...\n");
     printf("                n: %d\n", cmdline->bucket_bits);
     printf("                b: %d\n", cmdline->bucket_size);
     printf("          Entries: %ld\n", entries);
     printf("       Entry size: %ld\n", sizeof(Element));
-    printf("  Memory required: %ld MB\n\n", memory/(1024*1024));
+    printf("  Memory required: %ld MB\n", memory/(1024*1024));
+    if ((memory_options.mode != TABLE_MEMORY_MALLOC) || (memory_options.prefault) || (memory_options.lock)) {
+        printf("       Allocation: %s%s%s\n", table_memory_mode_name(memory_options.mode),
+               memory_options.prefault ? ", prefaulted" : "", memory_options.lock ? ", locked" : "");
+    }
+    if ((cmdline->numa_policy != NUMA_POLICY_NONE) || (cmdline->numa_pin)) {
+        numa_layout_report();
+    }
+    printf("\n");
     
     hash = hash_table_new(cmdline->bucket_bits, cmdline->bucket_size, 25, 1);
+    // Falling back from hugetlb is worth reporting, plain mmap for a NUMA policy isn't
+    if ((hash != NULL) && (hash->table_memory_mode != memory_options.mode) && (hash->table_memory_mode != TABLE_MEMORY_MMAP)) {
+        printf("       Allocation: %s used instead\n\n", table_memory_mode_name(hash->table_memory_mode));
+    }
     
     if (hash == NULL) {
         printf("Error: No memory for hash table\n");
@@ -121,6 +159,47 @@ HashTable* create_hash_table(CmdLine* cmdline, int kmer_size)
     return hash;
 }
 
+/*----------------------------------------------------------------------*
+ * Function:   create_key_index
+ * Purpose:    Copy loaded contaminant keys into a separate aligned array,
+ *             so bucket searches don't read flags and contaminant bits
+ * Parameters: hash -> contaminant hash table
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void create_key_index(HashTable* hash)
+{
+    KeyIndex* index;
+
+    printf("\nCreating split key index...\n");
+    index = key_index_new_from_hash_table(hash, true);
+    printf("  Keys per bucket: %d (padded to %lld)\n", index->bucket_size, index->stride);
+    printf("  Memory required: %lld MB\n", (index->number_buckets * index->stride * (long long)sizeof(BinaryKmer)) / (1024 * 1024));
+
+    hash->key_index = index;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   create_prefilter
+ * Purpose:    Build Bloom filter over loaded contaminant kmers, so that
+ *             lookups for absent kmers don't have to search a bucket
+ * Parameters: hash -> contaminant hash table
+ *             cmdline -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void create_prefilter(HashTable* hash, CmdLine* cmdline)
+{
+    BloomFilter* filter;
+    
+    printf("\nCreating Bloom filter prefilter...\n");
+    filter = bloom_filter_new_from_hash_table(hash, cmdline->bloom_bits);
+    printf("            Kmers: %llu\n", (unsigned long long)filter->number_kmers);
+    printf("    Bits per kmer: %d\n", cmdline->bloom_bits);
+    printf("  Memory required: %llu MB\n", (unsigned long long)((filter->number_blocks * sizeof(BloomBlock)) / (1024*1024)));
+    printf("   False positive: %.4f%% (estimated)\n", 100.0 * bloom_filter_false_positive_rate(filter));
+    
+    hash->prefilter = filter;
+}
+
 /*----------------------------------------------------------------------*
  * Function:
  * Purpose:
@@ -131,6 +210,7 @@ void load_contamints_from_file(HashTable* contaminant_hash, KmerStats* stats, Cm
 {
     char filename[MAX_PATH_LENGTH];
     char con[1024];
+    char phase[KMER_TIMING_NAME_LENGTH];
     FILE* fp = fopen(cmdline->contaminants_file, "r");
     
     if (!fp) {
@@ -146,7 +226,7 @@ void load_contamints_from_file(HashTable* contaminant_hash, KmerStats* stats, Cm
             chomp(con);
             if (strlen(con) > 1) {
                 printf("Loading contaminant %s\n", con);
-                sprintf(filename, "%s/%s.fasta.%d.kmers", cmdline->contaminant_dir, con, cmdline->kmer_size);
+                kmer_shard_library_filename(filename, cmdline->contaminant_dir, con, cmdline);
                 printf("      from filename %s\n", filename);
                 
                 stats->contaminant_ids[stats->n_contaminants] = malloc(strlen(con) + 1);
@@ -158,7 +238,10 @@ void load_contamints_from_file(HashTable* contaminant_hash, KmerStats* stats, Cm
                     exit(1);
                 }
                 
-                stats->contaminant_kmers[stats->n_contaminants] = load_kmer_library(filename, stats->n_contaminants, cmdline->kmer_size, contaminant_hash);
+                snprintf(phase, KMER_TIMING_NAME_LENGTH, "Load %.200s", con);
+                kmer_timing_start(phase);
+                stats->contaminant_kmers[stats->n_contaminants] = load_kmer_library(filename, stats->n_contaminants, cmdline->kmer_size, contaminant_hash, cmdline->shard, cmdline->n_shards);
+                kmer_timing_end(0, 0);
                 
                 stats->n_contaminants++;
                 
@@ -181,6 +264,7 @@ void load_contamints(HashTable* contaminant_hash, KmerStats* stats, CmdLine* cmd
 {
     char* con = strtok(cmdline->contaminants, ",");
     char filename[MAX_PATH_LENGTH];
+    char phase[KMER_TIMING_NAME_LENGTH];
     
     if (cmdline->contaminants_file != 0) {
         load_contamints_from_file(contaminant_hash, stats, cmdline);
@@ -190,7 +274,7 @@ void load_contamints(HashTable* contaminant_hash, KmerStats* stats, CmdLine* cmd
         printf("\n");
         while (con != NULL) {
             printf("Loading contaminant %s\n", con);
-            sprintf(filename, "%s/%s.fasta.%d.kmers", cmdline->contaminant_dir, con, cmdline->kmer_size);
+            kmer_shard_library_filename(filename, cmdline->contaminant_dir, con, cmdline);
             printf("      from filename %s\n", filename);
             
             stats->contaminant_ids[stats->n_contaminants] = malloc(strlen(con) + 1);
@@ -202,7 +286,10 @@ void load_contamints(HashTable* contaminant_hash, KmerStats* stats, CmdLine* cmd
                 exit(1);
             }
             
-            stats->contaminant_kmers[stats->n_contaminants] = load_kmer_library(filename, stats->n_contaminants, cmdline->kmer_size, contaminant_hash);
+            snprintf(phase, KMER_TIMING_NAME_LENGTH, "Load %.200s", con);
+            kmer_timing_start(phase);
+            stats->contaminant_kmers[stats->n_contaminants] = load_kmer_library(filename, stats->n_contaminants, cmdline->kmer_size, contaminant_hash, cmdline->shard, cmdline->n_shards);
+            kmer_timing_end(0, 0);
             
             stats->n_contaminants++;
             con = strtok(NULL, ",");
@@ -280,9 +367,10 @@ void filter_or_screen(char* filename_1, char* filename_2, HashTable* contaminant
             fra[i]->input_filename = filenames[i];
             fra[i]->quality_cut_off = 0;
             fra[i]->insert = false;
-            fra[i]->max_read_length = 200000;
+            fra[i]->max_read_length = cmdline->max_read_length;
             fra[i]->maximum_ocupancy = 75;
             fra[i]->KmerHash = contaminant_hash;
+            fra[i]->cmd_line = cmdline;
         
             if (fra[i]->output_filename) {
                 sprintf(fra[i]->output_filename, "%s%s", cmdline->output_prefix, get_leafname(filenames[i]));
@@ -317,15 +405,21 @@ void filter_or_screen(char* filename_1, char* filename_2, HashTable* contaminant
     
     kmer_stats->number_of_files = n_files;
 
-    if (cmdline->format == FASTA) {
-        if (n_files == 1) {
+    if (cmdline->long_reads) {
+        screen_windows_pipeline(cmdline, fra[0], kmer_stats);
+    } else if (cmdline->format == FASTA) {
+        if ((n_files == 1) && ((cmdline->pipeline) || (cmdline->numthreads > 1))) {
+            screen_windows_pipeline(cmdline, fra[0], kmer_stats);
+        } else if (n_files == 1) {
             screen_kmers_from_file(fra[0], cmdline, kmer_stats);
         } else {
             printf("Error: paired FASTA files not supported.\n");
             exit(3);
         }
     } else if (cmdline->format == FASTQ) {
-        if (cmdline->numthreads == 1) {
+        if (cmdline->pipeline) {
+            screen_or_filter_pipeline(cmdline, fra[0], fra[1], kmer_stats);
+        } else if (cmdline->numthreads == 1) {
             screen_or_filter_paired_end(cmdline, fra[0], fra[1], kmer_stats);
         } else {
             screen_or_filter_parallel(cmdline, fra[0], fra[1], kmer_stats);
@@ -395,16 +489,241 @@ void initialise_output_files(CmdLine* cmdline, KmerStats* stats)
     }
 }
 
+/*----------------------------------------------------------------------*
+ * Function:   print_banner
+ * Purpose:    Print version and build details
+ * Parameters: argc = number of arguments
+ *             argv -> arguments
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void print_banner(int argc, char* argv[])
+{
+    int i;
+
+    printf("\nkONTAMINANT v%s\n\n", VERSION);
+    
+    printf("Command line:");
+    for (i = 0; i < argc; i++) {
+        printf(" %s", argv[i]);
+    }
+    printf("\n\n");
+    
+    printf("Max contaminants: %d\n", MAX_CONTAMINANTS);
+    printf("Element size: %ld bytes\n", sizeof(Element));
+    printf("Kernels: %s\n", kmer_kernels.name);
+    printf("Kmer bitfields: %d (%d bytes)\n\n", NUMBER_OF_BITFIELDS_IN_BINARY_KMER, NUMBER_OF_BITFIELDS_IN_BINARY_KMER*8);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   timing_reads
+ * Purpose:    Count reads processed so far, for timing
+ * Parameters: stats -> stats
+ * Returns:    Number of reads, counting each end of a pair
+ *----------------------------------------------------------------------*/
+long long timing_reads(KmerStats* stats)
+{
+    return (long long)stats->read[0]->number_of_reads + (long long)stats->read[1]->number_of_reads;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   timing_lookups
+ * Purpose:    Count contaminant table lookups so far, for timing
+ * Parameters: stats -> stats
+ * Returns:    Number of lookups
+ *----------------------------------------------------------------------*/
+long long timing_lookups(KmerStats* stats)
+{
+    return (long long)(stats->read[0]->kmers_looked_up + stats->read[1]->kmers_looked_up);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   write_timing
+ * Purpose:    Report phase timings to screen and to
+ *             <output_prefix>timing.json
+ * Parameters: cmdline -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void write_timing(CmdLine* cmdline)
+{
+    char filename[MAX_PATH_LENGTH];
+
+    kmer_timing_report_to_screen();
+
+    if (cmdline->output_prefix != 0) {
+        sprintf(filename, "%stiming.json", cmdline->output_prefix);
+        kmer_timing_write_json(filename);
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   start_live_stats
+ * Purpose:    Start publishing live stats to <progress_dir>/live_stats.bin
+ * Parameters: stats -> stats
+ *             cmdline -> command line options
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void start_live_stats(KmerStats* stats, CmdLine* cmdline)
+{
+    char filename[MAX_PATH_LENGTH];
+
+    snprintf(filename, MAX_PATH_LENGTH, "%s/" KMER_LIVE_FILENAME, cmdline->progress_dir);
+    kmer_live_start(filename, stats, cmdline);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   screen_or_filter_job
+ * Purpose:    Screen or filter input files against loaded contaminants
+ *             and report
+ * Parameters: contaminant_hash -> hash table of contaminant kmers
+ *             kmer_stats -> stats
+ *             cmdline -> command line options for job
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void screen_or_filter_job(HashTable* contaminant_hash, KmerStats* kmer_stats, CmdLine* cmdline)
+{
+    long long reads = timing_reads(kmer_stats);
+    long long lookups = timing_lookups(kmer_stats);
+
+    kmer_timing_start("Contaminant comparison");
+    initialise_output_files(cmdline, kmer_stats);
+    printf("\n");
+    hash_table_print_stats(contaminant_hash);
+    if (cmdline->shard > 0) {
+        // A shard only holds some of each contaminant's kmers, so its
+        // counts go in the counts file and -Q writes the comparison
+        kmer_stats_count_contaminant_kmers(contaminant_hash, kmer_stats);
+    } else {
+        kmer_stats_compare_contaminant_kmers(contaminant_hash, kmer_stats, cmdline);
+    }
+    kmer_timing_end(0, 0);
+
+    printf("\nProcessing read files (after %.1f seconds)...\n", kmer_timing_elapsed());
+    
+    if (cmdline->lookup_stats) {
+        hash_table_count_lookups(true);
+    }
+
+    if (cmdline->write_progress_file) {
+        start_live_stats(kmer_stats, cmdline);
+    }
+
+    kmer_timing_start(cmdline->run_type == DO_FILTER ? "Filtering" : "Screening");
+    process_files(contaminant_hash, kmer_stats, cmdline);
+    kmer_live_stop();
+
+    if (cmdline->snapshot_file != 0) {
+        kmer_snapshot_write(cmdline->snapshot_file, contaminant_hash, kmer_stats, cmdline);
+    }
+    kmer_timing_end(timing_reads(kmer_stats) - reads, timing_lookups(kmer_stats) - lookups);
+
+    printf("\nCalculating stats (after %.1f seconds)...\n", kmer_timing_elapsed());
+    
+    kmer_timing_start("Stats calculation");
+    kmer_stats_calculate(kmer_stats);
+    kmer_stats_report_to_screen(kmer_stats, cmdline);
+    if (cmdline->lookup_stats) {
+        printf("\n");
+        hash_table_print_lookup_stats(contaminant_hash);
+    }
+    kmer_timing_end(0, 0);
+}
+
+/*----------------------------------------------------------------------*
+ * Data for server jobs
+ *----------------------------------------------------------------------*/
+typedef struct {
+    HashTable* contaminant_hash;
+    KmerStats* kmer_stats;
+    CmdLine* cmdline;
+} ServerIndex;
+
+/*----------------------------------------------------------------------*
+ * Function:   run_server_job
+ * Purpose:    Run a job sent to the server. Called in a process of its
+ *             own, so changes to the table and stats are private to it.
+ * Parameters: argc = number of arguments from client
+ *             argv -> arguments from client
+ *             data -> ServerIndex
+ * Returns:    Exit status
+ *----------------------------------------------------------------------*/
+int run_server_job(int argc, char* argv[], void* data)
+{
+    ServerIndex* index = data;
+    CmdLine cmdline;
+    size_t available;
+    int option;
+
+    // The server's pool workers weren't forked with us
+    thread_pool_reset_after_fork();
+
+    kmer_timing_initialise();
+
+    print_banner(argc, argv);
+
+    // Contaminants, kmer size and table come from the server
+    initialise_cmdline(&cmdline);
+    cmdline.contaminants = index->cmdline->contaminants;
+    cmdline.contaminant_dir = index->cmdline->contaminant_dir;
+    cmdline.kmer_size = index->cmdline->kmer_size;
+
+    // The table is the server's, set up by its own options, and shared
+    // by every job
+    option = find_command_line_option(argc, argv, "AbBHInUY", NULL);
+    if (option != 0) {
+        printf("Error: -%c sets up the server's table, so it must be given to the server, not to a job.\n", option);
+        return 1;
+    }
+
+    // getopt state is left over from the server's own command line
+    optind = 0;
+    parse_command_line(argc, argv, &cmdline);
+
+    if ((cmdline.run_type != DO_SCREEN) && (cmdline.run_type != DO_FILTER)) {
+        printf("Error: server only runs screening or filtering jobs.\n");
+        return 1;
+    }
+
+    if (cmdline.kmer_size != index->cmdline->kmer_size) {
+        printf("Error: server has kmer size %d.\n", index->cmdline->kmer_size);
+        return 1;
+    }
+
+    if ((cmdline.contaminants != index->cmdline->contaminants) || (cmdline.contaminants_file != 0)) {
+        printf("NOTE: contaminants loaded by the server are used, not those given with the job.\n\n");
+    }
+
+    // A hugetlb table is mapped private, so the pages this job sets
+    // coverage flags in are copied from the hugetlb pool. If the pool runs
+    // dry the job would die with SIGBUS part way through, so turn it away
+    // unless the pool could hold a copy of the whole table.
+    if (index->contaminant_hash->table_memory_mode == TABLE_MEMORY_HUGETLB) {
+        available = table_memory_hugetlb_available();
+        if (available < index->contaminant_hash->table_memory_bytes) {
+            printf("Error: the server's table uses %zu bytes of hugetlb pages, but only %zu bytes are free for this job to copy. Try again when other jobs have finished, or add huge pages.\n",
+                   index->contaminant_hash->table_memory_bytes, available);
+            return 1;
+        }
+    }
+
+    screen_or_filter_job(index->contaminant_hash, index->kmer_stats, &cmdline);
+
+    write_timing(&cmdline);
+
+    printf("\nDone. Completed in %.1f seconds.\n\n", kmer_timing_elapsed());
+
+    return 0;
+}
+
 /*----------------------------------------------------------------------*
  * Function:   main
  *----------------------------------------------------------------------*/
 int main(int argc, char* argv[])
 {
-    time_t start, end;
-    double seconds;
     HashTable* contaminant_hash = NULL;
     CmdLine cmdline;
     KmerStats kmer_stats;
+    ServerIndex server_index;
+    char* client_socket = 0;
     int i = 0;
     
     //Element e;
@@ -415,56 +734,94 @@ int main(int argc, char* argv[])
     //}
     //exit(0);
     
-    time(&start);
-    
-    printf("\nkONTAMINANT v%s\n\n", VERSION);
-    
-    printf("Command line:");
-    for (i = 0; i < argc; i++) {
-        printf(" %s", argv[i]);
+    // A client hands its whole command line to the server, so look for
+    // this before anything else is parsed or printed
+    if (find_command_line_option(argc, argv, "C", &client_socket)) {
+        return kmer_client_run(client_socket, argc, argv);
     }
-    printf("\n\n");
     
-    printf("Max contaminants: %d\n", MAX_CONTAMINANTS);
-    printf("Element size: %ld bytes\n", sizeof(Element));
-    printf("Kmer bitfields: %d (%d bytes)\n\n", NUMBER_OF_BITFIELDS_IN_BINARY_KMER, NUMBER_OF_BITFIELDS_IN_BINARY_KMER*8);
+    kmer_timing_initialise();
+    
+    kmer_kernels_initialise();
+    print_banner(argc, argv);
     
     initialise_cmdline(&cmdline);
     parse_command_line(argc, argv, &cmdline);
     kmer_stats_initialise(&kmer_stats, &cmdline);
+    kmer_timing_start("Table allocation");
     contaminant_hash = create_hash_table(&cmdline, cmdline.kmer_size);
+    kmer_timing_end(0, 0);
 
     if (cmdline.run_type == DO_INDEX) {
         // Index file
+        kmer_timing_start("Indexing");
         load_reads_into_table(&cmdline, contaminant_hash);
         printf("\n");
         hash_table_print_stats(contaminant_hash);
+        kmer_timing_end(0, 0);
+        kmer_timing_start("Writing index");
         dump_kmer_hash(&cmdline, contaminant_hash);
-    } else if ((cmdline.run_type == DO_SCREEN) || (cmdline.run_type == DO_FILTER)) {
+        kmer_timing_end(0, 0);
+    } else if ((cmdline.run_type == DO_SCREEN) || (cmdline.run_type == DO_FILTER) || (cmdline.run_type == DO_SERVE)) {
         load_contamints(contaminant_hash, &kmer_stats, &cmdline);
-        initialise_output_files(&cmdline, &kmer_stats);
-        printf("\n");
-        hash_table_print_stats(contaminant_hash);
-        kmer_stats_compare_contaminant_kmers(contaminant_hash, &kmer_stats, &cmdline);
+        if (cmdline.bloom_bits > 0) {
+            kmer_timing_start("Bloom filter");
+            create_prefilter(contaminant_hash, &cmdline);
+            kmer_timing_end(0, 0);
+        }
+        if (cmdline.split_keys) {
+            kmer_timing_start("Key index");
+            create_key_index(contaminant_hash);
+            kmer_timing_end(0, 0);
+        }
+        numa_layout_replicate_table(contaminant_hash);
 
-        time(&end);
-        seconds = difftime(end, start);
-        printf("\nProcessing read files (after %.0f seconds)...\n", seconds);
-        
-        process_files(contaminant_hash, &kmer_stats, &cmdline);
+        if (cmdline.run_type == DO_SERVE) {
+            printf("\n");
+            hash_table_print_stats(contaminant_hash);
+            kmer_stats_count_contaminant_kmers(contaminant_hash, &kmer_stats);
+            
+            kmer_timing_report_to_screen();
+            printf("\nContaminants loaded (after %.1f seconds).\n", kmer_timing_elapsed());
+            
+            server_index.contaminant_hash = contaminant_hash;
+            server_index.kmer_stats = &kmer_stats;
+            server_index.cmdline = &cmdline;
+            kmer_server_run(cmdline.server_socket, cmdline.max_jobs, run_server_job, &server_index);
+        } else {
+            screen_or_filter_job(contaminant_hash, &kmer_stats, &cmdline);
+        }
+    } else if ((cmdline.run_type == DO_MERGE) || (cmdline.run_type == DO_COMBINE)) {
+        if (cmdline.run_type == DO_MERGE) {
+            kmer_timing_start("Merging");
+            kmer_snapshot_merge_files(cmdline.n_merge_files, cmdline.merge_files, contaminant_hash, &kmer_stats, &cmdline);
+            printf("\n");
+            hash_table_print_stats(contaminant_hash);
+        } else {
+            kmer_timing_start("Combining");
+            kmer_shard_combine_files(cmdline.n_merge_files, cmdline.merge_files, &kmer_stats, &cmdline);
+        }
+        if (kmer_stats.n_contaminants > 1) {
+            printf("\n");
+            kmer_stats_write_contaminant_comparison(&kmer_stats, &cmdline);
+        }
+        kmer_timing_end(0, 0);
 
-        time(&end);
-        seconds = difftime(end, start);
-        printf("\nCalculating stats (after %.0f seconds)...\n", seconds);
-        
+        printf("\nCalculating stats (after %.1f seconds)...\n", kmer_timing_elapsed());
+
+        kmer_timing_start("Stats calculation");
         kmer_stats_calculate(&kmer_stats);
         kmer_stats_report_to_screen(&kmer_stats, &cmdline);
+        kmer_timing_end(0, 0);
     }
     
-    time(&end);
-    seconds = difftime(end, start);
+    if (cmdline.run_type == DO_INDEX) {
+        kmer_timing_report_to_screen();
+    } else {
+        write_timing(&cmdline);
+    }
 
-    printf("\nDone. Completed in %.0f seconds.\n\n", seconds);
+    printf("\nDone. Completed in %.1f seconds.\n\n", kmer_timing_elapsed());
     
         
 
@@ -0,0 +1,266 @@
+/*----------------------------------------------------------------------*
+ * File:    kontaminant_multi.c                                         *
+ * Purpose: Pick a kmer width and contaminant width build at startup    *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   NUMBER_OF_BITFIELDS_IN_BINARY_KMER and CONTAMINANT_FIELDS size every
+   Element and unroll every kmer loop, so they stay compile time
+   constants. 'make multi' instead compiles the whole program once for
+   each pair in MULTI_BITFIELDS x MULTI_CFIELDS, links each copy into
+   one object with only its main left global, renamed
+   kontaminant_b<bitfields>_c<fields>_main, and links them all with
+   this file.
+
+   main here looks at the kmer size and the number of contaminants
+   given (-c list or -e file) and runs the smallest build holding both,
+   so a k=21 run with a few contaminants gets a 16 byte Element however
+   wide the other builds are. The chosen build prints its Element size,
+   kmer bitfields and maximum contaminants in the banner as usual.
+
+   Merging (-M) and combining (-Q) take neither, so the first file's
+   header decides instead. A snapshot holds the build's Elements and
+   MAX_CONTAMINANTS wide counters, so only the build that wrote it can
+   read it; a shard counts file just needs a build holding its kmer size
+   and contaminants.
+
+   MULTI_VARIANTS, set by the Makefile, lists the builds as
+   VARIANT(bitfields, fields) ...
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <getopt.h>
+#include "cmd_line_options.h"
+
+#ifndef MULTI_VARIANTS
+#error "MULTI_VARIANTS must list the builds linked, see 'make multi'"
+#endif
+
+#define VARIANT(b, c) int kontaminant_b##b##_c##c##_main(int argc, char* argv[]);
+MULTI_VARIANTS
+#undef VARIANT
+
+typedef struct {
+    int bitfields;
+    int contaminant_fields;
+    int (*main)(int argc, char* argv[]);
+} KontaminantVariant;
+
+#define VARIANT(b, c) {b, c, kontaminant_b##b##_c##c##_main},
+static KontaminantVariant variants[] = {
+    MULTI_VARIANTS
+};
+#undef VARIANT
+
+#define NUMBER_OF_VARIANTS ((int)(sizeof(variants) / sizeof(KontaminantVariant)))
+
+/*----------------------------------------------------------------------*
+ * Function:   variant_max_contaminants
+ * Purpose:    Number of contaminants a build holds (MAX_CONTAMINANTS)
+ * Parameters: v -> build
+ * Returns:    Maximum contaminants
+ *----------------------------------------------------------------------*/
+static int variant_max_contaminants(KontaminantVariant* v)
+{
+    return (v->contaminant_fields * 32) + (32 - FLAG_BITS_USED);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   count_contaminants_list
+ * Purpose:    Count contaminants in a comma separated list, as
+ *             load_contamints does
+ * Parameters: list -> list
+ * Returns:    Number of contaminants
+ *----------------------------------------------------------------------*/
+static int count_contaminants_list(char* list)
+{
+    int n = 0;
+    int in_name = 0;
+    char* c;
+
+    for (c=list; *c != 0; c++) {
+        if (*c == ',') {
+            in_name = 0;
+        } else if (!in_name) {
+            in_name = 1;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   count_contaminants_file
+ * Purpose:    Count contaminants in a contaminants file, as
+ *             load_contamints_from_file does
+ * Parameters: filename -> file
+ * Returns:    Number of contaminants, or -1 if the file can't be read
+ *----------------------------------------------------------------------*/
+static int count_contaminants_file(char* filename)
+{
+    FILE* fp = fopen(filename, "r");
+    char con[1024];
+    int n = 0;
+
+    if (!fp) {
+        return -1;
+    }
+
+    while (fgets(con, 1024, fp)) {
+        con[strcspn(con, "\r\n")] = 0;
+        if (strlen(con) > 1) {
+            n++;
+        }
+    }
+
+    fclose(fp);
+
+    return n;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_file_build
+ * Purpose:    Read the kmer size and number of contaminants from the
+ *             header of a snapshot or shard counts file and, for a
+ *             snapshot, the build that wrote it. See kmer_snapshot.c and
+ *             kmer_shard.c for the layouts; the magic strings match
+ *             SNAPSHOT_MAGIC and SHARD_COUNTS_MAGIC.
+ * Parameters: filename -> file
+ *             bitfields -> set to the snapshot's kmer bitfields, or 0
+ *             max_contaminants -> set to the snapshot's maximum
+ *                                 contaminants, or 0
+ *             kmer_size -> set to kmer size
+ *             n_contaminants -> set to number of contaminants
+ * Returns:    1 if the header was read, 0 if the file can't be read or
+ *             isn't either type, in which case the build reports it
+ *----------------------------------------------------------------------*/
+static int read_file_build(char* filename, int* bitfields, int* max_contaminants, int* kmer_size, int* n_contaminants)
+{
+    FILE* fp = fopen(filename, "rb");
+    char magic[8];
+    uint32_t version;
+    uint32_t header[11];
+    int found = 0;
+
+    if (!fp) {
+        return 0;
+    }
+
+    if ((fread(magic, 8, 1, fp) == 1) && (fread(&version, sizeof(uint32_t), 1, fp) == 1)) {
+        if ((memcmp(magic, "KONTSNAP", 8) == 0) && (fread(header, sizeof(uint32_t), 11, fp) == 11)) {
+            *bitfields = header[1];
+            *max_contaminants = header[2];
+            *kmer_size = header[4];
+            *n_contaminants = header[9];
+            found = 1;
+        } else if ((memcmp(magic, "KONTSHRD", 8) == 0) && (fread(header, sizeof(uint32_t), 8, fp) == 8)) {
+            *bitfields = 0;
+            *max_contaminants = 0;
+            *kmer_size = header[0];
+            *n_contaminants = header[4];
+            found = 1;
+        }
+    }
+
+    fclose(fp);
+
+    return found;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   main
+ * Purpose:    Run the smallest build for the kmer size and contaminants
+ *----------------------------------------------------------------------*/
+int main(int argc, char* argv[])
+{
+    char** args = malloc((argc + 1) * sizeof(char*));
+    int kmer_size = 21;
+    int n_contaminants = 0;
+    int bitfields;
+    int file_bitfields = 0;
+    int file_max_contaminants = 0;
+    char* merge_file = 0;
+    int merging = 0;
+    int chosen = -1;
+    int opt;
+    int i;
+
+    if (!args) {
+        printf("Error: can't allocate memory for arguments\n");
+        exit(1);
+    }
+
+    // getopt_long reorders its argv, so scan a copy and leave the
+    // chosen build to report any errors
+    memcpy(args, argv, (argc + 1) * sizeof(char*));
+    opterr = 0;
+    while ((opt = getopt_long(argc, args, CMD_LINE_SHORT_OPTIONS, cmd_line_long_options, NULL)) > 0) {
+        switch (opt) {
+            case 'k':
+                kmer_size = atoi(optarg);
+                break;
+            case 'c':
+                n_contaminants = count_contaminants_list(optarg);
+                break;
+            case 'e':
+                n_contaminants = count_contaminants_file(optarg);
+                break;
+            case 'M':
+            case 'Q':
+                merging = 1;
+                break;
+        }
+    }
+    if (merging && (optind < argc)) {
+        merge_file = args[optind];
+        if (!read_file_build(merge_file, &file_bitfields, &file_max_contaminants, &kmer_size, &n_contaminants)) {
+            merge_file = 0;
+        }
+    }
+    free(args);
+    opterr = 1;
+    optind = 0;
+
+    // Same rule as MAXK in the Makefile: b bitfields hold k < 32b
+    bitfields = (kmer_size > 0) ? (kmer_size / 32) + 1 : 1;
+
+    for (i=0; i<NUMBER_OF_VARIANTS; i++) {
+        KontaminantVariant* v = &(variants[i]);
+
+        if ((v->bitfields < bitfields) || (variant_max_contaminants(v) < n_contaminants)) {
+            continue;
+        }
+
+        if ((file_bitfields > 0) && ((v->bitfields != file_bitfields) || (variant_max_contaminants(v) != file_max_contaminants))) {
+            continue;
+        }
+
+        if ((chosen < 0) ||
+            (v->bitfields < variants[chosen].bitfields) ||
+            ((v->bitfields == variants[chosen].bitfields) && (v->contaminant_fields < variants[chosen].contaminant_fields))) {
+            chosen = i;
+        }
+    }
+
+    if (chosen < 0) {
+        if (file_bitfields > 0) {
+            printf("Error: %s was written by a build with kmer bitfields %d and maximum contaminants %d, which isn't included. Builds included:\n", merge_file, file_bitfields, file_max_contaminants);
+        } else {
+            printf("Error: no build for kmer size %d with %d contaminants. Builds included:\n", kmer_size, n_contaminants);
+        }
+        for (i=0; i<NUMBER_OF_VARIANTS; i++) {
+            printf("    kmer size up to %d, up to %d contaminants\n", (variants[i].bitfields * 32) - 1, variant_max_contaminants(&(variants[i])));
+        }
+        exit(1);
+    }
+
+    return variants[chosen].main(argc, argv);
+}
@@ -0,0 +1,370 @@
+/*----------------------------------------------------------------------*
+ * File:    numa_layout.c                                               *
+ * Purpose: NUMA placement of the contaminant table and worker pinning  *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   The contaminant table is first touched by the main thread while the
+   libraries load, so without a policy it all sits on one socket and
+   every lookup from the other socket is a remote access. Two policies
+   are offered:
+
+   interleave - the table's pages are spread round robin over all nodes
+                (mbind MPOL_INTERLEAVE before the first touch), so
+                every worker sees the same average latency.
+   replicate  - once loaded, the table is copied onto each node (mbind
+                MPOL_BIND) and lookup workers search the copy on the
+                node they are running on. Contaminant bits are frozen
+                by then; the coverage flags that mark a kmer as seen
+                are still set in the primary table (see
+                element_get_and_increment_read_coverages), so seen
+                counts stay exact. Hits are rare next to lookups, so
+                those writes cost little. Costs one table per node.
+
+   Pinning fixes lookup worker i to a CPU taken round robin across the
+   nodes, so both sockets are used from the first worker up.
+
+   Topology comes from /sys/devices/system/node and mbind is called as
+   a raw system call, so there is no dependency on libnuma. Without
+   sysfs everything is treated as one node.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "table_memory.h"
+#include "key_index.h"
+#include "numa_layout.h"
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MPOL_INTERLEAVE
+#define MPOL_INTERLEAVE 3
+#endif
+
+static int numa_policy = NUMA_POLICY_NONE;
+static boolean numa_pin = false;
+static int number_of_nodes = 1;
+static int node_ids[NUMA_MAX_NODES];
+static int cpu_node[NUMA_MAX_CPUS];
+static int pin_order[NUMA_MAX_CPUS];
+static int number_of_pin_cpus = 0;
+static HashTable* replicas[NUMA_MAX_NODES];
+
+/*----------------------------------------------------------------------*
+ * Function:   numa_layout_parse_options
+ * Purpose:    Parse a comma separated list such as "replicate,pin"
+ * Parameters: string -> list of interleave, replicate, pin
+ *             policy -> set to NUMA_POLICY_ constant
+ *             pin -> set to true if pin given
+ * Returns:    true if every item was recognised
+ *----------------------------------------------------------------------*/
+boolean numa_layout_parse_options(char* string, int* policy, boolean* pin)
+{
+    char copy[256];
+    char* item;
+    char* saveptr = NULL;
+
+    if (strlen(string) >= sizeof(copy)) {
+        return false;
+    }
+    strcpy(copy, string);
+
+    *policy = NUMA_POLICY_NONE;
+    *pin = false;
+
+    for (item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(item, "interleave") == 0) {
+            *policy = NUMA_POLICY_INTERLEAVE;
+        } else if (strcmp(item, "replicate") == 0) {
+            *policy = NUMA_POLICY_REPLICATE;
+        } else if (strcmp(item, "pin") == 0) {
+            *pin = true;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_node_cpus
+ * Purpose:    Read a node's cpulist (eg. "0-7,16-23") from sysfs and
+ *             record the allowed CPUs as belonging to the node.
+ * Parameters: node_id = node number in sysfs
+ *             node_index = our index for the node
+ *             allowed -> CPUs this process may run on
+ * Returns:    true if the node exists
+ *----------------------------------------------------------------------*/
+static boolean read_node_cpus(int node_id, int node_index, cpu_set_t* allowed)
+{
+    char filename[128];
+    char line[4096];
+    char* p;
+    FILE* fp;
+    int first, last, cpu;
+
+    sprintf(filename, "/sys/devices/system/node/node%d/cpulist", node_id);
+    fp = fopen(filename, "r");
+    if (!fp) {
+        return false;
+    }
+
+    if (fgets(line, sizeof(line), fp)) {
+        p = line;
+        while (sscanf(p, "%d", &first) == 1) {
+            last = first;
+            while ((*p >= '0') && (*p <= '9')) p++;
+            if (*p == '-') {
+                p++;
+                sscanf(p, "%d", &last);
+                while ((*p >= '0') && (*p <= '9')) p++;
+            }
+            for (cpu=first; (cpu<=last) && (cpu<NUMA_MAX_CPUS); cpu++) {
+                if (CPU_ISSET(cpu, allowed)) {
+                    cpu_node[cpu] = node_index;
+                }
+            }
+            if (*p != ',') {
+                break;
+            }
+            p++;
+        }
+    }
+
+    fclose(fp);
+
+    return true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   numa_layout_initialise
+ * Purpose:    Discover nodes and the CPUs we may use on each, and work
+ *             out the order workers are pinned in.
+ * Parameters: policy = NUMA_POLICY_ constant
+ *             pin = true to pin lookup workers
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void numa_layout_initialise(int policy, boolean pin)
+{
+    cpu_set_t allowed;
+    int node, cpu, round;
+    boolean added;
+
+    numa_policy = policy;
+    numa_pin = pin;
+    number_of_nodes = 0;
+    number_of_pin_cpus = 0;
+
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        for (cpu=0; cpu<CPU_SETSIZE; cpu++) {
+            CPU_SET(cpu, &allowed);
+        }
+    }
+
+    for (cpu=0; cpu<NUMA_MAX_CPUS; cpu++) {
+        cpu_node[cpu] = -1;
+    }
+
+    for (node=0; node<NUMA_MAX_NODES; node++) {
+        if (read_node_cpus(node, number_of_nodes, &allowed)) {
+            node_ids[number_of_nodes++] = node;
+        }
+    }
+
+    if (number_of_nodes == 0) {
+        number_of_nodes = 1;
+        node_ids[0] = 0;
+        for (cpu=0; cpu<NUMA_MAX_CPUS; cpu++) {
+            if (CPU_ISSET(cpu, &allowed)) {
+                cpu_node[cpu] = 0;
+            }
+        }
+    }
+
+    // Take the first CPU of each node, then the second of each, ...
+    for (round=0, added=true; added; round++) {
+        added = false;
+        for (node=0; node<number_of_nodes; node++) {
+            int seen = 0;
+            for (cpu=0; cpu<NUMA_MAX_CPUS; cpu++) {
+                if (cpu_node[cpu] == node) {
+                    if (seen++ == round) {
+                        pin_order[number_of_pin_cpus++] = cpu;
+                        added = true;
+                        break;
+                    }
+                }
+            }
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   numa_layout_report
+ * Purpose:    Print the placement chosen
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void numa_layout_report(void)
+{
+    char* policy_names[] = {"first touch", "interleaved across nodes", "replicated on each node"};
+
+    printf("             NUMA: %d node%s with %d usable CPUs, table %s, lookup workers %s\n",
+           number_of_nodes, number_of_nodes == 1 ? "" : "s", number_of_pin_cpus,
+           policy_names[numa_policy], numa_pin ? "pinned round robin across nodes" : "not pinned");
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   numa_layout_number_of_nodes
+ * Purpose:    Number of nodes found
+ * Parameters: None
+ * Returns:    Number of nodes
+ *----------------------------------------------------------------------*/
+int numa_layout_number_of_nodes(void)
+{
+    return number_of_nodes;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   numa_layout_place_memory
+ * Purpose:    Set the memory policy of a mapping that hasn't been
+ *             touched yet.
+ * Parameters: address -> page aligned start of mapping
+ *             bytes = size of mapping
+ *             node = index of node to bind to, or NUMA_ALL_NODES to
+ *                    interleave
+ * Returns:    true if the policy was applied
+ *----------------------------------------------------------------------*/
+boolean numa_layout_place_memory(void* address, size_t bytes, int node)
+{
+    unsigned long mask[NUMA_MAX_NODES / (8 * sizeof(unsigned long))];
+    int mode = node == NUMA_ALL_NODES ? MPOL_INTERLEAVE : MPOL_BIND;
+    int i;
+
+    memset(mask, 0, sizeof(mask));
+    for (i=0; i<number_of_nodes; i++) {
+        if ((node == NUMA_ALL_NODES) || (node == i)) {
+            mask[node_ids[i] / (8 * sizeof(unsigned long))] |= 1UL << (node_ids[i] % (8 * sizeof(unsigned long)));
+        }
+    }
+
+    if (syscall(SYS_mbind, address, bytes, mode, mask, NUMA_MAX_NODES + 1, 0) != 0) {
+        printf("Warning: couldn't set NUMA policy for table memory (%s)\n", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   numa_layout_pin_worker
+ * Purpose:    Pin the calling thread, if pinning is on
+ * Parameters: worker = index of the worker
+ * Returns:    Index of the node the thread is on, or -1 if not known
+ *----------------------------------------------------------------------*/
+int numa_layout_pin_worker(int worker)
+{
+    cpu_set_t set;
+    int cpu;
+
+    if (numa_pin && (number_of_pin_cpus > 0)) {
+        cpu = pin_order[worker % number_of_pin_cpus];
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            printf("Warning: couldn't pin worker %d to CPU %d\n", worker, cpu);
+        }
+    }
+
+    cpu = sched_getcpu();
+    if ((cpu < 0) || (cpu >= NUMA_MAX_CPUS)) {
+        return -1;
+    }
+
+    return cpu_node[cpu];
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   numa_layout_replicate_table
+ * Purpose:    Copy a loaded table onto every node, when replicating.
+ *             The copies share everything but the Element array and
+ *             key index.
+ * Parameters: hash -> loaded table
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void numa_layout_replicate_table(HashTable* hash)
+{
+    size_t bytes = hash->number_buckets * hash->bucket_size * sizeof(Element);
+    int node;
+
+    if (numa_policy != NUMA_POLICY_REPLICATE) {
+        return;
+    }
+
+    if (number_of_nodes < 2) {
+        printf("Only one NUMA node, so the table is not replicated.\n");
+        return;
+    }
+
+    printf("\nReplicating table on %d NUMA nodes (%ld MB each)...\n", number_of_nodes, (long)(bytes / (1024 * 1024)));
+
+    for (node=0; node<number_of_nodes; node++) {
+        HashTable* replica = malloc(sizeof(HashTable));
+
+        if (!replica) {
+            printf("Error: can't allocate memory for table replica\n");
+            exit(1);
+        }
+
+        *replica = *hash;
+        replica->table = table_memory_alloc_on_node(bytes, node, &replica->table_memory_mode, &replica->table_memory_bytes);
+        if (!replica->table) {
+            printf("Error: can't allocate %ld MB for table replica on node %d\n", (long)(bytes / (1024 * 1024)), node_ids[node]);
+            exit(1);
+        }
+        memcpy(replica->table, hash->table, bytes);
+        replica->primary_table = hash->table;
+        if (hash->key_index) {
+            replica->key_index = key_index_copy_on_node(hash->key_index, node);
+        }
+        replicas[node] = replica;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   numa_layout_local_table
+ * Purpose:    Get the copy of a table for the node the calling thread
+ *             is running on.
+ * Parameters: hash -> primary table
+ * Returns:    Replica on this node, or hash if there isn't one
+ *----------------------------------------------------------------------*/
+HashTable* numa_layout_local_table(HashTable* hash)
+{
+    int cpu = sched_getcpu();
+
+    if ((cpu < 0) || (cpu >= NUMA_MAX_CPUS) || (cpu_node[cpu] < 0) ||
+        (replicas[cpu_node[cpu]] == NULL) || (replicas[cpu_node[cpu]]->primary_table != hash->table)) {
+        return hash;
+    }
+
+    return replicas[cpu_node[cpu]];
+}
@@ -0,0 +1,203 @@
+/*----------------------------------------------------------------------*
+ * File:    read_cache.c                                                *
+ * Purpose: Cache of kmer counts for repeated read sequences            *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Amplicon and other highly duplicated libraries contain the same pair
+   many times over. Each lookup thread keeps its own cache of the
+   KmerCounts from pairs it has already looked up, so a repeat can skip
+   the table altogether. This is exact: every kmer of a repeated pair was
+   marked as seen when the first copy was looked up, so the repeat adds
+   nothing to the kmers-seen counts and only its KmerCounts are needed.
+   The cache is set associative with a fixed number of entries, so its
+   memory is fixed when it is created.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "cmd_line.h"
+#include "kmer_stats.h"
+#include "read_cache.h"
+
+/*----------------------------------------------------------------------*
+ * Function:   read_cache_mix
+ * Purpose:    64 bit finaliser (from MurmurHash3)
+ * Parameters: h = value to mix
+ * Returns:    mixed value
+ *----------------------------------------------------------------------*/
+static inline uint64_t read_cache_mix(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDULL;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ULL;
+    h ^= h >> 33;
+
+    return h;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_cache_hash_sequence
+ * Purpose:    128 bit hash of a read sequence, as two independent 64 bit
+ *             lanes, so distinct pairs will not share a key in practice.
+ * Parameters: seq -> bases
+ *             length = number of bases
+ *             hash -> two words to receive hash
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void read_cache_hash_sequence(char* seq, int length, uint64_t* hash)
+{
+    uint64_t a = 0x9E3779B97F4A7C15ULL ^ (uint64_t)length;
+    uint64_t b = 0xD6E8FEB86659FD93ULL + (uint64_t)length;
+    uint64_t word;
+    int i = 0;
+
+    while (i < length) {
+        int n = (length - i) < 8 ? (length - i) : 8;
+
+        word = 0;
+        memcpy(&word, seq + i, n);
+        a = read_cache_mix(a ^ word) + 0x632BE59BD9B4E019ULL;
+        b = read_cache_mix(b + (word * 0x9FB21C651E98DF25ULL)) ^ a;
+        i += n;
+    }
+
+    hash[0] = read_cache_mix(a);
+    hash[1] = read_cache_mix(b ^ hash[0]);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_cache_new
+ * Purpose:    Allocate an empty cache
+ * Parameters: megabytes = memory to use
+ * Returns:    Pointer to cache
+ *----------------------------------------------------------------------*/
+ReadCache* read_cache_new(int megabytes)
+{
+    ReadCache* cache = calloc(1, sizeof(ReadCache));
+    uint64_t sets_wanted = ((uint64_t)megabytes * 1024 * 1024) / (READ_CACHE_WAYS * sizeof(ReadCacheEntry));
+
+    if (!cache) {
+        printf("Error: can't allocate memory for read cache\n");
+        exit(1);
+    }
+
+    // Power of two sets, no more than the memory asked for
+    cache->number_sets = 1;
+    while ((cache->number_sets * 2) <= sets_wanted) {
+        cache->number_sets <<= 1;
+    }
+    cache->set_mask = cache->number_sets - 1;
+
+    cache->entries = calloc(cache->number_sets * READ_CACHE_WAYS, sizeof(ReadCacheEntry));
+    if (!cache->entries) {
+        printf("Error: can't allocate %d MB for read cache\n", megabytes);
+        exit(1);
+    }
+
+    return cache;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_cache_free
+ * Purpose:    Free a cache
+ * Parameters: cache -> pointer to cache pointer, set to NULL
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void read_cache_free(ReadCache** cache)
+{
+    if (*cache) {
+        free((*cache)->entries);
+        free(*cache);
+        *cache = NULL;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_cache_set
+ * Purpose:    Find the set for a key
+ * Parameters: cache -> cache
+ *             key -> key
+ * Returns:    Pointer to first entry of set
+ *----------------------------------------------------------------------*/
+static inline ReadCacheEntry* read_cache_set(ReadCache* cache, uint64_t* key)
+{
+    return &(cache->entries[((key[0] ^ key[2]) & cache->set_mask) * READ_CACHE_WAYS]);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_cache_find
+ * Purpose:    Look for a pair in the cache
+ * Parameters: cache -> cache
+ *             key -> READ_CACHE_KEY_WORDS word key
+ * Returns:    Pointer to the pair's two KmerCounts, or NULL if not there
+ *----------------------------------------------------------------------*/
+KmerCounts* read_cache_find(ReadCache* cache, uint64_t* key)
+{
+    ReadCacheEntry* set = read_cache_set(cache, key);
+    int i;
+
+    for (i=0; i<READ_CACHE_WAYS; i++) {
+        if ((set[i].valid) && (memcmp(set[i].key, key, sizeof(set[i].key)) == 0)) {
+            set[i].last_used = ++cache->clock;
+            cache->hits++;
+            return set[i].counts;
+        }
+    }
+
+    cache->misses++;
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   read_cache_add
+ * Purpose:    Add a pair to the cache, replacing the least recently used
+ *             entry of its set if the set is full.
+ * Parameters: cache -> cache
+ *             key -> READ_CACHE_KEY_WORDS word key
+ *             counts_a -> counts for read 1
+ *             counts_b -> counts for read 2, or NULL
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void read_cache_add(ReadCache* cache, uint64_t* key, KmerCounts* counts_a, KmerCounts* counts_b)
+{
+    ReadCacheEntry* set = read_cache_set(cache, key);
+    ReadCacheEntry* entry = &(set[0]);
+    int i;
+
+    for (i=0; i<READ_CACHE_WAYS; i++) {
+        if (!set[i].valid) {
+            entry = &(set[i]);
+            break;
+        }
+        // Difference from the clock copes with it wrapping
+        if ((cache->clock - set[i].last_used) > (cache->clock - entry->last_used)) {
+            entry = &(set[i]);
+        }
+    }
+
+    if (entry->valid) {
+        cache->evictions++;
+    }
+
+    memcpy(entry->key, key, sizeof(entry->key));
+    entry->counts[0] = *counts_a;
+    if (counts_b) {
+        entry->counts[1] = *counts_b;
+    }
+    entry->last_used = ++cache->clock;
+    entry->valid = true;
+}
@@ -254,6 +254,119 @@ int read_sequence_from_fasta(FILE * fp, Sequence * seq, int max_chunk_length,
 	return j;
 }
 
+/*
+ * Skip to the start of the next line, returns false at end of file
+ */
+static boolean skip_line(FILE * fp)
+{
+	int c;
+
+	while ((c = getc(fp)) != EOF) {
+		if (c == '\n') {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Chunked FASTQ reader for long reads, with the same new_entry /
+// full_entry / offset behaviour as read_sequence_from_fasta, so a read of
+// any length can be streamed through a buffer of max_chunk_length bases.
+// Sequence must be on a single line. Qualities are skipped, not stored,
+// and seq->qual is zeroed as for FASTA.
+// It returns 0 when reaches EOF (in this case full_entry is true)
+
+int read_sequence_from_fastq_chunk(FILE * fp, Sequence * seq, int max_chunk_length,
+                                   boolean new_entry, boolean * full_entry, int offset)
+{
+	char line[MAX_LINE_LENGTH];
+	int i;
+	int j;
+	int c;
+
+	assert(fp != NULL);
+	assert(seq != NULL);
+	assert(seq->seq != NULL);
+	assert(seq->qual != NULL);
+	assert(seq->name != NULL);
+
+	if (new_entry == true) {	// need a '@' followed by a name
+		do {
+			if (fgets(line, MAX_LINE_LENGTH, fp) == NULL) {
+				*full_entry = true;
+				seq->length = 0;
+				return 0;
+			}
+		} while (line[0] == '\n');
+
+		if (line[0] != '@') {
+			fprintf(stderr, "syntax error in fastq entry %s\n", line);
+			assert(0);
+			exit(1);
+		}
+
+		for (i = 1; line[i] != '\0' && line[i] != '\n' && line[i] != '\t' && line[i] != '\r'; i++) {
+			seq->name[i - 1] = line[i];
+		}
+		seq->name[i - 1] = '\0';
+		seq->id_string = seq->name;
+
+		strcpy(current_entry_name, seq->name);
+		seq->start = 1;
+	} else {
+		strcpy(seq->name, current_entry_name);
+		seq->start = last_end_coord + 1;
+	}
+
+	j = offset;
+	*full_entry = false;
+
+	while (j < max_chunk_length) {
+		c = getc(fp);
+		if ((c == EOF) || (c == '\n')) {
+			*full_entry = true;
+			break;
+		} else if (c == '\r') {
+			continue;
+		} else if (c == '.') {
+			c = 'N';
+		}
+
+		seq->seq[j] = c;
+		seq->qual[j] = '\0';
+		j++;
+	}
+
+	// Chunk full - is that also the end of the line?
+	if (*full_entry == false) {
+		c = getc(fp);
+		if (c == '\r') {
+			c = getc(fp);
+		}
+		if ((c == EOF) || (c == '\n')) {
+			*full_entry = true;
+		} else {
+			ungetc(c, fp);
+		}
+	}
+
+	// End of read, so skip '+' and quality lines
+	if (*full_entry == true) {
+		skip_line(fp);
+		skip_line(fp);
+	}
+
+	seq->end = seq->start + j - 1 - offset;
+	last_end_coord = seq->end;
+
+	seq->seq[j] = '\0';
+	seq->qual[j] = '\0';
+	seq->length = j;
+
+	return j;
+}
+
 /*
  * Read sequence from file "fp" in FASTQ format. it returns the length of
  * the sequence, 0 if no sequence is left in file read with bad chars are
@@ -595,6 +708,264 @@ int read_sequence_from_fastq(FILE * fp, Sequence * seq, int max_read_length){
     return ret;
 }
 
+/*
+ * Make sure buffer has room for extra more bytes
+ */
+void sequence_buffer_reserve(SequenceBuffer * buffer, size_t extra)
+{
+    if ((buffer->length + extra) > buffer->capacity) {
+        while ((buffer->length + extra) > buffer->capacity) {
+            buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+        }
+        buffer->data = realloc(buffer->data, buffer->capacity);
+        if (!buffer->data) {
+            printf("Error: can't get memory for sequence buffer\n");
+            exit(1);
+        }
+    }
+}
+
+/*
+ * Read one line for scan_sequence_from_fastq, appending it to copy if
+ * not NULL. Sets first to the first character (EOF if nothing was left)
+ * and count to the characters before the first whitespace, which is
+ * what the parser keeps of a line.
+ */
+static boolean scan_line(FILE * fp, SequenceBuffer * copy, int * first, int * count)
+{
+    boolean counting = true;
+    int c;
+
+    *first = EOF;
+    *count = 0;
+
+    while ((c = getc_unlocked(fp)) != EOF) {
+        if (copy != NULL) {
+            if (copy->length == copy->capacity) {
+                sequence_buffer_reserve(copy, 1);
+            }
+            copy->data[copy->length++] = c;
+        }
+        if (*first == EOF) {
+            *first = c;
+        }
+        if (c == '\n') {
+            break;
+        } else if ((c == ' ') || (c == '\t') || (c == '\r')) {
+            counting = false;
+        } else if (counting) {
+            (*count)++;
+        }
+    }
+
+    return *first != EOF;
+}
+
+/*
+ * Scan the next entry of file "fp" in FASTQ format without parsing it,
+ * by the same layout rules as read_sequence_from_fastq: a header line
+ * starting '@', sequence lines up to a line starting '+' (or '-'), then
+ * quality lines until there are as many qualities as bases. If copy is
+ * not NULL the entry is appended to it as read. The scan runs straight
+ * over the stdio buffer. It returns the sequence length, 0 if no entry
+ * is left in the file, or -1 if the entry doesn't have that structure,
+ * having read some of it.
+ */
+int scan_sequence_from_fastq(FILE * fp, SequenceBuffer * copy)
+{
+    int first;
+    int count;
+    int length = 0;
+    int qualities = 0;
+
+    assert(fp != NULL);
+
+    if (!scan_line(fp, copy, &first, &count)) {
+        return 0;
+    }
+    if (first != '@') {
+        return -1;
+    }
+
+    while (1) {
+        if (!scan_line(fp, copy, &first, &count)) {
+            return -1;
+        }
+        if ((first == '+') || (first == '-')) {
+            break;
+        }
+        length += count;
+    }
+
+    // With no bases, the parser reads qualities up to the next '@' line
+    if (length == 0) {
+        return -1;
+    }
+
+    while (qualities < length) {
+        if (!scan_line(fp, copy, &first, &count)) {
+            return -1;
+        }
+        qualities += count;
+    }
+
+    return qualities == length ? length : -1;
+}
+
+/*
+ * Skip the next entry of file "fp" in FASTQ format. Well formed entries
+ * are only scanned. Anything else is left to read_sequence_from_fastq
+ * (into seq), so it is consumed, skipped or reported exactly as it would
+ * be if it were read, which needs a file that can be rewound. It returns
+ * the sequence length, 0 if no entry is left in the file.
+ */
+int skip_sequence_from_fastq(FILE * fp, Sequence * seq, int max_read_length)
+{
+    long start = ftell(fp);
+    int length = scan_sequence_from_fastq(fp, NULL);
+
+    if (length >= 0) {
+        return length;
+    }
+
+    if ((start < 0) || (fseek(fp, start, SEEK_SET) != 0)) {
+        printf("Error: malformed FASTQ entry in a stream, can't skip it\n");
+        exit(1);
+    }
+
+    return read_sequence_from_fastq(fp, seq, max_read_length);
+}
+
+/*
+ * Check a quality value as the FASTQ parsers do, warning once
+ */
+static void check_quality_value(Sequence * seq, int q)
+{
+    if (seq->qual[q] < seq->lowest_expected_value) {
+        log_and_screen_printf("Warning: Quality [%d] for [%s] lower than expected for specified quality offset [%d-%d].\n", seq->qual[q], seq->name, seq->lowest_expected_value, seq->highest_expected_value);
+        seq->check_quality_values = false;
+    } else if (seq->qual[q] > seq->highest_expected_value) {
+        log_and_screen_printf("Warning: Quality [%d] for [%s] higher than expected for specified quality offset [%d-%d].\n", seq->qual[q], seq->name, seq->lowest_expected_value, seq->highest_expected_value);
+        seq->check_quality_values = false;
+    } else if (seq->qual[q] > seq->highest_raw_read_value) {
+        log_and_screen_printf("Warning: Quality [%d] for [%s] higher than expected for raw reads [%d].\n", seq->qual[q], seq->name, seq->highest_raw_read_value);
+        seq->check_quality_values = false;
+    }
+}
+
+/*
+ * Parse one FASTQ entry held in memory, as copied by
+ * scan_sequence_from_fastq, with the same rules and messages as
+ * read_sequence_from_fastq reading it from a file. It returns the length
+ * of the sequence, 0 if the entry is a bad read (which the file reader
+ * would skip).
+ */
+int read_sequence_from_fastq_buffer(char * data, size_t length, Sequence * seq, int max_read_length)
+{
+    char * end = data + length;
+    char * line = data;
+    char * next;
+    boolean good_read = true;
+    int offset = seq->qual_offset;
+    int i;
+    int j = 0;
+    int q = 0;
+    header_function * f;
+
+    if (offset == 0) {
+        offset = 64;
+    }
+
+    seq->seq[0] = '\0';
+    seq->qual[0] = '\0';
+    seq->length = 0;
+
+    if ((length == 0) || (line[0] != '@')) {
+        return 0;
+    }
+
+    // Header, kept whole as the file reader does
+    next = memchr(line, '\n', end - line);
+    next = next ? next + 1 : end;
+    if ((next - line) >= seq->max_name_length) {
+        fputs("Name too long\n", stderr);
+        exit(1);
+    }
+    memcpy(seq->id_string, line, next - line);
+    seq->id_string[next - line] = '\0';
+    for (i = 1; (line + i < next) && (line[i] != '\n') && (line[i] != '\t') && (line[i] != '\r'); i++) {
+        seq->name[i - 1] = line[i];
+    }
+    seq->name[i - 1] = '\0';
+
+    // Sequence lines
+    for (line = next; line < end; line = next) {
+        next = memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+        if ((line[0] == '+') || (line[0] == '-')) {
+            line = next;
+            break;
+        }
+        for (i = 0; (line + i < next) && (line[i] != '\n') && (line[i] != ' ') && (line[i] != '\t') && (line[i] != '\r'); i++) {
+            char base = line[i] == '.' ? 'N' : line[i];
+
+            if (!nucleotide_good_base(base)) {
+                good_read = false;
+                fprintf(stderr, "Invalid symbol [%c] pos:%i in entry %s - skip read\n", base, i, seq->name);
+            }
+
+            seq->seq[j++] = base;
+
+            if (j == max_read_length) {
+                fprintf(stdout, "read [%s] too long [%i]. Exiting...\n", seq->name, j);
+                exit(1);
+            }
+        }
+    }
+
+    // Quality lines
+    for (; line < end; line = next) {
+        next = memchr(line, '\n', end - line);
+        next = next ? next + 1 : end;
+        for (i = 0; (line + i < next) && (line[i] != '\n') && (line[i] != ' ') && (line[i] != '\t') && (line[i] != '\r'); i++) {
+            seq->qual[q] = line[i] - offset;
+            if (seq->check_quality_values) {
+                check_quality_value(seq, q);
+            }
+            q++;
+
+            if (q == max_read_length) {
+                fprintf(stdout, "qualities for [%s] longer than the max read length  [%i]. Exiting...\n", seq->name, q);
+                exit(1);
+            }
+        }
+    }
+
+    if (j != q) {
+        fprintf(stdout, "Lengths of quality [%i] and sequence [%i]  strings don't coincide for this read: [%s]. Skip it\n", q, j, seq->name);
+        good_read = false;
+    }
+
+    if (!good_read) {
+        seq->seq[0] = '\0';
+        seq->qual[0] = '\0';
+        return 0;
+    }
+
+    seq->seq[j] = '\0';
+    seq->qual[q] = '\0';
+    seq->length = j;
+
+    if (seq->header != NULL) {
+        f = seq->header;
+        if (f->header_parser != NULL) {
+            f->header_parser(seq);
+        }
+    }
+
+    return j;
+}
+
 /*
  * Read sequence from file "fp" in FASTA format. Read the qualities file
  * "fq" in Qual format (454) it returns the length of the sequence, 0 if
@@ -0,0 +1,394 @@
+/*----------------------------------------------------------------------*
+ * File:    table_memory.c                                              *
+ * Purpose: Huge page backed, pre-faulted memory for large tables       *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   A big contaminant table in calloc'd 4K pages misses the TLB on nearly
+   every random lookup, and its page faults are taken one at a time
+   while the library loads. Tables can instead be mapped with
+   transparent huge pages (mmap + madvise(MADV_HUGEPAGE), start aligned
+   to 2MB) or from the hugetlbfs pool (MAP_HUGETLB, falling back to
+   transparent huge pages if the pool is empty).
+
+   Prefaulting touches every page before the table is used. It is split
+   across threads because the kernel zeroes each page as it is faulted,
+   which for tens of GB dominates a single threaded MAP_POPULATE. With
+   one thread hugetlb mappings just use MAP_POPULATE. Locking (mlock)
+   keeps the table out of swap; if RLIMIT_MEMLOCK refuses it we warn
+   and carry on.
+
+   A NUMA policy (see numa_layout.c) only affects pages not yet
+   touched, so a table that needs one is always mmap'd, and is
+   prefaulted by touching pages after the policy is set rather than
+   with MAP_POPULATE.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include "global.h"
+#include "binary_kmer.h"
+#include "element.h"
+#include "hash_table.h"
+#include "table_memory.h"
+#include "numa_layout.h"
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+static TableMemoryOptions table_memory_options = {TABLE_MEMORY_MALLOC, false, false, false, 1};
+
+typedef struct {
+    char* start;
+    size_t bytes;
+} PrefaultRange;
+
+/*----------------------------------------------------------------------*
+ * Function:   table_memory_set_options
+ * Purpose:    Set how subsequent tables are allocated
+ * Parameters: options -> options to copy
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void table_memory_set_options(TableMemoryOptions* options)
+{
+    table_memory_options = *options;
+    if (table_memory_options.threads < 1) {
+        table_memory_options.threads = 1;
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   table_memory_get_options
+ * Purpose:    Get the current allocation options
+ * Parameters: None
+ * Returns:    Pointer to options
+ *----------------------------------------------------------------------*/
+TableMemoryOptions* table_memory_get_options(void)
+{
+    return &table_memory_options;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   table_memory_parse_options
+ * Purpose:    Parse a comma separated list such as "hugetlb,prefault,lock"
+ * Parameters: string -> list of malloc, thp, hugetlb, prefault, lock
+ *             options -> options to fill in (threads left unchanged)
+ * Returns:    true if every item was recognised
+ *----------------------------------------------------------------------*/
+boolean table_memory_parse_options(char* string, TableMemoryOptions* options)
+{
+    char copy[256];
+    char* item;
+    char* saveptr = NULL;
+
+    if (strlen(string) >= sizeof(copy)) {
+        return false;
+    }
+    strcpy(copy, string);
+
+    options->mode = TABLE_MEMORY_MALLOC;
+    options->prefault = false;
+    options->lock = false;
+
+    for (item = strtok_r(copy, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+        if (strcmp(item, "malloc") == 0) {
+            options->mode = TABLE_MEMORY_MALLOC;
+        } else if (strcmp(item, "thp") == 0) {
+            options->mode = TABLE_MEMORY_THP;
+        } else if (strcmp(item, "hugetlb") == 0) {
+            options->mode = TABLE_MEMORY_HUGETLB;
+        } else if (strcmp(item, "prefault") == 0) {
+            options->prefault = true;
+        } else if (strcmp(item, "lock") == 0) {
+            options->lock = true;
+        } else {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   table_memory_mode_name
+ * Purpose:    Name of an allocation mode, for reporting
+ * Parameters: mode = TABLE_MEMORY_ constant
+ * Returns:    Name
+ *----------------------------------------------------------------------*/
+char* table_memory_mode_name(int mode)
+{
+    switch (mode) {
+        case TABLE_MEMORY_THP: return "thp";
+        case TABLE_MEMORY_HUGETLB: return "hugetlb";
+        case TABLE_MEMORY_MMAP: return "mmap";
+        default: return "malloc";
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   table_memory_hugetlb_available
+ * Purpose:    Find how much of the hugetlb pool is free and not already
+ *             reserved by another mapping, from /proc/meminfo
+ * Parameters: None
+ * Returns:    Bytes available, or 0 if it can't be read
+ *----------------------------------------------------------------------*/
+size_t table_memory_hugetlb_available(void)
+{
+    FILE* fp = fopen("/proc/meminfo", "r");
+    char line[256];
+    unsigned long long value;
+    unsigned long long free_pages = 0;
+    unsigned long long reserved_pages = 0;
+    unsigned long long page_kb = 0;
+
+    if (!fp) {
+        return 0;
+    }
+
+    while (fgets(line, sizeof(line), fp)) {
+        if (sscanf(line, "HugePages_Free: %llu", &value) == 1) {
+            free_pages = value;
+        } else if (sscanf(line, "HugePages_Rsvd: %llu", &value) == 1) {
+            reserved_pages = value;
+        } else if (sscanf(line, "Hugepagesize: %llu", &value) == 1) {
+            page_kb = value;
+        }
+    }
+    fclose(fp);
+
+    if (free_pages <= reserved_pages) {
+        return 0;
+    }
+
+    return (size_t)((free_pages - reserved_pages) * page_kb * 1024);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   prefault_thread
+ * Purpose:    Write to one byte in every page of a range
+ * Parameters: arg -> PrefaultRange
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* prefault_thread(void* arg)
+{
+    PrefaultRange* range = arg;
+    volatile char* p;
+    size_t i;
+
+    for (i=0; i<range->bytes; i+=TABLE_MEMORY_PAGE_SIZE) {
+        p = range->start + i;
+        *p = 0;
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   prefault_memory
+ * Purpose:    Fault in a zeroed region, splitting it across threads
+ * Parameters: address -> start of region, page aligned
+ *             bytes = size of region
+ *             threads = number of threads to use
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void prefault_memory(char* address, size_t bytes, int threads)
+{
+    pthread_t thread_ids[threads];
+    boolean joinable[threads];
+    PrefaultRange ranges[threads];
+    size_t pages = (bytes + TABLE_MEMORY_PAGE_SIZE - 1) / TABLE_MEMORY_PAGE_SIZE;
+    size_t pages_per_thread = (pages + threads - 1) / threads;
+    size_t offset = 0;
+    int started = 0;
+    int i;
+
+    for (i=0; i<threads && offset<bytes; i++) {
+        ranges[i].start = address + offset;
+        ranges[i].bytes = pages_per_thread * TABLE_MEMORY_PAGE_SIZE;
+        if (offset + ranges[i].bytes > bytes) {
+            ranges[i].bytes = bytes - offset;
+        }
+        offset += ranges[i].bytes;
+
+        joinable[i] = (i > 0) && (pthread_create(&thread_ids[i], NULL, prefault_thread, &ranges[i]) == 0);
+        if (!joinable[i]) {
+            // First range (or any we couldn't hand off) done on this thread
+            prefault_thread(&ranges[i]);
+        }
+        started++;
+    }
+
+    for (i=1; i<started; i++) {
+        if (joinable[i]) {
+            pthread_join(thread_ids[i], NULL);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   map_huge
+ * Purpose:    Map anonymous memory, normally backed by huge pages
+ * Parameters: bytes = size, a multiple of the huge page size
+ *             mode = TABLE_MEMORY_THP, TABLE_MEMORY_HUGETLB or
+ *                    TABLE_MEMORY_MMAP (4K pages)
+ *             populate = ask the kernel to populate the mapping
+ * Returns:    Address, or NULL if the mapping failed
+ *----------------------------------------------------------------------*/
+static void* map_huge(size_t bytes, int mode, boolean populate)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+    char* address;
+    uintptr_t start;
+    uintptr_t aligned;
+
+    if (mode == TABLE_MEMORY_HUGETLB) {
+        address = mmap(NULL, bytes, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB | (populate ? MAP_POPULATE : 0), -1, 0);
+        return address == MAP_FAILED ? NULL : address;
+    }
+
+    // Over-map by a huge page and trim, so the table starts on a 2MB boundary
+    address = mmap(NULL, bytes + TABLE_MEMORY_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (address == MAP_FAILED) {
+        return NULL;
+    }
+
+    start = (uintptr_t)address;
+    aligned = (start + TABLE_MEMORY_HUGE_PAGE_SIZE - 1) & ~((uintptr_t)TABLE_MEMORY_HUGE_PAGE_SIZE - 1);
+    if (aligned > start) {
+        munmap(address, aligned - start);
+    }
+    if (aligned + bytes < start + bytes + TABLE_MEMORY_HUGE_PAGE_SIZE) {
+        munmap((void*)(aligned + bytes), (start + bytes + TABLE_MEMORY_HUGE_PAGE_SIZE) - (aligned + bytes));
+    }
+
+#ifdef MADV_HUGEPAGE
+    if ((mode == TABLE_MEMORY_THP) && (madvise((void*)aligned, bytes, MADV_HUGEPAGE) != 0)) {
+        printf("Warning: transparent huge pages not available (%s)\n", strerror(errno));
+    }
+#endif
+
+    return (void*)aligned;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   table_memory_alloc
+ * Purpose:    Allocate zeroed memory for a table using the current
+ *             options.
+ * Parameters: bytes = size required
+ *             mode -> set to the mode actually used
+ *             mapped_bytes -> set to the size actually allocated
+ * Returns:    Address, or NULL if out of memory
+ *----------------------------------------------------------------------*/
+void* table_memory_alloc(size_t bytes, int* mode, size_t* mapped_bytes)
+{
+    int node = table_memory_options.interleave ? NUMA_ALL_NODES : TABLE_MEMORY_ANY_NODE;
+
+    return table_memory_alloc_on_node(bytes, node, mode, mapped_bytes);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   table_memory_alloc_on_node
+ * Purpose:    Allocate zeroed memory for a table using the current
+ *             options, placed on a given NUMA node.
+ * Parameters: bytes = size required
+ *             node = NUMA node index, NUMA_ALL_NODES to interleave or
+ *                    TABLE_MEMORY_ANY_NODE for no policy
+ *             mode -> set to the mode actually used
+ *             mapped_bytes -> set to the size actually allocated
+ * Returns:    Address, or NULL if out of memory
+ *----------------------------------------------------------------------*/
+void* table_memory_alloc_on_node(size_t bytes, int node, int* mode, size_t* mapped_bytes)
+{
+    TableMemoryOptions* options = &table_memory_options;
+    boolean placed = node != TABLE_MEMORY_ANY_NODE;
+    boolean populate = options->prefault && (options->threads == 1) && !placed;
+    boolean populated = false;
+    void* address = NULL;
+    size_t rounded = (bytes + TABLE_MEMORY_HUGE_PAGE_SIZE - 1) & ~((size_t)TABLE_MEMORY_HUGE_PAGE_SIZE - 1);
+
+    *mode = options->mode;
+    *mapped_bytes = bytes;
+
+    if (bytes == 0) {
+        *mode = TABLE_MEMORY_MALLOC;
+        return calloc(1, 1);
+    }
+
+    if ((*mode == TABLE_MEMORY_MALLOC) && placed) {
+        *mode = TABLE_MEMORY_MMAP;
+    }
+
+    if (*mode == TABLE_MEMORY_HUGETLB) {
+        address = map_huge(rounded, TABLE_MEMORY_HUGETLB, populate);
+        if (address == NULL) {
+            printf("Warning: couldn't map %zu bytes of hugetlb pages (%s), using transparent huge pages\n", rounded, strerror(errno));
+            *mode = TABLE_MEMORY_THP;
+        } else {
+            *mapped_bytes = rounded;
+            populated = populate;
+        }
+    }
+
+    if ((*mode == TABLE_MEMORY_THP) || (*mode == TABLE_MEMORY_MMAP)) {
+        address = map_huge(rounded, *mode, false);
+        *mapped_bytes = rounded;
+    }
+
+    if (*mode == TABLE_MEMORY_MALLOC) {
+        address = calloc(bytes, 1);
+    }
+
+    if (address == NULL) {
+        return NULL;
+    }
+
+    if (placed) {
+        numa_layout_place_memory(address, *mapped_bytes, node);
+    }
+
+    if (options->prefault && !populated) {
+        prefault_memory(address, *mapped_bytes, options->threads);
+    }
+
+    if (options->lock) {
+        if (mlock(address, *mapped_bytes) != 0) {
+            printf("Warning: couldn't lock %zu bytes of table memory (%s)\n", *mapped_bytes, strerror(errno));
+        }
+    }
+
+    return address;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   table_memory_free
+ * Purpose:    Release memory from table_memory_alloc
+ * Parameters: address -> memory
+ *             mapped_bytes = size returned by table_memory_alloc
+ *             mode = mode returned by table_memory_alloc
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void table_memory_free(void* address, size_t mapped_bytes, int mode)
+{
+    if (address == NULL) {
+        return;
+    }
+
+    if (mode == TABLE_MEMORY_MALLOC) {
+        if (table_memory_options.lock) {
+            munlock(address, mapped_bytes);
+        }
+        free(address);
+    } else {
+        munmap(address, mapped_bytes);
+    }
+}
@@ -0,0 +1,258 @@
+/*----------------------------------------------------------------------*
+ * File:    thread_pool.c                                               *
+ * Purpose: Persistent pool of threads for whole table scans            *
+ * Author:  Richard Leggett                                             *
+ *          Ricardo Ramirez-Gonzalez                                    *
+ *          The Genome Analysis Centre (TGAC), Norwich, UK              *
+ *          richard.leggett@tgac.ac.uk    								*
+ *----------------------------------------------------------------------*/
+
+/*
+   Counting shared and unique contaminant kmers, building the prefilter
+   and key index, and dumping kmers each scan every slot of the table.
+   Rather than start threads for each scan, one pool is started when the
+   table is created and handed each scan in turn (see
+   hash_table_parallel_traverse).
+
+   thread_pool_run wakes the workers, runs the task itself as thread 0
+   and returns once every thread has finished, so a scan looks like an
+   ordinary function call to its caller. Runs from different threads are
+   serialised; a task must not itself call thread_pool_run on the same
+   pool. A pool of one thread has no workers and just calls the task.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "global.h"
+#include "thread_pool.h"
+
+static ThreadPool* shared_pool = NULL;
+
+/*----------------------------------------------------------------------*
+ * Function:   thread_pool_worker
+ * Purpose:    Worker thread, waits for and runs each task
+ * Parameters: arg -> ThreadPoolWorker
+ * Returns:    NULL
+ *----------------------------------------------------------------------*/
+static void* thread_pool_worker(void* arg)
+{
+    ThreadPoolWorker* worker = (ThreadPoolWorker*)arg;
+    ThreadPool* pool = worker->pool;
+    long long seen = 0;
+    ThreadPoolTask task;
+    void* data;
+
+    while (1) {
+        pthread_mutex_lock(&pool->lock);
+        while ((!pool->stop) && (pool->generation == seen)) {
+            pthread_cond_wait(&pool->work_ready, &pool->lock);
+        }
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->lock);
+            break;
+        }
+        seen = pool->generation;
+        task = pool->task;
+        data = pool->data;
+        pthread_mutex_unlock(&pool->lock);
+
+        task(worker->thread, pool->number_of_threads, data);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->busy == 0) {
+            pthread_cond_signal(&pool->work_done);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    return NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   thread_pool_start
+ * Purpose:    Initialise a pool's locks and state and start its workers
+ * Parameters: pool -> pool, with number_of_threads and arrays allocated
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+static void thread_pool_start(ThreadPool* pool)
+{
+    int i;
+
+    pool->task = NULL;
+    pool->data = NULL;
+    pool->generation = 0;
+    pool->busy = 0;
+    pool->stop = false;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_mutex_init(&pool->run_lock, NULL);
+    pthread_cond_init(&pool->work_ready, NULL);
+    pthread_cond_init(&pool->work_done, NULL);
+
+    for (i=1; i<pool->number_of_threads; i++) {
+        pool->worker_args[i].pool = pool;
+        pool->worker_args[i].thread = i;
+        if (pthread_create(&pool->workers[i], NULL, thread_pool_worker, &pool->worker_args[i]) != 0) {
+            printf("Error: can't create thread pool worker\n");
+            exit(1);
+        }
+    }
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   thread_pool_new
+ * Purpose:    Start a pool
+ * Parameters: number_of_threads = threads, including the caller
+ * Returns:    Pointer to pool
+ *----------------------------------------------------------------------*/
+ThreadPool* thread_pool_new(int number_of_threads)
+{
+    ThreadPool* pool = calloc(1, sizeof(ThreadPool));
+
+    if (!pool) {
+        printf("Error: can't allocate memory for thread pool\n");
+        exit(1);
+    }
+
+    if (number_of_threads < 1) {
+        number_of_threads = 1;
+    } else if (number_of_threads > THREAD_POOL_MAX_THREADS) {
+        number_of_threads = THREAD_POOL_MAX_THREADS;
+    }
+
+    pool->number_of_threads = number_of_threads;
+    pool->workers = calloc(number_of_threads, sizeof(pthread_t));
+    pool->worker_args = calloc(number_of_threads, sizeof(ThreadPoolWorker));
+    if ((!pool->workers) || (!pool->worker_args)) {
+        printf("Error: can't allocate memory for thread pool\n");
+        exit(1);
+    }
+
+    thread_pool_start(pool);
+
+    return pool;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   thread_pool_run
+ * Purpose:    Run a task on every thread of the pool and wait for them
+ *             all to finish.
+ * Parameters: pool -> pool
+ *             task = function to run
+ *             data -> passed to task
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void thread_pool_run(ThreadPool* pool, ThreadPoolTask task, void* data)
+{
+    pthread_mutex_lock(&pool->run_lock);
+
+    if (pool->number_of_threads > 1) {
+        pthread_mutex_lock(&pool->lock);
+        pool->task = task;
+        pool->data = data;
+        pool->busy = pool->number_of_threads - 1;
+        pool->generation++;
+        pthread_cond_broadcast(&pool->work_ready);
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    task(0, pool->number_of_threads, data);
+
+    if (pool->number_of_threads > 1) {
+        pthread_mutex_lock(&pool->lock);
+        while (pool->busy > 0) {
+            pthread_cond_wait(&pool->work_done, &pool->lock);
+        }
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    pthread_mutex_unlock(&pool->run_lock);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   thread_pool_free
+ * Purpose:    Stop the workers and free a pool
+ * Parameters: pool -> pointer to pool pointer, set to NULL
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void thread_pool_free(ThreadPool** pool)
+{
+    int i;
+
+    if (*pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&(*pool)->lock);
+    (*pool)->stop = true;
+    pthread_cond_broadcast(&(*pool)->work_ready);
+    pthread_mutex_unlock(&(*pool)->lock);
+
+    for (i=1; i<(*pool)->number_of_threads; i++) {
+        pthread_join((*pool)->workers[i], NULL);
+    }
+
+    pthread_mutex_destroy(&(*pool)->lock);
+    pthread_mutex_destroy(&(*pool)->run_lock);
+    pthread_cond_destroy(&(*pool)->work_ready);
+    pthread_cond_destroy(&(*pool)->work_done);
+    free((*pool)->workers);
+    free((*pool)->worker_args);
+    free(*pool);
+    *pool = NULL;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   thread_pool_initialise_shared
+ * Purpose:    Start the pool used for table scans, replacing any
+ *             previous one.
+ * Parameters: number_of_threads = threads, including the caller
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void thread_pool_initialise_shared(int number_of_threads)
+{
+    if (shared_pool != NULL) {
+        if (shared_pool->number_of_threads == number_of_threads) {
+            return;
+        }
+        thread_pool_free(&shared_pool);
+    }
+
+    shared_pool = thread_pool_new(number_of_threads);
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   thread_pool_shared
+ * Purpose:    Get the pool used for table scans, starting a single
+ *             thread pool if none has been initialised.
+ * Parameters: None
+ * Returns:    Pointer to pool
+ *----------------------------------------------------------------------*/
+ThreadPool* thread_pool_shared(void)
+{
+    if (shared_pool == NULL) {
+        shared_pool = thread_pool_new(1);
+    }
+
+    return shared_pool;
+}
+
+/*----------------------------------------------------------------------*
+ * Function:   thread_pool_reset_after_fork
+ * Purpose:    Restart the shared pool in a forked child. Only the
+ *             forking thread is copied into the child, so the pool has
+ *             no workers, and its locks may have been held by threads
+ *             that aren't there. There is nothing to join, so the pool
+ *             is reinitialised in place and its workers started again.
+ * Parameters: None
+ * Returns:    None
+ *----------------------------------------------------------------------*/
+void thread_pool_reset_after_fork(void)
+{
+    if (shared_pool == NULL) {
+        return;
+    }
+
+    thread_pool_start(shared_pool);
+}